@@ -1,7 +1,38 @@
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QGuiApplication>
 #include "mainwindow.h"
+#include "renderer/batchrenderer.h"
+#include "renderer/distributedrenderer.h"
+#include "renderer/softwarerasterizer.h"
+#include "scene/assetcache.h"
+#include "scene/clusteredmesh.h"
+#include "scene/meshloader.h"
 #include <QSurfaceFormat>
 
+// --asset-cpu-mb / --asset-gpu-mb apply to every mode that loads meshes,
+// so they are read from argv before any mode parses its own options.
+static void applyAssetBudget(int argc, char *argv[])
+{
+    qint64 cpuMb = 1024;
+    qint64 gpuMb = 1024;
+    for (int i = 1; i < argc; ++i) {
+        const QByteArray arg(argv[i]);
+        const int eq = arg.indexOf('=');
+        const QByteArray name = eq >= 0 ? arg.left(eq) : arg;
+        qint64 *value = name == "--asset-cpu-mb" ? &cpuMb : name == "--asset-gpu-mb" ? &gpuMb : nullptr;
+        if (!value)
+            continue;
+        if (eq >= 0)
+            *value = arg.mid(eq + 1).toLongLong();
+        else if (i + 1 < argc)
+            *value = QByteArray(argv[++i]).toLongLong();
+    }
+    AssetCache::instance().setBudget(cpuMb << 20, gpuMb << 20);
+}
+
 int main(int argc, char *argv[])
 {
     QSurfaceFormat format;
@@ -10,11 +41,115 @@ int main(int argc, char *argv[])
     format.setDepthBufferSize(24);
     QSurfaceFormat::setDefaultFormat(format);
 
+    applyAssetBudget(argc, argv);
+
+    // Headless render nodes: no widgets, offscreen context only
+    // (run with QT_QPA_PLATFORM=offscreen when there is no display).
+    // Workers are started by a --batch --workers coordinator.
+    if (DistributedRenderer::isWorker(argc, argv)) {
+        QGuiApplication app(argc, argv);
+        return DistributedRenderer::runWorker(app.arguments());
+    }
+    if (BatchRenderer::isRequested(argc, argv)) {
+        QGuiApplication app(argc, argv);
+        return BatchRenderer::runFromCommandLine(app.arguments());
+    }
+
+    // Importer throughput: no GL at all.
+    //   --load-benchmark [--repeats N] mesh...
+    for (int i = 1; i < argc; ++i) {
+        if (qstrcmp(argv[i], "--load-benchmark") != 0)
+            continue;
+        QCoreApplication app(argc, argv);
+        QCommandLineParser parser;
+        parser.addOption({ "load-benchmark", "Time every mesh importer on the given meshes." });
+        parser.addOption({ "repeats", "Loads per format; the best is reported.", "n", "3" });
+        parser.addPositionalArgument("meshes", "OFF, PLY or OBJ files to convert and load.");
+        parser.process(app);
+        if (parser.positionalArguments().isEmpty()) {
+            qWarning("--load-benchmark needs at least one mesh");
+            return 1;
+        }
+        return MeshLoader::runBenchmark(parser.positionalArguments(), parser.value("repeats").toInt());
+    }
+
+    // Raster preview on the CPU, for nodes without a usable GPU.
+    //   --software-preview [--scene name] [--width w --height h] [--output file] mesh...
+    for (int i = 1; i < argc; ++i) {
+        if (qstrcmp(argv[i], "--software-preview") != 0)
+            continue;
+        QCoreApplication app(argc, argv);
+        return SoftwareRasterizer::runPreview(app.arguments());
+    }
+
+    // Prebuilds out-of-core cluster sets, e.g. on a machine with fast disks.
+    //   --build-clusters [--cluster-cache dir] [--cluster-size n] mesh...
+    for (int i = 1; i < argc; ++i) {
+        if (qstrcmp(argv[i], "--build-clusters") != 0)
+            continue;
+        QCoreApplication app(argc, argv);
+        QCommandLineParser parser;
+        parser.addOption({ "build-clusters", "Cluster the given meshes for out-of-core rendering." });
+        parser.addOption({ "cluster-cache", "Where cluster sets are kept.", "dir" });
+        parser.addOption({ "cluster-size", "Triangles per cluster.", "n", "8192" });
+        parser.addPositionalArgument("meshes", "OFF, PLY or OBJ files.");
+        parser.process(app);
+
+        ClusteredMesh::Options options;
+        options.cacheRoot = parser.value("cluster-cache");
+        options.trianglesPerCluster = qMax(64, parser.value("cluster-size").toInt());
+        int failures = 0;
+        for (const QString &path : parser.positionalArguments()) {
+            ClusteredMesh mesh;
+            if (!mesh.open(path, options)) {
+                ++failures;
+                continue;
+            }
+            qInfo().noquote() << QString("%1: %2 triangles, %3 clusters in %4")
+                                     .arg(path).arg(mesh.triangleCount()).arg(mesh.clusters().size())
+                                     .arg(mesh.directory());
+        }
+        return failures ? 1 : 0;
+    }
+
+    // Benchmark runs present as fast as possible: vsync must be off before
+    // the window is created.
+    bool benchmark = false;
+    for (int i = 1; i < argc; ++i)
+        if (qstrcmp(argv[i], "--benchmark") == 0) benchmark = true;
+    if (benchmark) {
+        format.setSwapInterval(0);
+        QSurfaceFormat::setDefaultFormat(format);
+    }
+
     QApplication app(argc, argv);
 
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addOption({ "replay", "Replay an input recording on a fixed timestep.", "file" });
+    parser.addOption({ "replay-report", "Per-frame CSV written when the replay ends.", "csv" });
+    parser.addOption({ "quit-after-replay", "Exit once the replay has finished." });
+    parser.addOption({ "benchmark", "Render uncapped with vsync off and log the frame rate." });
+    parser.addOption({ "retune", "Time the compute workgroup shapes again and keep the fastest." });
+    parser.addOption({ "asset-cpu-mb", "CPU memory for cached mesh geometry; unused assets are evicted past it.", "MiB", "1024" });
+    parser.addOption({ "asset-gpu-mb", "GPU memory for cached mesh buffers; unused assets are unloaded past it.", "MiB", "1024" });
+    parser.process(app);
+
     mainWindow window;
     window.resize(1280, 720);
     window.show();
 
+    if (parser.isSet("benchmark"))
+        window.enableBenchmark();
+    if (parser.isSet("retune"))
+        window.retuneWorkgroup();
+
+    if (parser.isSet("replay")) {
+        QString path = parser.value("replay");
+        QString report = parser.isSet("replay-report") ? parser.value("replay-report")
+                                                       : path + ".stats.csv";
+        window.startReplay(path, report, parser.isSet("quit-after-replay"));
+    }
+
     return app.exec();
 }
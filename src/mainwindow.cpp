@@ -1,11 +1,26 @@
 #include "mainwindow.h"
 #include "renderer/openglwindow.h"
+#include "renderer/imageexporter.h"
+#include "renderer/imageio.h"
 
 #include <QMenuBar>
 #include <QMenu>
 #include <QAction>
+#include <QActionGroup>
 #include <QtConcurrent>
 #include <QWidget>
+#include <QApplication>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QInputDialog>
+#include <QLabel>
+#include <QStatusBar>
+#include <QTimer>
+#include "renderer/memorytracker.h"
+#include "scene/assetcache.h"
+#include "scene/clusteredmesh.h"
+#include "scene/meshloader.h"
 
 mainWindow::mainWindow(QWidget *parent)
     : QMainWindow(parent)
@@ -20,30 +35,384 @@ mainWindow::mainWindow(QWidget *parent)
     QAction *loadMesh3D = new QAction("Load Mesh 3D", this);
     menuFile->addAction(loadMesh3D);
 
-    connect(loadMesh3D, &QAction::triggered, this, &mainWindow::openOffMesh);
+    connect(loadMesh3D, &QAction::triggered, this, &mainWindow::openMesh);
+
+    QAction *loadOutOfCore = new QAction("Load Mesh Out-of-Core...", this);
+    menuFile->addAction(loadOutOfCore);
+    connect(loadOutOfCore, &QAction::triggered, this, &mainWindow::openOutOfCoreMesh);
+
+    QAction *exportAction = new QAction("Export Image...", this);
+    menuFile->addAction(exportAction);
+    connect(exportAction, &QAction::triggered, this, &mainWindow::exportImage);
+
+    QAction *checkpoints = new QAction("Save Checkpoints...", this);
+    menuFile->addAction(checkpoints);
+    connect(checkpoints, &QAction::triggered, this, &mainWindow::configureCheckpoints);
+
+    connect(m_glWindow->exporter(), &ImageExporter::imageSaved, this,
+            [this](const QString &basePath, int spp) {
+                statusBar()->showMessage(QString("Saved %1 (%2 spp)").arg(basePath).arg(spp));
+            });
+    connect(m_glWindow->exporter(), &ImageExporter::imageSaveFailed, this,
+            [this](const QString &basePath, int spp) {
+                statusBar()->showMessage(QString("Unable to save %1 (%2 spp), see the log").arg(basePath).arg(spp));
+            });
+
+    QMenu *menuTools = menuBar()->addMenu("Tools");
+
+    QAction *convergence = new QAction("Sampler convergence report", this);
+    menuTools->addAction(convergence);
+
+    connect(convergence, &QAction::triggered, this, &mainWindow::runConvergenceHarness);
+
+    QAction *retune = new QAction("Retune Compute Workgroup", this);
+    menuTools->addAction(retune);
+    connect(retune, &QAction::triggered, this, &mainWindow::retuneWorkgroup);
+
+    QAction *bake = new QAction("Bake Lighting for Raster Mode", this);
+    bake->setCheckable(true);
+    bake->setChecked(m_glWindow->bakeLighting());
+    bake->setToolTip("Path-traced lighting baked into the meshes in the background (B)");
+    menuTools->addAction(bake);
+    connect(bake, &QAction::toggled, m_glWindow, &OpenGLWindow::setBakeLighting);
+
+    m_recordAction = new QAction("Start Input Recording", this);
+    menuTools->addAction(m_recordAction);
+    connect(m_recordAction, &QAction::triggered, this, &mainWindow::toggleRecording);
+
+    QAction *replay = new QAction("Replay Recording...", this);
+    menuTools->addAction(replay);
+    connect(replay, &QAction::triggered, this, &mainWindow::openReplay);
+
+    connect(m_glWindow, &OpenGLWindow::replayFinished, this, &mainWindow::onReplayFinished);
+    connect(m_glWindow, &OpenGLWindow::convergenceReport, this, [this](const QString &report) {
+        qDebug().noquote() << report;
+        statusBar()->showMessage("Convergence report written to the log");
+    });
+
+    menuTools->addSeparator();
+    QAction *releaseGeometry = new QAction("Release CPU Geometry After Upload", this);
+    releaseGeometry->setCheckable(true);
+    releaseGeometry->setChecked(m_glWindow->releaseCpuGeometry());
+    menuTools->addAction(releaseGeometry);
+    connect(releaseGeometry, &QAction::toggled, m_glWindow, &OpenGLWindow::setReleaseCpuGeometry);
+
+    QAction *clusterPool = new QAction("Out-of-Core Pool Size...", this);
+    menuTools->addAction(clusterPool);
+    connect(clusterPool, &QAction::triggered, this, &mainWindow::configureClusterPool);
+
+    QAction *memoryReport = new QAction("Save Memory Report...", this);
+    menuTools->addAction(memoryReport);
+    connect(memoryReport, &QAction::triggered, this, &mainWindow::saveMemoryReport);
+
+    m_latencyLabel = new QLabel(this);
+    statusBar()->addPermanentWidget(m_latencyLabel);
+    m_memoryLabel = new QLabel(this);
+    statusBar()->addPermanentWidget(m_memoryLabel);
+    QTimer *memoryTimer = new QTimer(this);
+    connect(memoryTimer, &QTimer::timeout, this, [this]() {
+        m_latencyLabel->setText(m_glWindow->latencySummary());
+        m_memoryLabel->setText(MemoryTracker::instance().summary());
+    });
+    memoryTimer->start(MemoryRefreshMs);
+
+    QMenu *menuLoop = menuBar()->addMenu("Render Loop");
+    QActionGroup *loopModes = new QActionGroup(this);
+    for (int mode = 0; mode < RenderLoop::ModeCount; ++mode) {
+        QAction *action = new QAction(RenderLoop::modeName(RenderLoop::Mode(mode)), this);
+        action->setCheckable(true);
+        action->setChecked(mode == m_glWindow->renderLoopSettings().mode);
+        loopModes->addAction(action);
+        menuLoop->addAction(action);
+        m_loopModeActions.append(action);
+        connect(action, &QAction::triggered, this, [this, mode]() { setRenderLoopMode(mode); });
+    }
+    // Vsync can only be turned off before the window exists: use --benchmark.
+    m_loopModeActions[RenderLoop::Benchmark]->setToolTip("Start with --benchmark to also disable vsync");
+
+    menuLoop->addSeparator();
+    QAction *sampleTarget = new QAction("Sample Target...", this);
+    menuLoop->addAction(sampleTarget);
+    connect(sampleTarget, &QAction::triggered, this, &mainWindow::configureSampleTarget);
+
+    QAction *errorTarget = new QAction("Error Target...", this);
+    menuLoop->addAction(errorTarget);
+    connect(errorTarget, &QAction::triggered, this, &mainWindow::configureErrorTarget);
+
+    QAction *tileBudget = new QAction("Tile Budget...", this);
+    menuLoop->addAction(tileBudget);
+    connect(tileBudget, &QAction::triggered, this, &mainWindow::configureTileBudget);
+
+    QAction *hybrid = new QAction("Rasterized Primary Visibility", this);
+    hybrid->setCheckable(true);
+    hybrid->setChecked(m_glWindow->hybrid());
+    hybrid->setToolTip("Hybrid mode: camera rays come from a G-buffer (H)");
+    menuLoop->addAction(hybrid);
+    connect(hybrid, &QAction::toggled, m_glWindow, &OpenGLWindow::setHybrid);
+
+    QAction *guiding = new QAction("Path Guiding", this);
+    guiding->setCheckable(true);
+    guiding->setChecked(m_glWindow->guiding());
+    guiding->setToolTip("Bounces also follow the light learnt from earlier paths (G)");
+    menuLoop->addAction(guiding);
+    connect(guiding, &QAction::toggled, m_glWindow, &OpenGLWindow::setGuiding);
+
+    QAction *persistent = new QAction("Persistent-Threads Dispatch", this);
+    persistent->setCheckable(true);
+    persistent->setChecked(m_glWindow->persistentThreads());
+    persistent->setToolTip("Resident workgroups pull pixels from a global counter (P)");
+    menuLoop->addAction(persistent);
+    connect(persistent, &QAction::toggled, m_glWindow, &OpenGLWindow::setPersistentThreads);
+
+    QMenu *menuMotion = menuLoop->addMenu("Motion Resolution");
+    QActionGroup *motionModes = new QActionGroup(this);
+    for (int motion = 0; motion < RenderLoop::MotionResolutionCount; ++motion) {
+        QAction *action = new QAction(RenderLoop::motionResolutionName(RenderLoop::MotionResolution(motion)), this);
+        action->setCheckable(true);
+        action->setChecked(motion == m_glWindow->renderLoopSettings().motionResolution);
+        motionModes->addAction(action);
+        menuMotion->addAction(action);
+        m_motionActions.append(action);
+        connect(action, &QAction::triggered, this, [this, motion]() { setMotionResolution(motion); });
+    }
 }
 
-void mainWindow::openOffMesh()
+void mainWindow::openMesh()
 {
     QString fileName = QFileDialog::getOpenFileName(
-        this, "Select 3D mesh", QString(), "OFF Files (*.off)");
+        this, "Select 3D mesh", QString(), MeshLoader::fileFilter());
 
     if (fileName.isEmpty())
         return;
 
-    statusBar()->showMessage("Loading OFF...");
+    statusBar()->showMessage("Loading mesh...");
 
+    // A file (or its content) opened before is shared instead of reloaded.
     QtConcurrent::run([this, fileName]() {
-        QVector<Mesh::Vertex> verts;
-        QVector<unsigned int> idx;
-
-        m_glWindow->loadOffFile(fileName, verts, idx);
+        QSharedPointer<MeshAsset> asset = AssetCache::instance().acquire(fileName);
 
-        QMetaObject::invokeMethod(this, [=]() {
-            m_glWindow->openOffMesh(verts, idx);
+        QMetaObject::invokeMethod(this, [this, fileName, asset]() {
+            if (!asset) {
+                statusBar()->showMessage("Unable to load " + fileName);
+                return;
+            }
+            m_glWindow->openMesh(asset, fileName);
             statusBar()->showMessage("Mesh loaded");
         });
     });
 }
 
 
+// The first open of a file builds its cluster set in the cache, which
+// streams the whole file once; later opens only read the index.
+void mainWindow::openOutOfCoreMesh()
+{
+    QString fileName = QFileDialog::getOpenFileName(
+        this, "Select 3D mesh to render out-of-core", QString(), MeshLoader::fileFilter());
+
+    if (fileName.isEmpty())
+        return;
+
+    statusBar()->showMessage("Clustering mesh...");
+
+    QtConcurrent::run([this, fileName]() {
+        ClusteredMesh *mesh = new ClusteredMesh();
+        bool ok = mesh->open(fileName);
+
+        QMetaObject::invokeMethod(this, [this, ok, fileName, mesh]() {
+            if (!ok) {
+                delete mesh;
+                statusBar()->showMessage("Unable to cluster " + fileName);
+                return;
+            }
+            m_glWindow->addClusteredMesh(mesh);
+            statusBar()->showMessage(QString("Out-of-core mesh loaded: %1 clusters").arg(mesh->clusters().size()));
+        });
+    });
+}
+
+void mainWindow::runConvergenceHarness()
+{
+    // The view keeps responding; the report comes with convergenceReport().
+    statusBar()->showMessage("Running sampler convergence harness...");
+    m_glWindow->runConvergenceHarness();
+}
+
+void mainWindow::exportImage()
+{
+    QString fileName = QFileDialog::getSaveFileName(
+        this, "Export rendered image", QString(),
+        "PNG tonemapped (*.png);;Portable float map (*.pfm);;OpenEXR (*.exr)");
+
+    if (fileName.isEmpty())
+        return;
+
+    QFileInfo info(fileName);
+    QString suffix = info.suffix().toLower();
+    int format = ImageIO::PNG;
+    if (suffix == "pfm") format = ImageIO::PFM;
+    else if (suffix == "exr") format = ImageIO::EXR;
+
+    QString basePath = info.dir().filePath(info.completeBaseName());
+    m_glWindow->exportImage(basePath, format);
+    statusBar()->showMessage("Exporting " + fileName + "...");
+}
+
+void mainWindow::configureCheckpoints()
+{
+    bool ok = false;
+    int every = QInputDialog::getInt(this, "Checkpoints", "Save every N spp (0 disables):",
+                                     m_glWindow->exporter()->checkpointInterval(), 0, 1000000, 1, &ok);
+    if (!ok)
+        return;
+
+    QString directory;
+    if (every > 0) {
+        directory = QFileDialog::getExistingDirectory(this, "Checkpoint directory");
+        if (directory.isEmpty())
+            return;
+    }
+
+    m_glWindow->setCheckpoints(every, directory, ImageIO::PFM | ImageIO::PNG);
+    statusBar()->showMessage(every > 0 ? QString("Saving checkpoints every %1 spp").arg(every)
+                                       : QString("Checkpoints disabled"));
+}
+
+void mainWindow::toggleRecording()
+{
+    if (!m_glWindow->isRecording()) {
+        m_glWindow->startRecording();
+        m_recordAction->setText("Stop Input Recording...");
+        statusBar()->showMessage("Recording input...");
+        return;
+    }
+
+    m_recordAction->setText("Start Input Recording");
+    QString fileName = QFileDialog::getSaveFileName(
+        this, "Save input recording", QString(), "Input recordings (*.rec)");
+    if (fileName.isEmpty()) {
+        m_glWindow->stopRecording(QString());
+        statusBar()->showMessage("Recording discarded");
+        return;
+    }
+
+    m_glWindow->stopRecording(fileName);
+    statusBar()->showMessage("Saving recording to " + fileName);
+}
+
+void mainWindow::openReplay()
+{
+    QString fileName = QFileDialog::getOpenFileName(
+        this, "Replay input recording", QString(), "Input recordings (*.rec)");
+    if (fileName.isEmpty())
+        return;
+
+    startReplay(fileName, fileName + ".stats.csv", false);
+}
+
+void mainWindow::startReplay(const QString &path, const QString &reportPath, bool quitWhenDone)
+{
+    m_quitAfterReplay = quitWhenDone;
+    if (m_glWindow->startReplay(path, reportPath))
+        statusBar()->showMessage("Replaying " + path + " (Esc to stop)");
+    else
+        statusBar()->showMessage("Unable to load recording " + path);
+}
+
+void mainWindow::onReplayFinished(const QString &summary)
+{
+    qInfo().noquote() << summary;
+    qInfo().noquote() << m_glWindow->latencySummary();
+    statusBar()->showMessage("Replay finished, report written next to the recording");
+
+    if (m_quitAfterReplay)
+        QApplication::quit();
+}
+
+void mainWindow::setRenderLoopMode(int mode)
+{
+    RenderLoop::Settings settings = m_glWindow->renderLoopSettings();
+    settings.mode = RenderLoop::Mode(mode);
+    m_glWindow->setRenderLoopSettings(settings);
+    m_loopModeActions[mode]->setChecked(true);
+    statusBar()->showMessage(QString("Render loop: ") + RenderLoop::modeName(settings.mode));
+}
+
+void mainWindow::setMotionResolution(int motion)
+{
+    RenderLoop::Settings settings = m_glWindow->renderLoopSettings();
+    settings.motionResolution = RenderLoop::MotionResolution(motion);
+    m_glWindow->setRenderLoopSettings(settings);
+    m_motionActions[motion]->setChecked(true);
+    statusBar()->showMessage(QString("While moving: ") + RenderLoop::motionResolutionName(settings.motionResolution));
+}
+
+void mainWindow::enableBenchmark()
+{
+    setRenderLoopMode(RenderLoop::Benchmark);
+}
+
+void mainWindow::retuneWorkgroup()
+{
+    m_glWindow->retuneWorkgroup();
+    statusBar()->showMessage("Compute workgroup is retuned on the next ray traced frame (see the log)");
+}
+
+void mainWindow::configureSampleTarget()
+{
+    RenderLoop::Settings settings = m_glWindow->renderLoopSettings();
+    bool ok = false;
+    int spp = QInputDialog::getInt(this, "Sample target",
+                                   "Stop accumulating at (spp, 0 = never):",
+                                   settings.targetSpp, 0, 1 << 24, 1, &ok);
+    if (!ok)
+        return;
+
+    settings.targetSpp = spp;
+    m_glWindow->setRenderLoopSettings(settings);
+}
+
+void mainWindow::configureErrorTarget()
+{
+    RenderLoop::Settings settings = m_glWindow->renderLoopSettings();
+    bool ok = false;
+    double percent = QInputDialog::getDouble(this, "Error target",
+                                             "Stop at estimated relative error (%, 0 = off):",
+                                             settings.errorTarget * 100.0, 0.0, 100.0, 2, &ok);
+    if (!ok)
+        return;
+
+    settings.errorTarget = float(percent / 100.0);
+    m_glWindow->setRenderLoopSettings(settings);
+}
+
+void mainWindow::configureTileBudget()
+{
+    bool ok = false;
+    double ms = QInputDialog::getDouble(this, "Tile budget",
+                                        "GPU time per frame for progressive tiles (ms, 0 = full frames):",
+                                        m_glWindow->tileBudget(), 0.0, 1000.0, 1, &ok);
+    if (ok)
+        m_glWindow->setTileBudget(ms);
+}
+
+void mainWindow::configureClusterPool()
+{
+    bool ok = false;
+    int mb = QInputDialog::getInt(this, "Out-of-core pool",
+                                  "GPU memory for out-of-core clusters (MiB, applies to the next mesh change):",
+                                  m_glWindow->clusterPoolBudget(), 16, 4096, 16, &ok);
+    if (ok)
+        m_glWindow->setClusterPoolBudget(mb);
+}
+
+void mainWindow::saveMemoryReport()
+{
+    QString path = QFileDialog::getSaveFileName(this, "Save memory report", "memory.json", "JSON (*.json)");
+    if (path.isEmpty())
+        return;
+
+    if (MemoryTracker::instance().writeJson(path))
+        statusBar()->showMessage("Memory report written to " + path);
+    qInfo().noquote() << "Memory:" << MemoryTracker::instance().summary();
+}
@@ -3,6 +3,7 @@
 #include <QMainWindow>
 
 class OpenGLWindow;
+class QLabel;
 
 class mainWindow : public QMainWindow
 {
@@ -11,11 +12,36 @@ class mainWindow : public QMainWindow
 public:
     mainWindow(QWidget *parent = nullptr);
 
+    void startReplay(const QString &path, const QString &reportPath, bool quitWhenDone);
+    void enableBenchmark();
+    void retuneWorkgroup();
+
 private slots:
-    void openOffMesh();
+    void openMesh();
+    void openOutOfCoreMesh();
+    void runConvergenceHarness();
+    void exportImage();
+    void configureCheckpoints();
+    void toggleRecording();
+    void openReplay();
+    void onReplayFinished(const QString &summary);
+    void setRenderLoopMode(int mode);
+    void setMotionResolution(int motion);
+    void configureSampleTarget();
+    void configureErrorTarget();
+    void configureTileBudget();
+    void configureClusterPool();
+    void saveMemoryReport();
 
 private:
     OpenGLWindow *m_glWindow;
+    QAction *m_recordAction;
+    QList<QAction*> m_loopModeActions;
+    QList<QAction*> m_motionActions;
+    bool m_quitAfterReplay = false;
+    QLabel *m_memoryLabel = nullptr;
+    QLabel *m_latencyLabel = nullptr;
+    static constexpr int MemoryRefreshMs = 1000;
 };
 
 #endif // MAINWINDOW_H
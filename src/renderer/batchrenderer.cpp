@@ -0,0 +1,439 @@
+#include "batchrenderer.h"
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <QThread>
+#include <climits>
+#include <cstring>
+#include <deque>
+#include "renderer/camera.h"
+#include "renderer/distributedrenderer.h"
+#include "renderer/imageexporter.h"
+#include "renderer/memorytracker.h"
+#include "renderer/pathtracer.h"
+#include "renderer/workgrouptuner.h"
+#include "scene/assetcache.h"
+#include "scene/clusteredmesh.h"
+#include "scene/mesh.h"
+#include "scene/scene.h"
+
+bool BatchRenderer::isRequested(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i)
+        if (std::strcmp(argv[i], "--batch") == 0) return true;
+    return false;
+}
+
+int BatchRenderer::runFromCommandLine(const QStringList &arguments)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Offline batch rendering");
+    parser.addHelpOption();
+    parser.addOption({ "batch", "JSON job file with the scene and camera views.", "jobfile" });
+    parser.addOption({ "output", "Override the output directory.", "dir" });
+    parser.addOption({ "spp", "Override the sample target of every view.", "count" });
+    parser.addOption({ "time", "Override the time budget of every view (seconds).", "seconds" });
+    parser.addOption({ "retune", "Time the compute workgroup shapes again and keep the fastest." });
+    parser.addOption({ "workers", "Render on this many local worker processes (coordinator mode).", "count" });
+    // Applied in main() before the mode is picked; workers inherit them.
+    parser.addOption({ "asset-cpu-mb", "CPU memory for cached mesh geometry; unused assets are evicted past it.", "MiB" });
+    parser.addOption({ "asset-gpu-mb", "GPU memory for cached mesh buffers; unused assets are unloaded past it.", "MiB" });
+    parser.process(arguments);
+
+    Job job;
+    if (!loadJob(parser.value("batch"), job))
+        return 1;
+
+    if (parser.isSet("output"))
+        job.outputDir = parser.value("output");
+    job.retuneWorkgroup = parser.isSet("retune");
+    for (View &v : job.views) {
+        if (parser.isSet("spp")) v.targetSpp = parser.value("spp").toInt();
+        if (parser.isSet("time")) v.timeBudget = parser.value("time").toDouble();
+    }
+
+    if (parser.isSet("workers")) {
+        DistributedRenderer coordinator(job, qMax(1, parser.value("workers").toInt()));
+        return coordinator.run() ? 0 : 1;
+    }
+
+    BatchRenderer renderer(job);
+    return renderer.run() ? 0 : 1;
+}
+
+bool BatchRenderer::loadJob(const QString &path, Job &job)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Unable to open batch job file:" << path;
+        return false;
+    }
+    return parseJob(file.readAll(), path, job);
+}
+
+bool BatchRenderer::parseJob(const QByteArray &json, const QString &source, Job &job)
+{
+    QJsonParseError error;
+    QJsonDocument doc = QJsonDocument::fromJson(json, &error);
+    if (doc.isNull()) {
+        qWarning() << "Invalid batch job file:" << source << error.errorString();
+        return false;
+    }
+    job.json = json;
+
+    QJsonObject root = doc.object();
+    job.scene = root.value("scene").toString(job.scene);
+    job.sphereCount = root.value("sphereCount").toInt(job.sphereCount);
+    for (const QJsonValue &m : root.value("meshes").toArray())
+        job.meshes.append(m.toString());
+    for (const QJsonValue &m : root.value("outOfCore").toArray())
+        job.outOfCore.append(m.toString());
+    job.clusterPoolMb = qMax(1, root.value("clusterPoolMb").toInt(job.clusterPoolMb));
+    job.width = root.value("width").toInt(job.width);
+    job.height = root.value("height").toInt(job.height);
+    job.outputDir = root.value("output").toString(job.outputDir);
+    job.chunkSpp = qMax(1, root.value("chunkSpp").toInt(job.chunkSpp));
+    job.workSpp = qMax(1, root.value("workSpp").toInt(job.workSpp));
+    job.releaseCpuGeometry = root.value("releaseCpuGeometry").toBool(job.releaseCpuGeometry);
+
+    QString hybrid = root.value("hybrid").toString();
+    if (hybrid == "on") job.hybrid = Job::HybridOn;
+    else if (hybrid == "compare") job.hybrid = Job::HybridCompare;
+    else if (hybrid == "off") job.hybrid = Job::HybridOff;
+
+    QString dispatch = root.value("dispatch").toString();
+    if (dispatch == "persistent") job.dispatch = Job::DispatchPersistent;
+    else if (dispatch == "compare") job.dispatch = Job::DispatchCompare;
+    else if (dispatch == "tiles") job.dispatch = Job::DispatchTiles;
+    job.persistentGroups = qMax(0, root.value("persistentGroups").toInt(job.persistentGroups));
+
+    QString sampler = root.value("sampler").toString();
+    if (sampler == "white") job.sampler = Sampler::WhiteNoise;
+    else if (sampler == "bluenoise") job.sampler = Sampler::BlueNoiseRank1;
+    else if (sampler == "sobol") job.sampler = Sampler::SobolOwen;
+
+    if (root.contains("formats")) {
+        job.formats = 0;
+        for (const QJsonValue &f : root.value("formats").toArray()) {
+            QString name = f.toString().toLower();
+            if (name == "png") job.formats |= ImageIO::PNG;
+            else if (name == "pfm") job.formats |= ImageIO::PFM;
+            else if (name == "exr") job.formats |= ImageIO::EXR;
+        }
+    }
+
+    int index = 0;
+    for (const QJsonValue &value : root.value("views").toArray()) {
+        QJsonObject o = value.toObject();
+        View v;
+        v.name = o.value("name").toString(QString("view%1").arg(index, 4, 10, QChar('0')));
+        QJsonArray pos = o.value("position").toArray();
+        if (pos.size() == 3)
+            v.position = QVector3D(pos[0].toDouble(), pos[1].toDouble(), pos[2].toDouble());
+        v.yaw = o.value("yaw").toDouble(v.yaw);
+        v.pitch = o.value("pitch").toDouble(v.pitch);
+        v.fovDeg = o.value("fov").toDouble(v.fovDeg);
+        v.targetSpp = o.value("spp").toInt(v.targetSpp);
+        v.timeBudget = o.value("time").toDouble(v.timeBudget);
+        job.views.append(v);
+        ++index;
+    }
+
+    if (job.views.isEmpty()) {
+        qWarning() << "Batch job has no views:" << source;
+        return false;
+    }
+    return true;
+}
+
+void BatchRenderer::buildScene(const Job &job, Scene &scene)
+{
+    if (job.scene == "planesphere")
+        scene.buildPlaneSphere();
+    else if (job.scene == "spheres")
+        scene.buildSphereField(job.sphereCount);
+    else
+        scene.buildCornellBox();
+
+    for (const QString &path : job.meshes) {
+        if (Mesh *mesh = AssetCache::instance().createMesh(path))
+            scene.addMesh(mesh);
+    }
+
+    for (const QString &path : job.outOfCore) {
+        ClusteredMesh *mesh = new ClusteredMesh();
+        if (!mesh->open(path)) {
+            delete mesh;
+            continue;
+        }
+        scene.addClusteredMesh(mesh);
+    }
+}
+
+BatchRenderer::BatchRenderer(const Job &job)
+    : m_job(job)
+{
+}
+
+bool BatchRenderer::run()
+{
+    QOffscreenSurface surface;
+    surface.setFormat(QSurfaceFormat::defaultFormat());
+    surface.create();
+
+    QOpenGLContext context;
+    context.setFormat(QSurfaceFormat::defaultFormat());
+    if (!context.create() || !context.makeCurrent(&surface)) {
+        qWarning() << "Batch: unable to create an offscreen OpenGL context";
+        return false;
+    }
+    qInfo() << "Batch: OpenGL" << (const char*)context.functions()->glGetString(GL_RENDERER)
+            << (const char*)context.functions()->glGetString(GL_VERSION);
+
+    QDir().mkpath(m_job.outputDir);
+
+    bool ok = true;
+    QElapsedTimer total;
+    total.start();
+    {
+        Scene scene;
+        buildScene(m_job, scene);
+
+        PathTracer tracer;
+        ImageExporter exporter;
+        // Encoding runs on the exporter's threads and there is no event
+        // loop here, so failures are collected directly from the signal.
+        QObject::connect(&exporter, &ImageExporter::imageSaveFailed, &exporter,
+                         [this](const QString &basePath, int) {
+                             QMutexLocker lock(&m_failedMutex);
+                             m_failedExports.append(basePath);
+                         }, Qt::DirectConnection);
+        if (!tracer.initialize(m_job.width, m_job.height)) {
+            ok = false;
+        } else {
+            exporter.initialize();
+            tracer.setSamplerMode(m_job.sampler);
+            tracer.setReleaseCpuGeometry(m_job.releaseCpuGeometry);
+            tracer.setClusterPoolBudget(qint64(m_job.clusterPoolMb) << 20);
+            tracer.setPersistentGroups(m_job.persistentGroups);
+            tracer.uploadScene(&scene);
+            qInfo().noquote() << "Batch: memory" << MemoryTracker::instance().summary();
+
+            const View &first = m_job.views.first();
+            Camera camera;
+            camera.setPosition(first.position);
+            camera.setYawPitch(first.yaw, first.pitch);
+            m_workgroup = WorkgroupTuner::apply(tracer, camera, first.fovDeg, m_job.retuneWorkgroup).name();
+
+            const PathTracer::Dispatch dispatch = m_job.dispatch == Job::DispatchTiles
+                ? PathTracer::TileDispatch : PathTracer::PersistentDispatch;
+            for (const View &view : m_job.views) {
+                double tracedRate = 0.0;
+                tracer.setDispatch(dispatch);
+                if (m_job.hybrid == Job::HybridCompare) {
+                    tracer.setHybrid(false);
+                    tracedRate = renderView(tracer, exporter, view, false).samplesPerSecond;
+                }
+                tracer.setHybrid(m_job.hybrid != Job::HybridOff);
+
+                double tileRate = 0.0;
+                if (m_job.dispatch == Job::DispatchCompare) {
+                    tracer.setDispatch(PathTracer::TileDispatch);
+                    tileRate = renderView(tracer, exporter, view, false).samplesPerSecond;
+                    tracer.setDispatch(dispatch);
+                }
+
+                const qint64 skippedBefore = tracer.primaryRaysSkipped();
+                ViewStats s = renderView(tracer, exporter, view);
+                s.tracedSamplesPerSecond = tracedRate;
+                s.tileSamplesPerSecond = tileRate;
+                s.primaryRaysSkipped = tracer.primaryRaysSkipped() - skippedBefore;
+                m_stats.append(s);
+                qInfo().noquote() << QString("Batch: %1  %2 spp  %3 s  %4 Msamples/s")
+                                         .arg(s.name).arg(s.spp)
+                                         .arg(s.seconds, 0, 'f', 2)
+                                         .arg(s.samplesPerSecond / 1e6, 0, 'f', 2);
+                if (tracedRate > 0.0)
+                    qInfo().noquote() << QString("Batch: %1  traced primary rays %2 Msamples/s, hybrid %3x")
+                                             .arg(s.name).arg(tracedRate / 1e6, 0, 'f', 2)
+                                             .arg(s.samplesPerSecond / tracedRate, 0, 'f', 2);
+                if (tileRate > 0.0)
+                    qInfo().noquote() << QString("Batch: %1  per-tile dispatch %2 Msamples/s, persistent %3x")
+                                             .arg(s.name).arg(tileRate / 1e6, 0, 'f', 2)
+                                             .arg(s.samplesPerSecond / tileRate, 0, 'f', 2);
+            }
+
+            // Drain the export pipeline before tearing the context down.
+            while (exporter.busy()) {
+                exporter.poll();
+                QThread::msleep(1);
+            }
+            exporter.destroy();
+            m_clusterStats = tracer.clusterStats();
+
+            QMutexLocker lock(&m_failedMutex);
+            for (ViewStats &s : m_stats) {
+                if (!m_failedExports.contains(QDir(m_job.outputDir).filePath(s.name)))
+                    continue;
+                qWarning() << "Batch: unable to write the images of" << s.name;
+                s.saved = false;
+                ok = false;
+            }
+        }
+    }
+    context.doneCurrent();
+
+    return writeStats(total.elapsed() / 1000.0) && ok;
+}
+
+BatchRenderer::ViewStats BatchRenderer::renderView(PathTracer &tracer, ImageExporter &exporter, const View &view,
+                                                   bool save)
+{
+    QOpenGLExtraFunctions *f = QOpenGLContext::currentContext()->extraFunctions();
+
+    Camera camera;
+    camera.setPosition(view.position);
+    camera.setYawPitch(view.yaw, view.pitch);
+
+    // Page in the clusters this view needs before timing it.
+    QElapsedTimer warmup;
+    warmup.start();
+    const int uploadsBefore = tracer.clusterStats().uploads;
+    if (tracer.clusterStats().clusters > 0) {
+        do {
+            tracer.traceFrame(camera, view.fovDeg);
+            f->glFinish();
+        } while (tracer.streaming() && warmup.elapsed() < MaxWarmupMs);
+        if (tracer.streaming())
+            qWarning() << "Batch:" << view.name << "still streaming clusters after" << MaxWarmupMs / 1000 << "s";
+    }
+    const double warmupSeconds = warmup.nsecsElapsed() / 1e9;
+
+    tracer.resetAccumulation();
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const int target = view.targetSpp > 0 ? view.targetSpp : (view.timeBudget > 0.0 ? INT_MAX : 1);
+    std::deque<GLsync> inFlight;
+    int issued = 0;
+    bool outOfTime = false;
+
+    while (issued < target && !outOfTime) {
+        int chunk = qMin(m_job.chunkSpp, target - issued);
+        for (int i = 0; i < chunk; ++i)
+            tracer.traceFrame(camera, view.fovDeg);
+        issued += chunk;
+        inFlight.push_back(f->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+
+        // Keep two chunks queued: the GPU always has work while we wait.
+        while (inFlight.size() > 2) {
+            f->glClientWaitSync(inFlight.front(), GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(10) * 1000000000);
+            f->glDeleteSync(inFlight.front());
+            inFlight.pop_front();
+        }
+        exporter.poll();
+
+        if (view.timeBudget > 0.0 && timer.elapsed() / 1000.0 >= view.timeBudget)
+            outOfTime = true;
+    }
+
+    while (!inFlight.empty()) {
+        f->glClientWaitSync(inFlight.front(), GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(10) * 1000000000);
+        f->glDeleteSync(inFlight.front());
+        inFlight.pop_front();
+    }
+
+    ViewStats stats;
+    stats.name = view.name;
+    stats.spp = tracer.accumFrame();
+    stats.seconds = timer.nsecsElapsed() / 1e9;
+    stats.samplesPerSecond = stats.seconds > 0.0
+        ? double(tracer.width()) * tracer.height() * stats.spp / stats.seconds : 0.0;
+    stats.warmupSeconds = warmupSeconds;
+    stats.clusterUploads = tracer.clusterStats().uploads - uploadsBefore;
+
+    if (!save)
+        return stats;
+
+    // The readback is queued behind the last dispatch; the next view starts
+    // tracing right away and the encode happens on a worker.
+    QString basePath = QDir(m_job.outputDir).filePath(view.name);
+    while (!exporter.capture(tracer.accumBuffer(), tracer.width(), tracer.height(),
+                             stats.spp, basePath, m_job.formats)) {
+        exporter.poll();
+        QThread::msleep(1);
+    }
+
+    return stats;
+}
+
+bool BatchRenderer::writeStats(double totalSeconds) const
+{
+    QJsonArray views;
+    double samples = 0.0;
+    for (const ViewStats &s : m_stats) {
+        QJsonObject o;
+        o["name"] = s.name;
+        o["spp"] = s.spp;
+        o["seconds"] = s.seconds;
+        o["samplesPerSecond"] = s.samplesPerSecond;
+        if (m_job.hybrid != Job::HybridOff)
+            o["primaryRaysSkipped"] = double(s.primaryRaysSkipped);
+        if (s.tracedSamplesPerSecond > 0.0) {
+            o["tracedSamplesPerSecond"] = s.tracedSamplesPerSecond;
+            o["hybridSpeedup"] = s.samplesPerSecond / s.tracedSamplesPerSecond;
+        }
+        if (s.tileSamplesPerSecond > 0.0) {
+            o["tileSamplesPerSecond"] = s.tileSamplesPerSecond;
+            o["persistentSpeedup"] = s.samplesPerSecond / s.tileSamplesPerSecond;
+        }
+        o["saved"] = s.saved;
+        if (m_clusterStats.clusters > 0) {
+            o["warmupSeconds"] = s.warmupSeconds;
+            o["clusterUploads"] = s.clusterUploads;
+        }
+        views.append(o);
+        samples += s.samplesPerSecond * s.seconds;
+    }
+
+    QJsonObject root;
+    root["width"] = m_job.width;
+    root["height"] = m_job.height;
+    root["views"] = views;
+    root["totalSeconds"] = totalSeconds;
+    root["samplesPerSecond"] = totalSeconds > 0.0 ? samples / totalSeconds : 0.0;
+    root["viewsPerHour"] = totalSeconds > 0.0 ? m_stats.size() * 3600.0 / totalSeconds : 0.0;
+    root["failedExports"] = QJsonArray::fromStringList(m_failedExports);
+    root["workgroup"] = m_workgroup;
+    root["dispatch"] = PathTracer::dispatchName(m_job.dispatch == Job::DispatchTiles
+                                                ? PathTracer::TileDispatch : PathTracer::PersistentDispatch);
+    if (m_clusterStats.clusters > 0) {
+        QJsonObject clusters;
+        clusters["clusters"] = m_clusterStats.clusters;
+        clusters["slots"] = m_clusterStats.slots;
+        clusters["resident"] = m_clusterStats.resident;
+        clusters["uploads"] = m_clusterStats.uploads;
+        clusters["uploadedBytes"] = double(m_clusterStats.uploadedBytes);
+        clusters["evictions"] = m_clusterStats.evictions;
+        root["outOfCore"] = clusters;
+    }
+    // Peaks cover the whole run; current values are after teardown.
+    root["memory"] = MemoryTracker::instance().toJson();
+
+    QFile file(QDir(m_job.outputDir).filePath("stats.json"));
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Unable to write batch stats:" << file.fileName();
+        return false;
+    }
+    file.write(QJsonDocument(root).toJson());
+    return true;
+}
@@ -0,0 +1,125 @@
+#pragma once
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QVector3D>
+#include "renderer/clusterpool.h"
+#include "renderer/imageio.h"
+#include "renderer/sampler.h"
+
+class PathTracer;
+class ImageExporter;
+class Scene;
+
+// Unattended offline rendering for render nodes. Loads a scene and a list
+// of camera views from a JSON job file, renders each view on an offscreen
+// context (QOffscreenSurface, works with llvmpipe) to a sample target or a
+// time budget, and writes images plus per-view stats and a memory report.
+//
+// "hybrid" starts paths from a rasterized G-buffer (PathTracer::setHybrid);
+// "compare" first renders every view with traced camera rays, without
+// saving it, and reports the hybrid speedup over that run.
+//
+// Out-of-core meshes are paged in on demand (ClusterPool): each view first
+// traces until the clusters it needs are resident, untimed, then restarts.
+//
+// Views are pipelined: the readback of a finished view is queued through
+// ImageExporter's PBO ring and encoded on worker threads while the GPU is
+// already tracing the next view, and dispatches are issued in chunks with
+// at most two chunks in flight so the queue stays full without piling up.
+//
+// With --workers N the job is rendered by a coordinator and N worker
+// processes instead (DistributedRenderer).
+//
+// Job file:
+//   { "scene": "cornell" | "planesphere" | "spheres", "sphereCount": 100000,
+//     "meshes": ["model3D/man.off"], "outOfCore": ["scan.ply"], "clusterPoolMb": 256,
+//     "width": 640, "height": 480, "output": "out", "sampler": "sobol",
+//     "formats": ["png", "pfm", "exr"], "chunkSpp": 4, "workSpp": 16, "releaseCpuGeometry": true,
+//     "hybrid": "off" | "on" | "compare",
+//     "views": [ { "name": "front", "position": [0, 0, 2.9], "yaw": -90,
+//                  "pitch": 0, "fov": 60, "spp": 256, "time": 30 } ] }
+class BatchRenderer
+{
+public:
+    struct View {
+        QString name;
+        QVector3D position { 0.0f, 0.0f, 3.0f };
+        float yaw = -90.0f;
+        float pitch = 0.0f;
+        float fovDeg = 60.0f;
+        int targetSpp = 256;
+        double timeBudget = 0.0; // seconds, 0 disables
+    };
+
+    struct Job {
+        QString scene = "cornell";
+        int sphereCount = 100000;
+        QStringList meshes;
+        QStringList outOfCore;
+        int clusterPoolMb = 256;
+        int width = 640;
+        int height = 480;
+        QString outputDir = "batch_output";
+        int formats = ImageIO::PNG | ImageIO::PFM;
+        Sampler::Mode sampler = Sampler::SobolOwen;
+        int chunkSpp = 4;
+        // Samples per work unit handed to a worker process.
+        int workSpp = 16;
+        bool releaseCpuGeometry = false;
+        enum Hybrid { HybridOff, HybridOn, HybridCompare } hybrid = HybridOff;
+        // Compare renders each view with one workgroup per tile first.
+        enum Dispatch { DispatchTiles, DispatchPersistent, DispatchCompare } dispatch = DispatchTiles;
+        int persistentGroups = 0;
+        // Time the workgroup shapes again instead of using the stored one.
+        bool retuneWorkgroup = false;
+        QVector<View> views;
+        // The job file as read, which workers parse again.
+        QByteArray json;
+    };
+
+    struct ViewStats {
+        QString name;
+        int spp = 0;
+        double seconds = 0.0;
+        double samplesPerSecond = 0.0;
+        double warmupSeconds = 0.0;
+        int clusterUploads = 0;
+        // Compare mode: the same view with traced camera rays.
+        double tracedSamplesPerSecond = 0.0;
+        qint64 primaryRaysSkipped = 0;
+        // Dispatch compare mode: the same view with one workgroup per tile.
+        double tileSamplesPerSecond = 0.0;
+        // False when any of the view's image files could not be written.
+        bool saved = true;
+    };
+
+    static bool isRequested(int argc, char *argv[]);
+    static int runFromCommandLine(const QStringList &arguments);
+    static bool loadJob(const QString &path, Job &job);
+    // source names the job in warnings.
+    static bool parseJob(const QByteArray &json, const QString &source, Job &job);
+    static void buildScene(const Job &job, Scene &scene);
+
+    explicit BatchRenderer(const Job &job);
+
+    // Creates its own offscreen context; returns false on any setup error
+    // or when an image could not be written.
+    bool run();
+    const QVector<ViewStats>& stats() const { return m_stats; }
+
+private:
+    ViewStats renderView(PathTracer &tracer, ImageExporter &exporter, const View &view, bool save = true);
+    bool writeStats(double totalSeconds) const;
+
+    static constexpr int MaxWarmupMs = 120000;
+
+    Job m_job;
+    QVector<ViewStats> m_stats;
+    ClusterPool::Stats m_clusterStats;
+    QString m_workgroup;
+    // Base paths of failed exports, reported from the encoding threads.
+    QMutex m_failedMutex;
+    QStringList m_failedExports;
+};
@@ -11,6 +11,8 @@ public:
     const QVector3D& position() const { return m_pos; }
 
     void setYawPitch(float yaw, float pitch);
+    float yaw() const { return m_yaw; }
+    float pitch() const { return m_pitch; }
     void processMouseMovement(float deltaX, float deltaY);
     void processKeyboard(const QVector3D& direction, float deltaTime);
     const QVector3D& front() const { return m_front; }
@@ -0,0 +1,380 @@
+#include "clusterpool.h"
+#include <QDebug>
+#include <QtConcurrent>
+#include <algorithm>
+#include <cstring>
+#include "scene/clusteredmesh.h"
+#include "renderer/memorytracker.h"
+
+namespace {
+
+// Words per cluster in ClusterTable (raytrace.comp).
+constexpr int ClusterWords = 12;
+
+quint32 floatBits(float f)
+{
+    quint32 u;
+    std::memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+}
+
+ClusterPool::ClusterPool()
+{
+}
+
+ClusterPool::~ClusterPool()
+{
+    for (Load &load : m_loads)
+        load.data.waitForFinished();
+}
+
+ClusterPool::Layout ClusterPool::plan(const std::vector<ClusteredMesh*> &meshes) const
+{
+    Layout layout;
+    int clusters = 0;
+    for (const ClusteredMesh *mesh : meshes) {
+        layout.slotVertices = qMax(layout.slotVertices, mesh->maxVertices());
+        layout.slotTriangles = qMax(layout.slotTriangles, mesh->maxTriangles());
+        layout.slotNodes = qMax(layout.slotNodes, mesh->maxNodes());
+        clusters += mesh->clusters().size();
+    }
+    if (clusters == 0)
+        return layout;
+
+    const qint64 slotBytes = qint64(layout.slotVertices) * sizeof(VertexFormat::PackedVertex)
+                           + qint64(layout.slotTriangles) * 3 * sizeof(quint32)
+                           + qint64(layout.slotNodes) * sizeof(Bvh::Node);
+    layout.slotCount = int(qBound<qint64>(1, m_budget / qMax<qint64>(1, slotBytes), clusters));
+    return layout;
+}
+
+void ClusterPool::reset(const std::vector<ClusteredMesh*> &meshes, const Layout &layout,
+                        GLuint vertices, GLuint triangles, GLuint nodes)
+{
+    if (!m_initialized) {
+        initializeOpenGLFunctions();
+        m_initialized = true;
+    }
+
+    for (Load &load : m_loads)
+        load.data.waitForFinished();
+    m_loads.clear();
+    m_requested.clear();
+    for (Readback &readback : m_readbacks) {
+        if (readback.fence) glDeleteSync(readback.fence);
+        readback.fence = nullptr;
+    }
+
+    m_layout = layout;
+    m_vertices = vertices;
+    m_triangles = triangles;
+    m_nodes = nodes;
+
+    m_entries.clear();
+    for (const ClusteredMesh *mesh : meshes)
+        for (int i = 0; i < mesh->clusters().size(); ++i) {
+            Entry e;
+            e.mesh = mesh;
+            e.index = i;
+            m_entries.append(e);
+        }
+    m_slotOwner = QVector<int>(layout.slotCount, -1);
+    ++m_residency;
+    m_settled = false;
+    m_warnedFull = false;
+    m_stats = Stats();
+    m_stats.clusters = m_entries.size();
+    m_stats.slots = layout.slotCount;
+
+    // Every cluster's bounds, none resident, demand counters at zero.
+    const int n = m_entries.size();
+    std::vector<quint32> table(size_t(qMax(n, 1)) * (ClusterWords + 1), 0u);
+    for (int c = 0; c < n; ++c)
+        entryWords(c, &table[size_t(c) * ClusterWords]);
+
+    if (!m_table) glCreateBuffers(1, &m_table);
+    glNamedBufferData(m_table, GLsizeiptr(table.size() * sizeof(quint32)), table.data(), GL_DYNAMIC_DRAW);
+    for (Readback &readback : m_readbacks) {
+        if (!readback.buffer) glCreateBuffers(1, &readback.buffer);
+        glNamedBufferData(readback.buffer, GLsizeiptr(sizeof(quint32)) * qMax(n, 1), nullptr, GL_STREAM_READ);
+    }
+
+    MemoryTracker &mem = MemoryTracker::instance();
+    mem.track(this, "clusterTable", "clusters", MemoryTracker::GpuBuffer, qint64(table.size() * sizeof(quint32)));
+    mem.track(this, "demandReadback", "clusters", MemoryTracker::GpuBuffer,
+              qint64(sizeof(quint32)) * n * ReadbackRing);
+
+    if (n)
+        qDebug() << "Cluster pool:" << layout.slotCount << "slots for" << n << "clusters,"
+                 << layout.slotTriangles << "triangles per slot";
+}
+
+void ClusterPool::entryWords(int cluster, quint32 *words) const
+{
+    const Entry &e = m_entries[cluster];
+    const ClusteredMesh::Cluster &c = e.mesh->clusters()[e.index];
+    const quint32 slot = e.slot >= 0 ? quint32(e.slot) : 0u;
+
+    words[0] = floatBits(c.quantization.min.x());
+    words[1] = floatBits(c.quantization.min.y());
+    words[2] = floatBits(c.quantization.min.z());
+    words[3] = m_layout.nodeOffset + slot * m_layout.slotNodes;
+    words[4] = floatBits(c.quantization.extent.x());
+    words[5] = floatBits(c.quantization.extent.y());
+    words[6] = floatBits(c.quantization.extent.z());
+    words[7] = m_layout.triOffset + slot * m_layout.slotTriangles;
+    words[8] = m_layout.vertexOffset + slot * m_layout.slotVertices;
+    words[9] = e.slot >= 0 ? 1u : 0u;
+    words[10] = words[11] = 0u;
+}
+
+void ClusterPool::writeEntry(int cluster)
+{
+    quint32 words[ClusterWords];
+    entryWords(cluster, words);
+    glNamedBufferSubData(m_table, GLintptr(sizeof(words)) * cluster, sizeof(words), words);
+}
+
+bool ClusterPool::update()
+{
+    if (m_entries.isEmpty())
+        return false;
+
+    readFinishedDemand();
+
+    bool changed = false;
+    qint64 uploaded = 0;
+    for (int i = 0; i < m_loads.size();) {
+        if (!m_loads[i].data.isFinished() || uploaded >= MaxUploadBytesPerFrame) {
+            ++i;
+            continue;
+        }
+        const int cluster = m_loads[i].cluster;
+        const QByteArray bytes = m_loads[i].data.result();
+        m_loads.removeAt(i);
+        m_entries[cluster].loading = false;
+        if (bytes.isEmpty()) {
+            m_entries[cluster].failed = true;
+            continue;
+        }
+
+        const int slot = acquireSlot();
+        if (slot < 0)
+            continue;
+        upload(cluster, slot, bytes);
+        uploaded += bytes.size();
+        changed = true;
+    }
+
+    int available = availableSlots();
+    if (available <= 0 && !m_requested.isEmpty()) {
+        if (!m_warnedFull)
+            qWarning() << "Cluster pool full:" << m_slotOwner.size() << "slots are all in use;"
+                       << "raise the out-of-core pool size to fill the holes";
+        m_warnedFull = true;
+        m_requested.clear();
+        // The holes stay: nothing more will become resident.
+        m_settled = true;
+    }
+
+    while (available > 0 && m_loads.size() < MaxLoadsInFlight && !m_requested.isEmpty()) {
+        const int cluster = m_requested.takeFirst();
+        Entry &e = m_entries[cluster];
+        if (e.slot >= 0 || e.loading)
+            continue;
+        e.loading = true;
+        --available;
+
+        const QString directory = e.mesh->directory();
+        const ClusteredMesh::Cluster info = e.mesh->clusters()[e.index];
+        m_loads.append({ cluster, QtConcurrent::run([directory, info]() {
+            QByteArray bytes;
+            if (!ClusteredMesh::readCluster(directory, info, bytes))
+                bytes.clear();
+            return bytes;
+        }) });
+    }
+
+    return changed;
+}
+
+// Only read what can be placed: free slots and slots nobody used lately.
+int ClusterPool::availableSlots() const
+{
+    int available = -m_loads.size();
+    for (int owner : m_slotOwner)
+        if (owner < 0 || m_entries[owner].lastUsed + KeepFrames <= m_frame)
+            ++available;
+    return available;
+}
+
+void ClusterPool::readFinishedDemand()
+{
+    // Oldest readback first; stop at the first one the GPU has not reached.
+    for (int i = 0; i < ReadbackRing; ++i) {
+        Readback &readback = m_readbacks[(m_nextReadback + i) % ReadbackRing];
+        if (!readback.fence)
+            continue;
+        GLenum status = glClientWaitSync(readback.fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+        glDeleteSync(readback.fence);
+        readback.fence = nullptr;
+        readDemand(readback);
+    }
+}
+
+void ClusterPool::readDemand(const Readback &readback)
+{
+    const int n = m_entries.size();
+    std::vector<quint32> demand(n);
+    glGetNamedBufferSubData(readback.buffer, 0, GLsizeiptr(sizeof(quint32)) * n, demand.data());
+    ++m_frame;
+
+    // Missing clusters, the most wanted first.
+    QVector<QPair<quint32, int>> wanted;
+    for (int c = 0; c < n; ++c) {
+        if (!demand[c])
+            continue;
+        Entry &e = m_entries[c];
+        e.lastUsed = m_frame;
+        if (e.slot < 0 && !e.loading && !e.failed)
+            wanted.append({ demand[c], c });
+    }
+    // Demand traced against the current residency that wants nothing new:
+    // the working set is in.
+    if (readback.residency == m_residency)
+        m_settled = wanted.isEmpty();
+    std::sort(wanted.begin(), wanted.end(), [](const QPair<quint32, int> &a, const QPair<quint32, int> &b) {
+        return a.first > b.first;
+    });
+
+    m_requested.clear();
+    for (const auto &w : wanted)
+        m_requested.append(w.second);
+}
+
+int ClusterPool::acquireSlot()
+{
+    int victim = -1;
+    quint64 oldest = ~0ull;
+    for (int s = 0; s < m_slotOwner.size(); ++s) {
+        const int owner = m_slotOwner[s];
+        if (owner < 0)
+            return s;
+        const quint64 used = m_entries[owner].lastUsed;
+        if (used + KeepFrames <= m_frame && used < oldest) {
+            oldest = used;
+            victim = s;
+        }
+    }
+    if (victim < 0)
+        return -1;
+
+    const int owner = m_slotOwner[victim];
+    m_entries[owner].slot = -1;
+    writeEntry(owner);
+    m_slotOwner[victim] = -1;
+    ++m_stats.evictions;
+    return victim;
+}
+
+void ClusterPool::upload(int cluster, int slot, const QByteArray &bytes)
+{
+    Entry &e = m_entries[cluster];
+    const ClusteredMesh::Cluster &c = e.mesh->clusters()[e.index];
+
+    const GLsizeiptr vertexSize = sizeof(VertexFormat::PackedVertex);
+    const GLsizeiptr triSize = 3 * sizeof(quint32);
+    const GLsizeiptr nodeSize = sizeof(Bvh::Node);
+    const char *data = bytes.constData();
+
+    glNamedBufferSubData(m_vertices, vertexSize * (m_layout.vertexOffset + qint64(slot) * m_layout.slotVertices),
+                         vertexSize * c.vertexCount, data);
+    data += vertexSize * c.vertexCount;
+    glNamedBufferSubData(m_triangles, triSize * (m_layout.triOffset + qint64(slot) * m_layout.slotTriangles),
+                         triSize * c.triangleCount, data);
+    data += triSize * c.triangleCount;
+    glNamedBufferSubData(m_nodes, nodeSize * (m_layout.nodeOffset + qint64(slot) * m_layout.slotNodes),
+                         nodeSize * c.nodeCount, data);
+
+    e.slot = slot;
+    e.lastUsed = m_frame;
+    m_slotOwner[slot] = cluster;
+    writeEntry(cluster);
+    ++m_residency;
+    m_settled = false;
+
+    m_stats.uploadedBytes += bytes.size();
+    ++m_stats.uploads;
+}
+
+void ClusterPool::afterTrace()
+{
+    if (m_entries.isEmpty())
+        return;
+
+    // With the ring full the counts keep adding up until the next copy.
+    Readback &readback = m_readbacks[m_nextReadback];
+    if (readback.fence)
+        return;
+
+    const GLsizeiptr bytes = GLsizeiptr(sizeof(quint32)) * m_entries.size();
+    const GLintptr demandOffset = GLintptr(sizeof(quint32)) * ClusterWords * m_entries.size();
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glCopyNamedBufferSubData(m_table, readback.buffer, demandOffset, 0, bytes);
+    glClearNamedBufferSubData(m_table, GL_R32UI, demandOffset, bytes, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readback.residency = m_residency;
+    m_nextReadback = (m_nextReadback + 1) % ReadbackRing;
+}
+
+void ClusterPool::bind(GLuint binding)
+{
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, m_table);
+}
+
+bool ClusterPool::streaming()
+{
+    if (m_entries.isEmpty())
+        return false;
+    readFinishedDemand();
+    if (!m_loads.isEmpty())
+        return true;
+    // Requests the pool has no room for are holes, not progress.
+    if (!m_requested.isEmpty())
+        return availableSlots() > 0;
+    return !m_settled;
+}
+
+ClusterPool::Stats ClusterPool::stats() const
+{
+    Stats s = m_stats;
+    s.resident = 0;
+    for (int owner : m_slotOwner)
+        if (owner >= 0) ++s.resident;
+    return s;
+}
+
+void ClusterPool::destroy()
+{
+    for (Load &load : m_loads)
+        load.data.waitForFinished();
+    m_loads.clear();
+    m_requested.clear();
+    m_entries.clear();
+    m_slotOwner.clear();
+
+    if (!m_initialized)
+        return;
+    for (Readback &readback : m_readbacks) {
+        if (readback.fence) glDeleteSync(readback.fence);
+        if (readback.buffer) glDeleteBuffers(1, &readback.buffer);
+        readback = Readback();
+    }
+    if (m_table) glDeleteBuffers(1, &m_table);
+    m_table = 0;
+    MemoryTracker::instance().release(this);
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include <QFuture>
+#include <QOpenGLFunctions_4_5_Core>
+#include <QVector>
+#include <vector>
+
+class ClusteredMesh;
+
+// Keeps the clusters of out-of-core meshes (ClusteredMesh) that rays need
+// in a fixed number of GPU slots. The slots sit at the end of the tracer's
+// mesh geometry buffers, so a resident cluster is traced like any mesh BVH.
+//
+// raytrace.comp counts, per cluster, the rays that reach its bounds. The
+// counts are copied to a readback buffer after each trace and read once the
+// GPU is past it, a frame or two later, without a stall. Missing clusters
+// with the most rays are read from disk on worker threads and uploaded over
+// the least recently used slots; clusters rays reached during the last
+// KeepFrames readbacks are never evicted, so a pool smaller than the
+// working set leaves holes instead of thrashing.
+class ClusterPool : protected QOpenGLFunctions_4_5_Core
+{
+public:
+    // Where the slots live in the tracer's buffers, in elements.
+    struct Layout {
+        quint32 vertexOffset = 0;
+        quint32 triOffset = 0;
+        quint32 nodeOffset = 0;
+        quint32 slotVertices = 0;
+        quint32 slotTriangles = 0;
+        quint32 slotNodes = 0;
+        int slotCount = 0;
+    };
+
+    struct Stats {
+        int clusters = 0;
+        int resident = 0;
+        int slots = 0;
+        qint64 uploadedBytes = 0;
+        int uploads = 0;
+        int evictions = 0;
+    };
+
+    static constexpr int KeepFrames = 16;
+    static constexpr int MaxLoadsInFlight = 8;
+    static constexpr qint64 MaxUploadBytesPerFrame = 64ll << 20;
+
+    ClusterPool();
+    ~ClusterPool();
+
+    // GPU memory for the slots; takes effect at the next reset().
+    void setBudget(qint64 bytes) { m_budget = bytes; }
+    qint64 budget() const { return m_budget; }
+
+    // Slot size and count for these meshes within the budget; the tracer
+    // fills in the offsets once it has placed the slots.
+    Layout plan(const std::vector<ClusteredMesh*> &meshes) const;
+    // Starts over on freshly allocated buffers: nothing is resident. The
+    // cluster table holds the meshes' clusters one mesh after the other.
+    void reset(const std::vector<ClusteredMesh*> &meshes, const Layout &layout,
+               GLuint vertices, GLuint triangles, GLuint nodes);
+    int clusterCount() const { return m_entries.size(); }
+
+    // Before a trace: reads finished demand, uploads finished loads and
+    // starts new ones. True when residency changed and the image must restart.
+    bool update();
+    // After the trace's dispatch: snapshots and clears the demand counters.
+    void afterTrace();
+    void bind(GLuint binding);
+
+    // Reads the demand the GPU has finished, then: loads in flight, clusters
+    // waiting for them, or no demand read yet since residency last changed.
+    // False once a trace of the current residency asked for nothing missing
+    // (or for more than the pool holds), so a caller that finishes the GPU
+    // between traces stops as soon as the working set is in.
+    bool streaming();
+    Stats stats() const;
+    void destroy();
+
+private:
+    struct Entry {
+        const ClusteredMesh *mesh = nullptr;
+        int index = 0;
+        int slot = -1;
+        quint64 lastUsed = 0;
+        bool loading = false;
+        bool failed = false;   // unreadable, never requested again
+    };
+    struct Load {
+        int cluster;
+        QFuture<QByteArray> data;
+    };
+    struct Readback {
+        GLuint buffer = 0;
+        GLsync fence = nullptr;
+        quint64 residency = 0;   // m_residency when the demand was copied
+    };
+
+    static constexpr int ReadbackRing = 3;
+
+    void readFinishedDemand();
+    int availableSlots() const;
+    void readDemand(const Readback &readback);
+    int acquireSlot();
+    void entryWords(int cluster, quint32 *words) const;
+    void writeEntry(int cluster);
+    void upload(int cluster, int slot, const QByteArray &bytes);
+
+    bool m_initialized = false;
+    qint64 m_budget = 256ll << 20;
+    Layout m_layout;
+    GLuint m_vertices = 0;
+    GLuint m_triangles = 0;
+    GLuint m_nodes = 0;
+    GLuint m_table = 0;
+
+    QVector<Entry> m_entries;
+    QVector<int> m_slotOwner;
+    QVector<int> m_requested;
+    QVector<Load> m_loads;
+    Readback m_readbacks[ReadbackRing];
+    int m_nextReadback = 0;
+    quint64 m_frame = 0;
+    quint64 m_residency = 0;
+    bool m_settled = false;
+    bool m_warnedFull = false;
+    Stats m_stats;
+};
@@ -0,0 +1,35 @@
+#include "commandqueue.h"
+
+CommandQueue::CommandQueue()
+{
+    Node *stub = new Node();
+    m_head.store(stub, std::memory_order_relaxed);
+    m_tail = stub;
+}
+
+CommandQueue::~CommandQueue()
+{
+    Command command;
+    while (pop(command)) {}
+    delete m_tail;
+}
+
+void CommandQueue::push(Command command)
+{
+    Node *node = new Node();
+    node->command = std::move(command);
+    Node *previous = m_head.exchange(node, std::memory_order_acq_rel);
+    previous->next.store(node, std::memory_order_release);
+}
+
+bool CommandQueue::pop(Command &command)
+{
+    Node *next = m_tail->next.load(std::memory_order_acquire);
+    if (!next)
+        return false;
+    command = std::move(next->command);
+    next->command = Command();
+    delete m_tail;
+    m_tail = next;
+    return true;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <QtGlobal>
+#include <atomic>
+#include <functional>
+
+// Work for the render thread, posted from any thread without locks: an
+// intrusive multi-producer, single-consumer queue (Vyukov). push() is one
+// atomic exchange plus a store, pop() never waits; a consumer racing a
+// push that has exchanged but not yet linked simply sees the queue empty
+// and picks the command up on its next pass. Commands run in push order
+// per producer. Nodes are allocated per push, which is fine for input
+// events and settings changes.
+class CommandQueue
+{
+public:
+    struct Command {
+        std::function<void()> run;
+        // Steady-clock time of the input event behind it, 0 for other work
+        // (input-to-photon latency).
+        qint64 inputNs = 0;
+    };
+
+    CommandQueue();
+    ~CommandQueue();
+    CommandQueue(const CommandQueue&) = delete;
+    CommandQueue& operator=(const CommandQueue&) = delete;
+
+    // Any thread.
+    void push(Command command);
+    // Consumer thread only; false when empty.
+    bool pop(Command &command);
+
+private:
+    struct Node {
+        std::atomic<Node*> next { nullptr };
+        Command command;
+    };
+
+    // Producers swap themselves in at the head; the consumer owns the tail,
+    // whose node is a stub whose command was already taken.
+    alignas(64) std::atomic<Node*> m_head;
+    alignas(64) Node *m_tail;
+};
@@ -0,0 +1,300 @@
+#include "convergenceharness.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <cmath>
+#include "renderer/camera.h"
+#include "scene/scene.h"
+
+ConvergenceHarness::ConvergenceHarness()
+{
+}
+
+ConvergenceHarness::ConvergenceHarness(const Settings &settings)
+    : m_settings(settings)
+{
+}
+
+double ConvergenceHarness::rmse(const std::vector<float> &a, const std::vector<float> &b)
+{
+    double sum = 0.0;
+    size_t count = 0;
+    for (size_t i = 0; i < a.size(); i += 3) {
+        for (int c = 0; c < 3; ++c) {
+            double d = double(a[i + c]) - double(b[i + c]);
+            sum += d * d;
+        }
+        count += 3;
+    }
+    return count ? std::sqrt(sum / double(count)) : 0.0;
+}
+
+// Interpolates the curve in log-log space; RMSE falls roughly as a power of
+// the sample count, so this is close to linear between measured points.
+double ConvergenceHarness::sppForError(const Curve &curve, double error)
+{
+    if (curve.rmse.isEmpty())
+        return 0.0;
+    if (error >= curve.rmse.first())
+        return curve.spp.first();
+
+    for (int i = 1; i < curve.rmse.size(); ++i) {
+        if (curve.rmse[i] <= error) {
+            double x0 = std::log(double(curve.spp[i - 1])), x1 = std::log(double(curve.spp[i]));
+            double y0 = std::log(curve.rmse[i - 1]), y1 = std::log(curve.rmse[i]);
+            double t = (std::log(error) - y0) / (y1 - y0);
+            return std::exp(x0 + t * (x1 - x0));
+        }
+    }
+
+    // Beyond the last level: extrapolate with the slope of the last segment.
+    int n = curve.rmse.size();
+    if (n < 2)
+        return curve.spp.last();
+    double slope = (std::log(curve.rmse[n - 1]) - std::log(curve.rmse[n - 2]))
+                 / (std::log(double(curve.spp[n - 1])) - std::log(double(curve.spp[n - 2])));
+    if (slope >= 0.0)
+        return curve.spp.last();
+    return curve.spp.last() * std::exp((std::log(error) - std::log(curve.rmse[n - 1])) / slope);
+}
+
+ConvergenceHarness::Results ConvergenceHarness::run()
+{
+    Results results;
+    QVector<Curve> &curves = results.samplers;
+
+    Scene scene;
+    scene.buildCornellBox();
+
+    Camera camera;
+    camera.setPosition(QVector3D(0.0f, 0.0f, 2.9f));
+    camera.setYawPitch(-90.0f, 0.0f);
+    const float fovDeg = 60.0f;
+
+    PathTracer tracer;
+    if (!tracer.initialize(m_settings.width, m_settings.height))
+        return results;
+    tracer.uploadScene(&scene);
+
+    // The reference uses plain random samples with a seed no measured run
+    // uses, so its own error is not correlated with any sampler under test.
+    qDebug() << "Convergence: rendering reference at" << m_settings.referenceSpp << "spp";
+    tracer.setSamplerMode(Sampler::WhiteNoise);
+    tracer.setEstimator(PathTracer::ImportanceMis);
+    tracer.setSeed(ReferenceSeed);
+    tracer.resetAccumulation();
+    for (int i = 0; i < m_settings.referenceSpp; ++i)
+        tracer.traceFrame(camera, fovDeg);
+    const std::vector<float> reference = tracer.readAccumulation();
+    tracer.setSeed(0u);
+
+    int maxSpp = 0;
+    for (int s : m_settings.sppLevels)
+        maxSpp = qMax(maxSpp, s);
+
+    for (int m = 0; m < Sampler::ModeCount; ++m) {
+        Curve curve;
+        curve.mode = Sampler::Mode(m);
+
+        tracer.setSamplerMode(curve.mode);
+        tracer.resetAccumulation();
+
+        for (int s = 1; s <= maxSpp; ++s) {
+            tracer.traceFrame(camera, fovDeg);
+            if (m_settings.sppLevels.contains(s)) {
+                curve.spp.append(s);
+                curve.rmse.append(rmse(tracer.readAccumulation(), reference));
+            }
+        }
+        curves.append(curve);
+    }
+
+    tracer.setSamplerMode(Sampler::SobolOwen);
+    for (int e = 0; e < PathTracer::EstimatorCount; ++e) {
+        EstimatorCurve curve;
+        curve.estimator = PathTracer::Estimator(e);
+        tracer.setEstimator(curve.estimator);
+
+        std::vector<std::vector<float>> firstSeed;
+        for (quint32 seed : { 1u, 2u }) {
+            tracer.setSeed(seed);
+            tracer.resetAccumulation();
+            for (int s = 1; s <= maxSpp; ++s) {
+                tracer.traceFrame(camera, fovDeg);
+                if (!m_settings.sppLevels.contains(s))
+                    continue;
+                std::vector<float> image = tracer.readAccumulation();
+                if (seed == 1u) {
+                    curve.spp.append(s);
+                    curve.rmse.append(rmse(image, reference));
+                    firstSeed.push_back(std::move(image));
+                } else {
+                    double d = rmse(image, firstSeed[curve.variance.size()]);
+                    curve.variance.append(0.5 * d * d);
+                }
+            }
+        }
+        results.estimators.append(curve);
+    }
+
+    // Each frame is waited for, so the timer sees the GPU time of the
+    // trace and, when guided, of the guide's training and rebuilds.
+    QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
+    tracer.setEstimator(PathTracer::ImportanceMis);
+    tracer.setSeed(1u);
+    for (bool guided : { false, true }) {
+        GuidingCurve curve;
+        curve.guided = guided;
+        tracer.setGuiding(guided);
+        tracer.resetAccumulation();
+        f->glFinish();
+
+        qint64 ns = 0;
+        for (int s = 1; s <= maxSpp; ++s) {
+            QElapsedTimer timer;
+            timer.start();
+            tracer.traceFrame(camera, fovDeg);
+            f->glFinish();
+            ns += timer.nsecsElapsed();
+            if (m_settings.sppLevels.contains(s)) {
+                curve.spp.append(s);
+                curve.ms.append(ns / 1.0e6);
+                curve.rmse.append(rmse(tracer.readAccumulation(), reference));
+            }
+        }
+        results.guiding.append(curve);
+    }
+    tracer.setGuiding(false);
+
+    return results;
+}
+
+QString ConvergenceHarness::report(const Results &results) const
+{
+    const QVector<Curve> &curves = results.samplers;
+    QString out;
+    out += QString("Sampler convergence on Cornell box %1x%2, reference %3 spp\n")
+               .arg(m_settings.width).arg(m_settings.height).arg(m_settings.referenceSpp);
+
+    out += QString("%1").arg(QString("spp"), 6);
+    for (const Curve &c : curves)
+        out += QString("%1").arg(QString(Sampler::modeName(c.mode)), 24);
+    out += "\n";
+
+    for (int i = 0; i < m_settings.sppLevels.size(); ++i) {
+        out += QString("%1").arg(m_settings.sppLevels[i], 6);
+        for (const Curve &c : curves)
+            out += QString("%1").arg(i < c.rmse.size() ? c.rmse[i] : 0.0, 24, 'g', 5);
+        out += "\n";
+    }
+
+    // Samples saved: for each white-noise quality level, how many samples
+    // the other samplers need to reach the same RMSE.
+    const Curve *baseline = nullptr;
+    for (const Curve &c : curves)
+        if (c.mode == Sampler::WhiteNoise) baseline = &c;
+    if (!baseline)
+        return out + estimatorReport(results.estimators) + guidingReport(results.guiding);
+
+    out += "Samples needed to match white-noise RMSE:\n";
+    for (int i = 0; i < baseline->spp.size(); ++i) {
+        out += QString("%1").arg(baseline->spp[i], 6);
+        for (const Curve &c : curves) {
+            double spp = sppForError(c, baseline->rmse[i]);
+            double saved = 100.0 * (1.0 - spp / baseline->spp[i]);
+            out += QString("%1").arg(QString("%1 (%2%)").arg(spp, 0, 'f', 1).arg(saved, 0, 'f', 0), 24);
+        }
+        out += "\n";
+    }
+
+    return out + estimatorReport(results.estimators) + guidingReport(results.guiding);
+}
+
+// Variance times spp is the variance of a single sample, flat when the
+// estimator converges as 1/N; the reduction is relative to the uniform
+// baseline at the same sample count.
+QString ConvergenceHarness::estimatorReport(const QVector<EstimatorCurve> &curves) const
+{
+    const EstimatorCurve *baseline = nullptr;
+    for (const EstimatorCurve &c : curves)
+        if (c.estimator == PathTracer::UniformLight) baseline = &c;
+
+    QString out = "Path estimators, Owen-scrambled Sobol (variance from two seeds):\n";
+    out += QString("%1").arg(QString("spp"), 6);
+    for (const EstimatorCurve &c : curves) {
+        out += QString("%1").arg(QString("%1 var*spp").arg(PathTracer::estimatorName(c.estimator)), 36);
+        out += QString("%1").arg(QString("RMSE"), 12);
+        if (baseline && &c != baseline)
+            out += QString("%1").arg(QString("reduction"), 12);
+    }
+    out += "\n";
+
+    for (int i = 0; i < m_settings.sppLevels.size(); ++i) {
+        out += QString("%1").arg(m_settings.sppLevels[i], 6);
+        for (const EstimatorCurve &c : curves) {
+            double variance = i < c.variance.size() ? c.variance[i] : 0.0;
+            out += QString("%1").arg(variance * m_settings.sppLevels[i], 36, 'g', 5);
+            out += QString("%1").arg(i < c.rmse.size() ? c.rmse[i] : 0.0, 12, 'g', 5);
+            if (baseline && &c != baseline) {
+                double base = i < baseline->variance.size() ? baseline->variance[i] : 0.0;
+                out += QString("%1").arg(variance > 0.0 ? QString("%1x").arg(base / variance, 0, 'f', 2)
+                                                        : QString("-"), 12);
+            }
+        }
+        out += "\n";
+    }
+    return out;
+}
+
+// Linear in log-log space, clamped to the measured range.
+double ConvergenceHarness::interpolateLogLog(const QVector<double> &x, const QVector<double> &y, double at)
+{
+    if (x.isEmpty())
+        return 0.0;
+    if (at <= x.first())
+        return y.first();
+    for (int i = 1; i < x.size(); ++i) {
+        if (at <= x[i]) {
+            double t = (std::log(at) - std::log(x[i - 1])) / (std::log(x[i]) - std::log(x[i - 1]));
+            return std::exp(std::log(y[i - 1]) + t * (std::log(y[i]) - std::log(y[i - 1])));
+        }
+    }
+    return y.last();
+}
+
+// For each sample count of the unguided run, the guided run's RMSE after
+// the same time; above 1x guiding wins even after paying for itself.
+QString ConvergenceHarness::guidingReport(const QVector<GuidingCurve> &curves) const
+{
+    const GuidingCurve *plain = nullptr;
+    const GuidingCurve *guided = nullptr;
+    for (const GuidingCurve &c : curves) {
+        if (c.guided) guided = &c;
+        else plain = &c;
+    }
+    if (!plain || !guided || guided->ms.isEmpty())
+        return QString();
+
+    QVector<double> guidedSpp;
+    for (int s : guided->spp)
+        guidedSpp.append(s);
+
+    QString out = "Path guiding at equal time (training included):\n";
+    out += QString("%1%2%3%4%5%6\n").arg(QString("spp"), 6).arg(QString("ms"), 12)
+               .arg(QString("unguided RMSE"), 16).arg(QString("guided RMSE"), 16)
+               .arg(QString("guided spp"), 12).arg(QString("reduction"), 12);
+    for (int i = 0; i < plain->spp.size(); ++i) {
+        const double ms = plain->ms[i];
+        const double error = interpolateLogLog(guided->ms, guided->rmse, ms);
+        out += QString("%1").arg(plain->spp[i], 6);
+        out += QString("%1").arg(ms, 12, 'f', 1);
+        out += QString("%1").arg(plain->rmse[i], 16, 'g', 5);
+        out += QString("%1").arg(error, 16, 'g', 5);
+        out += QString("%1").arg(interpolateLogLog(guided->ms, guidedSpp, ms), 12, 'f', 1);
+        out += QString("%1").arg(error > 0.0 ? QString("%1x").arg(plain->rmse[i] / error, 0, 'f', 2)
+                                             : QString("-"), 12);
+        out += "\n";
+    }
+    return out;
+}
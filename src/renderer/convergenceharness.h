@@ -0,0 +1,72 @@
+#pragma once
+#include <QString>
+#include <QVector>
+#include <vector>
+#include "renderer/pathtracer.h"
+#include "renderer/sampler.h"
+
+// Measures how fast each sampler converges on the Cornell box: renders a
+// high-spp reference with plain random samples, then the RMSE of every
+// sampler against it at a list of sample counts, and reports how many
+// samples each one saves per quality level.
+// Path estimators are compared the same way, plus their variance: two
+// renders with different seeds differ by twice the variance of a pixel, so
+// it is measured without trusting the reference. Path guiding is compared
+// at equal time: GPU time to each sample count, training included.
+// Needs a current OpenGL 4.5 context; renders into its own offscreen tracer.
+class ConvergenceHarness
+{
+public:
+    struct Settings {
+        int width = 256;
+        int height = 256;
+        int referenceSpp = 4096;
+        QVector<int> sppLevels { 1, 2, 4, 8, 16, 32, 64, 128, 256 };
+    };
+
+    struct Curve {
+        Sampler::Mode mode;
+        QVector<int> spp;
+        QVector<double> rmse;
+    };
+
+    struct EstimatorCurve {
+        PathTracer::Estimator estimator;
+        QVector<int> spp;
+        QVector<double> rmse;
+        // Mean per-pixel variance of the estimate at each sample count.
+        QVector<double> variance;
+    };
+
+    struct GuidingCurve {
+        bool guided = false;
+        QVector<int> spp;
+        // Time the trace took to reach each sample count, readbacks excluded.
+        QVector<double> ms;
+        QVector<double> rmse;
+    };
+
+    struct Results {
+        QVector<Curve> samplers;
+        QVector<EstimatorCurve> estimators;
+        QVector<GuidingCurve> guiding;
+    };
+
+    ConvergenceHarness();
+    explicit ConvergenceHarness(const Settings &settings);
+
+    Results run();
+    QString report(const Results &results) const;
+
+private:
+    // Seed of the reference render; the measured runs use 0, 1 and 2.
+    static constexpr quint32 ReferenceSeed = 0x5EEDu;
+
+    static double rmse(const std::vector<float> &a, const std::vector<float> &b);
+    static double sppForError(const Curve &curve, double error);
+    static double interpolateLogLog(const QVector<double> &x, const QVector<double> &y, double at);
+    QString estimatorReport(const QVector<EstimatorCurve> &curves) const;
+    QString guidingReport(const QVector<GuidingCurve> &curves) const;
+
+    Settings m_settings;
+};
@@ -0,0 +1,646 @@
+#include "distributedrenderer.h"
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QProcess>
+#include <climits>
+#include <cstring>
+#include "renderer/camera.h"
+#include "renderer/imageio.h"
+#include "renderer/pathtracer.h"
+#include "renderer/workgrouptuner.h"
+#include "scene/assetcache.h"
+#include "scene/scene.h"
+
+namespace {
+
+// Every message is a type byte and a payload, both QDataStream-framed, so
+// a reader can wait for a whole message with a stream transaction.
+QByteArray frame(quint8 type, const QByteArray &payload)
+{
+    QByteArray bytes;
+    QDataStream out(&bytes, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_6_0);
+    out << type << payload;
+    return bytes;
+}
+
+bool takeMessage(QLocalSocket *socket, quint8 &type, QByteArray &payload)
+{
+    QDataStream in(socket);
+    in.setVersion(QDataStream::Qt_6_0);
+    in.startTransaction();
+    in >> type >> payload;
+    return in.commitTransaction();
+}
+
+template<typename... Args>
+QByteArray pack(const Args&... args)
+{
+    QByteArray bytes;
+    QDataStream out(&bytes, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_6_0);
+    (out << ... << args);
+    return bytes;
+}
+
+template<typename... Args>
+void unpack(const QByteArray &payload, Args&... args)
+{
+    QDataStream in(payload);
+    in.setVersion(QDataStream::Qt_6_0);
+    (in >> ... >> args);
+}
+
+} // namespace
+
+bool DistributedRenderer::isWorker(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i)
+        if (std::strcmp(argv[i], "--render-worker") == 0) return true;
+    return false;
+}
+
+int DistributedRenderer::runWorker(const QStringList &arguments)
+{
+    QCommandLineParser parser;
+    parser.addOption({ "render-worker", "Coordinator socket to render for.", "server" });
+    parser.addOption({ "worker-index", "This worker's index.", "index" });
+    // Applied in main() before the mode is picked.
+    parser.addOption({ "asset-cpu-mb", "CPU memory for cached mesh geometry.", "MiB" });
+    parser.addOption({ "asset-gpu-mb", "GPU memory for cached mesh buffers.", "MiB" });
+    parser.process(arguments);
+    const int index = parser.value("worker-index").toInt();
+
+    QLocalSocket socket;
+    socket.connectToServer(parser.value("render-worker"));
+    if (!socket.waitForConnected(ConnectTimeoutMs)) {
+        qWarning() << "Worker" << index << ": unable to reach the coordinator:" << socket.errorString();
+        return 1;
+    }
+
+    auto send = [&socket](quint8 type, const QByteArray &payload) {
+        socket.write(frame(type, payload));
+        while (socket.bytesToWrite() > 0 && socket.waitForBytesWritten(-1)) {}
+    };
+    auto receive = [&socket](quint8 &type, QByteArray &payload) {
+        while (!takeMessage(&socket, type, payload))
+            if (!socket.waitForReadyRead(-1)) return false;
+        return true;
+    };
+
+    send(Hello, pack(qint32(index)));
+
+    quint8 type = 0;
+    QByteArray payload;
+    if (!receive(type, payload) || type != JobFile) {
+        qWarning() << "Worker" << index << ": no job from the coordinator";
+        return 1;
+    }
+    QByteArray json;
+    bool retune = false;
+    unpack(payload, json, retune);
+
+    BatchRenderer::Job job;
+    if (!BatchRenderer::parseJob(json, "coordinator", job))
+        return 1;
+
+    QOffscreenSurface surface;
+    surface.setFormat(QSurfaceFormat::defaultFormat());
+    surface.create();
+    QOpenGLContext context;
+    context.setFormat(QSurfaceFormat::defaultFormat());
+    if (!context.create() || !context.makeCurrent(&surface)) {
+        qWarning() << "Worker" << index << ": unable to create an offscreen OpenGL context";
+        return 1;
+    }
+    QOpenGLFunctions *f = context.functions();
+
+    int result = 0;
+    {
+        Scene scene;
+        BatchRenderer::buildScene(job, scene);
+
+        PathTracer tracer;
+        if (!tracer.initialize(job.width, job.height))
+            return 1;
+        tracer.setSamplerMode(job.sampler);
+        tracer.setReleaseCpuGeometry(job.releaseCpuGeometry);
+        tracer.setClusterPoolBudget(qint64(job.clusterPoolMb) << 20);
+        tracer.setPersistentGroups(job.persistentGroups);
+        tracer.setDispatch(job.dispatch == BatchRenderer::Job::DispatchTiles
+                           ? PathTracer::TileDispatch : PathTracer::PersistentDispatch);
+        tracer.setHybrid(job.hybrid != BatchRenderer::Job::HybridOff);
+        // Independent samples per worker; 0 is what a single renderer uses.
+        tracer.setSeed(quint32(index) + 1);
+        tracer.uploadScene(&scene);
+
+        // Worker 0 is set up alone and tunes the shape if the device has
+        // none stored; the others then pick up what it saved.
+        const BatchRenderer::View &first = job.views.first();
+        Camera camera;
+        camera.setPosition(first.position);
+        camera.setYawPitch(first.yaw, first.pitch);
+        const PathTracer::Workgroup workgroup = WorkgroupTuner::apply(tracer, camera, first.fovDeg, retune && index == 0);
+        send(Ready, pack(workgroup.name()));
+
+        int pass = -1;
+        const BatchRenderer::View *view = &first;
+        auto setView = [&](qint32 viewIndex) {
+            view = &job.views[qBound(0, int(viewIndex), int(job.views.size()) - 1)];
+            camera.setPosition(view->position);
+            camera.setYawPitch(view->yaw, view->pitch);
+        };
+        QElapsedTimer timer;
+        double busySeconds = 0.0;
+        while (receive(type, payload)) {
+            if (type == Quit)
+                break;
+
+            // Same cluster warmup as BatchRenderer::renderView, before the
+            // coordinator starts timing the view.
+            if (type == Warmup) {
+                qint32 viewIndex = 0;
+                unpack(payload, viewIndex);
+                setView(viewIndex);
+                if (tracer.clusterStats().clusters > 0) {
+                    timer.start();
+                    do {
+                        tracer.traceFrame(camera, view->fovDeg);
+                        f->glFinish();
+                    } while (tracer.streaming() && timer.elapsed() < MaxWarmupMs);
+                }
+                send(WarmedUp, pack(viewIndex, tracer.streaming()));
+                continue;
+            }
+            if (type != Work)
+                continue;
+
+            qint32 workPass = 0, viewIndex = 0, spp = 0;
+            unpack(payload, workPass, viewIndex, spp);
+            if (workPass != pass) {
+                pass = workPass;
+                setView(viewIndex);
+                tracer.resetAccumulation();
+                busySeconds = 0.0;
+            }
+
+            timer.start();
+            for (int i = 0; i < spp; ++i)
+                tracer.traceFrame(camera, view->fovDeg);
+            f->glFinish();
+            busySeconds += timer.nsecsElapsed() / 1e9;
+
+            const std::vector<float> rgb = tracer.readAccumulation();
+            const QByteArray bytes(reinterpret_cast<const char*>(rgb.data()), qsizetype(rgb.size() * sizeof(float)));
+            send(Partial, pack(qint32(pass), qint32(tracer.accumFrame()), busySeconds, bytes));
+            if (socket.state() != QLocalSocket::ConnectedState) {
+                result = 1;
+                break;
+            }
+        }
+    }
+    context.doneCurrent();
+    return result;
+}
+
+DistributedRenderer::DistributedRenderer(const BatchRenderer::Job &job, int workers)
+    : m_job(job)
+    , m_workerCount(qMax(1, workers))
+{
+}
+
+DistributedRenderer::~DistributedRenderer()
+{
+    stopWorkers();
+}
+
+bool DistributedRenderer::run()
+{
+    QDir().mkpath(m_job.outputDir);
+
+    QElapsedTimer total;
+    total.start();
+    if (!startWorkers())
+        return false;
+
+    const double pixels = double(m_job.width) * m_job.height;
+    bool ok = true;
+
+    // Single-worker rate on the first view, not saved.
+    int solo = 0;
+    while (solo < m_workers.size() && (m_workers[solo].dead || !m_workers[solo].ready))
+        ++solo;
+    if (solo < m_workers.size()) {
+        warmUp(0, { solo });
+        const double seconds = renderPass(0, 0, { solo }, CalibrationUnits * m_job.workSpp, 0.0);
+        m_soloRate = seconds > 0.0 ? pixels * m_workers[solo].spp / seconds : 0.0;
+        qInfo().noquote() << QString("Distributed: worker %1 alone %2 Msamples/s")
+                                 .arg(solo).arg(m_soloRate / 1e6, 0, 'f', 2);
+    }
+
+    for (int v = 0; v < m_job.views.size() && ok; ++v) {
+        const BatchRenderer::View &view = m_job.views[v];
+        QVector<int> workers;
+        for (int i = 0; i < m_workers.size(); ++i)
+            if (m_workers[i].ready && !m_workers[i].dead) workers.append(i);
+        if (workers.isEmpty()) {
+            qWarning() << "Distributed: no worker left for" << view.name;
+            ok = false;
+            break;
+        }
+
+        warmUp(v, workers);
+        PassStats s;
+        s.name = view.name;
+        s.seconds = renderPass(v + 1, v, workers, view.targetSpp, view.timeBudget);
+        m_distributedSeconds += s.seconds;
+        for (Worker &w : m_workers) {
+            s.workerSpp.append(w.spp);
+            s.spp += w.spp;
+            w.samples += pixels * w.spp;
+            w.gpuSeconds += w.busySeconds;
+        }
+        m_stats.append(s);
+
+        const std::vector<float> rgb = merge();
+        if (rgb.empty()) {
+            qWarning() << "Distributed: no samples for" << view.name;
+            ok = false;
+            continue;
+        }
+        if (!ImageIO::writeAll(QDir(m_job.outputDir).filePath(view.name), m_job.formats,
+                               m_job.width, m_job.height, rgb.data())) {
+            qWarning() << "Distributed: unable to write the images of" << view.name;
+            ok = false;
+        }
+        qInfo().noquote() << QString("Distributed: %1  %2 spp  %3 s  %4 Msamples/s")
+                                 .arg(s.name).arg(s.spp)
+                                 .arg(s.seconds, 0, 'f', 2)
+                                 .arg(s.seconds > 0.0 ? pixels * s.spp / s.seconds / 1e6 : 0.0, 0, 'f', 2);
+    }
+
+    stopWorkers();
+    return writeStats(total.elapsed() / 1000.0) && ok;
+}
+
+bool DistributedRenderer::startWorkers()
+{
+    m_serverName = QString("raytracinggpu-%1").arg(QCoreApplication::applicationPid());
+    QLocalServer::removeServer(m_serverName);
+    m_server = new QLocalServer();
+    if (!m_server->listen(m_serverName)) {
+        qWarning() << "Distributed: unable to listen on" << m_serverName << m_server->errorString();
+        return false;
+    }
+
+    m_workers.resize(m_workerCount);
+    for (int i = 0; i < m_workers.size(); ++i) {
+        Worker &w = m_workers[i];
+        w.process = new QProcess();
+        w.process->setProgram(QCoreApplication::applicationFilePath());
+        w.process->setArguments({ "--render-worker", m_serverName, "--worker-index", QString::number(i),
+                                  "--asset-cpu-mb", QString::number(AssetCache::instance().cpuBudget() >> 20),
+                                  "--asset-gpu-mb", QString::number(AssetCache::instance().gpuBudget() >> 20) });
+        w.process->setProcessChannelMode(QProcess::ForwardedChannels);
+        w.process->start();
+        if (!w.process->waitForStarted())
+            workerLost(i, "failed to start");
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    while (!allReady()) {
+        if (!pump(10))
+            return false;
+        if (timer.elapsed() > ConnectTimeoutMs) {
+            for (int i = 0; i < m_workers.size(); ++i)
+                if (!m_workers[i].ready) workerLost(i, "did not get ready in time");
+        }
+    }
+
+    int ready = 0;
+    for (const Worker &w : m_workers)
+        ready += w.ready && !w.dead;
+    qInfo() << "Distributed:" << ready << "of" << m_workers.size() << "workers ready";
+    return ready > 0;
+}
+
+void DistributedRenderer::stopWorkers()
+{
+    for (Worker &w : m_workers) {
+        if (w.socket && w.socket->state() == QLocalSocket::ConnectedState) {
+            w.socket->write(frame(Quit, QByteArray()));
+            w.socket->flush();
+        }
+    }
+    for (Worker &w : m_workers) {
+        if (w.process && !w.process->waitForFinished(5000))
+            w.process->kill();
+        delete w.process;
+        w.process = nullptr;
+        w.socket = nullptr;
+    }
+    // Owns the accepted sockets.
+    delete m_server;
+    m_server = nullptr;
+    m_pending.clear();
+}
+
+bool DistributedRenderer::allReady() const
+{
+    for (const Worker &w : m_workers)
+        if (!w.ready && !w.dead) return false;
+    return true;
+}
+
+bool DistributedRenderer::pump(int timeoutMs)
+{
+    QCoreApplication::processEvents(QEventLoop::AllEvents, timeoutMs);
+
+    while (m_server->hasPendingConnections())
+        m_pending.append(m_server->nextPendingConnection());
+    for (int p = m_pending.size() - 1; p >= 0; --p) {
+        quint8 type = 0;
+        QByteArray payload;
+        QLocalSocket *socket = m_pending[p];
+        if (!takeMessage(socket, type, payload))
+            continue;
+        m_pending.removeAt(p);
+        qint32 index = -1;
+        unpack(payload, index);
+        if (type != Hello || index < 0 || index >= m_workers.size() || m_workers[index].socket) {
+            socket->abort();
+            continue;
+        }
+        m_workers[index].socket = socket;
+        // Worker 0 sets up first; see runWorker.
+        if (index == 0 || m_workers[0].ready || m_workers[0].dead)
+            sendJob(index);
+    }
+
+    bool alive = false;
+    for (int i = 0; i < m_workers.size(); ++i) {
+        Worker &w = m_workers[i];
+        if (w.dead)
+            continue;
+        if (w.socket)
+            readMessages(i);
+        if (w.process->state() == QProcess::NotRunning)
+            workerLost(i, "exited");
+        else if (w.socket && w.socket->state() == QLocalSocket::UnconnectedState)
+            workerLost(i, "disconnected");
+        alive |= !w.dead;
+    }
+    if (!alive)
+        qWarning() << "Distributed: every worker died";
+    return alive;
+}
+
+void DistributedRenderer::readMessages(int index)
+{
+    Worker &w = m_workers[index];
+    quint8 type = 0;
+    QByteArray payload;
+    while (takeMessage(w.socket, type, payload)) {
+        if (type == Ready) {
+            QString workgroup;
+            unpack(payload, workgroup);
+            w.ready = true;
+            qInfo().noquote() << QString("Distributed: worker %1 ready, workgroup %2").arg(index).arg(workgroup);
+            if (index == 0) {
+                for (int i = 1; i < m_workers.size(); ++i)
+                    if (m_workers[i].socket) sendJob(i);
+            }
+        } else if (type == WarmedUp) {
+            qint32 view = 0;
+            bool streaming = false;
+            unpack(payload, view, streaming);
+            w.warmView = view;
+            if (streaming)
+                qWarning() << "Distributed: worker" << index << "still streaming clusters for"
+                           << m_job.views[view].name << "after" << MaxWarmupMs / 1000 << "s";
+        } else if (type == Partial) {
+            qint32 pass = 0, spp = 0;
+            double seconds = 0.0;
+            QByteArray rgb;
+            unpack(payload, pass, spp, seconds, rgb);
+            if (pass != m_pass || rgb.size() != qsizetype(m_job.width) * m_job.height * 3 * qsizetype(sizeof(float)))
+                continue;
+            w.outstanding = qMax(0, w.outstanding - (spp - w.spp));
+            w.spp = spp;
+            w.busySeconds = seconds;
+            w.rgb.resize(size_t(rgb.size()) / sizeof(float));
+            std::memcpy(w.rgb.data(), rgb.constData(), size_t(rgb.size()));
+        }
+    }
+}
+
+void DistributedRenderer::workerLost(int index, const char *reason)
+{
+    Worker &w = m_workers[index];
+    if (w.dead)
+        return;
+    // Its last partial still counts; the rest of its units are handed out again.
+    w.dead = true;
+    w.outstanding = 0;
+    qWarning() << "Distributed: worker" << index << reason;
+    if (index == 0 && !w.ready) {
+        for (int i = 1; i < m_workers.size(); ++i)
+            if (m_workers[i].socket) sendJob(i);
+    }
+}
+
+void DistributedRenderer::sendJob(int index)
+{
+    Worker &w = m_workers[index];
+    if (w.jobSent || w.dead)
+        return;
+    w.socket->write(frame(JobFile, pack(m_job.json, m_job.retuneWorkgroup)));
+    w.jobSent = true;
+}
+
+void DistributedRenderer::warmUp(int view, const QVector<int> &workers)
+{
+    QVector<int> waiting;
+    for (int i : workers) {
+        Worker &w = m_workers[i];
+        if (w.dead || w.warmView == view)
+            continue;
+        w.socket->write(frame(Warmup, pack(qint32(view))));
+        waiting.append(i);
+    }
+
+    // A worker that never answers is dropped like one that did not get ready.
+    QElapsedTimer timer;
+    timer.start();
+    for (;;) {
+        bool done = true;
+        for (int i : waiting)
+            done &= m_workers[i].dead || m_workers[i].warmView == view;
+        if (done || !pump(10))
+            return;
+        if (timer.elapsed() > MaxWarmupMs + ConnectTimeoutMs) {
+            for (int i : waiting)
+                if (m_workers[i].warmView != view) workerLost(i, "did not finish its warmup in time");
+        }
+    }
+}
+
+void DistributedRenderer::sendWork(int index, int pass, int view, int spp)
+{
+    Worker &w = m_workers[index];
+    w.socket->write(frame(Work, pack(qint32(pass), qint32(view), qint32(spp))));
+    w.outstanding += spp;
+}
+
+double DistributedRenderer::renderPass(int pass, int view, const QVector<int> &workers, int targetSpp, double timeBudget)
+{
+    m_pass = pass;
+    for (Worker &w : m_workers) {
+        w.spp = 0;
+        w.outstanding = 0;
+        w.busySeconds = 0.0;
+        w.rgb.clear();
+    }
+
+    const int target = targetSpp > 0 ? targetSpp : (timeBudget > 0.0 ? INT_MAX : 1);
+    QElapsedTimer timer;
+    timer.start();
+    bool outOfTime = false;
+
+    while (true) {
+        // Samples done or on their way; a dead worker's unfinished units
+        // drop out and are handed to the others.
+        qint64 issued = 0;
+        int outstanding = 0;
+        for (int i : workers) {
+            issued += m_workers[i].spp + m_workers[i].outstanding;
+            outstanding += m_workers[i].outstanding;
+        }
+
+        // Two units per worker: one tracing, one queued behind it so the
+        // worker never waits on the coordinator.
+        for (int i : workers) {
+            Worker &w = m_workers[i];
+            while (!w.dead && !outOfTime && issued < target && w.outstanding < 2 * m_job.workSpp) {
+                const int unit = int(qMin<qint64>(m_job.workSpp, target - issued));
+                sendWork(i, pass, view, unit);
+                issued += unit;
+                outstanding += unit;
+            }
+        }
+
+        if (outstanding == 0 && (issued >= target || outOfTime))
+            break;
+        if (!pump(10))
+            break;
+        if (timeBudget > 0.0 && timer.elapsed() / 1000.0 >= timeBudget)
+            outOfTime = true;
+    }
+    return timer.nsecsElapsed() / 1e9;
+}
+
+// Each worker's mean weighted by how many samples it holds: the mean over
+// every sample of the view.
+std::vector<float> DistributedRenderer::merge() const
+{
+    double total = 0.0;
+    for (const Worker &w : m_workers)
+        if (!w.rgb.empty()) total += w.spp;
+    if (total <= 0.0)
+        return {};
+
+    std::vector<double> sum(size_t(m_job.width) * m_job.height * 3, 0.0);
+    for (const Worker &w : m_workers) {
+        if (w.rgb.empty() || w.spp == 0)
+            continue;
+        for (size_t i = 0; i < sum.size(); ++i)
+            sum[i] += double(w.spp) * w.rgb[i];
+    }
+
+    std::vector<float> rgb(sum.size());
+    for (size_t i = 0; i < sum.size(); ++i)
+        rgb[i] = float(sum[i] / total);
+    return rgb;
+}
+
+bool DistributedRenderer::writeStats(double totalSeconds) const
+{
+    const double pixels = double(m_job.width) * m_job.height;
+
+    QJsonArray views;
+    double samples = 0.0;
+    for (const PassStats &s : m_stats) {
+        QJsonObject o;
+        o["name"] = s.name;
+        o["spp"] = s.spp;
+        o["seconds"] = s.seconds;
+        o["samplesPerSecond"] = s.seconds > 0.0 ? pixels * s.spp / s.seconds : 0.0;
+        QJsonArray perWorker;
+        for (int spp : s.workerSpp)
+            perWorker.append(spp);
+        o["workerSpp"] = perWorker;
+        views.append(o);
+        samples += pixels * s.spp;
+    }
+
+    // Speedup over worker 0 alone; efficiency is speedup per worker.
+    const double rate = m_distributedSeconds > 0.0 ? samples / m_distributedSeconds : 0.0;
+    const double speedup = m_soloRate > 0.0 ? rate / m_soloRate : 0.0;
+    QJsonArray workers;
+    for (int i = 0; i < m_workers.size(); ++i) {
+        const Worker &w = m_workers[i];
+        const double workerRate = m_distributedSeconds > 0.0 ? w.samples / m_distributedSeconds : 0.0;
+        QJsonObject o;
+        o["index"] = i;
+        o["samples"] = w.samples;
+        o["samplesPerSecond"] = workerRate;
+        o["efficiency"] = m_soloRate > 0.0 ? workerRate / m_soloRate : 0.0;
+        o["gpuBusy"] = m_distributedSeconds > 0.0 ? w.gpuSeconds / m_distributedSeconds : 0.0;
+        o["died"] = w.dead;
+        workers.append(o);
+        qInfo().noquote() << QString("Distributed: worker %1  %2 Msamples/s  %3% of solo%4")
+                                 .arg(i).arg(workerRate / 1e6, 0, 'f', 2)
+                                 .arg(o["efficiency"].toDouble() * 100.0, 0, 'f', 1)
+                                 .arg(w.dead ? "  (died)" : "");
+    }
+    qInfo().noquote() << QString("Distributed: %1 workers  speedup %2x  efficiency %3%")
+                             .arg(m_workers.size()).arg(speedup, 0, 'f', 2)
+                             .arg(m_workers.isEmpty() ? 0.0 : speedup / m_workers.size() * 100.0, 0, 'f', 1);
+
+    QJsonObject scaling;
+    scaling["workers"] = int(m_workers.size());
+    scaling["workSpp"] = m_job.workSpp;
+    scaling["soloSamplesPerSecond"] = m_soloRate;
+    scaling["samplesPerSecond"] = rate;
+    scaling["speedup"] = speedup;
+    scaling["efficiency"] = m_workers.isEmpty() ? 0.0 : speedup / m_workers.size();
+    scaling["perWorker"] = workers;
+
+    QJsonObject root;
+    root["width"] = m_job.width;
+    root["height"] = m_job.height;
+    root["views"] = views;
+    root["totalSeconds"] = totalSeconds;
+    root["distributed"] = scaling;
+
+    QFile file(QDir(m_job.outputDir).filePath("stats.json"));
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Unable to write batch stats:" << file.fileName();
+        return false;
+    }
+    file.write(QJsonDocument(root).toJson());
+    return true;
+}
@@ -0,0 +1,114 @@
+#pragma once
+#include <QElapsedTimer>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <vector>
+#include "renderer/batchrenderer.h"
+
+class QLocalServer;
+class QLocalSocket;
+class QProcess;
+
+// Batch jobs split across local worker processes. The coordinator (batch
+// mode with --workers N) starts N copies of the executable with
+// --render-worker, which connect back over a local socket, build the
+// job's scene on their own offscreen context and trace whatever they are
+// handed. Work is split by samples rather than by screen tiles: every
+// worker renders the whole view with its own sampler seed, in units of
+// "workSpp" samples handed out as workers finish their last one, until
+// the view's sample target or time budget is reached. A slow or busy
+// worker then simply ends up with fewer samples, and no tile borders have
+// to be stitched.
+//
+// After each unit a worker streams back its running mean for the view and
+// how many samples it holds; the coordinator keeps the latest one per
+// worker and merges them weighted by sample count, so the result is the
+// mean over every sample traced. A worker that dies keeps what it had
+// sent and its unfinished units go to the others.
+//
+// Before a view is timed, its workers page in the clusters it needs
+// (Warmup), like BatchRenderer's untimed warmup; each worker does so once
+// per view.
+//
+// Scaling: before the views, worker 0 renders the first one alone for
+// CalibrationUnits units, which gives the single-worker rate. stats.json
+// then reports each worker's share of that rate and the overall speedup
+// and efficiency (speedup over worker count). Workers on one machine
+// share its GPU; the efficiency says how much the extra processes bought.
+class DistributedRenderer
+{
+public:
+    static bool isWorker(int argc, char *argv[]);
+    // Worker process entry: --render-worker <server> --worker-index <i>.
+    static int runWorker(const QStringList &arguments);
+
+    DistributedRenderer(const BatchRenderer::Job &job, int workers);
+    ~DistributedRenderer();
+
+    // Runs the whole job; false on setup errors or when every worker died.
+    bool run();
+
+private:
+    enum Message : quint8 { Hello = 1, JobFile, Ready, Work, Partial, Quit, Warmup, WarmedUp };
+
+    struct Worker {
+        QProcess *process = nullptr;
+        QLocalSocket *socket = nullptr;
+        bool jobSent = false;
+        bool ready = false;
+        bool dead = false;
+        // View whose clusters the worker has paged in, -1 for none.
+        int warmView = -1;
+        // Samples handed out and not yet reported, in the current pass.
+        int outstanding = 0;
+        // Latest partial of the current pass.
+        int spp = 0;
+        double busySeconds = 0.0;
+        std::vector<float> rgb;
+        // Totals over the distributed passes.
+        double samples = 0.0;
+        double gpuSeconds = 0.0;
+    };
+
+    struct PassStats {
+        QString name;
+        int spp = 0;
+        double seconds = 0.0;
+        QVector<int> workerSpp;
+    };
+
+    bool startWorkers();
+    void stopWorkers();
+    // Delivers pending messages; false when no worker is left.
+    bool pump(int timeoutMs);
+    void readMessages(int index);
+    void workerLost(int index, const char *reason);
+    bool allReady() const;
+
+    // Has the given workers page in view's clusters; not timed.
+    void warmUp(int view, const QVector<int> &workers);
+    // Renders view on the given workers as pass number pass; returns the
+    // wall-clock seconds from the first unit to the last partial.
+    double renderPass(int pass, int view, const QVector<int> &workers, int targetSpp, double timeBudget);
+    void sendJob(int index);
+    void sendWork(int index, int pass, int view, int spp);
+    std::vector<float> merge() const;
+    bool writeStats(double totalSeconds) const;
+
+    static constexpr int CalibrationUnits = 4;
+    static constexpr int ConnectTimeoutMs = 120000;
+    static constexpr int MaxWarmupMs = 120000;
+
+    BatchRenderer::Job m_job;
+    int m_workerCount = 1;
+    QString m_serverName;
+    QLocalServer *m_server = nullptr;
+    QVector<QLocalSocket*> m_pending;
+    QVector<Worker> m_workers;
+    int m_pass = -1;
+
+    double m_soloRate = 0.0;
+    double m_distributedSeconds = 0.0;
+    QVector<PassStats> m_stats;
+};
@@ -0,0 +1,135 @@
+#include "gbuffer.h"
+#include <QDebug>
+#include "renderer/memorytracker.h"
+#include "renderer/sphereinstances.h"
+#include "scene/mesh.h"
+
+bool GBuffer::initialize()
+{
+    initializeOpenGLFunctions();
+
+    m_meshProgram = new QOpenGLShaderProgram();
+    if (!m_meshProgram->addShaderFromSourceFile(QOpenGLShader::Vertex, "src/shaders/gbuffer.vert"))
+        qWarning() << "G-buffer vertex compile error:" << m_meshProgram->log();
+    if (!m_meshProgram->addShaderFromSourceFile(QOpenGLShader::Fragment, "src/shaders/gbuffer.frag"))
+        qWarning() << "G-buffer frag compile error:" << m_meshProgram->log();
+    if (!m_meshProgram->link()) {
+        qWarning() << "G-buffer program link error:" << m_meshProgram->log();
+        return false;
+    }
+
+    m_sphereProgram = new QOpenGLShaderProgram();
+    if (!m_sphereProgram->addShaderFromSourceFile(QOpenGLShader::Vertex, "src/shaders/gbuffer_sphere.vert"))
+        qWarning() << "G-buffer sphere vertex compile error:" << m_sphereProgram->log();
+    if (!m_sphereProgram->addShaderFromSourceFile(QOpenGLShader::Fragment, "src/shaders/gbuffer_sphere.frag"))
+        qWarning() << "G-buffer sphere frag compile error:" << m_sphereProgram->log();
+    if (!m_sphereProgram->link()) {
+        qWarning() << "G-buffer sphere program link error:" << m_sphereProgram->log();
+        return false;
+    }
+
+    glCreateFramebuffers(1, &m_fbo);
+    return true;
+}
+
+void GBuffer::resize(int width, int height)
+{
+    width = qMax(1, width);
+    height = qMax(1, height);
+    if (width == m_width && height == m_height)
+        return;
+    m_width = width;
+    m_height = height;
+
+    GLuint textures[] = { m_position, m_surface, m_depth };
+    for (GLuint texture : textures)
+        if (texture) glDeleteTextures(1, &texture);
+
+    glCreateTextures(GL_TEXTURE_2D, 1, &m_position);
+    glTextureStorage2D(m_position, 1, GL_RGBA32F, width, height);
+    glCreateTextures(GL_TEXTURE_2D, 1, &m_surface);
+    glTextureStorage2D(m_surface, 1, GL_RGBA32UI, width, height);
+    glCreateTextures(GL_TEXTURE_2D, 1, &m_depth);
+    glTextureStorage2D(m_depth, 1, GL_DEPTH_COMPONENT32F, width, height);
+
+    glNamedFramebufferTexture(m_fbo, GL_COLOR_ATTACHMENT0, m_position, 0);
+    glNamedFramebufferTexture(m_fbo, GL_COLOR_ATTACHMENT1, m_surface, 0);
+    glNamedFramebufferTexture(m_fbo, GL_DEPTH_ATTACHMENT, m_depth, 0);
+    const GLenum buffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glNamedFramebufferDrawBuffers(m_fbo, 2, buffers);
+    if (glCheckNamedFramebufferStatus(m_fbo, GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        qWarning() << "G-buffer framebuffer incomplete at" << width << "x" << height;
+
+    MemoryTracker::instance().track(this, "gbuffer", "tracer", MemoryTracker::GpuTexture,
+                                    qint64(width) * height * (16 + 16 + 4));
+}
+
+// Leaves the caller's framebuffer, viewport and depth state as it found them.
+void GBuffer::render(const QVector<Draw> &draws, SphereInstances &spheres,
+                     const QMatrix4x4 &viewProj, const QVector3D &cameraPosition)
+{
+    if (!m_meshProgram || !m_sphereProgram || !m_width)
+        return;
+
+    GLint previousFbo = 0;
+    GLint viewport[4];
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFbo);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    const bool depthTest = glIsEnabled(GL_DEPTH_TEST);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_fbo);
+    glViewport(0, 0, m_width, m_height);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+
+    // Uncovered pixels read w = 0: the camera ray misses every surface.
+    static const float noPosition[4] = {};
+    static const GLuint noSurface[4] = {};
+    const float farDepth = 1.0f;
+    glClearNamedFramebufferfv(m_fbo, GL_COLOR, 0, noPosition);
+    glClearNamedFramebufferuiv(m_fbo, GL_COLOR, 1, noSurface);
+    glClearNamedFramebufferfv(m_fbo, GL_DEPTH, 0, &farDepth);
+
+    m_meshProgram->bind();
+    m_meshProgram->setUniformValue("viewProj", viewProj);
+    m_meshProgram->setUniformValue("cameraPosition", cameraPosition);
+    for (const Draw &draw : draws) {
+        m_meshProgram->setUniformValue("model", draw.mesh->modelMatrix);
+        m_meshProgram->setUniformValue("normalMatrix", draw.mesh->modelMatrix.normalMatrix());
+        m_meshProgram->setUniformValue("posMin", draw.mesh->bounds().min);
+        m_meshProgram->setUniformValue("posExtent", draw.mesh->bounds().extent);
+        m_meshProgram->setUniformValue("materialRef", GLuint(draw.materialRef));
+        draw.mesh->render();
+    }
+    m_meshProgram->release();
+
+    if (spheres.count() > 0) {
+        m_sphereProgram->bind();
+        m_sphereProgram->setUniformValue("viewProj", viewProj);
+        m_sphereProgram->setUniformValue("cameraPosition", cameraPosition);
+        spheres.draw(m_sphereProgram);
+        m_sphereProgram->release();
+    }
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, GLuint(previousFbo));
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    if (!depthTest)
+        glDisable(GL_DEPTH_TEST);
+}
+
+void GBuffer::destroy()
+{
+    delete m_meshProgram;
+    m_meshProgram = nullptr;
+    delete m_sphereProgram;
+    m_sphereProgram = nullptr;
+
+    GLuint textures[] = { m_position, m_surface, m_depth };
+    for (GLuint texture : textures)
+        if (texture) glDeleteTextures(1, &texture);
+    m_position = m_surface = m_depth = 0;
+    if (m_fbo) glDeleteFramebuffers(1, &m_fbo);
+    m_fbo = 0;
+    m_width = m_height = 0;
+    MemoryTracker::instance().release(this);
+}
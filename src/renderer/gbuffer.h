@@ -0,0 +1,54 @@
+#pragma once
+#include <QMatrix4x4>
+#include <QOpenGLFunctions_4_5_Core>
+#include <QOpenGLShaderProgram>
+#include <QVector>
+
+class Mesh;
+class SphereInstances;
+
+// Rasterized primary visibility for the path tracer's hybrid mode: one
+// pass over the mesh VAOs and the instanced spheres writes, per pixel, the
+// world-space first hit and its distance (RGBA32F) and the octahedral
+// normal, material reference and vertex color (RGBA32UI, w = 1 when
+// covered). raytrace.comp starts its paths there instead of tracing the
+// camera rays. Spheres are drawn slightly enlarged and refined to the exact
+// surface per fragment, so their hits match the traced ones.
+//
+// Material references match the tracer's tables: kind in the top two bits
+// (Kind), index in squares[], meshes[] or materials[] below.
+// Needs a current OpenGL 4.5 context; call destroy() before it goes away.
+class GBuffer : protected QOpenGLFunctions_4_5_Core
+{
+public:
+    enum Kind : quint32 { SphereKind = 0, SquareKind = 1, MeshKind = 2 };
+    static quint32 materialRef(Kind kind, int index) { return (quint32(kind) << 30) | quint32(index); }
+
+    struct Draw {
+        Mesh *mesh;
+        quint32 materialRef;
+    };
+
+    bool initialize();
+    void resize(int width, int height);
+
+    // viewProj already carries the frame's subpixel jitter.
+    void render(const QVector<Draw> &draws, SphereInstances &spheres,
+                const QMatrix4x4 &viewProj, const QVector3D &cameraPosition);
+
+    GLuint position() const { return m_position; }
+    GLuint surface() const { return m_surface; }
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    void destroy();
+
+private:
+    QOpenGLShaderProgram *m_meshProgram = nullptr;
+    QOpenGLShaderProgram *m_sphereProgram = nullptr;
+    GLuint m_fbo = 0;
+    GLuint m_position = 0;
+    GLuint m_surface = 0;
+    GLuint m_depth = 0;
+    int m_width = 0;
+    int m_height = 0;
+};
@@ -1,10 +1,17 @@
 #pragma once
 
+// Per-instance sphere data, shared by the instanced rasterizer (sphere.vert)
+// and the tracer; the material lives in the GpuMaterial table.
 struct GpuSphere {
     float cx, cy, cz, radius;
+    unsigned int materialId, pad0, pad1, pad2;
+};
+
+
+struct GpuMaterial {
     float diffuseR, diffuseG, diffuseB, kd;
     float specularR, specularG, specularB, ks;
-    float shininess; float pad1, pad2, pad3;
+    float shininess, pad1, pad2, pad3;
 };
 
 
@@ -21,5 +28,23 @@ struct GpuSquare {
 
 struct GpuLight {
     float px, py, pz, intensity;
-    float r, g, b, pad0;
+    float r, g, b, radius;
+};
+
+
+// Triangle mesh instance. The geometry lives in shared SSBOs: quantized
+// vertices, triangles in BVH leaf order and the object-space BVH nodes;
+// the offsets locate this mesh in each of them. Out-of-core meshes
+// (GpuMeshClustered) point nodeOffset at the top-level BVH over their
+// clusters and triOffset at their first entry in the cluster table.
+enum : unsigned int { GpuMeshClustered = 1u };
+
+struct GpuMesh {
+    float objectToWorld[16];
+    float worldToObject[16];
+    float posMinX, posMinY, posMinZ;          unsigned int nodeOffset;
+    float posExtentX, posExtentY, posExtentZ; unsigned int triOffset;
+    float diffuseR, diffuseG, diffuseB, kd;
+    float specularR, specularG, specularB, ks;
+    float shininess; unsigned int vertexOffset, colorOffset, flags;
 };
@@ -0,0 +1,78 @@
+#include "gputimer.h"
+
+void GpuTimer::initialize()
+{
+    initializeOpenGLFunctions();
+    glGenQueries(RingSize, m_queries);
+}
+
+void GpuTimer::destroy()
+{
+    if (m_queries[0])
+        glDeleteQueries(RingSize, m_queries);
+    for (int i = 0; i < RingSize; ++i) {
+        m_queries[i] = 0;
+        m_pending[i] = false;
+    }
+}
+
+bool GpuTimer::begin(int tag)
+{
+    if (m_pending[m_next] || m_active >= 0)
+        return false;
+
+    m_active = m_next;
+    m_tags[m_active] = tag;
+    glBeginQuery(GL_TIME_ELAPSED, m_queries[m_active]);
+    return true;
+}
+
+void GpuTimer::end()
+{
+    if (m_active < 0)
+        return;
+
+    glEndQuery(GL_TIME_ELAPSED);
+    m_pending[m_active] = true;
+    m_next = (m_active + 1) % RingSize;
+    m_active = -1;
+}
+
+QVector<QPair<int, double>> GpuTimer::collect()
+{
+    QVector<QPair<int, double>> done;
+
+    // Queries complete in submission order, so walk from the oldest.
+    for (int i = 0; i < RingSize; ++i) {
+        int slot = (m_next + i) % RingSize;
+        if (!m_pending[slot])
+            continue;
+
+        GLint available = 0;
+        glGetQueryObjectiv(m_queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(m_queries[slot], GL_QUERY_RESULT, &ns);
+        m_pending[slot] = false;
+        done.append({ m_tags[slot], double(ns) / 1.0e6 });
+    }
+    return done;
+}
+
+QVector<QPair<int, double>> GpuTimer::collectBlocking()
+{
+    QVector<QPair<int, double>> done;
+    for (int i = 0; i < RingSize; ++i) {
+        int slot = (m_next + i) % RingSize;
+        if (!m_pending[slot])
+            continue;
+
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(m_queries[slot], GL_QUERY_RESULT, &ns);
+        m_pending[slot] = false;
+        done.append({ m_tags[slot], double(ns) / 1.0e6 });
+    }
+    return done;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <QOpenGLFunctions_4_5_Core>
+#include <QPair>
+#include <QVector>
+
+// GL_TIME_ELAPSED queries on a small ring so GPU frame times can be read a
+// few frames later without ever waiting for the result.
+// Every method needs a current OpenGL 4.5 context.
+class GpuTimer : protected QOpenGLFunctions_4_5_Core
+{
+public:
+    static constexpr int RingSize = 4;
+
+    void initialize();
+    void destroy();
+
+    // Brackets the GPU work tagged with tag (e.g. a frame index). Returns
+    // false when every query is still pending; the interval is then skipped.
+    bool begin(int tag);
+    void end();
+
+    // Finished (tag, milliseconds) pairs, oldest first.
+    QVector<QPair<int, double>> collect();
+
+    // Waits for every pending query; for tools that time outside the loop.
+    QVector<QPair<int, double>> collectBlocking();
+
+private:
+    GLuint m_queries[RingSize] = {};
+    int m_tags[RingSize] = {};
+    bool m_pending[RingSize] = {};
+    int m_next = 0;
+    int m_active = -1;
+};
@@ -0,0 +1,166 @@
+#include "imageexporter.h"
+#include <QDebug>
+#include <QDir>
+#include <QThread>
+#include "renderer/imageio.h"
+#include "renderer/memorytracker.h"
+
+ImageExporter::ImageExporter(QObject *parent)
+    : QObject(parent)
+{
+    m_workers.setMaxThreadCount(qMax(1, QThread::idealThreadCount() - 1));
+}
+
+ImageExporter::~ImageExporter()
+{
+    m_workers.waitForDone();
+}
+
+void ImageExporter::initialize()
+{
+    initializeOpenGLFunctions();
+}
+
+void ImageExporter::destroy()
+{
+    m_workers.waitForDone();
+
+    for (Slot &slot : m_ring) {
+        if (slot.fence) glDeleteSync(slot.fence);
+        if (slot.pbo) {
+            glUnmapNamedBuffer(slot.pbo);
+            glDeleteBuffers(1, &slot.pbo);
+        }
+        slot.pbo = 0;
+        slot.size = 0;
+        slot.mapped = nullptr;
+        slot.fence = nullptr;
+        slot.state = Free;
+    }
+    MemoryTracker::instance().release(this);
+}
+
+bool ImageExporter::busy() const
+{
+    for (const Slot &slot : m_ring)
+        if (slot.state != Free) return true;
+    return false;
+}
+
+bool ImageExporter::capture(GLuint buffer, int width, int height, int spp,
+                            const QString &basePath, int formats)
+{
+    int index = -1;
+    for (int i = 0; i < RingSize && index < 0; ++i)
+        if (m_ring[(m_next + i) % RingSize].state == Free)
+            index = (m_next + i) % RingSize;
+    if (index < 0)
+        return false;
+    Slot &slot = m_ring[index];
+
+    const GLsizeiptr bytes = GLsizeiptr(width) * height * 3 * GLsizeiptr(sizeof(float));
+    if (slot.size != bytes) {
+        // Immutable storage: a new size needs a new buffer.
+        if (slot.pbo) {
+            glUnmapNamedBuffer(slot.pbo);
+            glDeleteBuffers(1, &slot.pbo);
+        }
+        const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glCreateBuffers(1, &slot.pbo);
+        glNamedBufferStorage(slot.pbo, bytes, nullptr, flags);
+        slot.mapped = static_cast<const float*>(glMapNamedBufferRange(slot.pbo, 0, bytes, flags));
+        slot.size = bytes;
+
+        MemoryTracker::instance().track(this, QByteArray("pbo" + QByteArray::number(index)).constData(),
+                                        "exporter", MemoryTracker::GpuBuffer, bytes);
+    }
+
+    // The tracer writes the buffer from its compute shader.
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glCopyNamedBufferSubData(buffer, slot.pbo, 0, 0, bytes);
+
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+
+    slot.width = width;
+    slot.height = height;
+    slot.spp = spp;
+    slot.formats = formats;
+    slot.basePath = basePath;
+    slot.state = InFlight;
+
+    m_next = (index + 1) % RingSize;
+    return true;
+}
+
+void ImageExporter::setCheckpoints(int everySpp, const QString &directory, int formats)
+{
+    m_checkpointEvery = qMax(0, everySpp);
+    m_checkpointDir = directory;
+    m_checkpointFormats = formats;
+    m_lastCheckpointSpp = 0;
+    m_checkpointPending = false;
+
+    if (m_checkpointEvery > 0)
+        QDir().mkpath(m_checkpointDir);
+}
+
+void ImageExporter::onFrameTraced(GLuint buffer, int width, int height, int spp)
+{
+    if (m_checkpointEvery <= 0)
+        return;
+
+    // The accumulation restarted (camera moved, scene changed).
+    if (spp < m_lastCheckpointSpp) {
+        m_lastCheckpointSpp = 0;
+        m_checkpointPending = false;
+    }
+
+    if (spp % m_checkpointEvery == 0 && spp != m_lastCheckpointSpp)
+        m_checkpointPending = true;
+
+    // A full ring defers the checkpoint to the next frame rather than
+    // waiting; the file name records the spp actually captured.
+    if (m_checkpointPending) {
+        QString base = QDir(m_checkpointDir).filePath(QString("checkpoint_%1spp").arg(spp, 7, 10, QChar('0')));
+        if (capture(buffer, width, height, spp, base, m_checkpointFormats)) {
+            m_checkpointPending = false;
+            m_lastCheckpointSpp = spp;
+        }
+    }
+}
+
+void ImageExporter::poll()
+{
+    for (Slot &slot : m_ring) {
+        if (slot.state != InFlight)
+            continue;
+
+        GLenum status = glClientWaitSync(slot.fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            continue;
+
+        glDeleteSync(slot.fence);
+        slot.fence = nullptr;
+
+        if (!slot.mapped) {
+            qWarning() << "Image export: readback buffer could not be mapped";
+            slot.state = Free;
+            emit imageSaveFailed(slot.basePath, slot.spp);
+            continue;
+        }
+
+        slot.state = Encoding;
+        Slot *s = &slot;
+        m_workers.start([this, s]() {
+            const bool written = ImageIO::writeAll(s->basePath, s->formats, s->width, s->height, s->mapped);
+            // Reported before the slot is freed, so once busy() is false
+            // every direct connection has seen its result.
+            if (written)
+                emit imageSaved(s->basePath, s->spp);
+            else
+                emit imageSaveFailed(s->basePath, s->spp);
+            s->state = Free;
+        });
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <QObject>
+#include <QOpenGLFunctions_4_5_Core>
+#include <QString>
+#include <QThreadPool>
+#include <array>
+#include <atomic>
+
+// Stall-free export of the accumulation. A capture copies the tracer's
+// packed RGB buffer into one of a ring of persistently mapped buffers on
+// the GPU and drops a fence; poll() only looks at fences that have already signalled and hands
+// the mapped pixels straight to a worker thread for tone mapping and
+// encoding. Nothing here waits on the GPU or copies on the render thread, so
+// progressive sampling keeps its rate while images are saved.
+// capture(), onFrameTraced() and poll() need the render context current.
+class ImageExporter : public QObject, protected QOpenGLFunctions_4_5_Core
+{
+    Q_OBJECT
+public:
+    static constexpr int RingSize = 3;
+
+    explicit ImageExporter(QObject *parent = nullptr);
+    ~ImageExporter();
+
+    void initialize();
+
+    // Queues a readback of the accumulation buffer (PathTracer::accumBuffer)
+    // into the next free ring slot; false if every slot is busy.
+    bool capture(GLuint buffer, int width, int height, int spp,
+                 const QString &basePath, int formats);
+
+    // Saves basePath_<spp>spp.* every everySpp samples; 0 disables.
+    void setCheckpoints(int everySpp, const QString &directory, int formats);
+    int checkpointInterval() const { return m_checkpointEvery; }
+
+    // Call once per traced frame, after the accumulation was written.
+    void onFrameTraced(GLuint buffer, int width, int height, int spp);
+
+    // Non-blocking: retires finished readbacks and starts their encoding.
+    void poll();
+
+    bool busy() const;
+
+    // Releases the ring; the render context must be current.
+    void destroy();
+
+signals:
+    void imageSaved(const QString &basePath, int spp);
+    // At least one of the requested files could not be written.
+    void imageSaveFailed(const QString &basePath, int spp);
+
+private:
+    enum SlotState { Free, InFlight, Encoding };
+
+    struct Slot {
+        GLuint pbo = 0;
+        GLsizeiptr size = 0;
+        const float *mapped = nullptr;
+        GLsync fence = nullptr;
+        std::atomic<int> state { Free };
+        int width = 0;
+        int height = 0;
+        int spp = 0;
+        int formats = 0;
+        QString basePath;
+    };
+
+    std::array<Slot, RingSize> m_ring;
+    int m_next = 0;
+    QThreadPool m_workers;
+
+    int m_checkpointEvery = 0;
+    int m_checkpointFormats = 0;
+    QString m_checkpointDir;
+    int m_lastCheckpointSpp = 0;
+    bool m_checkpointPending = false;
+};
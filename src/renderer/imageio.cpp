@@ -0,0 +1,161 @@
+#include "imageio.h"
+#include <QDebug>
+#include <QFile>
+#include <QImage>
+#include <QtEndian>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+template<typename T>
+void appendLE(QByteArray &out, T value)
+{
+    T le = qToLittleEndian(value);
+    out.append(reinterpret_cast<const char*>(&le), sizeof(T));
+}
+
+void appendAttribute(QByteArray &out, const char *name, const char *type, const QByteArray &value)
+{
+    out.append(name, int(std::strlen(name)) + 1);
+    out.append(type, int(std::strlen(type)) + 1);
+    appendLE<qint32>(out, qint32(value.size()));
+    out.append(value);
+}
+}
+
+float ImageIO::tonemap(float linear, float exposure)
+{
+    float x = qMax(0.0f, linear * exposure);
+    const float a = 2.51f, b = 0.03f, c = 2.43f, d = 0.59f, e = 0.14f;
+    x = qBound(0.0f, (x * (a * x + b)) / (x * (c * x + d) + e), 1.0f);
+    return x <= 0.0031308f ? 12.92f * x : 1.055f * std::pow(x, 1.0f / 2.4f) - 0.055f;
+}
+
+bool ImageIO::writePfm(const QString &path, int width, int height, const float *rgb)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Unable to write PFM file:" << path;
+        return false;
+    }
+
+    // Negative scale marks little-endian data; PFM rows are bottom-to-top,
+    // which is already the order of a GL readback.
+    file.write(QString("PF\n%1 %2\n-1.0\n").arg(width).arg(height).toLatin1());
+
+    std::vector<float> row(size_t(width) * 3);
+    for (int y = 0; y < height; ++y) {
+        const float *src = rgb + size_t(y) * width * 3;
+        for (int x = 0; x < width; ++x) {
+            row[x * 3 + 0] = qToLittleEndian(src[x * 3 + 0]);
+            row[x * 3 + 1] = qToLittleEndian(src[x * 3 + 1]);
+            row[x * 3 + 2] = qToLittleEndian(src[x * 3 + 2]);
+        }
+        file.write(reinterpret_cast<const char*>(row.data()), qint64(row.size() * sizeof(float)));
+    }
+    return true;
+}
+
+bool ImageIO::writeExr(const QString &path, int width, int height, const float *rgb)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Unable to write EXR file:" << path;
+        return false;
+    }
+
+    QByteArray header;
+    appendLE<quint32>(header, 20000630u); // magic
+    appendLE<quint32>(header, 2u);        // version 2, single-part scanline
+
+    // Channels must be listed alphabetically; 2 = FLOAT pixel type.
+    QByteArray channels;
+    for (const char *name : { "B", "G", "R" }) {
+        channels.append(name, 2);
+        appendLE<qint32>(channels, 2);
+        channels.append(4, '\0');         // pLinear + reserved
+        appendLE<qint32>(channels, 1);    // xSampling
+        appendLE<qint32>(channels, 1);    // ySampling
+    }
+    channels.append('\0');
+    appendAttribute(header, "channels", "chlist", channels);
+
+    appendAttribute(header, "compression", "compression", QByteArray(1, '\0'));
+
+    QByteArray box;
+    appendLE<qint32>(box, 0);
+    appendLE<qint32>(box, 0);
+    appendLE<qint32>(box, width - 1);
+    appendLE<qint32>(box, height - 1);
+    appendAttribute(header, "dataWindow", "box2i", box);
+    appendAttribute(header, "displayWindow", "box2i", box);
+
+    appendAttribute(header, "lineOrder", "lineOrder", QByteArray(1, '\0'));
+
+    QByteArray one;
+    appendLE<float>(one, 1.0f);
+    appendAttribute(header, "pixelAspectRatio", "float", one);
+
+    QByteArray center;
+    appendLE<float>(center, 0.0f);
+    appendLE<float>(center, 0.0f);
+    appendAttribute(header, "screenWindowCenter", "v2f", center);
+    appendAttribute(header, "screenWindowWidth", "float", one);
+    header.append('\0');
+
+    // Uncompressed scanline files store one line per block, each preceded
+    // by its y coordinate and payload size, with an offset table up front.
+    const qint32 lineBytes = qint32(width) * 3 * qint32(sizeof(float));
+    const quint64 tableStart = quint64(header.size());
+    const quint64 firstLine = tableStart + quint64(height) * sizeof(quint64);
+
+    for (int y = 0; y < height; ++y)
+        appendLE<quint64>(header, firstLine + quint64(y) * (8 + lineBytes));
+    file.write(header);
+
+    QByteArray line;
+    line.reserve(8 + lineBytes);
+    for (int y = 0; y < height; ++y) {
+        // EXR is top-to-bottom, the readback bottom-to-top.
+        const float *src = rgb + size_t(height - 1 - y) * width * 3;
+        line.clear();
+        appendLE<qint32>(line, y);
+        appendLE<qint32>(line, lineBytes);
+        for (int c : { 2, 1, 0 }) {
+            for (int x = 0; x < width; ++x)
+                appendLE<float>(line, src[x * 3 + c]);
+        }
+        file.write(line);
+    }
+    return true;
+}
+
+bool ImageIO::writePng(const QString &path, int width, int height, const float *rgb, float exposure)
+{
+    QImage image(width, height, QImage::Format_RGB888);
+    for (int y = 0; y < height; ++y) {
+        const float *src = rgb + size_t(height - 1 - y) * width * 3;
+        uchar *dst = image.scanLine(y);
+        for (int x = 0; x < width; ++x) {
+            for (int c = 0; c < 3; ++c)
+                dst[x * 3 + c] = uchar(std::lround(tonemap(src[x * 3 + c], exposure) * 255.0f));
+        }
+    }
+
+    if (!image.save(path, "PNG")) {
+        qWarning() << "Unable to write PNG file:" << path;
+        return false;
+    }
+    return true;
+}
+
+bool ImageIO::writeAll(const QString &basePath, int formats, int width, int height, const float *rgb)
+{
+    bool ok = true;
+    if (formats & PFM) ok &= writePfm(basePath + ".pfm", width, height, rgb);
+    if (formats & EXR) ok &= writeExr(basePath + ".exr", width, height, rgb);
+    if (formats & PNG) ok &= writePng(basePath + ".png", width, height, rgb);
+    return ok;
+}
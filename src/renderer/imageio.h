@@ -0,0 +1,23 @@
+#pragma once
+#include <QString>
+
+// Image encoders for packed linear RGB float buffers as read back from the
+// tracer (rows bottom-to-top, like OpenGL). Thread-safe; meant to run on workers.
+namespace ImageIO
+{
+    enum Format {
+        PFM = 0x1, // linear, portable float map
+        EXR = 0x2, // linear, uncompressed OpenEXR scanlines
+        PNG = 0x4  // tonemapped, 8-bit sRGB
+    };
+
+    bool writePfm(const QString &path, int width, int height, const float *rgb);
+    bool writeExr(const QString &path, int width, int height, const float *rgb);
+    bool writePng(const QString &path, int width, int height, const float *rgb, float exposure = 1.0f);
+
+    // ACES filmic curve followed by the sRGB transfer function.
+    float tonemap(float linear, float exposure);
+
+    // Writes basePath + ".pfm" / ".exr" / ".png" for every bit set in formats.
+    bool writeAll(const QString &basePath, int formats, int width, int height, const float *rgb);
+}
@@ -0,0 +1,293 @@
+#include "inputrecorder.h"
+#include <QDebug>
+#include <QFile>
+#include <QTextStream>
+#include <algorithm>
+#include "renderer/camera.h"
+
+// ---------------------------------------------------------------------------
+// InputRecording
+// ---------------------------------------------------------------------------
+
+bool InputRecording::save(const QString &path) const
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qWarning() << "Unable to write recording:" << path;
+        return false;
+    }
+
+    QTextStream out(&file);
+    out << "# RayTracingGPU input recording v1\n";
+    out << "scene " << sceneIndex << "\n";
+    for (const QString &mesh : meshPaths)
+        out << "mesh " << mesh << "\n";
+    out << "raytracing " << (raytracing ? 1 : 0) << "\n";
+    out << "sampler " << samplerMode << "\n";
+    out << "seed " << seed << "\n";
+    out << "size " << width << " " << height << "\n";
+
+    // Both streams are already sorted by time; merge them for readability.
+    int e = 0, c = 0;
+    while (e < events.size() || c < cameras.size()) {
+        bool takeCamera = e >= events.size()
+            || (c < cameras.size() && cameras[c].timeMs <= events[e].timeMs);
+        if (takeCamera) {
+            const CameraSample &s = cameras[c++];
+            out << "cam " << s.timeMs << " " << s.position.x() << " " << s.position.y() << " "
+                << s.position.z() << " " << s.yaw << " " << s.pitch << "\n";
+        } else {
+            const InputEvent &ev = events[e++];
+            if (ev.type == InputEvent::MouseMove)
+                out << "mouse " << ev.timeMs << " " << ev.dx << " " << ev.dy << "\n";
+            else
+                out << "key " << ev.timeMs << " " << (ev.type == InputEvent::KeyPress ? "press" : "release")
+                    << " " << ev.key << "\n";
+        }
+    }
+    return true;
+}
+
+bool InputRecording::load(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qWarning() << "Unable to open recording:" << path;
+        return false;
+    }
+
+    *this = InputRecording();
+
+    QTextStream in(&file);
+    while (!in.atEnd()) {
+        QString line = in.readLine().trimmed();
+        if (line.isEmpty() || line.startsWith('#'))
+            continue;
+
+        QStringList f = line.split(' ', Qt::SkipEmptyParts);
+        const QString &tag = f[0];
+
+        if (tag == "scene" && f.size() >= 2) {
+            sceneIndex = f[1].toInt();
+        } else if (tag == "mesh") {
+            meshPaths.append(line.mid(5));
+        } else if (tag == "raytracing" && f.size() >= 2) {
+            raytracing = f[1].toInt() != 0;
+        } else if (tag == "sampler" && f.size() >= 2) {
+            samplerMode = f[1].toInt();
+        } else if (tag == "seed" && f.size() >= 2) {
+            seed = f[1].toUInt();
+        } else if (tag == "size" && f.size() >= 3) {
+            width = f[1].toInt();
+            height = f[2].toInt();
+        } else if (tag == "cam" && f.size() >= 7) {
+            cameras.append({ f[1].toLongLong(),
+                             QVector3D(f[2].toFloat(), f[3].toFloat(), f[4].toFloat()),
+                             f[5].toFloat(), f[6].toFloat() });
+        } else if (tag == "key" && f.size() >= 4) {
+            InputEvent ev;
+            ev.type = f[2] == "press" ? InputEvent::KeyPress : InputEvent::KeyRelease;
+            ev.timeMs = f[1].toLongLong();
+            ev.key = f[3].toInt();
+            events.append(ev);
+        } else if (tag == "mouse" && f.size() >= 4) {
+            InputEvent ev;
+            ev.type = InputEvent::MouseMove;
+            ev.timeMs = f[1].toLongLong();
+            ev.dx = f[2].toFloat();
+            ev.dy = f[3].toFloat();
+            events.append(ev);
+        } else {
+            qWarning() << "Recording: ignoring line" << line;
+        }
+    }
+
+    if (cameras.isEmpty()) {
+        qWarning() << "Recording has no camera state:" << path;
+        return false;
+    }
+    return true;
+}
+
+qint64 InputRecording::durationMs() const
+{
+    qint64 d = 0;
+    if (!events.isEmpty()) d = qMax(d, events.last().timeMs);
+    if (!cameras.isEmpty()) d = qMax(d, cameras.last().timeMs);
+    return d;
+}
+
+// ---------------------------------------------------------------------------
+// InputRecorder
+// ---------------------------------------------------------------------------
+
+void InputRecorder::start(const InputRecording &header, const Camera &camera)
+{
+    m_recording = header;
+    m_recording.events.clear();
+    m_recording.cameras.clear();
+    m_clock.start();
+    m_active = true;
+    recordCamera(camera);
+}
+
+void InputRecorder::stop()
+{
+    m_active = false;
+}
+
+void InputRecorder::recordKey(bool press, int key)
+{
+    if (!m_active)
+        return;
+
+    InputEvent ev;
+    ev.type = press ? InputEvent::KeyPress : InputEvent::KeyRelease;
+    ev.timeMs = m_clock.elapsed();
+    ev.key = key;
+    m_recording.events.append(ev);
+}
+
+void InputRecorder::recordMouse(float dx, float dy)
+{
+    if (!m_active)
+        return;
+
+    InputEvent ev;
+    ev.type = InputEvent::MouseMove;
+    ev.timeMs = m_clock.elapsed();
+    ev.dx = dx;
+    ev.dy = dy;
+    m_recording.events.append(ev);
+}
+
+void InputRecorder::recordCamera(const Camera &camera)
+{
+    if (!m_active)
+        return;
+
+    m_recording.cameras.append({ m_clock.elapsed(), camera.position(), camera.yaw(), camera.pitch() });
+}
+
+// ---------------------------------------------------------------------------
+// ReplayDriver
+// ---------------------------------------------------------------------------
+
+bool ReplayDriver::start(const InputRecording &recording, const QString &reportPath)
+{
+    if (recording.cameras.isEmpty())
+        return false;
+
+    m_recording = recording;
+    m_reportPath = reportPath;
+    m_stats.clear();
+    m_eventCursor = 0;
+    m_cameraCursor = 0;
+    m_frame = 0;
+    m_maxDrift = 0.0f;
+    m_active = true;
+    return true;
+}
+
+void ReplayDriver::stop()
+{
+    m_active = false;
+}
+
+bool ReplayDriver::finished() const
+{
+    return m_frame * FixedDt * 1000.0f > float(m_recording.durationMs());
+}
+
+QVector<InputEvent> ReplayDriver::nextFrameEvents()
+{
+    QVector<InputEvent> out;
+    const double frameEndMs = (m_frame + 1) * double(FixedDt) * 1000.0;
+
+    while (m_eventCursor < m_recording.events.size()
+           && m_recording.events[m_eventCursor].timeMs < frameEndMs) {
+        out.append(m_recording.events[m_eventCursor++]);
+    }
+
+    ++m_frame;
+    return out;
+}
+
+// Compares the simulated camera with the recorded one closest in time; the
+// two only drift apart by the fixed-step integration error.
+void ReplayDriver::checkCamera(const Camera &camera)
+{
+    const double nowMs = m_frame * double(FixedDt) * 1000.0;
+    const QVector<CameraSample> &cams = m_recording.cameras;
+
+    while (m_cameraCursor + 1 < cams.size() && cams[m_cameraCursor + 1].timeMs <= nowMs)
+        ++m_cameraCursor;
+
+    float drift = (cams[m_cameraCursor].position - camera.position()).length();
+    m_maxDrift = qMax(m_maxDrift, drift);
+}
+
+void ReplayDriver::recordFrame(double cpuMs, int spp, double delta)
+{
+    FrameStats s;
+    s.frame = m_frame;
+    s.cpuMs = cpuMs;
+    s.spp = spp;
+    s.delta = delta;
+    m_stats.append(s);
+}
+
+void ReplayDriver::recordGpuTime(int frame, double gpuMs)
+{
+    for (int i = m_stats.size() - 1; i >= 0; --i) {
+        if (m_stats[i].frame == frame) {
+            m_stats[i].gpuMs = gpuMs;
+            return;
+        }
+    }
+}
+
+bool ReplayDriver::writeReport() const
+{
+    if (m_reportPath.isEmpty())
+        return true;
+
+    QFile file(m_reportPath);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qWarning() << "Unable to write replay report:" << m_reportPath;
+        return false;
+    }
+
+    QTextStream out(&file);
+    out << "frame,cpu_ms,gpu_ms,spp,delta\n";
+    for (const FrameStats &s : m_stats)
+        out << s.frame << "," << s.cpuMs << "," << s.gpuMs << "," << s.spp << "," << s.delta << "\n";
+    return true;
+}
+
+QString ReplayDriver::summary() const
+{
+    QVector<double> cpu, gpu;
+    for (const FrameStats &s : m_stats) {
+        cpu.append(s.cpuMs);
+        if (s.gpuMs >= 0.0) gpu.append(s.gpuMs);
+    }
+
+    auto describe = [](QVector<double> v) {
+        if (v.isEmpty())
+            return QString("n/a");
+        std::sort(v.begin(), v.end());
+        double sum = 0.0;
+        for (double x : v) sum += x;
+        return QString("mean %1 ms, median %2 ms, p95 %3 ms")
+            .arg(sum / v.size(), 0, 'f', 3)
+            .arg(v[v.size() / 2], 0, 'f', 3)
+            .arg(v[qMin(v.size() - 1, int(v.size() * 0.95))], 0, 'f', 3);
+    };
+
+    int finalSpp = m_stats.isEmpty() ? 0 : m_stats.last().spp;
+    return QString("Replay: %1 frames at fixed dt %2 s\n  CPU %3\n  GPU %4\n  final spp %5, max camera drift %6")
+        .arg(m_stats.size()).arg(FixedDt, 0, 'f', 4)
+        .arg(describe(cpu)).arg(describe(gpu))
+        .arg(finalSpp).arg(m_maxDrift, 0, 'g', 3);
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include <QElapsedTimer>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QVector3D>
+
+class Camera;
+
+struct InputEvent {
+    enum Type { KeyPress, KeyRelease, MouseMove };
+    Type type;
+    qint64 timeMs;
+    int key = 0;
+    float dx = 0.0f;
+    float dy = 0.0f;
+};
+
+struct CameraSample {
+    qint64 timeMs;
+    QVector3D position;
+    float yaw;
+    float pitch;
+};
+
+// A captured session: everything needed to rebuild the starting state
+// (scene, loaded meshes, mode, sampler, seed, trace resolution) plus the
+// timestamped input stream and the camera state of every recorded frame.
+struct InputRecording {
+    int sceneIndex = 0;
+    QStringList meshPaths;
+    bool raytracing = false;
+    int samplerMode = 0;
+    quint32 seed = 0;
+    int width = 0;
+    int height = 0;
+    QVector<InputEvent> events;
+    QVector<CameraSample> cameras;
+
+    bool save(const QString &path) const;
+    bool load(const QString &path);
+    qint64 durationMs() const;
+};
+
+class InputRecorder
+{
+public:
+    void start(const InputRecording &header, const Camera &camera);
+    void stop();
+    bool isRecording() const { return m_active; }
+
+    void recordKey(bool press, int key);
+    void recordMouse(float dx, float dy);
+    void recordCamera(const Camera &camera);
+
+    const InputRecording &recording() const { return m_recording; }
+
+private:
+    InputRecording m_recording;
+    QElapsedTimer m_clock;
+    bool m_active = false;
+};
+
+// Plays a recording back on a fixed timestep: frame k consumes the events
+// recorded in [k * FixedDt, (k + 1) * FixedDt), so motion no longer depends
+// on how fast the machine renders. Collects per-frame timing and
+// convergence statistics for comparing builds on the same flythrough.
+class ReplayDriver
+{
+public:
+    static constexpr float FixedDt = 1.0f / 60.0f;
+
+    struct FrameStats {
+        int frame = 0;
+        double cpuMs = 0.0;
+        double gpuMs = -1.0;   // filled in later, when the query returns
+        int spp = 0;
+        double delta = -1.0;   // mean |change| since the last measurement
+    };
+
+    bool start(const InputRecording &recording, const QString &reportPath);
+    void stop();
+    bool isActive() const { return m_active; }
+    bool finished() const;
+
+    const InputRecording &recording() const { return m_recording; }
+    int frameIndex() const { return m_frame; }
+
+    // Events to apply before rendering the next frame; advances the clock.
+    QVector<InputEvent> nextFrameEvents();
+
+    void recordFrame(double cpuMs, int spp, double delta);
+    void recordGpuTime(int frame, double gpuMs);
+    void checkCamera(const Camera &camera);
+
+    bool writeReport() const;
+    QString summary() const;
+
+private:
+    InputRecording m_recording;
+    QString m_reportPath;
+    QVector<FrameStats> m_stats;
+    int m_eventCursor = 0;
+    int m_cameraCursor = 0;
+    int m_frame = 0;
+    float m_maxDrift = 0.0f;
+    bool m_active = false;
+};
@@ -0,0 +1,259 @@
+#include "irradiancebaker.h"
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include "scene/clusteredmesh.h"
+#include "scene/mesh.h"
+#include "scene/scene.h"
+
+IrradianceBaker::IrradianceBaker()
+{
+}
+
+IrradianceBaker::IrradianceBaker(const Settings &settings)
+    : m_settings(settings)
+{
+}
+
+IrradianceBaker::~IrradianceBaker()
+{
+    delete m_tracer;
+}
+
+bool IrradianceBaker::start(Scene *scene)
+{
+    cancel();
+    m_sceneRevision = scene->revision();
+
+    // Quads are parametrized over their corners 0, 1 and 3; texel (x, y)
+    // is the texel center at u = (x + 0.5) / R along 0->1, v along 0->3.
+    const int resolution = qBound(2, m_settings.lightmapResolution, 1024);
+    QVector<PathTracer::BakePoint> points;
+    QVector<Target> targets;
+    int lightmaps = 0;
+    for (Mesh *mesh : scene->meshes()) {
+        if (mesh->indexCount() < 3)
+            continue;
+        if (!mesh->restoreCpuGeometry()) {
+            qWarning() << "Cannot bake lighting:" << mesh->name() << "released its CPU geometry";
+            return false;
+        }
+
+        const QMatrix4x4 &model = mesh->modelMatrix;
+        const QMatrix4x4 normalMatrix = model.inverted().transposed();
+        Target target;
+        target.mesh = mesh;
+        target.first = points.size();
+
+        if (mesh->vertexCount() == 4 && mesh->indexCount() == 6) {
+            target.lightmap = true;
+            ++lightmaps;
+            const QVector3D p0 = model.map(mesh->position(0));
+            const QVector3D du = model.map(mesh->position(1)) - p0;
+            const QVector3D dv = model.map(mesh->position(3)) - p0;
+            const QVector3D normal = normalMatrix.mapVector(mesh->normal(0)).normalized();
+            for (int y = 0; y < resolution; ++y) {
+                for (int x = 0; x < resolution; ++x) {
+                    const float u = (x + 0.5f) / resolution;
+                    const float v = (y + 0.5f) / resolution;
+                    points.append({ p0 + du * u + dv * v, normal });
+                }
+            }
+        } else {
+            for (int i = 0; i < mesh->vertexCount(); ++i)
+                points.append({ model.map(mesh->position(i)), normalMatrix.mapVector(mesh->normal(i)).normalized() });
+        }
+        targets.append(target);
+    }
+
+    if (points.isEmpty()) {
+        qWarning() << "Cannot bake lighting: the scene has no meshes";
+        return false;
+    }
+
+    m_targets = targets;
+    m_pointCount = points.size();
+    m_settings.lightmapResolution = resolution;
+    m_key = cacheKey(scene, points);
+    if (loadCache()) {
+        qInfo() << "Baked lighting loaded from" << cachePath();
+        return true;
+    }
+
+    if (!m_tracer) {
+        m_tracer = new PathTracer();
+        if (!m_tracer->initialize(PathTracer::BakeColumns, 1)) {
+            delete m_tracer;
+            m_tracer = nullptr;
+            m_targets.clear();
+            return false;
+        }
+    }
+    m_tracer->setTileBudget(m_settings.budgetMs);
+    m_tracer->setSampleCap(m_settings.targetSpp);
+    m_tracer->uploadScene(scene);
+    m_tracer->setBakePoints(points);
+
+    m_nextPublish = 1;
+    m_running = true;
+    m_timer.start();
+    qInfo() << "Baking lighting:" << lightmaps << "lightmaps," << targets.size() - lightmaps << "vertex-lit meshes,"
+            << m_pointCount << "points at" << m_settings.targetSpp << "spp";
+    return true;
+}
+
+void IrradianceBaker::step()
+{
+    if (!m_running)
+        return;
+
+    m_tracer->traceFrame(m_camera, 60.0f);
+    const int spp = m_tracer->accumFrame();
+    const bool done = spp >= m_settings.targetSpp && !m_tracer->streaming();
+    if (spp < m_nextPublish && !done)
+        return;
+
+    // Reads back once per doubling of the sample count: a handful of
+    // stalls over the whole bake.
+    std::vector<float> rgb = m_tracer->readAccumulation();
+    publish(rgb.data());
+    while (m_nextPublish <= spp)
+        m_nextPublish *= 2;
+
+    if (done) {
+        m_running = false;
+        saveCache(rgb);
+        qInfo() << "Lighting baked:" << m_pointCount << "points," << spp << "spp in"
+                << m_timer.elapsed() / 1000.0 << "s";
+    }
+}
+
+void IrradianceBaker::cancel()
+{
+    m_running = false;
+    m_targets.clear();
+    m_pointCount = 0;
+}
+
+int IrradianceBaker::samples() const
+{
+    return m_tracer ? m_tracer->accumFrame() : 0;
+}
+
+void IrradianceBaker::publish(const float *rgb)
+{
+    for (const Target &target : m_targets) {
+        const float *first = rgb + size_t(target.first) * 3;
+        if (target.lightmap)
+            target.mesh->setBakedLightmap(m_settings.lightmapResolution, first);
+        else
+            target.mesh->setBakedVertices(first);
+    }
+}
+
+// Everything the light reaching the bake points depends on. Clustered
+// meshes are identified by their cache directory, itself keyed on the
+// source file.
+QByteArray IrradianceBaker::cacheKey(Scene *scene, const QVector<PathTracer::BakePoint> &points) const
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    auto addBytes = [&hash](const void *data, qint64 bytes) {
+        hash.addData(QByteArrayView(static_cast<const char*>(data), bytes));
+    };
+    auto addMaterial = [&addBytes](const Material &m) {
+        const float values[] = { m.color.x(), m.color.y(), m.color.z(),
+                                 m.specularColor.x(), m.specularColor.y(), m.specularColor.z(),
+                                 m.shininess, m.kd, m.ks };
+        addBytes(values, sizeof(values));
+    };
+
+    const qint32 settings[] = { qint32(CacheMagic), m_settings.lightmapResolution, m_settings.targetSpp };
+    addBytes(settings, sizeof(settings));
+    for (const PathTracer::BakePoint &p : points) {
+        const float values[] = { p.position.x(), p.position.y(), p.position.z(),
+                                 p.normal.x(), p.normal.y(), p.normal.z() };
+        addBytes(values, sizeof(values));
+    }
+
+    for (Mesh *mesh : scene->meshes()) {
+        addBytes(mesh->modelMatrix.constData(), 16 * sizeof(float));
+        addMaterial(mesh->material());
+        addBytes(mesh->packedVertices().constData(), mesh->packedVertices().size() * qint64(sizeof(VertexFormat::PackedVertex)));
+        addBytes(mesh->indices().constData(), mesh->indices().size() * qint64(sizeof(unsigned int)));
+        addBytes(mesh->packedColors().constData(), mesh->packedColors().size() * qint64(sizeof(quint32)));
+    }
+    for (ClusteredMesh *mesh : scene->clusteredMeshes()) {
+        hash.addData(mesh->directory().toUtf8());
+        addBytes(mesh->modelMatrix.constData(), 16 * sizeof(float));
+        addMaterial(mesh->material());
+    }
+    for (const Light &light : scene->lights()) {
+        const float values[] = { light.position.x(), light.position.y(), light.position.z(),
+                                 light.color.x(), light.color.y(), light.color.z(),
+                                 light.intensity, light.radius };
+        addBytes(values, sizeof(values));
+    }
+    for (const SphereInstance &sphere : scene->spheres()) {
+        const float values[] = { sphere.center.x(), sphere.center.y(), sphere.center.z(), sphere.radius };
+        addBytes(values, sizeof(values));
+        addBytes(&sphere.materialId, sizeof(sphere.materialId));
+    }
+    for (const Material &m : scene->materials())
+        addMaterial(m);
+
+    return hash.result().toHex();
+}
+
+QString IrradianceBaker::cacheDirectory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/bakes";
+}
+
+QString IrradianceBaker::cachePath() const
+{
+    return QDir(cacheDirectory()).filePath(QString::fromLatin1(m_key) + ".bin");
+}
+
+// Header: magic, point count, samples; then three floats per point.
+bool IrradianceBaker::loadCache()
+{
+    QFile file(cachePath());
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    quint32 header[3] = {};
+    const qint64 bytes = qint64(m_pointCount) * 3 * sizeof(float);
+    if (file.read(reinterpret_cast<char*>(header), sizeof(header)) != qint64(sizeof(header))
+        || header[0] != CacheMagic || header[1] != quint32(m_pointCount) || file.size() != qint64(sizeof(header)) + bytes) {
+        qWarning() << "Ignoring invalid bake cache" << file.fileName();
+        return false;
+    }
+
+    std::vector<float> rgb(size_t(m_pointCount) * 3);
+    if (file.read(reinterpret_cast<char*>(rgb.data()), bytes) != bytes)
+        return false;
+    publish(rgb.data());
+    return true;
+}
+
+void IrradianceBaker::saveCache(const std::vector<float> &rgb) const
+{
+    if (!QDir().mkpath(cacheDirectory())) {
+        qWarning() << "Unable to create bake cache directory:" << cacheDirectory();
+        return;
+    }
+
+    QSaveFile file(cachePath());
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Unable to write bake cache:" << file.fileName();
+        return;
+    }
+    const quint32 header[3] = { CacheMagic, quint32(m_pointCount), quint32(samples()) };
+    file.write(reinterpret_cast<const char*>(header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(rgb.data()), qint64(m_pointCount) * 3 * sizeof(float));
+    if (!file.commit())
+        qWarning() << "Unable to write bake cache:" << file.fileName();
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <QElapsedTimer>
+#include <QString>
+#include <QVector>
+#include "renderer/camera.h"
+#include "renderer/pathtracer.h"
+
+class Mesh;
+class Scene;
+
+// Bakes path-traced lighting into the scene's meshes for raster mode.
+// Quads (four-vertex meshes) get a lightmap of lightmapResolution texels
+// per side spanning their corners, other triangle meshes one value per
+// vertex; analytic spheres are not baked but still shadow and bounce
+// light. Each texel or vertex is a bake point the tracer (in bake mode)
+// accumulates on, a budgeted batch of tiles per step() so the bake runs
+// in the background of the interactive view. Results reach the meshes at
+// 1, 2, 4... samples and once more when done.
+//
+// Finished bakes are cached on disk, keyed by a hash of everything the
+// lighting depends on: geometry, transforms, materials, lights and the
+// settings. Starting a bake the cache already holds applies it at once.
+//
+// The baker owns its own PathTracer, so the interactive tracer keeps its
+// image. Meshes must still have their CPU geometry (see
+// PathTracer::setReleaseCpuGeometry). Needs a current OpenGL 4.5 context.
+class IrradianceBaker
+{
+public:
+    struct Settings {
+        int lightmapResolution = 32;
+        int targetSpp = 256;
+        // GPU time per step(); 0 traces every bake point each step.
+        double budgetMs = 4.0;
+    };
+
+    IrradianceBaker();
+    explicit IrradianceBaker(const Settings &settings);
+    ~IrradianceBaker();
+
+    // Drops any bake in progress and starts one for scene. False when the
+    // scene has nothing to bake or cannot be baked.
+    bool start(Scene *scene);
+    // Traces one batch; call once per frame while running().
+    void step();
+    // Stops without touching the meshes, which may already be gone.
+    void cancel();
+
+    bool running() const { return m_running; }
+    // The scene revision the bake (running or finished) was made for.
+    quint64 sceneRevision() const { return m_sceneRevision; }
+    int samples() const;
+
+    static QString cacheDirectory();
+
+private:
+    struct Target {
+        Mesh *mesh = nullptr;
+        int first = 0;
+        bool lightmap = false;
+    };
+
+    QByteArray cacheKey(Scene *scene, const QVector<PathTracer::BakePoint> &points) const;
+    QString cachePath() const;
+    bool loadCache();
+    void saveCache(const std::vector<float> &rgb) const;
+    void publish(const float *rgb);
+
+    Settings m_settings;
+    PathTracer *m_tracer = nullptr;
+    Camera m_camera;
+
+    QVector<Target> m_targets;
+    int m_pointCount = 0;
+    QByteArray m_key;
+    quint64 m_sceneRevision = 0;
+    bool m_running = false;
+    int m_nextPublish = 1;
+    QElapsedTimer m_timer;
+
+    static constexpr quint32 CacheMagic = 0x42414B31; // "BAK1"
+};
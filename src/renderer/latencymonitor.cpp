@@ -0,0 +1,67 @@
+#include "latencymonitor.h"
+#include <QStringList>
+#include <algorithm>
+#include "renderer/renderthread.h"
+
+LatencyMonitor::LatencyMonitor(QObject *parent)
+    : QObject(parent)
+{
+    m_heartbeat.setTimerType(Qt::PreciseTimer);
+    m_heartbeat.setInterval(HeartbeatMs);
+    connect(&m_heartbeat, &QTimer::timeout, this, [this]() { beat(); });
+}
+
+void LatencyMonitor::start()
+{
+    m_lastBeatNs = RenderThread::now();
+    m_heartbeat.start();
+}
+
+void LatencyMonitor::beat()
+{
+    const qint64 now = RenderThread::now();
+    const double late = (now - m_lastBeatNs) / 1.0e6 - HeartbeatMs;
+    m_lastBeatNs = now;
+    m_uiLag.add(qMax(0.0, late));
+}
+
+void LatencyMonitor::Series::add(double ms)
+{
+    if (int(samples.size()) < SampleCount) {
+        samples.push_back(ms);
+        return;
+    }
+    samples[next] = ms;
+    next = (next + 1) % SampleCount;
+}
+
+double LatencyMonitor::Series::percentile(double p) const
+{
+    if (samples.empty())
+        return 0.0;
+    std::vector<double> sorted = samples;
+    const size_t rank = qMin(sorted.size() - 1, size_t(p * (sorted.size() - 1) + 0.5));
+    std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+    return sorted[rank];
+}
+
+double LatencyMonitor::Series::max() const
+{
+    return samples.empty() ? 0.0 : *std::max_element(samples.begin(), samples.end());
+}
+
+QString LatencyMonitor::summary() const
+{
+    QStringList parts;
+    if (!m_inputToPhoton.samples.empty())
+        parts << QString("Input to photon %1 ms (p95 %2)")
+                     .arg(m_inputToPhoton.percentile(0.5), 0, 'f', 1)
+                     .arg(m_inputToPhoton.percentile(0.95), 0, 'f', 1);
+    if (!m_uiLag.samples.empty())
+        parts << QString("UI lag p95 %1 ms, max %2")
+                     .arg(m_uiLag.percentile(0.95), 0, 'f', 1)
+                     .arg(m_uiLag.max(), 0, 'f', 1);
+    if (!m_present.samples.empty())
+        parts << QString("present %1 ms").arg(m_present.percentile(0.5), 0, 'f', 2);
+    return parts.join(", ");
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <QObject>
+#include <QString>
+#include <QTimer>
+#include <vector>
+
+// GUI-thread view of interactive latency, over the last SampleCount
+// samples of each series:
+//   input to photon  from the input event to the swap of the first frame
+//                    that reflects it (RenderThread stamps the frames)
+//   UI lag           how late a HeartbeatMs timer fires: the time the GUI
+//                    event loop was kept from handling input, menus and
+//                    repaints
+//   present          GUI-thread time spent copying a frame to the window
+// The swap is the last point the application sees; the display adds its
+// scanout on top.
+class LatencyMonitor : public QObject
+{
+public:
+    static constexpr int SampleCount = 256;
+    static constexpr int HeartbeatMs = 10;
+
+    explicit LatencyMonitor(QObject *parent = nullptr);
+
+    void start();
+    void addInputToPhoton(double ms) { m_inputToPhoton.add(ms); }
+    void addPresent(double ms) { m_present.add(ms); }
+
+    // One line for the status bar; empty series are left out.
+    QString summary() const;
+
+private:
+    struct Series {
+        std::vector<double> samples;
+        int next = 0;
+        void add(double ms);
+        double percentile(double p) const;
+        double max() const;
+    };
+
+    void beat();
+
+    QTimer m_heartbeat;
+    qint64 m_lastBeatNs = 0;
+    Series m_inputToPhoton;
+    Series m_uiLag;
+    Series m_present;
+};
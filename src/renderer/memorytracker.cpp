@@ -0,0 +1,167 @@
+#include "memorytracker.h"
+#include <QDebug>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <algorithm>
+#include <vector>
+
+MemoryTracker& MemoryTracker::instance()
+{
+    static MemoryTracker tracker;
+    return tracker;
+}
+
+const char* MemoryTracker::kindName(Kind kind)
+{
+    switch (kind) {
+    case Cpu:        return "cpu";
+    case GpuBuffer:  return "gpuBuffers";
+    case GpuTexture: return "gpuTextures";
+    default:         return "?";
+    }
+}
+
+void MemoryTracker::add(Usage &usage, Kind kind, qint64 delta)
+{
+    usage.current[kind] += delta;
+    usage.peak[kind] = qMax(usage.peak[kind], usage.current[kind]);
+    usage.currentTotal += delta;
+    usage.peakTotal = qMax(usage.peakTotal, usage.currentTotal);
+}
+
+void MemoryTracker::track(const void *owner, const char *name, const char *subsystem, Kind kind, qint64 bytes)
+{
+    QMutexLocker lock(&m_mutex);
+
+    Owner &o = m_owners[owner];
+    auto it = o.allocations.find(QByteArray(name));
+    if (it != o.allocations.end()) {
+        // Drop the old size first so a kind or subsystem change is accounted right.
+        add(m_total, it->kind, -it->bytes);
+        add(m_subsystems[it->subsystem], it->kind, -it->bytes);
+        o.allocations.erase(it);
+    }
+
+    if (bytes > 0) {
+        o.allocations.insert(QByteArray(name), { QString::fromLatin1(subsystem), kind, bytes });
+        add(m_total, kind, bytes);
+        add(m_subsystems[QString::fromLatin1(subsystem)], kind, bytes);
+    }
+
+    if (o.allocations.isEmpty() && o.label.isEmpty())
+        m_owners.remove(owner);
+}
+
+void MemoryTracker::release(const void *owner)
+{
+    QMutexLocker lock(&m_mutex);
+
+    auto it = m_owners.find(owner);
+    if (it == m_owners.end())
+        return;
+    for (const Allocation &a : it->allocations) {
+        add(m_total, a.kind, -a.bytes);
+        add(m_subsystems[a.subsystem], a.kind, -a.bytes);
+    }
+    m_owners.erase(it);
+}
+
+void MemoryTracker::setLabel(const void *owner, const QString &label)
+{
+    QMutexLocker lock(&m_mutex);
+    m_owners[owner].label = label;
+}
+
+MemoryTracker::Usage MemoryTracker::total() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_total;
+}
+
+MemoryTracker::Usage MemoryTracker::subsystem(const QString &name) const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_subsystems.value(name);
+}
+
+QString MemoryTracker::summary() const
+{
+    Usage u = total();
+    auto mib = [](qint64 bytes) { return QString::number(bytes / (1024.0 * 1024.0), 'f', 1); };
+    return QString("CPU %1 MiB, GPU %2 MiB (peak %3 MiB total)")
+        .arg(mib(u.current[Cpu]))
+        .arg(mib(u.current[GpuBuffer] + u.current[GpuTexture]))
+        .arg(mib(u.peakTotal));
+}
+
+QJsonObject MemoryTracker::toJson() const
+{
+    QMutexLocker lock(&m_mutex);
+
+    auto usageJson = [](const Usage &u) {
+        QJsonObject current, peak;
+        for (int k = 0; k < KindCount; ++k) {
+            current[kindName(Kind(k))] = double(u.current[k]);
+            peak[kindName(Kind(k))] = double(u.peak[k]);
+        }
+        current["total"] = double(u.currentTotal);
+        peak["total"] = double(u.peakTotal);
+        QJsonObject o;
+        o["current"] = current;
+        o["peak"] = peak;
+        return o;
+    };
+
+    QJsonObject subsystems;
+    for (auto it = m_subsystems.constBegin(); it != m_subsystems.constEnd(); ++it)
+        subsystems[it.key()] = usageJson(it.value());
+
+    // Largest owners first: that is where a footprint regression shows up.
+    struct Entry { qint64 bytes; QJsonObject json; };
+    std::vector<Entry> owners;
+    for (auto it = m_owners.constBegin(); it != m_owners.constEnd(); ++it) {
+        QJsonObject allocations;
+        qint64 bytes = 0;
+        QString subsystem;
+        for (auto a = it->allocations.constBegin(); a != it->allocations.constEnd(); ++a) {
+            QJsonObject alloc;
+            alloc["kind"] = kindName(a->kind);
+            alloc["bytes"] = double(a->bytes);
+            allocations[QString::fromLatin1(a.key())] = alloc;
+            bytes += a->bytes;
+            subsystem = a->subsystem;
+        }
+        if (allocations.isEmpty())
+            continue;
+
+        QJsonObject o;
+        o["label"] = it->label.isEmpty()
+            ? QString("%1@%2").arg(subsystem).arg(quintptr(it.key()), 0, 16) : it->label;
+        o["subsystem"] = subsystem;
+        o["bytes"] = double(bytes);
+        o["allocations"] = allocations;
+        owners.push_back({ bytes, o });
+    }
+    std::sort(owners.begin(), owners.end(), [](const Entry &a, const Entry &b) { return a.bytes > b.bytes; });
+
+    QJsonArray ownerArray;
+    for (const Entry &e : owners)
+        ownerArray.append(e.json);
+
+    QJsonObject root = usageJson(m_total);
+    root["subsystems"] = subsystems;
+    root["owners"] = ownerArray;
+    return root;
+}
+
+bool MemoryTracker::writeJson(const QString &path) const
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Unable to write memory report:" << path;
+        return false;
+    }
+    file.write(QJsonDocument(toJson()).toJson());
+    return true;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <QHash>
+#include <QJsonObject>
+#include <QMutex>
+#include <QString>
+
+// Process-wide accounting of the memory held by the renderer: CPU copies
+// of geometry and acceleration structures, GL buffers and GL textures.
+// Owners (a mesh, the tracer, the sphere instances...) report the current
+// size of each of their allocations by name and forget them on release;
+// the tracker keeps current and peak totals per kind and per subsystem.
+// Sizes are what was requested from the driver, not what it reserved.
+// Thread-safe; tracking never touches GL.
+class MemoryTracker
+{
+public:
+    enum Kind { Cpu, GpuBuffer, GpuTexture, KindCount };
+
+    struct Usage {
+        qint64 current[KindCount] = {};
+        qint64 peak[KindCount] = {};
+        qint64 currentTotal = 0;
+        qint64 peakTotal = 0;
+    };
+
+    static MemoryTracker& instance();
+    static const char* kindName(Kind kind);
+
+    // Sets the size of the allocation name of owner; 0 bytes forgets it.
+    // subsystem groups owners in the report ("mesh", "tracer", ...).
+    void track(const void *owner, const char *name, const char *subsystem, Kind kind, qint64 bytes);
+    void release(const void *owner);
+    // Shown instead of the owner's address in reports (e.g. a file name).
+    void setLabel(const void *owner, const QString &label);
+
+    Usage total() const;
+    Usage subsystem(const QString &name) const;
+
+    // One line for the status bar.
+    QString summary() const;
+    QJsonObject toJson() const;
+    bool writeJson(const QString &path) const;
+
+private:
+    struct Allocation {
+        QString subsystem;
+        Kind kind = Cpu;
+        qint64 bytes = 0;
+    };
+    struct Owner {
+        QString label;
+        QHash<QByteArray, Allocation> allocations;
+    };
+
+    static void add(Usage &usage, Kind kind, qint64 delta);
+
+    mutable QMutex m_mutex;
+    QHash<const void*, Owner> m_owners;
+    QHash<QString, Usage> m_subsystems;
+    Usage m_total;
+};
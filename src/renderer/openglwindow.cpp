@@ -2,31 +2,81 @@
 #include <QKeyEvent>
 #include <QMouseEvent>
 #include <QFile>
+#include <QFileInfo>
 #include <QDebug>
 #include <QMenu>
+#include <QGuiApplication>
+#include "scene/assetcache.h"
+#include "scene/clusteredmesh.h"
 #include "scene/mesh.h"
 #include "scene/scene.h"
-#include "gpu_stucts.h"
+#include "renderer/pathtracer.h"
+#include "renderer/convergenceharness.h"
+#include "renderer/imageexporter.h"
+#include "renderer/irradiancebaker.h"
+#include "renderer/workgrouptuner.h"
 
 OpenGLWindow::OpenGLWindow(QWindow *parent)
     : QOpenGLWindow(NoPartialUpdate, parent)
 {
     m_scene = new Scene();
+    m_exporter = new ImageExporter(this);
+
+    // The render thread throttles itself in the background.
+    connect(qGuiApp, &QGuiApplication::applicationStateChanged, this, [this](Qt::ApplicationState state) {
+        m_applicationActive = state == Qt::ApplicationActive;
+        post([this]() { requestFrame(); });
+    });
+    connect(this, &QOpenGLWindow::frameSwapped, this, &OpenGLWindow::onFrameSwapped);
+    m_latency.start();
 }
 
 OpenGLWindow::~OpenGLWindow()
 {
     makeCurrent();
+    m_renderThread.releasePresenter();
+    doneCurrent();
+
+    // Runs shutdownRender() on the render thread. Without one (never
+    // exposed) nothing reached the GPU.
+    if (m_renderThread.running())
+        m_renderThread.stop();
+    else
+        delete m_scene;
+}
+
+void OpenGLWindow::shutdownRender()
+{
     delete m_program;
+    delete m_sphereProgram;
+    m_sphereInstances.destroy();
+    m_upscaler.destroy();
+    m_gpuTimer.destroy();
+    m_exporter->destroy();
+    if (m_errorReadback.fence)
+        glDeleteSync(m_errorReadback.fence);
+    if (m_errorReadback.buffer) {
+        glUnmapNamedBuffer(m_errorReadback.buffer);
+        glDeleteBuffers(1, &m_errorReadback.buffer);
+    }
+    delete m_baker;
+    delete m_tracer;
     delete m_scene;
-    doneCurrent();
+    m_scene = nullptr;
+    if (m_quadVAO)
+        glDeleteVertexArrays(1, &m_quadVAO);
 }
 
 void OpenGLWindow::changeScene()
 {
-    m_sceneIndex = (m_sceneIndex + 1) % 2;
+    post([this]() { setSceneIndex((m_sceneIndex + 1) % SceneCount); });
+}
+
+void OpenGLWindow::setSceneIndex(int index)
+{
+    m_sceneIndex = index;
+    m_loadedMeshPaths.clear();
 
-    makeCurrent();
     if (m_sceneIndex == 0)
     {
         m_scene->clear();
@@ -37,13 +87,64 @@ void OpenGLWindow::changeScene()
         m_scene->clear();
         m_scene->buildCornellBox();
     }
-    doneCurrent();
-    update();
+    else if (m_sceneIndex == 2)
+    {
+        m_scene->buildSphereField(SphereFieldCount);
+    }
+    requestFrame();
 }
 
 void OpenGLWindow::initializeGL()
 {
+    RenderThread::Callbacks callbacks;
+    const int w = width();
+    const int h = height();
+    const qreal dpr = devicePixelRatio();
+    callbacks.initialize = [this, w, h, dpr]() { initializeRender(w, h, dpr); };
+    callbacks.render = [this]() { renderFrame(); };
+    callbacks.shutdown = [this]() { shutdownRender(); };
+    // One queued repaint at a time; it presents whatever is newest by then.
+    callbacks.frameReady = [this]() {
+        if (!m_presentPending.exchange(true))
+            QMetaObject::invokeMethod(this, [this]() {
+                m_presentPending = false;
+                update();
+            }, Qt::QueuedConnection);
+    };
+    if (!m_renderThread.start(context(), callbacks))
+        qWarning() << "The view cannot render without its render thread";
+}
+
+void OpenGLWindow::resizeGL(int w, int h)
+{
+    const qreal dpr = devicePixelRatio();
+    post([this, w, h, dpr]() { resizeView(w, h, dpr); });
+}
+
+// Never waits for the render thread: a frame still in flight shows up
+// with the next repaint it triggers.
+void OpenGLWindow::paintGL()
+{
+    QElapsedTimer timer;
+    timer.start();
+    const qreal dpr = devicePixelRatio();
+    RenderThread::Presented presented = m_renderThread.present(defaultFramebufferObject(),
+                                                               qRound(width() * dpr), qRound(height() * dpr));
+    if (presented.newFrame && presented.inputNs)
+        m_swapInputNs = presented.inputNs;
+    m_latency.addPresent(timer.nsecsElapsed() / 1.0e6);
+}
 
+void OpenGLWindow::onFrameSwapped()
+{
+    if (!m_swapInputNs)
+        return;
+    m_latency.addInputToPhoton((RenderThread::now() - m_swapInputNs) / 1.0e6);
+    m_swapInputNs = 0;
+}
+
+void OpenGLWindow::initializeRender(int w, int h, qreal dpr)
+{
     initializeOpenGLFunctions();
     qDebug() << "OpenGL Version:" << (const char*)glGetString(GL_VERSION);
     qDebug() << "GLSL Version:"  << (const char*)glGetString(GL_SHADING_LANGUAGE_VERSION);
@@ -56,26 +157,24 @@ void OpenGLWindow::initializeGL()
     glBindVertexArray(m_quadVAO);
     glBindVertexArray(0);
 
-    glGenTextures(1, &m_computeTex);
-    glBindTexture(GL_TEXTURE_2D, m_computeTex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, qMax(1, width()), qMax(1, height()), 0, GL_RGBA, GL_FLOAT, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-
-    glGenTextures(1, &m_accumTex);
-    glBindTexture(GL_TEXTURE_2D, m_accumTex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, qMax(1, width()), qMax(1, height()), 0, GL_RGBA, GL_FLOAT, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glBindTexture(GL_TEXTURE_2D, 0);
-
+    m_viewWidth = qMax(1, w);
+    m_viewHeight = qMax(1, h);
+    m_renderThread.resizeFrames(qRound(m_viewWidth * dpr), qRound(m_viewHeight * dpr));
+
+    m_tracer = new PathTracer();
+    m_tracer->initialize(m_viewWidth, m_viewHeight);
+    m_tracer->setTileBudget(m_tileBudgetMs);
+    m_tracer->setReleaseCpuGeometry(m_releaseCpuGeometry);
+    m_tracer->setClusterPoolBudget(qint64(m_clusterPoolMb) << 20);
+    m_tracer->setHybrid(m_hybrid);
+    m_tracer->setGuiding(m_guiding);
+    m_tracer->setDispatch(m_persistentThreads ? PathTracer::PersistentDispatch : PathTracer::TileDispatch);
+    m_exporter->initialize();
+    m_gpuTimer.initialize();
 
     m_lastCamPos = m_camera.position();
     m_lastCamFront = m_camera.front();
     m_lastCamUp = m_camera.up();
-    m_accumFrame = 0;
 
     m_sceneIndex = 0;
     m_scene->buildPlaneSphere();
@@ -86,144 +185,158 @@ void OpenGLWindow::initializeGL()
     m_lastTimeMs = m_frameTimer.elapsed();
     m_camera.setPosition(QVector3D(0.0f, 1.5f, 5.0f));
     m_camera.setYawPitch(-90.0f, -10.0f);
+    m_camera.setPerspective(60.0f, float(m_viewWidth) / float(m_viewHeight), 0.1f, 100.0f);
+    requestFrame();
 }
 
-void OpenGLWindow::resizeGL(int w, int h)
+void OpenGLWindow::resizeView(int w, int h, qreal dpr)
 {
     if (h == 0) h = 1;
+    m_viewWidth = qMax(1, w);
+    m_viewHeight = h;
     float aspect = float(w) / float(h);
     m_camera.setPerspective(60.0f, aspect, 0.1f, 100.0f);
-    glViewport(0, 0, w, h);
-    glBindTexture(GL_TEXTURE_2D, m_computeTex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, qMax(1,w), qMax(1,h), 0, GL_RGBA, GL_FLOAT, nullptr);
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    if (m_accumTex) {
-        glBindTexture(GL_TEXTURE_2D, m_accumTex);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, qMax(1,w), qMax(1,h), 0, GL_RGBA, GL_FLOAT, nullptr);
-        glBindTexture(GL_TEXTURE_2D, 0);
-        m_accumFrame = 0;
-    }
+    // Full device resolution, so the presenter's copy is not a stretch.
+    m_renderThread.resizeFrames(qRound(m_viewWidth * dpr), qRound(m_viewHeight * dpr));
+
+    // A replay traces at the recorded resolution regardless of the window.
+    if (!m_replay.isActive())
+        m_tracer->resize(m_viewWidth, m_viewHeight);
+    requestFrame();
 }
 
 void OpenGLWindow::resetAccumulation()
 {
-    m_accumFrame = 0;
+    m_tracer->resetAccumulation();
+    requestFrame();
+}
 
-    if (m_accumTex) {
-        glBindTexture(GL_TEXTURE_2D, m_accumTex);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, qMax(1,width()), qMax(1,height()), 0, GL_RGBA, GL_FLOAT, nullptr);
-        glBindTexture(GL_TEXTURE_2D, 0);
-    }
+void OpenGLWindow::setTileBudget(double ms)
+{
+    m_tileBudgetMs = ms;
+    post([this, ms]() {
+        m_tracer->setTileBudget(ms);
+        requestFrame();
+    });
 }
 
+void OpenGLWindow::setReleaseCpuGeometry(bool release)
+{
+    m_releaseCpuGeometry = release;
+    post([this, release]() { m_tracer->setReleaseCpuGeometry(release); });
+}
 
-void OpenGLWindow::uploadSceneToGPU()
+void OpenGLWindow::setHybrid(bool hybrid)
 {
-    std::vector<GpuSphere> spheres;
-    std::vector<GpuSquare> squares;
-    std::vector<GpuLight>  lights;
+    m_hybrid = hybrid;
+    post([this, hybrid]() {
+        m_tracer->setHybrid(hybrid);
+        resetAccumulation();
+    });
+    qDebug() << "Hybrid primary visibility =" << hybrid;
+}
 
-    for (Mesh* mesh : m_scene->meshes())
-    {
-        if (mesh->isSphere)
-        {
-            GpuSphere s;
-            QVector3D pos = mesh->modelMatrix.map(QVector3D(0,0,0));
-            s.cx = pos.x(); s.cy = pos.y(); s.cz = pos.z();
-            s.radius = 1.0f;
-
-            s.diffuseR = mesh->material().color.x();
-            s.diffuseG = mesh->material().color.y();
-            s.diffuseB = mesh->material().color.z();
-            s.kd = mesh->material().kd;
-            s.ks = mesh->material().ks;
-            s.specularR = mesh->material().specularColor.x();
-            s.specularG = mesh->material().specularColor.y();
-            s.specularB = mesh->material().specularColor.z();
-            s.shininess=mesh->material().shininess;
-
-            s.pad1=0.0f;
-            s.pad2=0.0f;
-            s.pad3=0.0f;
-            spheres.push_back(s);
-        }
-        else
-        {
-            GpuSquare sq;
-
-            QVector3D A = mesh->modelMatrix.map(mesh->m_Vertices[0].pos);
-            QVector3D B = mesh->modelMatrix.map(mesh->m_Vertices[1].pos);
-            QVector3D C = mesh->modelMatrix.map(mesh->m_Vertices[2].pos);
-            QVector3D D = mesh->modelMatrix.map(mesh->m_Vertices[3].pos);
-
-            sq.ax = A.x(); sq.ay = A.y(); sq.az = A.z(); sq.padA=0.0f;
-            sq.bx = B.x(); sq.by = B.y(); sq.bz = B.z(); sq.padB=0.0f;
-            sq.cx = C.x(); sq.cy = C.y(); sq.cz = C.z(); sq.padC=0.0f;
-            sq.dx = D.x(); sq.dy = D.y(); sq.dz = D.z(); sq.padD=0.0f;
-
-            sq.diffuseR = mesh->material().color.x();
-            sq.diffuseG = mesh->material().color.y();
-            sq.diffuseB = mesh->material().color.z();
-            sq.kd = mesh->material().kd;
-            sq.ks = mesh->material().ks;
-            sq.specularR = mesh->material().specularColor.x();
-            sq.specularG = mesh->material().specularColor.y();
-            sq.specularB = mesh->material().specularColor.z();
-            sq.shininess=mesh->material().shininess;
-
-            squares.push_back(sq);
-        }
-    }
+void OpenGLWindow::setGuiding(bool guiding)
+{
+    m_guiding = guiding;
+    post([this, guiding]() {
+        m_tracer->setGuiding(guiding);
+        requestFrame();
+    });
+    qDebug() << "Path guiding =" << guiding;
+}
 
-    // --- LIGHTS ---
-    for (auto &l : m_scene->lights())
-    {
-        GpuLight g;
-        g.px = l.position.x();
-        g.py = l.position.y();
-        g.pz = l.position.z();
-        g.intensity = l.intensity;
+void OpenGLWindow::setPersistentThreads(bool persistent)
+{
+    m_persistentThreads = persistent;
+    const PathTracer::Dispatch dispatch = persistent ? PathTracer::PersistentDispatch : PathTracer::TileDispatch;
+    post([this, dispatch]() { m_tracer->setDispatch(dispatch); });
+    qDebug() << "Dispatch =" << PathTracer::dispatchName(dispatch);
+}
 
-        g.r = l.color.x();
-        g.g = l.color.y();
-        g.b = l.color.z();
-        g.pad0 = 0.0f;
-        lights.push_back(g);
-    }
+void OpenGLWindow::setClusterPoolBudget(int mb)
+{
+    m_clusterPoolMb = mb;
+    post([this, mb]() { m_tracer->setClusterPoolBudget(qint64(mb) << 20); });
+}
+
+void OpenGLWindow::retuneWorkgroup()
+{
+    post([this]() {
+        m_workgroupPending = true;
+        m_retuneWorkgroup = true;
+        requestFrame();
+    });
+}
 
-    m_gpuSphereCount = spheres.size();
-    m_gpuSquareCount = squares.size();
-    m_gpuLightCount  = lights.size();
+void OpenGLWindow::setBakeLighting(bool bake)
+{
+    m_bakeLighting = bake;
+    // Back to the key light; the next bake starts over, or from its cache.
+    post([this, bake]() {
+        if (!bake && m_baker) {
+            delete m_baker;
+            m_baker = nullptr;
+            for (Mesh *mesh : m_scene->meshes())
+                mesh->clearBaked();
+        }
+        requestFrame();
+    });
+    qDebug() << "Baked lighting =" << bake;
+}
 
-    // Upload buffers
-    if (!m_ssboSpheres) glGenBuffers(1, &m_ssboSpheres);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_ssboSpheres);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GpuSphere)*spheres.size(),
-                 spheres.data(), GL_DYNAMIC_DRAW);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_ssboSpheres);
+void OpenGLWindow::setRenderLoopSettings(const RenderLoop::Settings &settings)
+{
+    m_loopSettings = settings;
+    post([this, settings]() {
+        m_renderLoop.setSettings(settings);
+        requestFrame();
+    });
+}
 
-    if (!m_ssboLights) glGenBuffers(1, &m_ssboLights);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_ssboLights);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GpuLight)*lights.size(),
-                 lights.data(), GL_DYNAMIC_DRAW);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_ssboLights);
+void OpenGLWindow::runConvergenceHarness()
+{
+    post([this]() {
+        ConvergenceHarness harness;
+        QString report = harness.report(harness.run());
+        resetAccumulation();
+        emit convergenceReport(report);
+    });
+}
 
-    if (!m_squaresSSBO) glGenBuffers(1, &m_squaresSSBO);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_squaresSSBO);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GpuSquare)*squares.size(),
-                 squares.data(), GL_DYNAMIC_DRAW);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_squaresSSBO);
+void OpenGLWindow::exportImage(const QString &basePath, int formats)
+{
+    post([this, basePath, formats]() {
+        if (!m_useRaytracing || m_tracer->accumFrame() == 0) {
+            qWarning() << "Nothing to export: switch to ray tracing mode (R) first";
+            return;
+        }
+        if (!m_exporter->capture(m_tracer->accumBuffer(), m_tracer->width(), m_tracer->height(),
+                                 m_tracer->accumFrame(), basePath, formats))
+            qWarning() << "Export queue full, try again in a moment";
+        requestFrame();
+    });
+}
 
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+void OpenGLWindow::setCheckpoints(int everySpp, const QString &directory, int formats)
+{
+    post([this, everySpp, directory, formats]() { m_exporter->setCheckpoints(everySpp, directory, formats); });
 }
 
-void OpenGLWindow::doRayTrace()
+
+void OpenGLWindow::advanceCamera()
 {
     qint64 now = m_frameTimer.elapsed();
     float dt = (now - m_lastTimeMs) / 1000.0f;
     m_lastTimeMs = now;
 
+    // The first frame after an idle period must not jump the camera.
+    dt = qMin(dt, MaxFrameDt);
+
+    // Replays integrate on a fixed step so runs are comparable across machines.
+    if (m_replay.isActive())
+        dt = ReplayDriver::FixedDt;
+
     QVector3D dir = inputDirection();
     QVector3D worldMove(0.0f, 0.0f, 0.0f);
     if (!dir.isNull()) {
@@ -233,72 +346,115 @@ void OpenGLWindow::doRayTrace()
     }
     m_camera.processKeyboard(worldMove, dt);
 
+    m_recorder.recordCamera(m_camera);
+}
+
+void OpenGLWindow::doRayTrace()
+{
+    advanceCamera();
+
     if ( (m_camera.position() - m_lastCamPos).length() > 1e-4f ||
         (m_camera.front() - m_lastCamFront).length() > 1e-4f ||
         (m_camera.up() - m_lastCamUp).length() > 1e-4f )
     {
         resetAccumulation();
+        m_renderLoop.cameraMoved();
         m_lastCamPos   = m_camera.position();
         m_lastCamFront = m_camera.front();
         m_lastCamUp    = m_camera.up();
     }
 
-    m_computeProgram->bind();
+    applyMotionResolution();
 
-    m_computeProgram->setUniformValue("u_sphereCount",  m_gpuSphereCount);
-    m_computeProgram->setUniformValue("u_lightCount",   m_gpuLightCount);
-    m_computeProgram->setUniformValue("u_squareCount",  m_gpuSquareCount);
+    pollErrorCheck();
 
-    m_computeProgram->setUniformValue("u_camPos",   m_camera.position());
-    m_computeProgram->setUniformValue("u_camFront", m_camera.front());
-    m_computeProgram->setUniformValue("u_camRight", m_camera.right());
-    m_computeProgram->setUniformValue("u_camUp",    m_camera.up());
-    m_computeProgram->setUniformValue("u_fovDeg",   60.0f);
+    // Keep tracing while clusters are paged in: every arrival restarts the image.
+    if (m_renderLoop.needsSamples(m_tracer->accumFrame()) || m_tracer->streaming()) {
+        const RenderLoop::Settings &loop = m_renderLoop.settings();
+        m_tracer->setSampleCap(loop.mode == RenderLoop::Benchmark ? 0 : loop.targetSpp);
+        m_tracer->traceFrame(m_camera, 60.0f);
+        m_exporter->onFrameTraced(m_tracer->accumBuffer(), m_tracer->width(), m_tracer->height(),
+                                  m_tracer->accumFrame());
 
-    m_computeProgram->setUniformValue("u_width",  width());
-    m_computeProgram->setUniformValue("u_height", height());
-    m_computeProgram->setUniformValue("u_frameIndex", m_accumFrame);
+        if (m_renderLoop.wantsErrorCheck(m_tracer->accumFrame()))
+            queueErrorCheck();
+    }
 
-    glBindImageTexture(0, m_accumTex, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+    m_upscaler.draw(m_tracer->frame(), m_quadVAO);
+}
 
-    int gx = (width()  + 15) / 16;
-    int gy = (height() + 15) / 16;
-    glDispatchCompute(gx, gy, 1);
+// Copies the accumulation into a persistently mapped buffer behind the
+// frame's dispatches; one check is in flight at a time.
+void OpenGLWindow::queueErrorCheck()
+{
+    ErrorReadback &r = m_errorReadback;
+    if (r.fence)
+        return;
+
+    const GLsizeiptr bytes = GLsizeiptr(m_tracer->width()) * m_tracer->height() * 3 * GLsizeiptr(sizeof(float));
+    if (r.size != bytes) {
+        if (r.buffer) {
+            glUnmapNamedBuffer(r.buffer);
+            glDeleteBuffers(1, &r.buffer);
+        }
+        const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glCreateBuffers(1, &r.buffer);
+        glNamedBufferStorage(r.buffer, bytes, nullptr, flags);
+        r.mapped = static_cast<const float*>(glMapNamedBufferRange(r.buffer, 0, bytes, flags));
+        r.size = bytes;
+    }
+    if (!r.mapped)
+        return;
 
-    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glCopyNamedBufferSubData(m_tracer->accumBuffer(), r.buffer, 0, 0, bytes);
+    r.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
 
-    m_computeProgram->release();
+    r.spp = m_tracer->accumFrame();
+    r.width = m_tracer->width();
+    r.height = m_tracer->height();
+    r.generation = m_tracer->generation();
+}
 
-    glDisable(GL_DEPTH_TEST);
-    m_screenProgram->bind();
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, m_accumTex);
-    m_screenProgram->setUniformValue("tex", 0);
+// Hands a finished copy to the render loop; a copy from before the last
+// restart of the accumulation is dropped.
+void OpenGLWindow::pollErrorCheck()
+{
+    ErrorReadback &r = m_errorReadback;
+    if (!r.fence)
+        return;
 
-    glBindVertexArray(m_quadVAO);
-    glDrawArrays(GL_TRIANGLES, 0, 3);
-    glBindVertexArray(0);
+    GLenum status = glClientWaitSync(r.fence, 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        return;
+    glDeleteSync(r.fence);
+    r.fence = nullptr;
 
-    m_screenProgram->release();
+    if (r.generation != m_tracer->generation())
+        return;
+    const size_t floats = size_t(r.width) * r.height * 3;
+    m_renderLoop.addErrorCheck(r.spp, r.width, r.height, std::vector<float>(r.mapped, r.mapped + floats));
+}
 
-    m_accumFrame = qMin(m_accumFrame + 1, 1000000);
-    update();
+// Cheaper tracing while the camera moves; the accumulation restarts at
+// full resolution once the view has been still for the motion hold.
+void OpenGLWindow::applyMotionResolution()
+{
+    RenderLoop::MotionResolution motion = m_renderLoop.inMotion()
+        ? m_renderLoop.settings().motionResolution : RenderLoop::FullResolution;
+
+    switch (motion) {
+    case RenderLoop::Checkerboard: m_tracer->setResolution(PathTracer::Checkerboard); break;
+    case RenderLoop::Scale67:      m_tracer->setResolution(PathTracer::Scaled, 2.0f / 3.0f); break;
+    case RenderLoop::Scale50:      m_tracer->setResolution(PathTracer::Scaled, 0.5f); break;
+    default:                       m_tracer->setResolution(PathTracer::Native); break;
+    }
 }
 
 void OpenGLWindow::doRaster()
 {
-    qint64 now = m_frameTimer.elapsed();
-    float dt = (now - m_lastTimeMs) / 1000.0f;
-    m_lastTimeMs = now;
-
-    QVector3D dir = inputDirection();
-    QVector3D worldMove(0.0f, 0.0f, 0.0f);
-    if (!dir.isNull()) {
-        QVector3D forward = m_camera.front();
-        QVector3D right   = QVector3D::crossProduct(forward, QVector3D(0.0f, 1.0f, 0.0f)).normalized();
-        worldMove = forward * dir.z() + right * dir.x();
-    }
-    m_camera.processKeyboard(worldMove, dt);
+    advanceCamera();
 
     glClearColor(0.1f, 0.12f, 0.15f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -308,55 +464,261 @@ void OpenGLWindow::doRaster()
 
     QMatrix4x4 view = m_camera.viewMatrix();
     QMatrix4x4 proj;
-    float aspect = float(width()) / float(height() ? height() : 1);
+    float aspect = float(m_viewWidth) / float(m_viewHeight);
     proj.perspective(60.0f, aspect, 0.1f, 100.0f);
 
     if (m_program) {
         m_program->bind();
         m_program->setUniformValue("view", view);
         m_program->setUniformValue("proj", proj);
+        m_program->setUniformValue("u_lightmap", 0);
 
         for (Mesh* mesh : m_scene->meshes()) {
-            m_program->setUniformValue("model", mesh->modelMatrix * model);
+            QMatrix4x4 meshModel = mesh->modelMatrix * model;
+            m_program->setUniformValue("model", meshModel);
+            m_program->setUniformValue("normalMatrix", meshModel.normalMatrix());
+            m_program->setUniformValue("posMin", mesh->bounds().min);
+            m_program->setUniformValue("posExtent", mesh->bounds().extent);
+
+            const Mesh::Baked baked = m_bakeLighting ? mesh->baked() : Mesh::NotBaked;
+            m_program->setUniformValue("u_baked", int(baked));
+            m_program->setUniformValue("u_kd", mesh->material().kd);
+            if (baked == Mesh::BakedLightmap) {
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, mesh->lightmap());
+            }
             mesh->render();
         }
+        glBindTexture(GL_TEXTURE_2D, 0);
 
         m_program->release();
     }
 
-    update();
+    if (m_sphereProgram) {
+        m_sphereInstances.upload(*m_scene, false);
+        m_sphereProgram->bind();
+        m_sphereProgram->setUniformValue("view", view);
+        m_sphereProgram->setUniformValue("proj", proj);
+        m_sphereInstances.draw(m_sphereProgram);
+        m_sphereProgram->release();
+    }
 }
 
-void OpenGLWindow::paintGL()
+void OpenGLWindow::renderFrame()
 {
+    QElapsedTimer cpuTimer;
+    cpuTimer.start();
+
+    // Only replays record GPU frame times; other frames issue no queries.
+    const bool timed = m_replay.isActive();
+    if (timed)
+        beginReplayFrame();
+
+    if (m_tracerSizeDirty) {
+        m_tracer->resize(m_viewWidth, m_viewHeight);
+        m_tracerSizeDirty = false;
+    }
+
+    // The workgroup is picked on the first traced frame, once the tracer
+    // holds the scene it is timed on; outside the frame's GPU timer, whose
+    // query would overlap the tuner's.
+    if (m_useRaytracing && m_workgroupPending) {
+        m_tracer->uploadScene(m_scene);
+        WorkgroupTuner::apply(*m_tracer, m_camera, 60.0f, m_retuneWorkgroup);
+        m_workgroupPending = false;
+        m_retuneWorkgroup = false;
+    }
+
+    // Lighting bakes while rasterizing, a budgeted batch per frame, kept
+    // out of the frame's GPU time like the tuning above.
+    if (m_bakeLighting && !m_useRaytracing) {
+        if (!m_baker)
+            m_baker = new IrradianceBaker();
+        if (m_baker->sceneRevision() != m_scene->revision())
+            m_baker->start(m_scene);
+        m_baker->step();
+    }
+
+    if (timed)
+        m_gpuTimer.begin(m_replay.frameIndex());
+
     if(m_useRaytracing)
     {
-        uploadSceneToGPU();
+        m_tracer->uploadScene(m_scene);
         doRayTrace();
     }
     else
     {
         doRaster();
     }
+
+    if (timed) {
+        m_gpuTimer.end();
+        endReplayFrame(cpuTimer.nsecsElapsed() / 1.0e6);
+    }
+
+    m_exporter->poll();
+
+    m_renderLoop.frameRendered();
+    scheduleNextFrame();
 }
 
-void OpenGLWindow::loadShaders()
+void OpenGLWindow::scheduleNextFrame()
 {
-    m_computeProgram = new QOpenGLShaderProgram();
-    if (!m_computeProgram->addShaderFromSourceFile(QOpenGLShader::Compute, "src/shaders/raytrace.comp")) {
-        qWarning() << "Compute shader compile error:" << m_computeProgram->log();
+    if (m_replay.isActive() || m_renderLoop.continuous() || !inputDirection().isNull()) {
+        requestFrame();
+        return;
+    }
+
+    if (m_useRaytracing && (m_renderLoop.needsSamples(m_tracer->accumFrame()) || m_tracer->streaming())) {
+        // Unfocused windows leave most of the GPU to other applications.
+        requestFrame(m_applicationActive ? 0 : m_renderLoop.settings().backgroundIntervalMs);
+        return;
+    }
+
+    if (!m_useRaytracing && m_baker && m_baker->running()) {
+        requestFrame(m_applicationActive ? 0 : m_renderLoop.settings().backgroundIntervalMs);
+        return;
+    }
+
+    if (m_exporter->busy())
+        requestFrame(ExportPollIntervalMs);
+}
+
+void OpenGLWindow::beginReplayFrame()
+{
+    for (const InputEvent &ev : m_replay.nextFrameEvents()) {
+        switch (ev.type) {
+        case InputEvent::KeyPress:   applyKeyPress(ev.key); break;
+        case InputEvent::KeyRelease: applyKeyRelease(ev.key); break;
+        case InputEvent::MouseMove:  applyMouseDelta(ev.dx, ev.dy); break;
+        }
+    }
+}
+
+void OpenGLWindow::endReplayFrame(double cpuMs)
+{
+    m_replay.checkCamera(m_camera);
+
+    // Convergence is sampled every few frames with a synchronous readback,
+    // taken after the frame's CPU time was measured.
+    double delta = -1.0;
+    int spp = m_useRaytracing ? m_tracer->accumFrame() : 0;
+    if (m_useRaytracing && m_replay.frameIndex() % ReplayConvergenceInterval == 0) {
+        std::vector<float> current = m_tracer->readAccumulation();
+        if (spp > m_replaySnapshotSpp && m_replaySnapshot.size() == current.size()) {
+            double sum = 0.0;
+            for (size_t i = 0; i < current.size(); ++i)
+                sum += qAbs(double(current[i]) - double(m_replaySnapshot[i]));
+            delta = sum / double(current.size());
+        }
+        m_replaySnapshot.swap(current);
+        m_replaySnapshotSpp = spp;
     }
-    if (!m_computeProgram->link()) {
-        qWarning() << "Compute shader link error:" << m_computeProgram->log();
+
+    m_replay.recordFrame(cpuMs, spp, delta);
+    for (const auto &t : m_gpuTimer.collect())
+        m_replay.recordGpuTime(t.first, t.second);
+
+    if (m_replay.finished()) {
+        for (const auto &t : m_gpuTimer.collectBlocking())
+            m_replay.recordGpuTime(t.first, t.second);
+        finishReplay();
     }
+}
+
+void OpenGLWindow::finishReplay()
+{
+    m_replay.stop();
+    m_replay.writeReport();
+    m_replaySnapshot.clear();
+    m_keysPressed.clear();
+
+    // Back to the window resolution on the next frame, with the context current.
+    m_tracerSizeDirty = true;
+    m_tracer->setSeed(0);
+    requestFrame();
+    m_replaying = false;
+
+    emit replayFinished(m_replay.summary());
+}
+
+void OpenGLWindow::startRecording()
+{
+    m_recording = true;
+    post([this]() {
+        InputRecording header;
+        header.sceneIndex = m_sceneIndex;
+        header.meshPaths = m_loadedMeshPaths;
+        header.raytracing = m_useRaytracing;
+        header.samplerMode = int(m_tracer->samplerMode());
+        header.seed = m_tracer->seed();
+        header.width = m_tracer->width();
+        header.height = m_tracer->height();
+
+        m_recorder.start(header, m_camera);
+    });
+}
+
+void OpenGLWindow::stopRecording(const QString &path)
+{
+    m_recording = false;
+    post([this, path]() {
+        m_recorder.stop();
+        if (!path.isEmpty() && !m_recorder.recording().save(path))
+            qWarning() << "Unable to save the recording to" << path;
+    });
+}
+
+bool OpenGLWindow::startReplay(const QString &path, const QString &reportPath)
+{
+    InputRecording rec;
+    if (!rec.load(path))
+        return false;
+
+    // Also before the first expose (e.g. from the command line): the
+    // command runs once the render thread has initialized.
+    m_replaying = true;
+    m_recording = false;
+    post([this, rec, reportPath]() { beginReplay(rec, reportPath); });
+    return true;
+}
 
-    m_screenProgram = new QOpenGLShaderProgram();
-    if (!m_screenProgram->addShaderFromSourceFile(QOpenGLShader::Vertex,   "src/shaders/screen.vert"))
-        qWarning() << "Screen vertex compile error:" << m_screenProgram->log();
-    if (!m_screenProgram->addShaderFromSourceFile(QOpenGLShader::Fragment, "src/shaders/screen.frag"))
-        qWarning() << "Screen frag compile error:" << m_screenProgram->log();
-    if (!m_screenProgram->link())
-        qWarning() << "Screen program link error:" << m_screenProgram->log();
+void OpenGLWindow::beginReplay(const InputRecording &rec, const QString &reportPath)
+{
+    m_recorder.stop();
+
+    setSceneIndex(rec.sceneIndex);
+    for (const QString &meshPath : rec.meshPaths) {
+        if (QSharedPointer<MeshAsset> asset = AssetCache::instance().acquire(meshPath))
+            addMesh(asset, meshPath);
+    }
+
+    m_useRaytracing = rec.raytracing;
+    m_keysPressed.clear();
+
+    const CameraSample &start = rec.cameras.first();
+    m_camera.setPosition(start.position);
+    m_camera.setYawPitch(start.yaw, start.pitch);
+
+    m_tracer->setSamplerMode(Sampler::Mode(rec.samplerMode));
+    m_tracer->setSeed(rec.seed);
+    if (rec.width > 0 && rec.height > 0)
+        m_tracer->resize(rec.width, rec.height);
+    m_gpuTimer.collectBlocking(); // drop timings left by an earlier replay
+
+    resetAccumulation();
+    m_replaySnapshot.clear();
+    m_replaySnapshotSpp = 0;
+    m_lastTimeMs = m_frameTimer.elapsed();
+
+    m_replay.start(rec, reportPath);
+    requestFrame();
+}
+
+void OpenGLWindow::loadShaders()
+{
+    m_upscaler.initialize();
 
     m_program = new QOpenGLShaderProgram();
     bool ok = m_program->addShaderFromSourceFile(QOpenGLShader::Vertex, "src/shaders/basic.vert");
@@ -367,6 +729,14 @@ void OpenGLWindow::loadShaders()
     if (!m_program->link()) {
         qWarning() << "Shader program link error:" << m_program->log();
     }
+
+    m_sphereProgram = new QOpenGLShaderProgram();
+    if (!m_sphereProgram->addShaderFromSourceFile(QOpenGLShader::Vertex, "src/shaders/sphere.vert"))
+        qWarning() << "Sphere vertex compile error:" << m_sphereProgram->log();
+    if (!m_sphereProgram->addShaderFromSourceFile(QOpenGLShader::Fragment, "src/shaders/basic.frag"))
+        qWarning() << "Sphere frag compile error:" << m_sphereProgram->log();
+    if (!m_sphereProgram->link())
+        qWarning() << "Sphere program link error:" << m_sphereProgram->log();
 }
 
 void OpenGLWindow::keyPressEvent(QKeyEvent *ev)
@@ -379,29 +749,87 @@ void OpenGLWindow::keyPressEvent(QKeyEvent *ev)
         return;
     }
 
-    if (ev->key() == Qt::Key_W || ev->key() == Qt::Key_Z || ev->key() == Qt::Key_S || ev->key() == Qt::Key_A || ev->key() == Qt::Key_D) {
+    if (m_replaying) {
+        if (ev->key() == Qt::Key_Escape)
+            post([this]() {
+                if (m_replay.isActive())
+                    finishReplay();
+            });
+        return;
+    }
+
+    // Stamped: the frame that applies the key measures input to photon.
+    int key = ev->text() == "+" ? int(Qt::Key_Plus) : ev->key();
+    post([this, key]() {
+        m_recorder.recordKey(true, key);
+        applyKeyPress(key);
+    }, RenderThread::now());
+
+    QOpenGLWindow::keyPressEvent(ev);
+}
+
+void OpenGLWindow::keyReleaseEvent(QKeyEvent *ev)
+{
+    if (m_replaying)
+        return;
+
+    int key = ev->text() == "+" ? int(Qt::Key_Plus) : ev->key();
+    post([this, key]() {
+        m_recorder.recordKey(false, key);
+        applyKeyRelease(key);
+    });
+
+    QOpenGLWindow::keyReleaseEvent(ev);
+}
+
+void OpenGLWindow::applyKeyPress(int key)
+{
+    if (key == Qt::Key_W || key == Qt::Key_Z || key == Qt::Key_S || key == Qt::Key_A || key == Qt::Key_D) {
         resetAccumulation();
     }
 
-    if (ev->key() == Qt::Key_Plus || ev->text() == "+") {
-        changeScene();
+    if (key == Qt::Key_Plus) {
+        setSceneIndex((m_sceneIndex + 1) % SceneCount);
     }
 
-    if (ev->key() == Qt::Key_R) {
+    if (key == Qt::Key_N) {
+        Sampler::Mode mode = Sampler::Mode((m_tracer->samplerMode() + 1) % Sampler::ModeCount);
+        m_tracer->setSamplerMode(mode);
+        resetAccumulation();
+        qDebug() << "Sampler =" << Sampler::modeName(mode);
+    }
+
+    if (key == Qt::Key_H)
+        setHybrid(!m_hybrid);
+
+    if (key == Qt::Key_P)
+        setPersistentThreads(!m_persistentThreads);
+
+    if (key == Qt::Key_G)
+        setGuiding(!m_guiding);
+
+    if (key == Qt::Key_B)
+        setBakeLighting(!m_bakeLighting);
+
+    if (key == Qt::Key_R) {
         m_useRaytracing = !m_useRaytracing;
         resetAccumulation();
         qDebug() << "Raytracing mode =" << m_useRaytracing;
     }
 
+    m_keysPressed.insert(key);
+    requestFrame();
+}
 
-    m_keysPressed.insert(ev->key());
-    QOpenGLWindow::keyPressEvent(ev);
+void OpenGLWindow::applyKeyRelease(int key)
+{
+    m_keysPressed.remove(key);
 }
 
-void OpenGLWindow::keyReleaseEvent(QKeyEvent *ev)
+void OpenGLWindow::applyMouseDelta(float dx, float dy)
 {
-    m_keysPressed.remove(ev->key());
-    QOpenGLWindow::keyReleaseEvent(ev);
+    m_camera.processMouseMovement(dx, -dy);
+    resetAccumulation();
 }
 
 QVector3D OpenGLWindow::inputDirection() const
@@ -421,6 +849,7 @@ void OpenGLWindow::mousePressEvent(QMouseEvent *ev)
 {
     if (ev->button() == Qt::LeftButton && !m_fpsActive) {
         m_fpsActive = true;
+        post([this]() { m_tracer->clearFocus(); });
         m_lastMousePos = ev->position();
         setCursor(Qt::BlankCursor);
         setKeyboardGrabEnabled(true);
@@ -435,6 +864,12 @@ void OpenGLWindow::mouseMoveEvent(QMouseEvent *ev)
 {
     if (!m_fpsActive) {
         m_lastMousePos = ev->position();
+        // The free cursor steers which tiles are refined first.
+        if (width() > 0 && height() > 0) {
+            const float fx = float(ev->position().x()) / width();
+            const float fy = 1.0f - float(ev->position().y()) / height();
+            post([this, fx, fy]() { m_tracer->setFocus(fx * m_tracer->width(), fy * m_tracer->height()); });
+        }
         QOpenGLWindow::mouseMoveEvent(ev);
         return;
     }
@@ -443,8 +878,15 @@ void OpenGLWindow::mouseMoveEvent(QMouseEvent *ev)
     QPointF delta = cur - m_lastMousePos;
     m_lastMousePos = cur;
 
-    m_camera.processMouseMovement(delta.x(), -delta.y());
-    resetAccumulation();
+    if (m_replaying)
+        return;
+
+    const float dx = delta.x();
+    const float dy = delta.y();
+    post([this, dx, dy]() {
+        m_recorder.recordMouse(dx, dy);
+        applyMouseDelta(dx, dy);
+    }, RenderThread::now());
 }
 
 void OpenGLWindow::focusOutEvent(QFocusEvent *ev)
@@ -459,74 +901,43 @@ void OpenGLWindow::focusOutEvent(QFocusEvent *ev)
     QOpenGLWindow::focusOutEvent(ev);
 }
 
-void OpenGLWindow::loadOffFile(const QString &fileName,
-                               QVector<Mesh::Vertex> &verts,
-                               QVector<unsigned int> &idx)
+void OpenGLWindow::openMesh(const QSharedPointer<MeshAsset> &asset, const QString &sourcePath)
 {
-    QFile file(fileName);
-    if (!file.open(QIODevice::ReadOnly)) {
-        qWarning() << "Unable to open OFF file:" << fileName;
-    }
-
-    QTextStream in(&file);
-
-    QString header;
-    in >> header;
-    if (header != "OFF") {
-        qWarning() << "Invalid OFF file:" << fileName;
-    }
-
-    int vertexCount = 0;
-    int faceCount = 0;
-    int edgeCount = 0;
-    in >> vertexCount >> faceCount >> edgeCount;
-
-    if (vertexCount <= 0 || faceCount <= 0) {
-        qWarning() << "Invalid mesh size";
-    }
-
-    verts.clear();
-    idx.clear();
-
-    verts.reserve(vertexCount);
-    idx.reserve(faceCount * 3);
-
-    QVector3D defaultColor(1.0f, 1.0f, 1.0f);
-
-    std::vector<QVector3D> positions;
-    positions.reserve(vertexCount);
-
-    for (int i = 0; i < vertexCount; ++i) {
-        float x, y, z;
-        in >> x >> y >> z;
-        positions.emplace_back(x, y, z);
-    }
+    post([this, asset, sourcePath]() { addMesh(asset, sourcePath); });
+}
 
-    for (auto &p : positions)
-        verts.append({p, defaultColor});
+void OpenGLWindow::addMesh(const QSharedPointer<MeshAsset> &asset, const QString &sourcePath)
+{
+    Mesh* mesh = new Mesh();
+    mesh->initialize(asset);
+    mesh->modelMatrix.setToIdentity();
+    if (!sourcePath.isEmpty())
+        mesh->setName(QFileInfo(sourcePath).fileName());
 
-    for (int i = 0; i < faceCount; ++i) {
-        int n, a, b, c;
-        in >> n >> a >> b >> c;
+    m_scene->addMesh(mesh);
 
-        if (n != 3) {
-            qWarning() << "Non triangular face encountered. Only triangles are supported!";
-        }
+    qDebug() << "Mesh:" << mesh->vertexCount() << "vertices," << mesh->indexCount() / 3 << "triangles,"
+             << mesh->bytesPerVertex() << "bytes/vertex (float position + color: 24)";
+    qDebug().noquote() << AssetCache::instance().summary();
 
-        idx.append(static_cast<unsigned int>(a));
-        idx.append(static_cast<unsigned int>(b));
-        idx.append(static_cast<unsigned int>(c));
-    }
+    if (!sourcePath.isEmpty())
+        m_loadedMeshPaths.append(sourcePath);
+    requestFrame();
 }
 
-void OpenGLWindow::openOffMesh(const QVector<Mesh::Vertex> &verts,
-                               const QVector<unsigned int> &idx)
+void OpenGLWindow::addClusteredMesh(ClusteredMesh *mesh)
 {
-    Mesh* mesh = new Mesh();
-    mesh->initialize(verts, idx);
-    mesh->modelMatrix.setToIdentity();
+    post([this, mesh]() {
+        mesh->modelMatrix.setToIdentity();
+        m_scene->addClusteredMesh(mesh);
 
-    m_scene->addMesh(mesh);
+        qDebug() << "Out-of-core mesh:" << mesh->triangleCount() << "triangles in"
+                 << mesh->clusters().size() << "clusters";
+
+        if (!m_useRaytracing)
+            qInfo() << "Out-of-core meshes are only drawn by the path tracer";
+        requestFrame();
+    });
 }
 
 
@@ -11,21 +11,99 @@
 #include "scene/mesh.h"
 #include "renderer/camera.h"
 #include "scene/scene.h"
-
+#include "renderer/gputimer.h"
+#include "renderer/inputrecorder.h"
+#include "renderer/latencymonitor.h"
+#include "renderer/renderloop.h"
+#include "renderer/renderthread.h"
+#include "renderer/sphereinstances.h"
+#include "renderer/upscaler.h"
+#include <atomic>
+
+class PathTracer;
+class ImageExporter;
+class IrradianceBaker;
+class ClusteredMesh;
+
+// The interactive view. Its GL work runs on a RenderThread with a context
+// shared with the window's: the tracer, the scene, the camera and the
+// replay state belong to that thread, and paintGL only copies the newest
+// finished frame to the screen. The public methods and the input events
+// run on the GUI thread and post commands to the render thread; the
+// getters read copies that are safe to read there.
 class OpenGLWindow : public QOpenGLWindow, protected QOpenGLFunctions_4_5_Core
 {
     Q_OBJECT
 public:
     explicit OpenGLWindow(QWindow *parent = nullptr);
     ~OpenGLWindow();
-    void openOffMesh(const QVector<Mesh::Vertex> &verts,
-                     const QVector<unsigned int> &idx);
-    static void loadOffFile(const QString &fileName,
-                     QVector<Mesh::Vertex> &verts,
-                     QVector<unsigned int> &idx);
+    // Adds a mesh drawing asset, taking over its AssetCache reference.
+    void openMesh(const QSharedPointer<MeshAsset> &asset, const QString &sourcePath);
+    // Takes an opened out-of-core mesh; only the path tracer draws it.
+    void addClusteredMesh(ClusteredMesh *mesh);
     void changeScene();
+    // Runs on the render thread; the report arrives with convergenceReport().
+    void runConvergenceHarness();
+
+    ImageExporter *exporter() const { return m_exporter; }
+    void exportImage(const QString &basePath, int formats);
+    void setCheckpoints(int everySpp, const QString &directory, int formats);
+
+    void startRecording();
+    // Saves the recording to path (nothing when empty); failures are logged.
+    void stopRecording(const QString &path);
+    bool isRecording() const { return m_recording; }
+    // False when the recording cannot be read.
+    bool startReplay(const QString &path, const QString &reportPath);
+    bool isReplaying() const { return m_replaying; }
+
+    void setRenderLoopSettings(const RenderLoop::Settings &settings);
+    const RenderLoop::Settings& renderLoopSettings() const { return m_loopSettings; }
+
+    // Input-to-photon latency and GUI responsiveness (LatencyMonitor).
+    QString latencySummary() const { return m_latency.summary(); }
+
+    // GPU time per frame for progressive tiles; 0 traces the whole image.
+    void setTileBudget(double ms);
+    double tileBudget() const { return m_tileBudgetMs; }
+
+    // Drops the CPU copy of loaded meshes once the tracer has uploaded them.
+    // Raster-only sessions keep it: the tracer still needs it for its BVH.
+    void setReleaseCpuGeometry(bool release);
+    bool releaseCpuGeometry() const { return m_releaseCpuGeometry; }
+
+    // Rasterized camera-ray hits for the path tracer (PathTracer::setHybrid); H toggles it.
+    void setHybrid(bool hybrid);
+    bool hybrid() const { return m_hybrid; }
+
+    // Path guiding for the tracer (PathTracer::setGuiding); G toggles it.
+    void setGuiding(bool guiding);
+    bool guiding() const { return m_guiding; }
+
+    // Persistent-threads dispatch for the tracer (PathTracer::PersistentDispatch); P toggles it.
+    void setPersistentThreads(bool persistent);
+    bool persistentThreads() const { return m_persistentThreads; }
+
+    // GPU pool for out-of-core clusters, in MiB; applies to the next mesh change.
+    void setClusterPoolBudget(int mb);
+    int clusterPoolBudget() const { return m_clusterPoolMb; }
+
+    // Benchmarks the compute workgroup shapes again (WorkgroupTuner) on the
+    // next ray traced frame and keeps the fastest for this device.
+    void retuneWorkgroup();
+
+    // Raster mode shows path-traced lighting baked into the meshes
+    // (IrradianceBaker), baked in the background while rasterizing and
+    // again whenever the scene changes; B toggles it.
+    void setBakeLighting(bool bake);
+    bool bakeLighting() const { return m_bakeLighting; }
+
+signals:
+    void replayFinished(const QString &summary);
+    void convergenceReport(const QString &report);
 
 protected:
+    // GUI thread: start the render thread, forward the size, present.
     void initializeGL() override;
     void resizeGL(int w, int h) override;
     void paintGL() override;
@@ -37,9 +115,36 @@ protected:
     void focusOutEvent(QFocusEvent *ev) override;
     void resetAccumulation();
 private:
+    void post(std::function<void()> run, qint64 inputNs = 0) { m_renderThread.post(std::move(run), inputNs); }
+    void onFrameSwapped();
+
+    // Render thread from here on.
+    // w and h in window units; frames are allocated in device pixels.
+    void initializeRender(int w, int h, qreal dpr);
+    void renderFrame();
+    void shutdownRender();
+    void resizeView(int w, int h, qreal dpr);
+    void requestFrame(int delayMs = 0) { m_renderThread.requestFrame(delayMs); }
+    void addMesh(const QSharedPointer<MeshAsset> &asset, const QString &sourcePath);
+    void beginReplay(const InputRecording &rec, const QString &reportPath);
 
     void doRayTrace();
     void doRaster();
+    void advanceCamera();
+    void scheduleNextFrame();
+    void applyMotionResolution();
+    void queueErrorCheck();
+    void pollErrorCheck();
+    void setSceneIndex(int index);
+
+    // Shared by live events and replay
+    void applyKeyPress(int key);
+    void applyKeyRelease(int key);
+    void applyMouseDelta(float dx, float dy);
+
+    void beginReplayFrame();
+    void endReplayFrame(double cpuMs);
+    void finishReplay();
 
     QStatusBar * statusbar;
     bool m_useRaytracing = false;
@@ -47,40 +152,78 @@ private:
     void loadShaders();
 
     QVector3D inputDirection() const;
-    void uploadSceneToGPU();
     QOpenGLShaderProgram *m_program { nullptr };
+    QOpenGLShaderProgram *m_sphereProgram { nullptr };
+    SphereInstances m_sphereInstances;
     Scene *m_scene { nullptr };
     Camera m_camera;
     QElapsedTimer m_frameTimer;
     qint64 m_lastTimeMs {0};
     QSet<int> m_keysPressed;
     int m_sceneIndex = 0;
-
+    static constexpr int SceneCount = 3;
+    static constexpr int SphereFieldCount = 100000;
+    QStringList m_loadedMeshPaths;
+
+    InputRecorder m_recorder;
+    ReplayDriver m_replay;
+    GpuTimer m_gpuTimer;
+    std::vector<float> m_replaySnapshot;
+    int m_replaySnapshotSpp = 0;
+    bool m_tracerSizeDirty = false;
+    static constexpr int ReplayConvergenceInterval = 16;
+
+    RenderLoop m_renderLoop;
+    // Accumulation copy for the convergence check, read once its fence has
+    // signalled so the interactive loop never waits on the GPU.
+    struct ErrorReadback {
+        GLuint buffer = 0;
+        GLsizeiptr size = 0;
+        const float *mapped = nullptr;
+        GLsync fence = nullptr;
+        int spp = 0;
+        int width = 0;
+        int height = 0;
+        quint32 generation = 0;
+    } m_errorReadback;
+    bool m_workgroupPending = true;
+    bool m_retuneWorkgroup = false;
+    int m_viewWidth = 1;
+    int m_viewHeight = 1;
+    static constexpr int ExportPollIntervalMs = 10;
+    static constexpr float MaxFrameDt = 0.1f;
+
+    // Written by the setters (any thread), read by the getters and when
+    // the render thread starts.
+    std::atomic<double> m_tileBudgetMs { 12.0 };
+    std::atomic<bool> m_releaseCpuGeometry { false };
+    std::atomic<int> m_clusterPoolMb { 256 };
+    std::atomic<bool> m_hybrid { false };
+    std::atomic<bool> m_persistentThreads { false };
+    std::atomic<bool> m_guiding { false };
+    std::atomic<bool> m_bakeLighting { false };
+    std::atomic<bool> m_applicationActive { true };
+    std::atomic<bool> m_replaying { false };
+    std::atomic<bool> m_presentPending { false };
+
+    // GUI thread.
+    RenderThread m_renderThread;
+    LatencyMonitor m_latency;
+    RenderLoop::Settings m_loopSettings;
+    bool m_recording = false;
+    qint64 m_swapInputNs = 0;
     bool m_fpsActive { false };
     QPointF m_lastMousePos;
 
-    GLuint m_computeTex = 0;
-    QOpenGLShaderProgram* m_computeProgram = nullptr;
-    QOpenGLShaderProgram* m_screenProgram  = nullptr;
-
-    GLuint m_ssboSpheres = 0;
-    GLuint m_ssboLights  = 0;
-    GLuint m_squaresSSBO = 0;
+    PathTracer *m_tracer { nullptr };
+    ImageExporter *m_exporter { nullptr };
+    IrradianceBaker *m_baker { nullptr };
+    Upscaler m_upscaler;
 
     GLuint m_quadVAO = 0;
-    GLuint m_accumTex = 0;
-    int m_accumFrame = 0;
     int m_maxBounces = 4;
 
     QVector3D m_lastCamPos;
     QVector3D m_lastCamFront;
     QVector3D m_lastCamUp;
-
-    int m_gpuSphereCount = 0;
-    int m_gpuLightCount = 0;
-    int m_gpuSquareCount = 0;
-
-
-
-
 };
@@ -0,0 +1,84 @@
+#include "pathguide.h"
+#include <QDebug>
+#include "renderer/memorytracker.h"
+
+bool PathGuide::initialize()
+{
+    initializeOpenGLFunctions();
+
+    m_buildProgram = new QOpenGLShaderProgram();
+    if (!m_buildProgram->addShaderFromSourceFile(QOpenGLShader::Compute, "src/shaders/guide.comp"))
+        qWarning() << "Guide build compile error:" << m_buildProgram->log();
+    if (!m_buildProgram->link()) {
+        qWarning() << "Guide build link error:" << m_buildProgram->log();
+        delete m_buildProgram;
+        m_buildProgram = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void PathGuide::destroy()
+{
+    delete m_buildProgram;
+    m_buildProgram = nullptr;
+    GLuint buffers[] = { m_training, m_sampling };
+    for (GLuint buffer : buffers)
+        if (buffer) glDeleteBuffers(1, &buffer);
+    m_training = m_sampling = 0;
+    MemoryTracker::instance().release(this);
+}
+
+void PathGuide::reset(const QVector3D &boundsMin, const QVector3D &boundsMax)
+{
+    if (!m_buildProgram)
+        return;
+
+    const GLsizeiptr bytes = GLsizeiptr(CellCount) * (Bins + 1) * sizeof(quint32);
+    if (!m_training) {
+        glCreateBuffers(1, &m_training);
+        glNamedBufferStorage(m_training, bytes, nullptr, GL_DYNAMIC_STORAGE_BIT);
+        glCreateBuffers(1, &m_sampling);
+        glNamedBufferStorage(m_sampling, bytes, nullptr, GL_DYNAMIC_STORAGE_BIT);
+        MemoryTracker &mem = MemoryTracker::instance();
+        mem.track(this, "guideTraining", "tracer", MemoryTracker::GpuBuffer, bytes);
+        mem.track(this, "guideSampling", "tracer", MemoryTracker::GpuBuffer, bytes);
+    }
+    // Zero bits are zero floats: empty histograms, no distributions.
+    glClearNamedBufferData(m_training, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glClearNamedBufferData(m_sampling, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+    const QVector3D extent = boundsMax - boundsMin;
+    const float side = qMax(extent.x(), qMax(extent.y(), extent.z()));
+    m_cellSize = side > 0.0f ? side / CellsPerSide : 1.0f;
+    m_iteration = 0;
+    m_iterationSamples = 0;
+}
+
+void PathGuide::afterTrace(qint64 samples, qint64 imagePixels)
+{
+    if (!training())
+        return;
+    m_iterationSamples += samples;
+    if (m_iterationSamples < (qint64(1) << m_iteration) * imagePixels)
+        return;
+
+    build();
+    ++m_iteration;
+    m_iterationSamples = 0;
+}
+
+void PathGuide::build()
+{
+    m_buildProgram->bind();
+    bind(17, 18);
+    glDispatchCompute(CellCount, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    m_buildProgram->release();
+}
+
+void PathGuide::bind(GLuint training, GLuint sampling)
+{
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, training, m_training);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, sampling, m_sampling);
+}
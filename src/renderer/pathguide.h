@@ -0,0 +1,60 @@
+#pragma once
+#include <QOpenGLFunctions_4_5_Core>
+#include <QOpenGLShaderProgram>
+#include <QVector3D>
+
+// Online path guiding for raytrace.comp: a spatial hash of world-space
+// cells, each with a histogram of the radiance that arrived at it from
+// every direction (8x8 equal-area bins over the sphere, z = cos theta by
+// phi). Paths train it when they finish: every bounce adds the luminance
+// its continuation brought back to the bin of the direction it took. The
+// bounces then sample a mix of the BSDF and their cell's distribution and
+// divide by the mixture's pdf, so the image converges to the same result
+// whatever the guide has learnt; it only changes the noise.
+//
+// Training runs in iterations of doubling length, 1, 2, 4... samples per
+// pixel of the traced image. At the end of one, guide.comp turns each
+// cell's histogram into the CDF the next iteration samples from; cells too
+// few paths reached keep the one they had. After MaxIterations the
+// distributions stay as they are and paths stop training. Cells live in
+// world space, so the guide survives camera moves; a new scene starts over.
+// Needs a current OpenGL 4.5 context; call destroy() before it goes away.
+class PathGuide : protected QOpenGLFunctions_4_5_Core
+{
+public:
+    // GUIDE_* in raytrace.comp and guide.comp.
+    static constexpr int CellCount = 1 << 15;
+    static constexpr int Bins = 64;
+    static constexpr int MaxIterations = 9;
+    // Cell size: the longest side of the scene's bounds over CellsPerSide.
+    static constexpr int CellsPerSide = 64;
+
+    bool initialize();
+    void destroy();
+
+    // Forgets what was learnt; allocates the buffers on first use.
+    void reset(const QVector3D &boundsMin, const QVector3D &boundsMax);
+    bool allocated() const { return m_training != 0; }
+    // After a dispatch that traced samples pixel samples of an image of
+    // imagePixels; ends the iteration when it is complete.
+    void afterTrace(qint64 samples, qint64 imagePixels);
+
+    bool training() const { return m_iteration < MaxIterations; }
+    // Distributions exist once the first iteration is over.
+    bool ready() const { return m_iteration > 0; }
+    int iteration() const { return m_iteration; }
+    float cellSize() const { return m_cellSize; }
+    void bind(GLuint training, GLuint sampling);
+
+private:
+    void build();
+
+    QOpenGLShaderProgram *m_buildProgram = nullptr;
+    // CellCount x (Bins + 1): fixed-point bin weights then the path count,
+    // and the bins' CDF then 1 when the cell has a distribution.
+    GLuint m_training = 0;
+    GLuint m_sampling = 0;
+    float m_cellSize = 1.0f;
+    int m_iteration = 0;
+    qint64 m_iterationSamples = 0;
+};
@@ -0,0 +1,950 @@
+#include "pathtracer.h"
+#include <QDebug>
+#include <QFile>
+#include <QOpenGLContext>
+#include <QVector2D>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include "scene/assetcache.h"
+#include "scene/clusteredmesh.h"
+#include "scene/mesh.h"
+#include "scene/scene.h"
+#include "gpu_stucts.h"
+#include "renderer/memorytracker.h"
+
+#ifndef GL_SM_COUNT_NV
+#define GL_WARP_SIZE_NV    0x9339
+#define GL_WARPS_PER_SM_NV 0x933A
+#define GL_SM_COUNT_NV     0x933B
+#endif
+
+PathTracer::PathTracer()
+{
+}
+
+PathTracer::~PathTracer()
+{
+    delete m_computeProgram;
+
+    GLuint textures[] = { m_guideTex, m_previewGuide };
+    for (GLuint texture : textures)
+        if (texture) glDeleteTextures(1, &texture);
+    GLuint targets[] = { m_accumBuffer, m_previewBuffer };
+    for (GLuint buffer : targets)
+        if (buffer) glDeleteBuffers(1, &buffer);
+    m_spheres.destroy();
+    m_gbuffer.destroy();
+    m_guide.destroy();
+    if (m_tileSSBO) glDeleteBuffers(1, &m_tileSSBO);
+    if (m_workQueue) glDeleteBuffers(1, &m_workQueue);
+    if (m_bakeSSBO) glDeleteBuffers(1, &m_bakeSSBO);
+    for (TileQuery &query : m_tileQueries)
+        if (query.ids[0]) glDeleteQueries(2, query.ids);
+    if (m_ssboLights) glDeleteBuffers(1, &m_ssboLights);
+    if (m_squaresSSBO) glDeleteBuffers(1, &m_squaresSSBO);
+    if (m_ssboSampler) glDeleteBuffers(1, &m_ssboSampler);
+
+    GLuint meshBuffers[] = { m_ssboMeshes, m_ssboMeshVertices, m_ssboMeshTriangles,
+                             m_ssboMeshBvh, m_ssboMeshColors };
+    for (GLuint buffer : meshBuffers)
+        if (buffer) glDeleteBuffers(1, &buffer);
+    m_clusterPool.destroy();
+    MemoryTracker::instance().release(this);
+}
+
+bool PathTracer::initialize(int width, int height)
+{
+    initializeOpenGLFunctions();
+
+    delete m_computeProgram;
+    m_computeProgram = compileProgram(m_workgroup);
+    if (!m_computeProgram)
+        return false;
+
+    GLuint *textures[] = { &m_guideTex, &m_previewGuide };
+    for (GLuint *texture : textures) {
+        glGenTextures(1, texture);
+        glBindTexture(GL_TEXTURE_2D, *texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glCreateBuffers(1, &m_accumBuffer);
+    glCreateBuffers(1, &m_previewBuffer);
+    // The screen pass binds the preview even before there is one.
+    glNamedBufferData(m_previewBuffer, 3 * sizeof(float), nullptr, GL_DYNAMIC_COPY);
+    resize(width, height);
+
+    for (TileQuery &query : m_tileQueries)
+        glGenQueries(2, query.ids);
+
+    uploadSamplerTables();
+    m_gbufferReady = m_gbuffer.initialize();
+    m_guideReady = m_guide.initialize();
+
+    // NVIDIA reports how many invocations its SMs keep resident; others get
+    // a count large enough to fill current desktop GPUs.
+    if (QOpenGLContext::currentContext()->hasExtension("GL_NV_shader_thread_group")) {
+        GLint sms = 0, warps = 0, warpSize = 0;
+        glGetIntegerv(GL_SM_COUNT_NV, &sms);
+        glGetIntegerv(GL_WARPS_PER_SM_NV, &warps);
+        glGetIntegerv(GL_WARP_SIZE_NV, &warpSize);
+        if (sms > 0 && warps > 0 && warpSize > 0)
+            m_residentThreads = sms * warps * warpSize;
+    }
+    return true;
+}
+
+bool PathTracer::Workgroup::valid() const
+{
+    if (morton)
+        return y == 1 && x >= 4 && x <= 256 && 256 % x == 0;
+    return x >= 1 && y >= 1 && x <= TileScheduler::TileSize && y <= TileScheduler::TileSize
+        && TileScheduler::TileSize % x == 0 && TileScheduler::TileSize % y == 0;
+}
+
+QString PathTracer::Workgroup::name() const
+{
+    return morton ? QString("%1x1 Morton").arg(x) : QString("%1x%2").arg(x).arg(y);
+}
+
+// raytrace.comp with the workgroup shape and BVH stack size defined ahead of
+// its own defaults.
+QOpenGLShaderProgram* PathTracer::compileProgram(const Workgroup &workgroup)
+{
+    QFile file("src/shaders/raytrace.comp");
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Unable to open compute shader:" << file.fileName();
+        return nullptr;
+    }
+    QByteArray source = file.readAll();
+    int versionEnd = source.indexOf('\n') + 1;
+    source.insert(versionEnd, QByteArray("#define WG_X ") + QByteArray::number(workgroup.x)
+                            + "\n#define WG_Y " + QByteArray::number(workgroup.y)
+                            + "\n#define WG_MORTON " + (workgroup.morton ? "1" : "0")
+                            + "\n#define BVH_STACK_SIZE " + QByteArray::number(Bvh::MaxDepth) + "\n");
+
+    QOpenGLShaderProgram *program = new QOpenGLShaderProgram();
+    if (!program->addShaderFromSourceCode(QOpenGLShader::Compute, source)) {
+        qWarning() << "Compute shader compile error (" << workgroup.name() << "):" << program->log();
+        delete program;
+        return nullptr;
+    }
+    if (!program->link()) {
+        qWarning() << "Compute shader link error (" << workgroup.name() << "):" << program->log();
+        delete program;
+        return nullptr;
+    }
+    return program;
+}
+
+bool PathTracer::setWorkgroup(const Workgroup &workgroup)
+{
+    if (workgroup == m_workgroup && m_computeProgram)
+        return true;
+    if (!workgroup.valid()) {
+        qWarning() << "Invalid compute workgroup" << workgroup.name();
+        return false;
+    }
+
+    QOpenGLShaderProgram *program = compileProgram(workgroup);
+    if (!program)
+        return false;
+    delete m_computeProgram;
+    m_computeProgram = program;
+    m_workgroup = workgroup;
+    return true;
+}
+
+void PathTracer::setDispatch(Dispatch dispatch)
+{
+    if (dispatch == m_dispatch)
+        return;
+    m_dispatch = dispatch;
+    // Per-tile costs measured with the other dispatch no longer apply.
+    m_tiles.reset();
+}
+
+const char* PathTracer::dispatchName(Dispatch dispatch)
+{
+    switch (dispatch) {
+    case TileDispatch:       return "one workgroup per tile";
+    case PersistentDispatch: return "persistent threads";
+    default:                 return "unknown";
+    }
+}
+
+int PathTracer::persistentGroups() const
+{
+    if (m_persistentGroups > 0)
+        return m_persistentGroups;
+    return qMax(1, m_residentThreads / (m_workgroup.x * m_workgroup.y));
+}
+
+void PathTracer::resize(int width, int height)
+{
+    m_width = qMax(1, width);
+    m_height = qMax(1, height);
+
+    glNamedBufferData(m_accumBuffer, GLsizeiptr(m_width) * m_height * 3 * sizeof(float), nullptr, GL_DYNAMIC_COPY);
+    glBindTexture(GL_TEXTURE_2D, m_guideTex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32UI, m_width, m_height, 0, GL_RG_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    // Tiles not traced yet after a resize show black, not stale memory.
+    glClearNamedBufferData(m_accumBuffer, GL_R32F, GL_RED, GL_FLOAT, nullptr);
+    glClearTexImage(m_guideTex, 0, GL_RG_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+    if (m_resolution == Scaled)
+        allocatePreview();
+    m_hasFallback = false;
+    ++m_generation;
+    updateTileLayout();
+    trackTargets();
+}
+
+void PathTracer::trackTargets()
+{
+    const qint64 color = 3 * sizeof(float);
+    const qint64 guide = 2 * sizeof(quint32);
+    MemoryTracker &mem = MemoryTracker::instance();
+    mem.track(this, "accumulation", "tracer", MemoryTracker::GpuBuffer, qint64(m_width) * m_height * color);
+    mem.track(this, "guide", "tracer", MemoryTracker::GpuTexture, qint64(m_width) * m_height * guide);
+    mem.track(this, "preview", "tracer", MemoryTracker::GpuTexture,
+              qint64(m_previewWidth) * m_previewHeight * (color + guide));
+}
+
+// A tile's first sample overwrites the accumulation instead of
+// blending with it, so a reset only has to rewind the per-tile counters and
+// start a new generation; it never touches GL state.
+void PathTracer::resetAccumulation()
+{
+    m_tiles.reset();
+    m_hasFallback = false;
+    ++m_generation;
+}
+
+void PathTracer::setResolution(Resolution mode, float scale)
+{
+    scale = mode == Scaled ? qBound(0.1f, scale, 1.0f) : 1.0f;
+    if (mode == m_resolution && qFuzzyCompare(scale, m_renderScale))
+        return;
+
+    // The camera has not moved: what was traced so far stays on screen
+    // until the new mode has covered it.
+    m_fallbackGeneration = m_generation;
+    m_hasFallback = true;
+    ++m_generation;
+
+    m_resolution = mode;
+    m_renderScale = scale;
+    if (mode == Scaled)
+        allocatePreview();
+    updateTileLayout();
+}
+
+void PathTracer::allocatePreview()
+{
+    int w = qMax(1, qRound(m_width * m_renderScale));
+    int h = qMax(1, qRound(m_height * m_renderScale));
+    if (w == m_previewWidth && h == m_previewHeight)
+        return;
+
+    m_previewWidth = w;
+    m_previewHeight = h;
+    m_previewGeneration = 0;
+    glNamedBufferData(m_previewBuffer, GLsizeiptr(w) * h * 3 * sizeof(float), nullptr, GL_DYNAMIC_COPY);
+    glBindTexture(GL_TEXTURE_2D, m_previewGuide);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32UI, w, h, 0, GL_RG_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glClearTexImage(m_previewGuide, 0, GL_RG_INTEGER, GL_UNSIGNED_INT, nullptr);
+    trackTargets();
+}
+
+// The scheduler works on the image that is actually traced: the preview
+// in Scaled mode, and a half-width image of pixel pairs in Checkerboard
+// mode, where every pixel of a pair needs its own samples.
+void PathTracer::updateTileLayout()
+{
+    switch (m_resolution) {
+    case Native:       m_tiles.resize(m_width, m_height); break;
+    case Scaled:       m_tiles.resize(m_previewWidth, m_previewHeight); break;
+    case Checkerboard: m_tiles.resize((m_width + 1) / 2, m_height); break;
+    }
+    setSampleCap(m_sampleCap);
+    applyFocus();
+}
+
+void PathTracer::applyFocus()
+{
+    if (!m_hasFocus) {
+        m_tiles.clearFocus();
+        return;
+    }
+
+    switch (m_resolution) {
+    case Native:
+        m_tiles.setFocus(m_focusX, m_focusY);
+        break;
+    case Scaled:
+        m_tiles.setFocus(m_focusX * m_previewWidth / m_width, m_focusY * m_previewHeight / m_height);
+        break;
+    case Checkerboard:
+        m_tiles.setFocus(m_focusX * 0.5f, m_focusY);
+        break;
+    }
+}
+
+int PathTracer::accumFrame() const
+{
+    switch (m_resolution) {
+    case Native:       return m_tiles.minSamples();
+    case Checkerboard: return m_tiles.minSamples() / 2;
+    default:           return 0;
+    }
+}
+
+PathTracer::Frame PathTracer::frame() const
+{
+    Frame f;
+    f.mode = m_resolution;
+    f.color = m_accumBuffer;
+    f.guide = m_guideTex;
+    f.previewColor = m_previewBuffer;
+    f.previewGuide = m_previewGuide;
+    f.width = m_width;
+    f.height = m_height;
+    f.revision = m_revision;
+    f.generation = m_generation;
+    f.fallbackGeneration = m_fallbackGeneration;
+    f.hasFallback = m_hasFallback;
+    f.previewValid = m_previewWidth > 0
+        && (m_resolution == Scaled || (m_hasFallback && m_previewGeneration == m_fallbackGeneration));
+    return f;
+}
+
+void PathTracer::setTileBudget(double ms)
+{
+    m_tiles.setBudgetMs(ms);
+}
+
+void PathTracer::setSampleCap(int spp)
+{
+    m_sampleCap = spp;
+    m_tiles.setSampleCap(m_resolution == Checkerboard ? spp * 2 : spp);
+}
+
+void PathTracer::setFocus(float x, float y)
+{
+    m_hasFocus = true;
+    m_focusX = x;
+    m_focusY = y;
+    applyFocus();
+}
+
+void PathTracer::clearFocus()
+{
+    m_hasFocus = false;
+    m_tiles.clearFocus();
+}
+
+void PathTracer::setSamplerMode(Sampler::Mode mode)
+{
+    if (mode == m_samplerMode)
+        return;
+    m_samplerMode = mode;
+    m_tiles.reset();
+}
+
+void PathTracer::setEstimator(Estimator estimator)
+{
+    if (estimator == m_estimator)
+        return;
+    m_estimator = estimator;
+    m_tiles.reset();
+}
+
+void PathTracer::setGuiding(bool guiding)
+{
+    if (guiding == m_guiding)
+        return;
+    m_guiding = guiding;
+    m_guideRevision = 0;
+    m_tiles.reset();
+}
+
+const char* PathTracer::estimatorName(Estimator estimator)
+{
+    switch (estimator) {
+    case ImportanceMis: return "BSDF sampling + MIS";
+    case UniformLight:  return "uniform + light sampling";
+    default:            return "unknown";
+    }
+}
+
+void PathTracer::setHybrid(bool hybrid)
+{
+    if (hybrid == m_hybrid)
+        return;
+    m_hybrid = hybrid;
+    m_tiles.reset();
+}
+
+bool PathTracer::hybridActive() const
+{
+    return m_hybrid && m_gbufferReady && m_clusterPool.clusterCount() == 0 && m_bakeCount == 0;
+}
+
+void PathTracer::setBakePoints(const QVector<BakePoint> &points)
+{
+    m_bakeCount = points.size();
+    if (points.isEmpty())
+        return;
+
+    std::vector<float> words;
+    words.reserve(size_t(points.size()) * 8);
+    for (const BakePoint &p : points)
+        words.insert(words.end(), { p.position.x(), p.position.y(), p.position.z(), 0.0f,
+                                    p.normal.x(), p.normal.y(), p.normal.z(), 0.0f });
+    if (!m_bakeSSBO) glCreateBuffers(1, &m_bakeSSBO);
+    glNamedBufferData(m_bakeSSBO, GLsizeiptr(words.size() * sizeof(float)), words.data(), GL_STATIC_DRAW);
+    MemoryTracker::instance().track(this, "bakePoints", "tracer", MemoryTracker::GpuBuffer,
+                                    qint64(words.size() * sizeof(float)));
+
+    setResolution(Native);
+    resize(BakeColumns, (m_bakeCount + BakeColumns - 1) / BakeColumns);
+    resetAccumulation();
+}
+
+void PathTracer::setSeed(quint32 seed)
+{
+    if (seed == m_seed)
+        return;
+    m_seed = seed;
+    m_tiles.reset();
+}
+
+void PathTracer::uploadSamplerTables()
+{
+    std::vector<quint32> table = m_sampler.gpuTable();
+
+    if (!m_ssboSampler) glGenBuffers(1, &m_ssboSampler);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_ssboSampler);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(quint32) * table.size(),
+                 table.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    MemoryTracker::instance().track(this, "samplerTables", "tracer", MemoryTracker::GpuBuffer,
+                                    qint64(sizeof(quint32)) * table.size());
+}
+
+// World-space bounds of everything the tracer intersects.
+static void sceneBounds(Scene *scene, QVector3D &lo, QVector3D &hi)
+{
+    lo = QVector3D(FLT_MAX, FLT_MAX, FLT_MAX);
+    hi = QVector3D(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    auto add = [&](const QVector3D &p) {
+        lo = QVector3D(qMin(lo.x(), p.x()), qMin(lo.y(), p.y()), qMin(lo.z(), p.z()));
+        hi = QVector3D(qMax(hi.x(), p.x()), qMax(hi.y(), p.y()), qMax(hi.z(), p.z()));
+    };
+    auto addBox = [&](const QMatrix4x4 &model, const QVector3D &min, const QVector3D &max) {
+        for (int corner = 0; corner < 8; ++corner)
+            add(model.map(QVector3D(corner & 1 ? max.x() : min.x(), corner & 2 ? max.y() : min.y(),
+                                    corner & 4 ? max.z() : min.z())));
+    };
+
+    for (Mesh *mesh : scene->meshes())
+        addBox(mesh->modelMatrix, mesh->bounds().min, mesh->bounds().min + mesh->bounds().extent);
+    for (ClusteredMesh *mesh : scene->clusteredMeshes())
+        for (const ClusteredMesh::Cluster &cluster : mesh->clusters())
+            addBox(mesh->modelMatrix, cluster.min, cluster.max);
+    for (const SphereInstance &s : scene->spheres()) {
+        add(s.center - QVector3D(s.radius, s.radius, s.radius));
+        add(s.center + QVector3D(s.radius, s.radius, s.radius));
+    }
+    if (lo.x() > hi.x())
+        lo = hi = QVector3D();
+}
+
+void PathTracer::uploadScene(Scene *scene)
+{
+    std::vector<GpuSquare> squares;
+    std::vector<GpuLight>  lights;
+    std::vector<Mesh*>     triangleMeshes;
+    m_primaryDraws.clear();
+
+    for (Mesh* mesh : scene->meshes())
+    {
+        if (mesh->vertexCount() == 4 && mesh->indexCount() == 6)
+        {
+            GpuSquare sq;
+
+            QVector3D A = mesh->modelMatrix.map(mesh->position(0));
+            QVector3D B = mesh->modelMatrix.map(mesh->position(1));
+            QVector3D C = mesh->modelMatrix.map(mesh->position(2));
+            QVector3D D = mesh->modelMatrix.map(mesh->position(3));
+
+            sq.ax = A.x(); sq.ay = A.y(); sq.az = A.z(); sq.padA=0.0f;
+            sq.bx = B.x(); sq.by = B.y(); sq.bz = B.z(); sq.padB=0.0f;
+            sq.cx = C.x(); sq.cy = C.y(); sq.cz = C.z(); sq.padC=0.0f;
+            sq.dx = D.x(); sq.dy = D.y(); sq.dz = D.z(); sq.padD=0.0f;
+
+            sq.diffuseR = mesh->material().color.x();
+            sq.diffuseG = mesh->material().color.y();
+            sq.diffuseB = mesh->material().color.z();
+            sq.kd = mesh->material().kd;
+            sq.ks = mesh->material().ks;
+            sq.specularR = mesh->material().specularColor.x();
+            sq.specularG = mesh->material().specularColor.y();
+            sq.specularB = mesh->material().specularColor.z();
+            sq.shininess=mesh->material().shininess;
+
+            m_primaryDraws.append({ mesh, GBuffer::materialRef(GBuffer::SquareKind, int(squares.size())) });
+            squares.push_back(sq);
+        }
+        else if (mesh->indexCount() >= 3)
+        {
+            triangleMeshes.push_back(mesh);
+        }
+    }
+
+    // --- LIGHTS ---
+    for (auto &l : scene->lights())
+    {
+        GpuLight g;
+        g.px = l.position.x();
+        g.py = l.position.y();
+        g.pz = l.position.z();
+        g.intensity = l.intensity;
+
+        g.r = l.color.x();
+        g.g = l.color.y();
+        g.b = l.color.z();
+        g.radius = l.radius;
+        lights.push_back(g);
+    }
+
+    m_gpuSquareCount = squares.size();
+    m_gpuLightCount  = lights.size();
+
+    // Upload buffers
+    if (!m_ssboLights) glGenBuffers(1, &m_ssboLights);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_ssboLights);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GpuLight)*lights.size(),
+                 lights.data(), GL_DYNAMIC_DRAW);
+
+    if (!m_squaresSSBO) glGenBuffers(1, &m_squaresSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_squaresSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GpuSquare)*squares.size(),
+                 squares.data(), GL_DYNAMIC_DRAW);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    MemoryTracker &mem = MemoryTracker::instance();
+    mem.track(this, "lights", "tracer", MemoryTracker::GpuBuffer, qint64(sizeof(GpuLight)) * lights.size());
+    mem.track(this, "squares", "tracer", MemoryTracker::GpuBuffer, qint64(sizeof(GpuSquare)) * squares.size());
+
+    m_spheres.upload(*scene, true);
+
+    bool rebuildGeometry = scene->revision() != m_meshRevision;
+    m_meshRevision = scene->revision();
+    if (rebuildGeometry)
+        sceneBounds(scene, m_sceneMin, m_sceneMax);
+    const QVector<ClusteredMesh*> &outOfCore = scene->clusteredMeshes();
+    uploadMeshes(triangleMeshes, std::vector<ClusteredMesh*>(outOfCore.begin(), outOfCore.end()), rebuildGeometry);
+}
+
+// Uploads the instance table every call (transforms and materials are
+// cheap) and the vertex, triangle, BVH and color buffers only when the mesh
+// list changed. The vertices stay in the quantized format and are decoded
+// in raytrace.comp. Geometry is stored once per MeshAsset, so instances of
+// one file cost a GpuMesh entry each and nothing more. Each asset is
+// written into its range of the new buffers straight from its own arrays;
+// assets whose CPU geometry was released are copied on the GPU from their
+// range in the previous buffers.
+//
+// Out-of-core meshes follow the regular ones: their top-level BVHs go after
+// the other BVH nodes, and the ClusterPool slots take the tail of the
+// vertex, triangle and node buffers. Their instances point at the top-level
+// BVH and at their first entry in the pool's cluster table.
+void PathTracer::uploadMeshes(const std::vector<Mesh*> &allMeshes, const std::vector<ClusteredMesh*> &clustered,
+                              bool rebuildGeometry)
+{
+    const quint32 NoColor = 0xFFFFFFFFu;
+
+    std::vector<Mesh*> meshes;
+    for (Mesh *mesh : allMeshes) {
+        if (m_meshRanges.contains(mesh->asset()) || mesh->restoreCpuGeometry())
+            meshes.push_back(mesh);
+        else
+            qWarning() << "Mesh" << mesh->name() << "released its geometry before reaching the tracer";
+    }
+
+    std::vector<GpuMesh> instances;
+    QHash<const MeshAsset*, MeshRange> ranges;
+    // First mesh of each asset, which uploads it.
+    std::vector<Mesh*> uniqueMeshes;
+    MeshRange next;
+
+    for (Mesh *mesh : meshes)
+    {
+        MeshRange r;
+        auto shared = ranges.constFind(mesh->asset());
+        if (shared != ranges.constEnd()) {
+            r = *shared;
+        } else {
+            if (mesh->hasCpuGeometry())
+                mesh->bvh();
+
+            r.vertexOffset = next.vertexOffset;
+            r.vertexCount = mesh->vertexCount();
+            r.triOffset = next.triOffset;
+            r.triCount = mesh->indexCount() / 3;
+            r.nodeOffset = next.nodeOffset;
+            r.nodeCount = mesh->bvhNodeCount();
+            r.colorOffset = next.colorOffset;
+            r.colorCount = mesh->hasColors() ? mesh->vertexCount() : 0;
+            ranges.insert(mesh->asset(), r);
+            uniqueMeshes.push_back(mesh);
+
+            next.vertexOffset += r.vertexCount;
+            next.triOffset += r.triCount;
+            next.nodeOffset += r.nodeCount;
+            next.colorOffset += r.colorCount;
+        }
+
+        const VertexFormat::Bounds &b = mesh->bounds();
+        const Material m = mesh->material();
+
+        GpuMesh g;
+        QMatrix4x4 worldToObject = mesh->modelMatrix.inverted();
+        std::copy(mesh->modelMatrix.constData(), mesh->modelMatrix.constData() + 16, g.objectToWorld);
+        std::copy(worldToObject.constData(), worldToObject.constData() + 16, g.worldToObject);
+        g.posMinX = b.min.x(); g.posMinY = b.min.y(); g.posMinZ = b.min.z();
+        g.posExtentX = b.extent.x(); g.posExtentY = b.extent.y(); g.posExtentZ = b.extent.z();
+        g.nodeOffset = r.nodeOffset;
+        g.triOffset = r.triOffset;
+        g.vertexOffset = r.vertexOffset;
+        g.colorOffset = mesh->hasColors() ? r.colorOffset : NoColor;
+        g.diffuseR = m.color.x(); g.diffuseG = m.color.y(); g.diffuseB = m.color.z();
+        g.kd = m.kd;
+        g.specularR = m.specularColor.x(); g.specularG = m.specularColor.y(); g.specularB = m.specularColor.z();
+        g.ks = m.ks;
+        g.shininess = m.shininess;
+        g.flags = 0;
+        m_primaryDraws.append({ mesh, GBuffer::materialRef(GBuffer::MeshKind, int(instances.size())) });
+        instances.push_back(g);
+    }
+
+    std::vector<quint32> topLevelOffsets;
+    quint32 clusterBase = 0;
+    for (ClusteredMesh *mesh : clustered) {
+        topLevelOffsets.push_back(next.nodeOffset);
+        const Material m = mesh->material();
+
+        GpuMesh g;
+        QMatrix4x4 worldToObject = mesh->modelMatrix.inverted();
+        std::copy(mesh->modelMatrix.constData(), mesh->modelMatrix.constData() + 16, g.objectToWorld);
+        std::copy(worldToObject.constData(), worldToObject.constData() + 16, g.worldToObject);
+        g.posMinX = g.posMinY = g.posMinZ = 0.0f;
+        g.posExtentX = g.posExtentY = g.posExtentZ = 0.0f;
+        g.nodeOffset = next.nodeOffset;
+        g.triOffset = clusterBase;
+        g.vertexOffset = 0;
+        g.colorOffset = NoColor;
+        g.diffuseR = m.color.x(); g.diffuseG = m.color.y(); g.diffuseB = m.color.z();
+        g.kd = m.kd;
+        g.specularR = m.specularColor.x(); g.specularG = m.specularColor.y(); g.specularB = m.specularColor.z();
+        g.ks = m.ks;
+        g.shininess = m.shininess;
+        g.flags = GpuMeshClustered;
+        instances.push_back(g);
+
+        next.nodeOffset += mesh->topLevel().nodes().size();
+        clusterBase += mesh->clusters().size();
+    }
+
+    ClusterPool::Layout pool = m_clusterPool.plan(clustered);
+    pool.vertexOffset = next.vertexOffset;
+    pool.triOffset = next.triOffset;
+    pool.nodeOffset = next.nodeOffset;
+    next.vertexOffset += pool.slotVertices * pool.slotCount;
+    next.triOffset += pool.slotTriangles * pool.slotCount;
+    next.nodeOffset += pool.slotNodes * pool.slotCount;
+
+    m_gpuMeshCount = int(instances.size());
+
+    // Never leave a binding without storage, even for an empty scene.
+    static const quint32 dummy[4] = {};
+    if (!m_ssboMeshes) glCreateBuffers(1, &m_ssboMeshes);
+    glNamedBufferData(m_ssboMeshes, instances.empty() ? GLsizeiptr(sizeof(dummy)) : GLsizeiptr(sizeof(GpuMesh) * instances.size()),
+                      instances.empty() ? dummy : static_cast<const void*>(instances.data()), GL_STATIC_DRAW);
+    MemoryTracker::instance().track(this, "meshInstances", "tracer", MemoryTracker::GpuBuffer,
+                                    qint64(sizeof(GpuMesh)) * instances.size());
+
+    if (!rebuildGeometry)
+        return;
+
+    const GLsizeiptr vertexSize = sizeof(VertexFormat::PackedVertex);
+    const GLsizeiptr triSize = 3 * sizeof(quint32);
+    const GLsizeiptr nodeSize = sizeof(Bvh::Node);
+    const GLsizeiptr colorSize = sizeof(quint32);
+
+    GLuint *targets[] = { &m_ssboMeshVertices, &m_ssboMeshTriangles, &m_ssboMeshBvh, &m_ssboMeshColors };
+    const GLsizeiptr bytes[] = { vertexSize * next.vertexOffset, triSize * next.triOffset,
+                                 nodeSize * next.nodeOffset, colorSize * next.colorOffset };
+    const char *names[] = { "meshVertices", "meshTriangles", "meshBvh", "meshColors" };
+    GLuint fresh[4];
+    glCreateBuffers(4, fresh);
+    for (int i = 0; i < 4; ++i) {
+        glNamedBufferData(fresh[i], qMax(bytes[i], GLsizeiptr(sizeof(dummy))), nullptr, GL_STATIC_DRAW);
+        if (!bytes[i])
+            glNamedBufferSubData(fresh[i], 0, sizeof(dummy), dummy);
+        MemoryTracker::instance().track(this, names[i], "tracer", MemoryTracker::GpuBuffer, bytes[i]);
+    }
+
+    std::vector<quint32> triangles;
+    for (Mesh *mesh : uniqueMeshes) {
+        const MeshRange &r = ranges[mesh->asset()];
+
+        if (mesh->hasCpuGeometry()) {
+            const Bvh &bvh = mesh->bvh();
+            const QVector<unsigned int> &idx = mesh->indices();
+            triangles.clear();
+            triangles.reserve(size_t(r.triCount) * 3);
+            for (quint32 t : bvh.primitives()) {
+                triangles.push_back(idx[3 * t]);
+                triangles.push_back(idx[3 * t + 1]);
+                triangles.push_back(idx[3 * t + 2]);
+            }
+
+            glNamedBufferSubData(fresh[0], vertexSize * r.vertexOffset, vertexSize * r.vertexCount,
+                                 mesh->packedVertices().constData());
+            glNamedBufferSubData(fresh[1], triSize * r.triOffset, triSize * r.triCount, triangles.data());
+            glNamedBufferSubData(fresh[2], nodeSize * r.nodeOffset, nodeSize * r.nodeCount, bvh.nodes().constData());
+            if (r.colorCount)
+                glNamedBufferSubData(fresh[3], colorSize * r.colorOffset, colorSize * r.colorCount,
+                                     mesh->packedColors().constData());
+        } else {
+            const MeshRange &old = m_meshRanges[mesh->asset()];
+            glCopyNamedBufferSubData(m_ssboMeshVertices, fresh[0], vertexSize * old.vertexOffset,
+                                     vertexSize * r.vertexOffset, vertexSize * r.vertexCount);
+            glCopyNamedBufferSubData(m_ssboMeshTriangles, fresh[1], triSize * old.triOffset,
+                                     triSize * r.triOffset, triSize * r.triCount);
+            glCopyNamedBufferSubData(m_ssboMeshBvh, fresh[2], nodeSize * old.nodeOffset,
+                                     nodeSize * r.nodeOffset, nodeSize * r.nodeCount);
+            if (r.colorCount)
+                glCopyNamedBufferSubData(m_ssboMeshColors, fresh[3], colorSize * old.colorOffset,
+                                         colorSize * r.colorOffset, colorSize * r.colorCount);
+        }
+    }
+    for (size_t i = 0; i < clustered.size(); ++i) {
+        const QVector<Bvh::Node> &nodes = clustered[i]->topLevel().nodes();
+        glNamedBufferSubData(fresh[2], nodeSize * topLevelOffsets[i], nodeSize * nodes.size(), nodes.constData());
+    }
+
+    for (int i = 0; i < 4; ++i) {
+        if (*targets[i]) glDeleteBuffers(1, targets[i]);
+        *targets[i] = fresh[i];
+    }
+    m_meshRanges = ranges;
+    m_clusterPool.reset(clustered, pool, fresh[0], fresh[1], fresh[2]);
+
+    // Cached assets are shared with other meshes and tracers: only drop a
+    // copy that can be restored from its packed file.
+    if (m_releaseCpuGeometry)
+        for (Mesh *mesh : uniqueMeshes)
+            if (!mesh->asset()->packedFile().isEmpty() || !AssetCache::instance().contains(mesh->asset()))
+                mesh->releaseCpuGeometry();
+
+    if (!meshes.empty() || !clustered.empty())
+        qDebug() << "Tracer meshes:" << meshes.size() << "instances of" << uniqueMeshes.size() << "assets,"
+                 << next.vertexOffset << "vertices at" << vertexSize << "bytes,"
+                 << next.triOffset << "triangles," << next.nodeOffset << "BVH nodes,"
+                 << (bytes[0] + bytes[1] + bytes[2] + bytes[3]) / 1024 << "KiB";
+}
+
+// Traces one sample into each tile picked by the scheduler. The dispatch is
+// one workgroup per tile, or resident workgroups pulling the tiles' pixels
+// (PersistentDispatch); timestamps around it feed the scheduler's cost
+// estimate a few frames later, without waiting on the GPU.
+void PathTracer::traceFrame(const Camera &camera, float fovDeg)
+{
+    collectTileTimings();
+    // Clusters that arrived or left change the picture: start over.
+    if (m_clusterPool.update())
+        resetAccumulation();
+
+    const QVector<TileScheduler::Job> &jobs = m_tiles.schedule();
+    if (jobs.isEmpty())
+        return;
+
+    if (!m_tileSSBO) glCreateBuffers(1, &m_tileSSBO);
+    glNamedBufferData(m_tileSSBO, sizeof(TileScheduler::Job) * jobs.size(), jobs.constData(), GL_STREAM_DRAW);
+    MemoryTracker::instance().track(this, "tileList", "tracer", MemoryTracker::GpuBuffer,
+                                    qint64(sizeof(TileScheduler::Job)) * jobs.size());
+
+    const bool preview = m_resolution == Scaled;
+    const int traceWidth = preview ? m_previewWidth : m_width;
+    const int traceHeight = preview ? m_previewHeight : m_height;
+    const bool hybrid = hybridActive();
+    if (hybrid)
+        rasterizePrimary(camera, fovDeg, traceWidth, traceHeight);
+
+    m_computeProgram->bind();
+
+    m_computeProgram->setUniformValue("u_sphereCount",  m_spheres.count());
+    m_computeProgram->setUniformValue("u_lightCount",   m_gpuLightCount);
+    m_computeProgram->setUniformValue("u_squareCount",  m_gpuSquareCount);
+    m_computeProgram->setUniformValue("u_meshCount",    m_gpuMeshCount);
+    m_computeProgram->setUniformValue("u_clusterCount", m_clusterPool.clusterCount());
+
+    m_computeProgram->setUniformValue("u_camPos",   camera.position());
+    m_computeProgram->setUniformValue("u_camFront", camera.front());
+    m_computeProgram->setUniformValue("u_camRight", camera.right());
+    m_computeProgram->setUniformValue("u_camUp",    camera.up());
+    m_computeProgram->setUniformValue("u_fovDeg",   fovDeg);
+
+    m_computeProgram->setUniformValue("u_width",  traceWidth);
+    m_computeProgram->setUniformValue("u_height", traceHeight);
+    m_computeProgram->setUniformValue("u_hybrid", hybrid ? 1 : 0);
+    m_computeProgram->setUniformValue("u_checkerboard", m_resolution == Checkerboard ? 1 : 0);
+    m_computeProgram->setUniformValue("u_generation", GLuint(m_generation));
+    m_computeProgram->setUniformValue("u_tileCount", int(jobs.size()));
+    m_computeProgram->setUniformValue("u_samplerMode", int(m_samplerMode));
+    m_computeProgram->setUniformValue("u_estimator", int(m_estimator));
+    m_computeProgram->setUniformValue("u_seed", GLuint(m_seed));
+    m_computeProgram->setUniformValue("u_persistent", m_dispatch == PersistentDispatch ? 1 : 0);
+    m_computeProgram->setUniformValue("u_bakeCount", m_bakeCount);
+
+    // A new scene (or guiding just turned on) starts learning over.
+    const bool guiding = m_guiding && m_guideReady;
+    if (guiding && m_guideRevision != m_meshRevision) {
+        m_guide.reset(m_sceneMin, m_sceneMax);
+        m_guideRevision = m_meshRevision;
+    }
+    int guideFlags = 0;
+    if (guiding && m_guide.allocated()) {
+        guideFlags = (m_guide.ready() ? 1 : 0) | (m_guide.training() ? 2 : 0);
+        m_guide.bind(17, 18);
+    }
+    m_computeProgram->setUniformValue("u_guiding", guideFlags);
+    m_computeProgram->setUniformValue("u_guideCellSize", m_guide.cellSize());
+
+    m_spheres.bind(1, 10);
+    m_spheres.bindBvh(11);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_ssboLights);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_squaresSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_ssboSampler);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, m_ssboMeshes);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, m_ssboMeshVertices);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, m_ssboMeshTriangles);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, m_ssboMeshBvh);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, m_ssboMeshColors);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, m_tileSSBO);
+    m_clusterPool.bind(13);
+    if (m_bakeCount > 0)
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 16, m_bakeSSBO);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 15, preview ? m_previewBuffer : m_accumBuffer);
+    glBindImageTexture(1, preview ? m_previewGuide : m_guideTex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG32UI);
+    if (preview)
+        m_previewGeneration = m_generation;
+    if (hybrid) {
+        glBindImageTexture(2, m_gbuffer.position(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+        glBindImageTexture(3, m_gbuffer.surface(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32UI);
+        m_primaryRaysSkipped += qint64(jobs.size()) * TileScheduler::TileSize * TileScheduler::TileSize;
+    }
+
+    // Workgroup counts are limited to 65535 per axis: fold long lists into rows.
+    const int tiles = jobs.size();
+    int gx = qMin(tiles, MaxGroupsPerRow);
+    int gy = (tiles + gx - 1) / gx;
+    if (m_dispatch == PersistentDispatch) {
+        // No more workgroups than have pixels to claim in their first batch.
+        const int groupPixels = m_workgroup.x * m_workgroup.y * PersistentBatch;
+        const int pixels = tiles * TileScheduler::TileSize * TileScheduler::TileSize;
+        gx = qBound(1, (pixels + groupPixels - 1) / groupPixels, qMin(persistentGroups(), MaxGroupsPerRow));
+        gy = 1;
+
+        if (!m_workQueue) {
+            glCreateBuffers(1, &m_workQueue);
+            glNamedBufferStorage(m_workQueue, sizeof(GLuint), nullptr, 0);
+        }
+        const GLuint zero = 0;
+        glClearNamedBufferData(m_workQueue, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 14, m_workQueue);
+    }
+
+    TileQuery &query = m_tileQueries[m_nextTileQuery];
+    bool timed = !query.pending;
+    if (timed) glQueryCounter(query.ids[0], GL_TIMESTAMP);
+
+    glDispatchCompute(gx, gy, 1);
+
+    if (timed) {
+        glQueryCounter(query.ids[1], GL_TIMESTAMP);
+        query.pending = true;
+        query.tiles = tiles;
+        m_nextTileQuery = (m_nextTileQuery + 1) % TileQueryRing;
+    }
+
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT
+                    | GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+    m_clusterPool.afterTrace();
+    ++m_revision;
+
+    m_computeProgram->release();
+
+    if (guideFlags & 2)
+        m_guide.afterTrace(qint64(tiles) * TileScheduler::TileSize * TileScheduler::TileSize,
+                           qint64(traceWidth) * traceHeight);
+}
+
+// One subpixel jitter per frame from the R2 sequence, applied to the whole
+// G-buffer; raytrace.comp shoots the misses with the same offset.
+void PathTracer::rasterizePrimary(const Camera &camera, float fovDeg, int width, int height)
+{
+    // The seed moves each tracer to its own stretch of the R2 sequence, so
+    // workers with different seeds do not rasterize the same offsets.
+    const quint32 n = m_hybridFrame++ + m_seed * 0x9E3779B9u;
+    const float jx = float(std::fmod(0.5 + n * 0.7548776662466927, 1.0));
+    const float jy = float(std::fmod(0.5 + n * 0.5698402909980532, 1.0));
+
+    QMatrix4x4 jitter;
+    jitter.translate(2.0f * (0.5f - jx) / width, 2.0f * (0.5f - jy) / height, 0.0f);
+    QMatrix4x4 proj;
+    proj.perspective(fovDeg, float(width) / float(height), 0.01f, 1.0e4f);
+
+    m_gbuffer.resize(width, height);
+    m_gbuffer.render(m_primaryDraws, m_spheres, jitter * proj * camera.viewMatrix(), camera.position());
+
+    m_computeProgram->bind();
+    m_computeProgram->setUniformValue("u_jitter", QVector2D(jx, jy));
+}
+
+void PathTracer::collectTileTimings()
+{
+    for (TileQuery &query : m_tileQueries) {
+        if (!query.pending)
+            continue;
+
+        GLint available = 0;
+        glGetQueryObjectiv(query.ids[1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            continue;
+
+        GLuint64 t0 = 0, t1 = 0;
+        glGetQueryObjectui64v(query.ids[0], GL_QUERY_RESULT, &t0);
+        glGetQueryObjectui64v(query.ids[1], GL_QUERY_RESULT, &t1);
+        query.pending = false;
+        m_tiles.reportGpuTime(query.tiles, (t1 - t0) / 1.0e6);
+    }
+}
+
+std::vector<float> PathTracer::readAccumulation()
+{
+    std::vector<float> rgb(size_t(m_width) * m_height * 3);
+    glGetNamedBufferSubData(m_accumBuffer, 0, GLsizeiptr(rgb.size() * sizeof(float)), rgb.data());
+    return rgb;
+}
@@ -0,0 +1,298 @@
+#pragma once
+#include <QOpenGLFunctions_4_5_Core>
+#include <QHash>
+#include <QOpenGLShaderProgram>
+#include "renderer/camera.h"
+#include "renderer/clusterpool.h"
+#include "renderer/gbuffer.h"
+#include "renderer/pathguide.h"
+#include "renderer/sampler.h"
+#include "renderer/sphereinstances.h"
+#include "renderer/tilescheduler.h"
+#include <vector>
+
+class ClusteredMesh;
+class Mesh;
+class MeshAsset;
+class Scene;
+
+// Owns the compute path tracer: its program, the scene SSBOs, the sampler
+// tables and the accumulation buffer. Independent of any window so the same
+// tracer can run in the interactive view or on an offscreen context.
+// Every method except the constructor needs a current OpenGL 4.5 context.
+class PathTracer : protected QOpenGLFunctions_4_5_Core
+{
+public:
+    PathTracer();
+    ~PathTracer();
+
+    // Interactive shortcuts while the camera moves. Scaled traces a
+    // smaller image that the screen pass upsamples; Checkerboard traces
+    // every other pixel per frame, alternating, and reconstructs the rest.
+    enum Resolution { Native, Scaled, Checkerboard };
+
+    // What Upscaler needs to rebuild the full-resolution image. Each traced
+    // pixel stores its primary hit normal, depth and the accumulation
+    // generation in a guide image; pixels from an older generation are
+    // stale and get reconstructed. After a resolution change the previous
+    // generation stays usable as a fallback until its pixels are retraced.
+    // Colors are buffers of packed RGB floats (see accumBuffer()).
+    struct Frame {
+        Resolution mode = Native;
+        GLuint color = 0;
+        GLuint guide = 0;
+        GLuint previewColor = 0;
+        GLuint previewGuide = 0;
+        int width = 0;
+        int height = 0;
+        quint32 generation = 0;
+        quint32 fallbackGeneration = 0;
+        bool hasFallback = false;
+        bool previewValid = false;
+        // Counts traces, so an unchanged frame can skip its resolve.
+        quint64 revision = 0;
+    };
+
+    bool initialize(int width, int height);
+    void resize(int width, int height);
+    void uploadScene(Scene *scene);
+
+    // Frees each triangle mesh's CPU geometry once its vertices, triangles
+    // and BVH are on the GPU; later rebuilds copy them between buffers.
+    void setReleaseCpuGeometry(bool release) { m_releaseCpuGeometry = release; }
+    bool releaseCpuGeometry() const { return m_releaseCpuGeometry; }
+
+    // GPU memory for the clusters of out-of-core meshes; applies when the
+    // mesh list next changes. While streaming() clusters rays asked for are
+    // still on their way, so callers keep tracing even at the sample cap.
+    void setClusterPoolBudget(qint64 bytes) { m_clusterPool.setBudget(bytes); }
+    qint64 clusterPoolBudget() const { return m_clusterPool.budget(); }
+    bool streaming() { return m_clusterPool.streaming(); }
+    ClusterPool::Stats clusterStats() const { return m_clusterPool.stats(); }
+    void resetAccumulation();
+    void traceFrame(const Camera &camera, float fovDeg);
+
+    // Restarts accumulation when the mode or scale changes.
+    void setResolution(Resolution mode, float scale = 1.0f);
+    Resolution resolution() const { return m_resolution; }
+    float renderScale() const { return m_renderScale; }
+    Frame frame() const;
+
+    // Tile scheduling (see TileScheduler). A budget of 0 traces every
+    // tile each frame, which is what offline renders want.
+    void setTileBudget(double ms);
+    double tileBudget() const { return m_tiles.budgetMs(); }
+    void setSampleCap(int spp);
+    int sampleCap() const { return m_sampleCap; }
+    void setFocus(float x, float y);
+    void clearFocus();
+
+    void setSamplerMode(Sampler::Mode mode);
+    Sampler::Mode samplerMode() const { return m_samplerMode; }
+
+    // How paths pick directions (ESTIMATOR_* in raytrace.comp). Both
+    // converge to the same image; UniformLight is the plain baseline,
+    // uniform hemisphere bounces and light sampling only, that the
+    // convergence harness measures the variance reduction against.
+    enum Estimator { ImportanceMis, UniformLight, EstimatorCount };
+    void setEstimator(Estimator estimator);
+    Estimator estimator() const { return m_estimator; }
+    static const char* estimatorName(Estimator estimator);
+
+    // Path guiding (PathGuide): bounces also sample the directions light
+    // came from at nearby points, learnt from earlier paths. Turning it on
+    // starts learning from scratch; it keeps learning across camera moves.
+    void setGuiding(bool guiding);
+    bool guiding() const { return m_guiding; }
+    // Training iterations done so far, PathGuide::MaxIterations at most.
+    int guideIteration() const { return m_guide.iteration(); }
+
+    // Hybrid mode rasterizes the camera rays' first hits into a G-buffer
+    // before each trace and starts the paths there; only shadow and
+    // secondary rays are traced. All pixels of a frame then share one
+    // subpixel jitter. Scenes with out-of-core meshes, which are not
+    // rasterized, keep tracing their camera rays.
+    void setHybrid(bool hybrid);
+    bool hybrid() const { return m_hybrid; }
+    bool hybridActive() const;
+    // Camera rays answered by the G-buffer since the tracer was created,
+    // counted per pixel of the traced tiles.
+    qint64 primaryRaysSkipped() const { return m_primaryRaysSkipped; }
+
+    // Compute workgroup shape (WG_* in raytrace.comp). A workgroup always
+    // traces one 16x16 tile; smaller ones loop over it, 2D groups in blocks
+    // of their shape, linear ones along a Morton curve. WorkgroupTuner
+    // picks the fastest for the device.
+    struct Workgroup {
+        int x = 16;
+        int y = 16;
+        bool morton = false;
+
+        bool valid() const;
+        QString name() const;
+        bool operator==(const Workgroup &other) const
+        { return x == other.x && y == other.y && morton == other.morton; }
+    };
+    // Recompiles the program; keeps the current one if the shape fails to build.
+    bool setWorkgroup(const Workgroup &workgroup);
+    Workgroup workgroup() const { return m_workgroup; }
+
+    // How the scheduled tiles are handed to the GPU. TileDispatch launches
+    // one workgroup per tile. PersistentDispatch launches only as many
+    // workgroups as the device keeps resident and lets their invocations
+    // claim pixels from a global counter until the frame is done, so long
+    // paths no longer leave the rest of a tile's workgroup idle.
+    enum Dispatch { TileDispatch, PersistentDispatch, DispatchCount };
+    void setDispatch(Dispatch dispatch);
+    Dispatch dispatch() const { return m_dispatch; }
+    static const char* dispatchName(Dispatch dispatch);
+    // Workgroups of a persistent dispatch; 0 sizes them to the device.
+    void setPersistentGroups(int groups) { m_persistentGroups = qMax(0, groups); }
+    int persistentGroups() const;
+
+    // Bake mode (IrradianceBaker): instead of camera rays, pixel i starts
+    // its paths on point i, a white Lambert surface facing along normal,
+    // and converges to the irradiance there divided by pi. The image
+    // becomes BakeColumns wide with as many rows as the points need; the
+    // camera passed to traceFrame() is ignored. An empty list goes back to
+    // tracing the camera (call resize() to restore the image size).
+    struct BakePoint {
+        QVector3D position;
+        QVector3D normal;
+    };
+    static constexpr int BakeColumns = 1024;
+    void setBakePoints(const QVector<BakePoint> &points);
+    int bakeCount() const { return m_bakeCount; }
+
+    // Mixed into every pixel's sampler seed; replays pin it for determinism.
+    void setSeed(quint32 seed);
+    quint32 seed() const { return m_seed; }
+
+    // Synchronous RGB float readback of the accumulation, rows bottom to top.
+    // Stalls the pipeline; meant for tools and harnesses, not for the
+    // interactive loop.
+    std::vector<float> readAccumulation();
+    // Bumped by every restart of the accumulation.
+    quint32 generation() const { return m_generation; }
+
+    // Shader storage buffer of the full-resolution running mean: three
+    // floats per pixel, rows bottom to top. Sample counts live in the tile
+    // scheduler, so there is no alpha channel.
+    GLuint accumBuffer() const { return m_accumBuffer; }
+    // Samples every pixel of the full-resolution image has; tiles near the
+    // focus may already have more. Always 0 while tracing a scaled preview.
+    int accumFrame() const;
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+
+private:
+    void uploadSamplerTables();
+    void collectTileTimings();
+    void allocatePreview();
+    void updateTileLayout();
+    void applyFocus();
+    void uploadMeshes(const std::vector<Mesh*> &allMeshes, const std::vector<ClusteredMesh*> &clustered,
+                      bool rebuildGeometry);
+    void trackTargets();
+    void rasterizePrimary(const Camera &camera, float fovDeg, int width, int height);
+    static QOpenGLShaderProgram* compileProgram(const Workgroup &workgroup);
+
+    QOpenGLShaderProgram *m_computeProgram = nullptr;
+    Workgroup m_workgroup;
+
+    Dispatch m_dispatch = TileDispatch;
+    int m_persistentGroups = 0;
+    int m_residentThreads = DefaultResidentThreads;
+    GLuint m_workQueue = 0;
+
+    PathGuide m_guide;
+    bool m_guideReady = false;
+    bool m_guiding = false;
+    // Scene the guide learnt, and its bounds, which size the cells.
+    quint64 m_guideRevision = 0;
+    QVector3D m_sceneMin;
+    QVector3D m_sceneMax;
+
+    GLuint m_bakeSSBO = 0;
+    int m_bakeCount = 0;
+    // Invocations assumed resident when the driver cannot tell.
+    static constexpr int DefaultResidentThreads = 65536;
+
+    Sampler m_sampler;
+    Sampler::Mode m_samplerMode = Sampler::SobolOwen;
+    Estimator m_estimator = ImportanceMis;
+    quint32 m_seed = 0;
+
+    SphereInstances m_spheres;
+    GLuint m_ssboLights  = 0;
+    GLuint m_squaresSSBO = 0;
+    GLuint m_ssboSampler = 0;
+
+    GLuint m_ssboMeshes = 0;
+    GLuint m_ssboMeshVertices = 0;
+    GLuint m_ssboMeshTriangles = 0;
+    GLuint m_ssboMeshBvh = 0;
+    GLuint m_ssboMeshColors = 0;
+    quint64 m_meshRevision = 0;
+
+    // Where each asset lives in the geometry buffers, in elements; meshes
+    // sharing an asset share its range.
+    struct MeshRange {
+        quint32 vertexOffset = 0, vertexCount = 0;
+        quint32 triOffset = 0, triCount = 0;
+        quint32 nodeOffset = 0, nodeCount = 0;
+        quint32 colorOffset = 0, colorCount = 0;
+    };
+    QHash<const MeshAsset*, MeshRange> m_meshRanges;
+    bool m_releaseCpuGeometry = false;
+    ClusterPool m_clusterPool;
+
+    GBuffer m_gbuffer;
+    bool m_gbufferReady = false;
+    bool m_hybrid = false;
+    QVector<GBuffer::Draw> m_primaryDraws;
+    quint32 m_hybridFrame = 0;
+    qint64 m_primaryRaysSkipped = 0;
+
+    GLuint m_accumBuffer = 0;
+    GLuint m_guideTex = 0;
+    quint64 m_revision = 0;
+
+    Resolution m_resolution = Native;
+    float m_renderScale = 1.0f;
+    GLuint m_previewBuffer = 0;
+    GLuint m_previewGuide = 0;
+    int m_previewWidth = 0;
+    int m_previewHeight = 0;
+    quint32 m_previewGeneration = 0;
+
+    // Generation 0 marks never-traced pixels (the guide is cleared to 0).
+    quint32 m_generation = 1;
+    quint32 m_fallbackGeneration = 0;
+    bool m_hasFallback = false;
+
+    int m_sampleCap = 0;
+    bool m_hasFocus = false;
+    float m_focusX = 0.0f;
+    float m_focusY = 0.0f;
+    TileScheduler m_tiles;
+    GLuint m_tileSSBO = 0;
+
+    struct TileQuery {
+        GLuint ids[2] = {};
+        bool pending = false;
+        int tiles = 0;
+    };
+    static constexpr int TileQueryRing = 4;
+    static constexpr int MaxGroupsPerRow = 32768;
+    // Pixels a persistent invocation claims at once (PERSISTENT_BATCH).
+    static constexpr int PersistentBatch = 4;
+    TileQuery m_tileQueries[TileQueryRing];
+    int m_nextTileQuery = 0;
+    int m_width = 1;
+    int m_height = 1;
+
+    int m_gpuLightCount = 0;
+    int m_gpuSquareCount = 0;
+    int m_gpuMeshCount = 0;
+};
@@ -0,0 +1,132 @@
+#include "renderloop.h"
+#include <QDebug>
+#include <cmath>
+
+const char* RenderLoop::modeName(Mode mode)
+{
+    switch (mode) {
+    case OnDemand:   return "On demand";
+    case Continuous: return "Continuous";
+    case Benchmark:  return "Benchmark (uncapped)";
+    default:         return "?";
+    }
+}
+
+const char* RenderLoop::motionResolutionName(MotionResolution motion)
+{
+    switch (motion) {
+    case FullResolution: return "Full resolution";
+    case Checkerboard:   return "Checkerboard (1/2 rays)";
+    case Scale67:        return "67% scale (~1/2 rays)";
+    case Scale50:        return "50% scale (1/4 rays)";
+    default:             return "?";
+    }
+}
+
+void RenderLoop::setSettings(const Settings &settings)
+{
+    m_settings = settings;
+    m_reported = false;
+    m_rateFrames = 0;
+    m_rateClock.invalidate();
+}
+
+void RenderLoop::resetConvergence()
+{
+    m_snapshot.clear();
+    m_snapshotSpp = 0;
+    m_error = -1.0f;
+    m_reported = false;
+}
+
+bool RenderLoop::needsSamples(int spp)
+{
+    if (spp < m_lastSpp)
+        resetConvergence();
+    m_lastSpp = spp;
+
+    if (m_settings.mode == Benchmark)
+        return true;
+
+    bool sppReached = m_settings.targetSpp > 0 && spp >= m_settings.targetSpp;
+    bool errorReached = m_settings.errorTarget > 0.0f && m_error >= 0.0f
+                        && m_error <= m_settings.errorTarget;
+    if (!sppReached && !errorReached)
+        return true;
+
+    if (!m_reported) {
+        m_reported = true;
+        if (errorReached)
+            qDebug() << "Converged at" << spp << "spp, estimated error" << m_error;
+        else
+            qDebug() << "Sample target reached:" << spp << "spp";
+    }
+    return false;
+}
+
+bool RenderLoop::wantsErrorCheck(int spp) const
+{
+    if (m_settings.errorTarget <= 0.0f || spp < MinErrorCheckSpp / 2)
+        return false;
+    return (spp & (spp - 1)) == 0 && spp != m_snapshotSpp;
+}
+
+void RenderLoop::addErrorCheck(int spp, int width, int height, const std::vector<float> &rgb)
+{
+    const size_t pixels = size_t(width) * height;
+    if (rgb.size() < pixels * 3)
+        return;
+
+    std::vector<float> lum(pixels);
+    for (size_t i = 0; i < pixels; ++i)
+        lum[i] = 0.2126f * rgb[i * 3] + 0.7152f * rgb[i * 3 + 1] + 0.0722f * rgb[i * 3 + 2];
+
+    if (m_snapshotSpp > 0 && spp == 2 * m_snapshotSpp && m_snapshot.size() == pixels) {
+        double diff2 = 0.0, mean = 0.0;
+        for (size_t i = 0; i < pixels; ++i) {
+            double d = double(lum[i]) - double(m_snapshot[i]);
+            diff2 += d * d;
+            mean += lum[i];
+        }
+        mean /= double(pixels);
+        if (mean > 0.0)
+            m_error = float(std::sqrt(diff2 / double(pixels)) / mean);
+    }
+
+    m_snapshot.swap(lum);
+    m_snapshotSpp = spp;
+}
+
+void RenderLoop::cameraMoved()
+{
+    m_motionClock.start();
+}
+
+bool RenderLoop::inMotion() const
+{
+    return m_settings.motionResolution != FullResolution && m_motionClock.isValid()
+        && m_motionClock.elapsed() < m_settings.motionHoldMs;
+}
+
+void RenderLoop::frameRendered()
+{
+    if (m_settings.mode != Benchmark)
+        return;
+
+    if (!m_rateClock.isValid()) {
+        m_rateClock.start();
+        m_rateFrames = 0;
+        return;
+    }
+
+    ++m_rateFrames;
+    qint64 ns = m_rateClock.nsecsElapsed();
+    if (ns >= 1000000000) {
+        double seconds = ns / 1e9;
+        qInfo().noquote() << QString("Benchmark: %1 fps, %2 ms/frame")
+                                 .arg(m_rateFrames / seconds, 0, 'f', 1)
+                                 .arg(seconds * 1000.0 / m_rateFrames, 0, 'f', 3);
+        m_rateFrames = 0;
+        m_rateClock.restart();
+    }
+}
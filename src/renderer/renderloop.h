@@ -0,0 +1,74 @@
+#pragma once
+#include <QElapsedTimer>
+#include <vector>
+
+// Frame scheduling policy of the interactive view. Frames are only requested
+// when something can change on screen: input, a scene edit, or a path
+// tracer that still has samples to add. Accumulation stops at a sample
+// target or once the estimated relative error drops below a threshold, and
+// unfocused windows trace at a throttled rate. Benchmark mode renders
+// back-to-back (the caller turns vsync off) and logs the frame rate.
+//
+// The error is estimated on a doubling schedule: with I_n the mean of n
+// samples, I_2n - I_n = (I'_n - I_n) / 2 has the same RMS as the error of
+// I_2n, so comparing luminance snapshots at n and 2n spp gives an unbiased
+// estimate for the cost of log2(spp) readbacks.
+//
+// While the camera moves, and for MotionHoldMs after it stopped, the tracer
+// switches to the motion resolution (checkerboard or a render scale) and
+// returns to full resolution once the view settles.
+class RenderLoop
+{
+public:
+    enum Mode { OnDemand, Continuous, Benchmark, ModeCount };
+    enum MotionResolution { FullResolution, Checkerboard, Scale67, Scale50, MotionResolutionCount };
+
+    struct Settings {
+        Mode mode = OnDemand;
+        int targetSpp = 4096;        // 0 = unlimited
+        float errorTarget = 0.0f;    // relative RMS error, 0 disables
+        int backgroundIntervalMs = 100;
+        MotionResolution motionResolution = Checkerboard;
+        int motionHoldMs = 150;
+    };
+
+    static constexpr int MinErrorCheckSpp = 16;
+
+    static const char* modeName(Mode mode);
+    static const char* motionResolutionName(MotionResolution motion);
+
+    void setSettings(const Settings &settings);
+    const Settings& settings() const { return m_settings; }
+    bool continuous() const { return m_settings.mode != OnDemand; }
+
+    // True while the accumulation at spp should keep receiving samples.
+    // Notices restarts (spp dropping) on its own.
+    bool needsSamples(int spp);
+
+    // Whether the image at spp should be read back for the error estimate.
+    bool wantsErrorCheck(int spp) const;
+    void addErrorCheck(int spp, int width, int height, const std::vector<float> &rgb);
+    float errorEstimate() const { return m_error; }
+
+    // Restarts the motion hold; inMotion() stays true for motionHoldMs.
+    void cameraMoved();
+    bool inMotion() const;
+
+    // Counts presented frames; logs the rate once a second in Benchmark mode.
+    void frameRendered();
+
+private:
+    void resetConvergence();
+
+    Settings m_settings;
+
+    std::vector<float> m_snapshot;   // luminance at m_snapshotSpp
+    int m_snapshotSpp = 0;
+    int m_lastSpp = 0;
+    float m_error = -1.0f;
+    bool m_reported = false;
+
+    QElapsedTimer m_motionClock;
+    QElapsedTimer m_rateClock;
+    int m_rateFrames = 0;
+};
@@ -0,0 +1,264 @@
+#include "renderthread.h"
+#include <QCoreApplication>
+#include <QDebug>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <chrono>
+
+namespace {
+
+// Bound on waiting for the previous frame; a hung GPU must not hang the
+// thread for good.
+constexpr GLuint64 FrameWaitNs = 2000000000ull;
+
+}
+
+RenderThread::RenderThread(QObject *parent)
+    : QThread(parent)
+{
+}
+
+RenderThread::~RenderThread()
+{
+    stop();
+}
+
+qint64 RenderThread::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool RenderThread::start(QOpenGLContext *shareContext, const Callbacks &callbacks)
+{
+    if (m_context)
+        return true;
+
+    m_context = new QOpenGLContext();
+    m_context->setFormat(shareContext->format());
+    m_context->setShareContext(shareContext);
+    if (!m_context->create() || !QOpenGLContext::areSharing(m_context, shareContext)) {
+        qWarning() << "Unable to create a shared context for the render thread";
+        delete m_context;
+        m_context = nullptr;
+        return false;
+    }
+
+    // Offscreen surfaces must be created on the GUI thread.
+    m_surface = new QOffscreenSurface();
+    m_surface->setFormat(m_context->format());
+    m_surface->create();
+
+    m_presentGl.initializeOpenGLFunctions();
+    m_callbacks = callbacks;
+    m_quit = false;
+    m_context->moveToThread(this);
+    QThread::start();
+    return true;
+}
+
+void RenderThread::stop()
+{
+    if (!m_context)
+        return;
+    post([this]() { m_quit = true; });
+    wait();
+
+    delete m_context;
+    m_context = nullptr;
+    delete m_surface;
+    m_surface = nullptr;
+}
+
+void RenderThread::post(std::function<void()> run, qint64 inputNs)
+{
+    CommandQueue::Command command;
+    command.run = std::move(run);
+    command.inputNs = inputNs;
+    m_commands.push(std::move(command));
+    m_wake.release();
+}
+
+void RenderThread::requestFrame(int delayMs)
+{
+    const qint64 due = now() + qint64(qMax(0, delayMs)) * 1000000;
+    if (m_frameDueNs < 0 || due < m_frameDueNs)
+        m_frameDueNs = due;
+}
+
+void RenderThread::resizeFrames(int width, int height)
+{
+    m_frameWidth = qMax(1, width);
+    m_frameHeight = qMax(1, height);
+}
+
+void RenderThread::run()
+{
+    if (!m_context->makeCurrent(m_surface)) {
+        qWarning() << "Render thread: unable to make its context current";
+        m_context->moveToThread(QCoreApplication::instance()->thread());
+        return;
+    }
+    m_gl.initializeOpenGLFunctions();
+    if (m_callbacks.initialize)
+        m_callbacks.initialize();
+
+    // Each post() releases the semaphore once; leftover counts only cost
+    // an extra pass over an empty queue.
+    for (;;) {
+        runCommands();
+        if (m_quit)
+            break;
+
+        const qint64 time = now();
+        if (m_frameDueNs >= 0 && time >= m_frameDueNs) {
+            m_frameDueNs = -1;
+            renderFrame();
+            continue;
+        }
+        if (m_frameDueNs < 0)
+            m_wake.acquire();
+        else
+            m_wake.tryAcquire(1, int((m_frameDueNs - time + 999999) / 1000000));
+    }
+
+    if (m_callbacks.shutdown)
+        m_callbacks.shutdown();
+    releaseSlots();
+    m_context->doneCurrent();
+    m_context->moveToThread(QCoreApplication::instance()->thread());
+}
+
+void RenderThread::runCommands()
+{
+    CommandQueue::Command command;
+    while (m_commands.pop(command)) {
+        if (command.inputNs && (!m_pendingInputNs || command.inputNs < m_pendingInputNs))
+            m_pendingInputNs = command.inputNs;
+        command.run();
+    }
+}
+
+void RenderThread::renderFrame()
+{
+    // At most one frame in flight: input applied now is on screen one frame
+    // later, not behind a queue of them.
+    if (m_inFlight) {
+        m_gl.glClientWaitSync(m_inFlight, GL_SYNC_FLUSH_COMMANDS_BIT, FrameWaitNs);
+        m_inFlight = nullptr;
+    }
+
+    prepareBackSlot();
+    Slot &slot = m_slots[m_back];
+    m_gl.glBindFramebuffer(GL_FRAMEBUFFER, slot.fbo);
+    m_gl.glViewport(0, 0, slot.width, slot.height);
+
+    if (m_callbacks.render)
+        m_callbacks.render();
+
+    m_gl.glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    slot.rendered = m_gl.glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // The presenter's context waits on the fence: it must reach the GPU.
+    m_gl.glFlush();
+    slot.inputNs = m_pendingInputNs;
+    m_pendingInputNs = 0;
+    m_inFlight = slot.rendered;
+
+    m_back = m_middle.exchange(m_back | Fresh, std::memory_order_acq_rel) & SlotMask;
+    if (m_callbacks.frameReady)
+        m_callbacks.frameReady();
+}
+
+void RenderThread::prepareBackSlot()
+{
+    Slot &slot = m_slots[m_back];
+    if (slot.presented) {
+        m_gl.glWaitSync(slot.presented, 0, GL_TIMEOUT_IGNORED);
+        m_gl.glDeleteSync(slot.presented);
+        slot.presented = nullptr;
+    }
+    if (slot.rendered) {
+        m_gl.glDeleteSync(slot.rendered);
+        slot.rendered = nullptr;
+    }
+
+    if (m_depthWidth != m_frameWidth || m_depthHeight != m_frameHeight) {
+        if (m_depth)
+            m_gl.glDeleteRenderbuffers(1, &m_depth);
+        m_gl.glCreateRenderbuffers(1, &m_depth);
+        m_gl.glNamedRenderbufferStorage(m_depth, GL_DEPTH_COMPONENT24, m_frameWidth, m_frameHeight);
+        m_depthWidth = m_frameWidth;
+        m_depthHeight = m_frameHeight;
+    }
+
+    // Plain RGBA8: the passes write display-encoded values and the
+    // presenter's blit copies them as they are.
+    if (!slot.texture || slot.width != m_frameWidth || slot.height != m_frameHeight) {
+        if (slot.texture)
+            m_gl.glDeleteTextures(1, &slot.texture);
+        m_gl.glCreateTextures(GL_TEXTURE_2D, 1, &slot.texture);
+        m_gl.glTextureStorage2D(slot.texture, 1, GL_RGBA8, m_frameWidth, m_frameHeight);
+        if (!slot.fbo)
+            m_gl.glCreateFramebuffers(1, &slot.fbo);
+        m_gl.glNamedFramebufferTexture(slot.fbo, GL_COLOR_ATTACHMENT0, slot.texture, 0);
+        slot.width = m_frameWidth;
+        slot.height = m_frameHeight;
+    }
+    m_gl.glNamedFramebufferRenderbuffer(slot.fbo, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depth);
+}
+
+void RenderThread::releaseSlots()
+{
+    for (Slot &slot : m_slots) {
+        if (slot.rendered) m_gl.glDeleteSync(slot.rendered);
+        if (slot.presented) m_gl.glDeleteSync(slot.presented);
+        if (slot.texture) m_gl.glDeleteTextures(1, &slot.texture);
+        if (slot.fbo) m_gl.glDeleteFramebuffers(1, &slot.fbo);
+        slot = Slot();
+    }
+    if (m_depth)
+        m_gl.glDeleteRenderbuffers(1, &m_depth);
+    m_depth = 0;
+    m_depthWidth = m_depthHeight = 0;
+    m_inFlight = nullptr;
+}
+
+RenderThread::Presented RenderThread::present(GLuint targetFbo, int width, int height)
+{
+    Presented result;
+    if (m_middle.load(std::memory_order_acquire) & Fresh) {
+        m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & SlotMask;
+        result.newFrame = true;
+        result.inputNs = m_slots[m_front].inputNs;
+    }
+
+    Slot &slot = m_slots[m_front];
+    QOpenGLFunctions_4_5_Core &f = m_presentGl;
+    f.glBindFramebuffer(GL_DRAW_FRAMEBUFFER, targetFbo);
+    if (!slot.rendered) {
+        f.glClearColor(0.1f, 0.12f, 0.15f, 1.0f);
+        f.glClear(GL_COLOR_BUFFER_BIT);
+        return result;
+    }
+
+    // A GPU-side wait: the GUI thread itself never blocks on the renderer.
+    f.glWaitSync(slot.rendered, 0, GL_TIMEOUT_IGNORED);
+    if (!m_readFbo)
+        f.glCreateFramebuffers(1, &m_readFbo);
+    f.glNamedFramebufferTexture(m_readFbo, GL_COLOR_ATTACHMENT0, slot.texture, 0);
+    f.glBlitNamedFramebuffer(m_readFbo, targetFbo, 0, 0, slot.width, slot.height,
+                             0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+
+    if (slot.presented)
+        f.glDeleteSync(slot.presented);
+    slot.presented = f.glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    f.glFlush();
+    return result;
+}
+
+void RenderThread::releasePresenter()
+{
+    if (m_readFbo)
+        m_presentGl.glDeleteFramebuffers(1, &m_readFbo);
+    m_readFbo = 0;
+}
@@ -0,0 +1,133 @@
+#pragma once
+#include <QOpenGLFunctions_4_5_Core>
+#include <QSemaphore>
+#include <QThread>
+#include <atomic>
+#include <functional>
+#include "renderer/commandqueue.h"
+
+class QOffscreenSurface;
+class QOpenGLContext;
+
+// The thread that owns the interactive view's GL work. It has its own
+// context, shared with the window's, and renders every frame into an
+// offscreen texture; the window's paintGL only copies the newest finished
+// one to the screen. A long dispatch or a large upload therefore never
+// holds up the GUI thread, and input keeps being received while a frame
+// is in flight.
+//
+// Everything else reaches the thread as commands on a lock-free queue
+// (CommandQueue), run in order before the next frame. The thread sleeps
+// until a command arrives or a requested frame is due.
+//
+// Frames go through three slots in the classic triple-buffer arrangement:
+// the render thread draws into its back slot and swaps it with the shared
+// middle one in a single atomic exchange; the GUI thread swaps the middle
+// slot with its front one when a newer frame is there. Neither side ever
+// waits for the other on the CPU. Fences order the GPU work across the
+// two contexts: the presenter waits (on the GPU) for a slot's frame to be
+// rendered, the renderer for the presenter's last copy out of the slot it
+// is about to overwrite. The renderer keeps at most one frame in flight,
+// so input is not queued behind several frames of GPU work.
+class RenderThread : public QThread
+{
+public:
+    struct Callbacks {
+        // On the render thread with its context current.
+        std::function<void()> initialize;
+        // Draws one frame into the bound framebuffer (the back slot).
+        std::function<void()> render;
+        std::function<void()> shutdown;
+        // After each finished frame, on the render thread: ask the window
+        // to present.
+        std::function<void()> frameReady;
+    };
+
+    struct Presented {
+        bool newFrame = false;
+        // Steady-clock time of the oldest input the frame reflects, 0 when
+        // none arrived since the previous frame.
+        qint64 inputNs = 0;
+    };
+
+    static constexpr int SlotCount = 3;
+
+    explicit RenderThread(QObject *parent = nullptr);
+    ~RenderThread() override;
+
+    // GUI thread, with the window's context current: creates the render
+    // context sharing with it and starts the thread.
+    bool start(QOpenGLContext *shareContext, const Callbacks &callbacks);
+    // GUI thread: runs the pending commands and the shutdown callback, then
+    // joins the thread.
+    void stop();
+    bool running() const { return m_context != nullptr; }
+
+    // Any thread. inputNs (from now()) marks commands carrying user input.
+    void post(std::function<void()> run, qint64 inputNs = 0);
+    static qint64 now();
+
+    // Render thread.
+    void requestFrame(int delayMs = 0);
+    // Size of the frames rendered from the next one on.
+    void resizeFrames(int width, int height);
+    int frameWidth() const { return m_frameWidth; }
+    int frameHeight() const { return m_frameHeight; }
+
+    // GUI thread, with the window's context current: copies the newest
+    // finished frame into targetFbo, scaled to width x height. Before the
+    // first frame it only clears.
+    Presented present(GLuint targetFbo, int width, int height);
+    // GUI thread: frees the presenter's objects before its context goes.
+    void releasePresenter();
+
+protected:
+    void run() override;
+
+private:
+    struct Slot {
+        GLuint texture = 0;
+        GLuint fbo = 0;           // render context
+        int width = 0;
+        int height = 0;
+        GLsync rendered = nullptr;   // made by the renderer
+        GLsync presented = nullptr;  // made by the presenter
+        qint64 inputNs = 0;
+    };
+
+    static constexpr int SlotMask = 3;
+    static constexpr int Fresh = 4;   // middle slot not shown yet
+
+    void runCommands();
+    void renderFrame();
+    void prepareBackSlot();
+    void releaseSlots();
+
+    QOpenGLContext *m_context = nullptr;
+    QOffscreenSurface *m_surface = nullptr;
+    Callbacks m_callbacks;
+    CommandQueue m_commands;
+    QSemaphore m_wake;
+    bool m_quit = false;
+
+    // Render thread.
+    QOpenGLFunctions_4_5_Core m_gl;
+    Slot m_slots[SlotCount];
+    int m_back = 0;
+    GLuint m_depth = 0;
+    int m_depthWidth = 0;
+    int m_depthHeight = 0;
+    int m_frameWidth = 1;
+    int m_frameHeight = 1;
+    qint64 m_frameDueNs = -1;
+    qint64 m_pendingInputNs = 0;
+    GLsync m_inFlight = nullptr;
+
+    // Shared: index of the middle slot, | Fresh once a new frame is there.
+    std::atomic<int> m_middle { 1 };
+
+    // GUI thread.
+    QOpenGLFunctions_4_5_Core m_presentGl;
+    int m_front = 2;
+    GLuint m_readFbo = 0;
+};
@@ -0,0 +1,221 @@
+#include "sampler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <random>
+
+Sampler::Sampler()
+{
+    buildSobolMatrices();
+    buildRank1Generator();
+    buildBlueNoise();
+}
+
+const char* Sampler::modeName(Mode mode)
+{
+    switch (mode) {
+    case WhiteNoise:     return "white noise";
+    case SobolOwen:      return "Owen-scrambled Sobol";
+    case BlueNoiseRank1: return "blue-noise rank-1";
+    default:             return "unknown";
+    }
+}
+
+std::vector<quint32> Sampler::gpuTable() const
+{
+    std::vector<quint32> table;
+    table.reserve(m_sobol.size() + m_rank1.size() + m_blueNoise.size());
+    table.insert(table.end(), m_sobol.begin(), m_sobol.end());
+    table.insert(table.end(), m_rank1.begin(), m_rank1.end());
+    for (float v : m_blueNoise) {
+        quint32 bits;
+        std::memcpy(&bits, &v, sizeof(bits));
+        table.push_back(bits);
+    }
+    return table;
+}
+
+// Generator matrices for the first four Sobol dimensions (Joe & Kuo direction
+// numbers). Dimension 0 is the van der Corput sequence.
+void Sampler::buildSobolMatrices()
+{
+    struct Poly { int degree; quint32 a; quint32 m[3]; };
+    static const Poly polys[Dimensions - 1] = {
+        { 1, 0, { 1, 0, 0 } },
+        { 2, 1, { 1, 3, 0 } },
+        { 3, 1, { 1, 3, 1 } },
+    };
+
+    m_sobol.assign(Dimensions * MatrixBits, 0u);
+
+    for (int i = 0; i < MatrixBits; ++i)
+        m_sobol[i] = 1u << (31 - i);
+
+    for (int d = 1; d < Dimensions; ++d) {
+        const Poly &p = polys[d - 1];
+        quint32 *v = &m_sobol[d * MatrixBits];
+
+        for (int i = 0; i < p.degree; ++i)
+            v[i] = p.m[i] << (31 - i);
+
+        for (int i = p.degree; i < MatrixBits; ++i) {
+            v[i] = v[i - p.degree] ^ (v[i - p.degree] >> p.degree);
+            for (int k = 1; k < p.degree; ++k) {
+                if ((p.a >> (p.degree - 1 - k)) & 1u)
+                    v[i] ^= v[i - k];
+            }
+        }
+    }
+}
+
+// Component-by-component search for a rank-1 lattice generator, minimising the
+// P2 worst-case error for Rank1Points points. The shader walks the lattice in
+// radical-inverse order, (bitfieldReverse(i) * z) mod 2^32, so every
+// power-of-two prefix is itself a lattice.
+void Sampler::buildRank1Generator()
+{
+    const int n = Rank1Points;
+    const double twoPi2 = 2.0 * M_PI * M_PI;
+
+    auto bernoulli2 = [](double x) { return x * x - x + 1.0 / 6.0; };
+
+    std::vector<double> product(n, 1.0);
+    auto accumulate = [&](quint32 z) {
+        for (int k = 0; k < n; ++k) {
+            double x = double((quint64(k) * z) % n) / n;
+            product[k] *= 1.0 + twoPi2 * bernoulli2(x);
+        }
+    };
+
+    m_rank1.clear();
+    m_rank1.push_back(1u);
+    accumulate(1u);
+
+    for (int d = 1; d < Dimensions; ++d) {
+        quint32 bestZ = 1u;
+        double bestErr = std::numeric_limits<double>::max();
+
+        for (quint32 z = 3; z < quint32(n); z += 2) {
+            if (std::find(m_rank1.begin(), m_rank1.end(), z) != m_rank1.end())
+                continue;
+
+            double err = 0.0;
+            for (int k = 0; k < n; ++k) {
+                double x = double((quint64(k) * z) % n) / n;
+                err += product[k] * (1.0 + twoPi2 * bernoulli2(x));
+            }
+            if (err < bestErr) {
+                bestErr = err;
+                bestZ = z;
+            }
+        }
+
+        m_rank1.push_back(bestZ);
+        accumulate(bestZ);
+    }
+}
+
+// Void-and-cluster blue-noise dither mask (Ulichney 1993), stored as ranks
+// normalised to [0, 1).
+void Sampler::buildBlueNoise()
+{
+    const int size = BlueNoiseSize;
+    const int n = size * size;
+    const float sigma = 1.5f;
+
+    std::vector<float> kernel(n);
+    for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+            int dx = std::min(x, size - x);
+            int dy = std::min(y, size - y);
+            kernel[y * size + x] = std::exp(-float(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+        }
+    }
+
+    auto splat = [&](std::vector<float> &energy, int p, float sign) {
+        int px = p % size;
+        int py = p / size;
+        for (int y = 0; y < size; ++y) {
+            const float *krow = &kernel[((y - py + size) % size) * size];
+            float *erow = &energy[y * size];
+            for (int x = 0; x < size; ++x)
+                erow[x] += sign * krow[(x - px + size) % size];
+        }
+    };
+
+    auto tightestCluster = [&](const std::vector<char> &pattern, const std::vector<float> &energy) {
+        int best = -1;
+        for (int i = 0; i < n; ++i)
+            if (pattern[i] && (best < 0 || energy[i] > energy[best])) best = i;
+        return best;
+    };
+
+    auto largestVoid = [&](const std::vector<char> &pattern, const std::vector<float> &energy) {
+        int best = -1;
+        for (int i = 0; i < n; ++i)
+            if (!pattern[i] && (best < 0 || energy[i] < energy[best])) best = i;
+        return best;
+    };
+
+    // Initial binary pattern: random points relaxed until the tightest
+    // cluster and the largest void coincide.
+    const int initialOnes = n / 10;
+    std::vector<int> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::mt19937 rng(0x5eed1234u);
+    std::shuffle(order.begin(), order.end(), rng);
+
+    std::vector<char> initial(n, 0);
+    std::vector<float> initialEnergy(n, 0.0f);
+    for (int i = 0; i < initialOnes; ++i) {
+        initial[order[i]] = 1;
+        splat(initialEnergy, order[i], 1.0f);
+    }
+
+    for (int iter = 0; iter < n; ++iter) {
+        int cluster = tightestCluster(initial, initialEnergy);
+        initial[cluster] = 0;
+        splat(initialEnergy, cluster, -1.0f);
+
+        int voidPx = largestVoid(initial, initialEnergy);
+        initial[voidPx] = 1;
+        splat(initialEnergy, voidPx, 1.0f);
+
+        if (voidPx == cluster)
+            break;
+    }
+
+    std::vector<int> rank(n, 0);
+
+    // Phase 1: rank the initial points by repeatedly removing the tightest cluster.
+    {
+        std::vector<char> pattern = initial;
+        std::vector<float> energy = initialEnergy;
+        for (int r = initialOnes - 1; r >= 0; --r) {
+            int cluster = tightestCluster(pattern, energy);
+            pattern[cluster] = 0;
+            splat(energy, cluster, -1.0f);
+            rank[cluster] = r;
+        }
+    }
+
+    // Phases 2 and 3: fill the largest void until every pixel is ranked. Past
+    // half coverage the tightest cluster of zeros is the same pixel as the
+    // largest void of ones, so a single loop covers both phases.
+    {
+        std::vector<char> pattern = initial;
+        std::vector<float> energy = initialEnergy;
+        for (int r = initialOnes; r < n; ++r) {
+            int voidPx = largestVoid(pattern, energy);
+            pattern[voidPx] = 1;
+            splat(energy, voidPx, 1.0f);
+            rank[voidPx] = r;
+        }
+    }
+
+    m_blueNoise.resize(n);
+    for (int i = 0; i < n; ++i)
+        m_blueNoise[i] = (float(rank[i]) + 0.5f) / float(n);
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <QtGlobal>
+#include <vector>
+
+// Sample tables used by the compute tracer to draw pixel jitter and bounce
+// directions. Everything is generated once on the CPU and uploaded as a single
+// SSBO (see gpuTable()); raytrace.comp indexes it by pixel, sample index and
+// dimension set (one 4D set for the camera, then one per bounce).
+class Sampler
+{
+public:
+    enum Mode {
+        WhiteNoise = 0,     // legacy hash RNG
+        SobolOwen = 1,      // 4D Sobol, Owen scrambled and shuffled per pixel
+        BlueNoiseRank1 = 2, // rank-1 lattice sequence rotated by a blue-noise mask
+        ModeCount
+    };
+
+    static constexpr int Dimensions = 4;
+    static constexpr int MatrixBits = 32;
+    static constexpr int BlueNoiseSize = 64;
+    static constexpr int Rank1Points = 1024;
+
+    Sampler();
+
+    const std::vector<quint32>& sobolMatrices() const { return m_sobol; }
+    const std::vector<quint32>& rank1Generator() const { return m_rank1; }
+    const std::vector<float>& blueNoise() const { return m_blueNoise; }
+
+    // Layout matches the SamplerTables block in raytrace.comp:
+    // uint sobolMatrices[Dimensions * MatrixBits]; uint rank1Generator[Dimensions];
+    // float blueNoise[BlueNoiseSize * BlueNoiseSize];
+    std::vector<quint32> gpuTable() const;
+
+    static const char* modeName(Mode mode);
+
+private:
+    void buildSobolMatrices();
+    void buildRank1Generator();
+    void buildBlueNoise();
+
+    std::vector<quint32> m_sobol;
+    std::vector<quint32> m_rank1;
+    std::vector<float> m_blueNoise;
+};
@@ -0,0 +1,687 @@
+#include "softwarerasterizer.h"
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <QtMath>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <numeric>
+#include "renderer/camera.h"
+#include "renderer/sphereinstances.h"
+#include "scene/assetcache.h"
+#include "scene/mesh.h"
+#include "scene/parallel.h"
+#include "scene/scene.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SOFTWARE_RASTERIZER_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+constexpr int SubpixelScale = 1 << SoftwareRasterizer::SubpixelBits;
+constexpr int BlockSize = SoftwareRasterizer::BlockSize;
+constexpr int MeshChunk = 16384;   // triangles per setup job
+constexpr int SphereChunk = 64;    // sphere instances per setup job
+const quint32 ClearColor = 0xff261f1au; // doRaster's (0.1, 0.12, 0.15)
+
+struct ClipVertex {
+    float x, y, z, w;
+    float r, g, b;
+};
+
+ClipVertex lerp(const ClipVertex &a, const ClipVertex &b, float t)
+{
+    return { a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t, a.w + (b.w - a.w) * t,
+             a.r + (b.r - a.r) * t, a.g + (b.g - a.g) * t, a.b + (b.b - a.b) * t };
+}
+
+// basic.frag without baked lighting.
+QVector3D shaded(const QVector3D &color, const QVector3D &normal)
+{
+    static const QVector3D light = QVector3D(0.3f, 1.0f, 0.5f).normalized();
+    return color * (0.35f + 0.65f * qAbs(QVector3D::dotProduct(normal.normalized(), light)));
+}
+
+ClipVertex clipVertex(const QMatrix4x4 &mvp, const QVector3D &position, const QVector3D &color)
+{
+    const QVector4D p = mvp.map(QVector4D(position, 1.0f));
+    return { p.x(), p.y(), p.z(), p.w(), color.x(), color.y(), color.z() };
+}
+
+// Edge i runs from vertex i to vertex i + 1; E(p) = a * x + b * y + c in
+// fixed-point units is positive inside, and c has the fill-rule bias
+// folded in so that inside is E >= 0. Depth and color are planes in
+// pixels around vertex 0.
+struct Triangle {
+    qint32 a[3], b[3];
+    qint64 c[3];
+    float x0, y0;
+    float z0, dzdx, dzdy;
+    float c0[3], dcdx[3], dcdy[3];
+    float minZ;
+    int minX, minY, maxX, maxY;
+};
+
+struct Batch {
+    QVector<Triangle> triangles;
+    // One entry per triangle and tile it overlaps, in triangle order.
+    QVector<quint32> tiles;
+    QVector<quint32> entries;
+};
+
+struct Setup {
+    int width = 0;
+    int height = 0;
+    int tilesX = 0;
+    float guardX = 1.0f;
+    float guardY = 1.0f;
+};
+
+// Clip-space outcodes. Bits 0-5 are the planes triangles are clipped
+// against: near, far and the guard band. Bits 6-9 are the viewport sides,
+// only used to drop triangles that are entirely off screen.
+int outcode(const ClipVertex &v, const Setup &s)
+{
+    int code = 0;
+    if (v.z < -v.w) code |= 1;
+    if (v.z > v.w) code |= 2;
+    if (v.x < -s.guardX * v.w) code |= 4;
+    if (v.x > s.guardX * v.w) code |= 8;
+    if (v.y < -s.guardY * v.w) code |= 16;
+    if (v.y > s.guardY * v.w) code |= 32;
+    if (v.x < -v.w) code |= 64;
+    if (v.x > v.w) code |= 128;
+    if (v.y < -v.w) code |= 256;
+    if (v.y > v.w) code |= 512;
+    return code;
+}
+
+float planeDistance(const ClipVertex &v, int plane, const Setup &s)
+{
+    switch (plane) {
+    case 0: return v.w + v.z;
+    case 1: return v.w - v.z;
+    case 2: return s.guardX * v.w + v.x;
+    case 3: return s.guardX * v.w - v.x;
+    case 4: return s.guardY * v.w + v.y;
+    default: return s.guardY * v.w - v.y;
+    }
+}
+
+struct ScreenVertex {
+    qint32 X, Y;
+    float x, y, z;
+    float r, g, b;
+};
+
+ScreenVertex project(const ClipVertex &v, const Setup &s)
+{
+    const float invW = 1.0f / v.w;
+    ScreenVertex out;
+    out.X = qint32(std::lround((v.x * invW * 0.5f + 0.5f) * s.width * SubpixelScale));
+    out.Y = qint32(std::lround((0.5f - v.y * invW * 0.5f) * s.height * SubpixelScale));
+    out.x = float(out.X) / SubpixelScale;
+    out.y = float(out.Y) / SubpixelScale;
+    out.z = qBound(0.0f, v.z * invW * 0.5f + 0.5f, 1.0f);
+    out.r = v.r;
+    out.g = v.g;
+    out.b = v.b;
+    return out;
+}
+
+void setupScreenTriangle(ScreenVertex v0, ScreenVertex v1, ScreenVertex v2, const Setup &s, Batch &out)
+{
+    qint64 area = qint64(v1.X - v0.X) * (v2.Y - v0.Y) - qint64(v2.X - v0.X) * (v1.Y - v0.Y);
+    if (area == 0)
+        return;
+    // No back-face culling: basic.frag lights both sides.
+    if (area < 0) {
+        std::swap(v1, v2);
+        area = -area;
+    }
+
+    // Pixel centers sit at +1/2; keep those inside the snapped bounds.
+    const int half = SubpixelScale / 2;
+    Triangle t;
+    t.minX = qMax(0, (qMin(v0.X, qMin(v1.X, v2.X)) - half + SubpixelScale - 1) >> SoftwareRasterizer::SubpixelBits);
+    t.minY = qMax(0, (qMin(v0.Y, qMin(v1.Y, v2.Y)) - half + SubpixelScale - 1) >> SoftwareRasterizer::SubpixelBits);
+    t.maxX = qMin(s.width - 1, (qMax(v0.X, qMax(v1.X, v2.X)) - half) >> SoftwareRasterizer::SubpixelBits);
+    t.maxY = qMin(s.height - 1, (qMax(v0.Y, qMax(v1.Y, v2.Y)) - half) >> SoftwareRasterizer::SubpixelBits);
+    if (t.minX > t.maxX || t.minY > t.maxY)
+        return;
+
+    const ScreenVertex *v[3] = { &v0, &v1, &v2 };
+    for (int i = 0; i < 3; ++i) {
+        const ScreenVertex &p = *v[i];
+        const ScreenVertex &q = *v[(i + 1) % 3];
+        t.a[i] = p.Y - q.Y;
+        t.b[i] = q.X - p.X;
+        t.c[i] = -qint64(t.a[i]) * p.X - qint64(t.b[i]) * p.Y;
+        // An edge shared by two triangles has opposite a and b in each, so
+        // exactly one of them owns the pixels centered on it.
+        const bool owns = t.a[i] > 0 || (t.a[i] == 0 && t.b[i] < 0);
+        if (!owns)
+            t.c[i] -= 1;
+    }
+
+    const float det = float(area) / (SubpixelScale * SubpixelScale);
+    const float ex1 = v1.x - v0.x, ey1 = v1.y - v0.y;
+    const float ex2 = v2.x - v0.x, ey2 = v2.y - v0.y;
+    auto plane = [&](float f0, float f1, float f2, float &ddx, float &ddy) {
+        ddx = ((f1 - f0) * ey2 - (f2 - f0) * ey1) / det;
+        ddy = ((f2 - f0) * ex1 - (f1 - f0) * ex2) / det;
+    };
+    t.x0 = v0.x;
+    t.y0 = v0.y;
+    t.z0 = v0.z;
+    plane(v0.z, v1.z, v2.z, t.dzdx, t.dzdy);
+    t.c0[0] = v0.r; plane(v0.r, v1.r, v2.r, t.dcdx[0], t.dcdy[0]);
+    t.c0[1] = v0.g; plane(v0.g, v1.g, v2.g, t.dcdx[1], t.dcdy[1]);
+    t.c0[2] = v0.b; plane(v0.b, v1.b, v2.b, t.dcdx[2], t.dcdy[2]);
+    t.minZ = qMin(v0.z, qMin(v1.z, v2.z));
+
+    const quint32 index = quint32(out.triangles.size());
+    out.triangles.append(t);
+    const int size = SoftwareRasterizer::TileSize;
+    for (int ty = t.minY / size; ty <= t.maxY / size; ++ty) {
+        for (int tx = t.minX / size; tx <= t.maxX / size; ++tx) {
+            out.tiles.append(quint32(ty * s.tilesX + tx));
+            out.entries.append(index);
+        }
+    }
+}
+
+void setupTriangle(const ClipVertex &a, const ClipVertex &b, const ClipVertex &c, const Setup &s, Batch &out)
+{
+    const int codes[3] = { outcode(a, s), outcode(b, s), outcode(c, s) };
+    if (codes[0] & codes[1] & codes[2])
+        return;
+
+    if (!((codes[0] | codes[1] | codes[2]) & 63)) {
+        setupScreenTriangle(project(a, s), project(b, s), project(c, s), s, out);
+        return;
+    }
+
+    // Sutherland-Hodgman against the planes some vertex is outside of.
+    ClipVertex buffers[2][9] = { { a, b, c } };
+    int count = 3;
+    int current = 0;
+    const int crossed = codes[0] | codes[1] | codes[2];
+    for (int plane = 0; plane < 6 && count >= 3; ++plane) {
+        if (!(crossed & (1 << plane)))
+            continue;
+        const ClipVertex *in = buffers[current];
+        ClipVertex *clipped = buffers[current ^ 1];
+        int n = 0;
+        for (int i = 0; i < count; ++i) {
+            const ClipVertex &p = in[i];
+            const ClipVertex &q = in[(i + 1) % count];
+            const float dp = planeDistance(p, plane, s);
+            const float dq = planeDistance(q, plane, s);
+            if (dp >= 0.0f)
+                clipped[n++] = p;
+            if ((dp >= 0.0f) != (dq >= 0.0f))
+                clipped[n++] = lerp(p, q, dp / (dp - dq));
+        }
+        count = n;
+        current ^= 1;
+    }
+    if (count < 3)
+        return;
+
+    ScreenVertex projected[9];
+    for (int i = 0; i < count; ++i)
+        projected[i] = project(buffers[current][i], s);
+    for (int i = 1; i + 1 < count; ++i)
+        setupScreenTriangle(projected[0], projected[i], projected[i + 1], s, out);
+}
+
+quint32 packColor(float r, float g, float b)
+{
+    auto unorm8 = [](float v) { return quint32(qBound(0.0f, v, 1.0f) * 255.0f + 0.5f); };
+    return unorm8(r) | (unorm8(g) << 8) | (unorm8(b) << 16) | 0xff000000u;
+}
+
+// One 8x8 block of a triangle. e holds the edge functions at the first
+// pixel center, sx and sy their steps per pixel; edges the whole block is
+// inside of come in as zero. depth and color point at the block's first
+// pixel. Returns whether any pixel was written.
+bool drawBlock(const Triangle &t, int bx, int by, const qint32 e[3], const qint32 sx[3], const qint32 sy[3],
+               float *depth, quint32 *color, int stride)
+{
+    const float fx = bx + 0.5f - t.x0;
+    const float fy = by + 0.5f - t.y0;
+    float z = t.z0 + t.dzdx * fx + t.dzdy * fy;
+    float c[3];
+    for (int k = 0; k < 3; ++k)
+        c[k] = t.c0[k] + t.dcdx[k] * fx + t.dcdy[k] * fy;
+    bool written = false;
+
+#ifdef SOFTWARE_RASTERIZER_SSE2
+    const __m128 lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    const __m128i minusOne = _mm_set1_epi32(-1);
+    const __m128i alpha = _mm_set1_epi32(int(0xff000000u));
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 scale = _mm_set1_ps(255.0f);
+    const __m128 round = _mm_set1_ps(0.5f);
+
+    __m128i edge[3][2];
+    __m128i edgeStepY[3];
+    for (int k = 0; k < 3; ++k) {
+        edge[k][0] = _mm_setr_epi32(e[k], e[k] + sx[k], e[k] + 2 * sx[k], e[k] + 3 * sx[k]);
+        edge[k][1] = _mm_add_epi32(edge[k][0], _mm_set1_epi32(4 * sx[k]));
+        edgeStepY[k] = _mm_set1_epi32(sy[k]);
+    }
+    __m128 zRow[2], cRow[3][2];
+    zRow[0] = _mm_add_ps(_mm_set1_ps(z), _mm_mul_ps(_mm_set1_ps(t.dzdx), lanes));
+    zRow[1] = _mm_add_ps(zRow[0], _mm_set1_ps(4.0f * t.dzdx));
+    for (int k = 0; k < 3; ++k) {
+        cRow[k][0] = _mm_add_ps(_mm_set1_ps(c[k]), _mm_mul_ps(_mm_set1_ps(t.dcdx[k]), lanes));
+        cRow[k][1] = _mm_add_ps(cRow[k][0], _mm_set1_ps(4.0f * t.dcdx[k]));
+    }
+    const __m128 zStepY = _mm_set1_ps(t.dzdy);
+    const __m128 cStepY[3] = { _mm_set1_ps(t.dcdy[0]), _mm_set1_ps(t.dcdy[1]), _mm_set1_ps(t.dcdy[2]) };
+
+    for (int y = 0; y < BlockSize; ++y) {
+        for (int h = 0; h < 2; ++h) {
+            const __m128i any = _mm_or_si128(_mm_or_si128(edge[0][h], edge[1][h]), edge[2][h]);
+            const __m128i inside = _mm_cmpgt_epi32(any, minusOne);
+            float *d = depth + y * stride + 4 * h;
+            const __m128 stored = _mm_loadu_ps(d);
+            const __m128 pass = _mm_and_ps(_mm_castsi128_ps(inside), _mm_cmplt_ps(zRow[h], stored));
+            if (_mm_movemask_ps(pass)) {
+                _mm_storeu_ps(d, _mm_or_ps(_mm_and_ps(pass, zRow[h]), _mm_andnot_ps(pass, stored)));
+                __m128i rgb[3];
+                for (int k = 0; k < 3; ++k) {
+                    const __m128 v = _mm_min_ps(_mm_max_ps(cRow[k][h], zero), one);
+                    rgb[k] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, scale), round));
+                }
+                const __m128i packed = _mm_or_si128(_mm_or_si128(rgb[0], _mm_slli_epi32(rgb[1], 8)),
+                                                    _mm_or_si128(_mm_slli_epi32(rgb[2], 16), alpha));
+                __m128i *out = reinterpret_cast<__m128i*>(color + y * stride + 4 * h);
+                const __m128i passMask = _mm_castps_si128(pass);
+                const __m128i old = _mm_loadu_si128(out);
+                _mm_storeu_si128(out, _mm_or_si128(_mm_and_si128(passMask, packed), _mm_andnot_si128(passMask, old)));
+                written = true;
+            }
+        }
+        for (int k = 0; k < 3; ++k) {
+            edge[k][0] = _mm_add_epi32(edge[k][0], edgeStepY[k]);
+            edge[k][1] = _mm_add_epi32(edge[k][1], edgeStepY[k]);
+        }
+        for (int h = 0; h < 2; ++h) {
+            zRow[h] = _mm_add_ps(zRow[h], zStepY);
+            for (int k = 0; k < 3; ++k)
+                cRow[k][h] = _mm_add_ps(cRow[k][h], cStepY[k]);
+        }
+    }
+#else
+    qint32 row[3] = { e[0], e[1], e[2] };
+    for (int y = 0; y < BlockSize; ++y) {
+        qint32 edge[3] = { row[0], row[1], row[2] };
+        float zx = z;
+        float cx[3] = { c[0], c[1], c[2] };
+        for (int x = 0; x < BlockSize; ++x) {
+            float &stored = depth[y * stride + x];
+            if ((edge[0] | edge[1] | edge[2]) >= 0 && zx < stored) {
+                stored = zx;
+                color[y * stride + x] = packColor(cx[0], cx[1], cx[2]);
+                written = true;
+            }
+            for (int k = 0; k < 3; ++k) {
+                edge[k] += sx[k];
+                cx[k] += t.dcdx[k];
+            }
+            zx += t.dzdx;
+        }
+        for (int k = 0; k < 3; ++k) {
+            row[k] += sy[k];
+            c[k] += t.dcdy[k];
+        }
+        z += t.dzdy;
+    }
+#endif
+    return written;
+}
+
+struct TileCounters {
+    qint64 blocks = 0;
+    qint64 culled = 0;
+};
+
+} // namespace
+
+void SoftwareRasterizer::resize(int width, int height)
+{
+    width = qBound(1, width, MaxSize);
+    height = qBound(1, height, MaxSize);
+    if (width == m_width && height == m_height)
+        return;
+
+    m_width = width;
+    m_height = height;
+    m_stride = (width + TileSize - 1) / TileSize * TileSize;
+    m_paddedHeight = (height + TileSize - 1) / TileSize * TileSize;
+    m_depth.assign(size_t(m_stride) * m_paddedHeight, 1.0f);
+    m_color.assign(size_t(m_stride) * m_paddedHeight, ClearColor);
+    m_blockMaxZ.assign(size_t(m_stride / BlockSize) * (m_paddedHeight / BlockSize), 1.0f);
+}
+
+void SoftwareRasterizer::render(const Scene &scene, const QMatrix4x4 &view, const QMatrix4x4 &proj)
+{
+    if (m_width == 0)
+        resize(1, 1);
+    m_stats = Stats();
+
+    Setup setup;
+    setup.width = m_width;
+    setup.height = m_height;
+    setup.tilesX = m_stride / TileSize;
+    setup.guardX = float(GuardBand) / (0.5f * m_width);
+    setup.guardY = float(GuardBand) / (0.5f * m_height);
+    const int tilesY = m_paddedHeight / TileSize;
+    const int tileCount = setup.tilesX * tilesY;
+
+    // Vertices, per mesh.
+    QElapsedTimer timer;
+    timer.start();
+    const QMatrix4x4 viewProj = proj * view;
+    QVector<Mesh*> meshes;
+    QVector<QVector<ClipVertex>> vertices;
+    for (Mesh *mesh : scene.meshes()) {
+        if (mesh->indexCount() < 3)
+            continue;
+        if (!mesh->restoreCpuGeometry()) {
+            qWarning() << "Software rasterizer: skipping" << mesh->name() << "(CPU geometry released)";
+            continue;
+        }
+        const QMatrix4x4 mvp = viewProj * mesh->modelMatrix;
+        const QMatrix4x4 normalMatrix = mesh->modelMatrix.inverted().transposed();
+        const QVector3D materialColor = mesh->material().color;
+        QVector<ClipVertex> out(mesh->vertexCount());
+        ClipVertex *transformed = out.data();
+        parallelRanges(out.size(), 4096, [&](int begin, int end) {
+            for (int i = begin; i < end; ++i) {
+                QVector3D color = materialColor;
+                if (mesh->hasColors()) {
+                    const quint32 c = mesh->packedColors()[i];
+                    color = QVector3D(float(c & 0xff), float((c >> 8) & 0xff), float((c >> 16) & 0xff)) / 255.0f;
+                }
+                transformed[i] = clipVertex(mvp, mesh->position(i), shaded(color, normalMatrix.mapVector(mesh->normal(i))));
+            }
+        });
+        meshes.append(mesh);
+        vertices.append(out);
+        m_stats.triangles += mesh->indexCount() / 3;
+    }
+
+    // Spheres are the shared unit sphere of the OpenGL view, transformed
+    // per instance during setup; whole spheres outside the frustum are
+    // skipped using its planes (Gribb and Hartmann).
+    const QVector<SphereInstance> &spheres = scene.spheres();
+    Mesh::Geometry unitSphere;
+    QVector4D frustum[6];
+    if (!spheres.isEmpty()) {
+        unitSphere = Mesh::sphereGeometry(1.0f, SphereInstances::RasterStacks, SphereInstances::RasterSlices);
+        m_stats.triangles += qint64(spheres.size()) * (unitSphere.indices.size() / 3);
+        for (int i = 0; i < 3; ++i) {
+            frustum[2 * i] = viewProj.row(3) + viewProj.row(i);
+            frustum[2 * i + 1] = viewProj.row(3) - viewProj.row(i);
+        }
+        for (QVector4D &plane : frustum)
+            plane /= plane.toVector3D().length();
+    }
+    m_stats.transformMs = timer.nsecsElapsed() / 1e6;
+
+    // Clipping, setup and binning.
+    timer.start();
+    struct Job { int mesh; int begin; int end; };
+    QVector<Job> jobs;
+    for (int m = 0; m < meshes.size(); ++m) {
+        const int triangles = meshes[m]->indexCount() / 3;
+        for (int begin = 0; begin < triangles; begin += MeshChunk)
+            jobs.append({ m, begin, qMin(triangles, begin + MeshChunk) });
+    }
+    for (int begin = 0; begin < spheres.size(); begin += SphereChunk)
+        jobs.append({ -1, begin, qMin(int(spheres.size()), begin + SphereChunk) });
+
+    QVector<Batch> batches(jobs.size());
+    Batch *batchData = batches.data();
+    QVector<int> jobIndices(jobs.size());
+    std::iota(jobIndices.begin(), jobIndices.end(), 0);
+    QtConcurrent::blockingMap(jobIndices, [&](int j) {
+        const Job &job = jobs[j];
+        Batch &out = batchData[j];
+        if (job.mesh >= 0) {
+            const QVector<unsigned int> &indices = meshes[job.mesh]->indices();
+            const ClipVertex *v = vertices[job.mesh].constData();
+            for (int t = job.begin; t < job.end; ++t)
+                setupTriangle(v[indices[3 * t]], v[indices[3 * t + 1]], v[indices[3 * t + 2]], setup, out);
+            return;
+        }
+
+        const QVector<Material> &materials = scene.materials();
+        QVector<ClipVertex> local(unitSphere.positions.size());
+        for (int i = job.begin; i < job.end; ++i) {
+            const SphereInstance &sphere = spheres[i];
+            bool visible = true;
+            for (const QVector4D &plane : frustum)
+                visible &= QVector3D::dotProduct(plane.toVector3D(), sphere.center) + plane.w() >= -sphere.radius;
+            if (!visible)
+                continue;
+
+            const QVector3D color = sphere.materialId >= 0 && sphere.materialId < materials.size()
+                ? materials[sphere.materialId].color : QVector3D(0.8f, 0.8f, 0.8f);
+            for (int k = 0; k < local.size(); ++k)
+                local[k] = clipVertex(viewProj, sphere.center + unitSphere.positions[k] * sphere.radius,
+                                      shaded(color, unitSphere.normals[k]));
+            const QVector<unsigned int> &indices = unitSphere.indices;
+            for (int t = 0; t + 2 < indices.size(); t += 3)
+                setupTriangle(local[indices[t]], local[indices[t + 1]], local[indices[t + 2]], setup, out);
+        }
+    });
+
+    // Stable counting sort of the bin entries by tile: every tile sees its
+    // triangles in submission order.
+    std::vector<quint32> binStart(size_t(tileCount) + 1, 0);
+    for (const Batch &batch : batches) {
+        m_stats.rasterized += batch.triangles.size();
+        for (quint32 tile : batch.tiles)
+            ++binStart[tile + 1];
+    }
+    for (int i = 0; i < tileCount; ++i)
+        binStart[i + 1] += binStart[i];
+    m_stats.binned = binStart[tileCount];
+    std::vector<const Triangle*> bins(binStart[tileCount]);
+    std::vector<quint32> fill(binStart.begin(), binStart.end() - 1);
+    for (const Batch &batch : batches)
+        for (int i = 0; i < batch.tiles.size(); ++i)
+            bins[fill[batch.tiles[i]]++] = &batch.triangles[batch.entries[i]];
+    m_stats.setupMs = timer.nsecsElapsed() / 1e6;
+
+    // Tiles.
+    timer.start();
+    const int blocksPerRow = m_stride / BlockSize;
+    QVector<int> tiles(tileCount);
+    std::iota(tiles.begin(), tiles.end(), 0);
+    std::vector<TileCounters> counters(tileCount);
+    QtConcurrent::blockingMap(tiles, [&](int tile) {
+        const int x0 = (tile % setup.tilesX) * TileSize;
+        const int y0 = (tile / setup.tilesX) * TileSize;
+        for (int y = y0; y < y0 + TileSize; ++y) {
+            std::fill_n(m_depth.begin() + size_t(y) * m_stride + x0, TileSize, 1.0f);
+            std::fill_n(m_color.begin() + size_t(y) * m_stride + x0, TileSize, ClearColor);
+        }
+        for (int by = y0 / BlockSize; by < (y0 + TileSize) / BlockSize; ++by)
+            std::fill_n(m_blockMaxZ.begin() + size_t(by) * blocksPerRow + x0 / BlockSize, TileSize / BlockSize, 1.0f);
+
+        TileCounters &count = counters[tile];
+        for (quint32 b = binStart[tile]; b < binStart[tile + 1]; ++b) {
+            const Triangle &t = *bins[b];
+            const int bx0 = qMax(t.minX, x0) & ~(BlockSize - 1);
+            const int by0 = qMax(t.minY, y0) & ~(BlockSize - 1);
+            const int bx1 = qMin(t.maxX, x0 + TileSize - 1);
+            const int by1 = qMin(t.maxY, y0 + TileSize - 1);
+            for (int by = by0; by <= by1; by += BlockSize) {
+                for (int bx = bx0; bx <= bx1; bx += BlockSize) {
+                    ++count.blocks;
+                    float &blockMaxZ = m_blockMaxZ[size_t(by / BlockSize) * blocksPerRow + bx / BlockSize];
+                    if (t.minZ >= blockMaxZ) {
+                        ++count.culled;
+                        continue;
+                    }
+
+                    // Exact corner tests in 64 bits; an edge that crosses
+                    // the block stays well inside 32 bits over it.
+                    const qint64 px = qint64(bx) * SubpixelScale + SubpixelScale / 2;
+                    const qint64 py = qint64(by) * SubpixelScale + SubpixelScale / 2;
+                    const qint64 span = BlockSize - 1;
+                    qint32 e[3], sx[3], sy[3];
+                    bool outside = false;
+                    for (int k = 0; k < 3 && !outside; ++k) {
+                        const qint64 value = t.a[k] * px + t.b[k] * py + t.c[k];
+                        const qint64 stepX = qint64(t.a[k]) * SubpixelScale;
+                        const qint64 stepY = qint64(t.b[k]) * SubpixelScale;
+                        const qint64 low = value + qMin<qint64>(0, span * stepX) + qMin<qint64>(0, span * stepY);
+                        const qint64 high = value + qMax<qint64>(0, span * stepX) + qMax<qint64>(0, span * stepY);
+                        outside = high < 0;
+                        const bool covered = low >= 0;
+                        e[k] = covered ? 0 : qint32(value);
+                        sx[k] = covered ? 0 : qint32(stepX);
+                        sy[k] = covered ? 0 : qint32(stepY);
+                    }
+                    if (outside)
+                        continue;
+
+                    const size_t first = size_t(by) * m_stride + bx;
+                    if (!drawBlock(t, bx, by, e, sx, sy, m_depth.data() + first, m_color.data() + first, m_stride))
+                        continue;
+                    float farthest = 0.0f;
+                    for (int y = 0; y < BlockSize; ++y)
+                        for (int x = 0; x < BlockSize; ++x)
+                            farthest = qMax(farthest, m_depth[first + size_t(y) * m_stride + x]);
+                    blockMaxZ = farthest;
+                }
+            }
+        }
+    });
+    for (const TileCounters &count : counters) {
+        m_stats.blocks += count.blocks;
+        m_stats.blocksCulled += count.culled;
+    }
+    m_stats.rasterMs = timer.nsecsElapsed() / 1e6;
+}
+
+QImage SoftwareRasterizer::image() const
+{
+    if (m_color.empty())
+        return QImage();
+    return QImage(reinterpret_cast<const uchar*>(m_color.data()), m_width, m_height,
+                  qsizetype(m_stride) * sizeof(quint32), QImage::Format_RGBX8888).copy();
+}
+
+int SoftwareRasterizer::runPreview(const QStringList &arguments)
+{
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addOption({ "software-preview", "Rasterize on the CPU to an image, without OpenGL." });
+    parser.addOption({ "scene", "Built-in scene: cornell, planesphere, spheres or none.", "name" });
+    parser.addOption({ "width", "Image width.", "pixels", "1280" });
+    parser.addOption({ "height", "Image height.", "pixels", "720" });
+    parser.addOption({ "yaw", "Camera yaw in degrees.", "degrees", "-90" });
+    parser.addOption({ "pitch", "Camera pitch in degrees.", "degrees", "0" });
+    parser.addOption({ "fov", "Vertical field of view in degrees.", "degrees", "60" });
+    parser.addOption({ "repeats", "Frames to render; the fastest is reported.", "n", "1" });
+    parser.addOption({ "output", "Image to write.", "file", "preview.png" });
+    parser.addPositionalArgument("meshes", "OFF, PLY or OBJ files to add.");
+    parser.process(arguments);
+
+    // Meshes on their own by default: scanned models rarely fit the box.
+    const QStringList paths = parser.positionalArguments();
+    const QString sceneName = parser.value("scene").isEmpty() ? (paths.isEmpty() ? "cornell" : "none")
+                                                              : parser.value("scene");
+    Scene scene;
+    if (sceneName == "cornell") scene.buildCornellBox();
+    else if (sceneName == "planesphere") scene.buildPlaneSphere();
+    else if (sceneName == "spheres") scene.buildSphereField(100000);
+    else if (sceneName != "none") qWarning() << "Unknown scene" << sceneName << "- using none";
+
+    for (const QString &path : paths) {
+        if (Mesh *mesh = AssetCache::instance().createMesh(path))
+            scene.addMesh(mesh);
+    }
+
+    // Frame everything: bounding sphere of the meshes' and spheres' boxes.
+    QVector3D lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    auto include = [&lo, &hi](const QVector3D &p) {
+        lo = QVector3D(qMin(lo.x(), p.x()), qMin(lo.y(), p.y()), qMin(lo.z(), p.z()));
+        hi = QVector3D(qMax(hi.x(), p.x()), qMax(hi.y(), p.y()), qMax(hi.z(), p.z()));
+    };
+    for (Mesh *mesh : scene.meshes()) {
+        const VertexFormat::Bounds &b = mesh->bounds();
+        for (int corner = 0; corner < 8; ++corner)
+            include(mesh->modelMatrix.map(b.min + QVector3D(corner & 1 ? b.extent.x() : 0.0f,
+                                                            corner & 2 ? b.extent.y() : 0.0f,
+                                                            corner & 4 ? b.extent.z() : 0.0f)));
+    }
+    for (const SphereInstance &s : scene.spheres()) {
+        include(s.center - QVector3D(s.radius, s.radius, s.radius));
+        include(s.center + QVector3D(s.radius, s.radius, s.radius));
+    }
+    if (lo.x() > hi.x()) {
+        qWarning("--software-preview: nothing to draw");
+        return 1;
+    }
+
+    const float fov = qBound(1.0f, parser.value("fov").toFloat(), 170.0f);
+    const QVector3D center = (lo + hi) * 0.5f;
+    const float radius = qMax(1e-4f, (hi - lo).length() * 0.5f);
+    const float distance = radius / std::sin(qDegreesToRadians(fov) * 0.5f);
+    Camera camera;
+    camera.setYawPitch(parser.value("yaw").toFloat(), parser.value("pitch").toFloat());
+    camera.setPosition(center - camera.front() * distance);
+
+    SoftwareRasterizer rasterizer;
+    rasterizer.resize(parser.value("width").toInt(), parser.value("height").toInt());
+    QMatrix4x4 proj;
+    proj.perspective(fov, float(rasterizer.width()) / rasterizer.height(),
+                     qMax(distance - radius, distance * 1e-3f) * 0.5f, distance + radius * 2.0f);
+
+    const int repeats = qMax(1, parser.value("repeats").toInt());
+    double best = DBL_MAX;
+    Stats stats;
+    for (int i = 0; i < repeats; ++i) {
+        rasterizer.render(scene, camera.viewMatrix(), proj);
+        const Stats &s = rasterizer.stats();
+        const double ms = s.transformMs + s.setupMs + s.rasterMs;
+        if (ms < best) {
+            best = ms;
+            stats = s;
+        }
+    }
+
+    qInfo().noquote() << QString("Software preview: %1x%2, %3 threads, %4 triangles (%5 drawn, %6 tile bins)")
+                             .arg(rasterizer.width()).arg(rasterizer.height())
+                             .arg(QThreadPool::globalInstance()->maxThreadCount())
+                             .arg(stats.triangles).arg(stats.rasterized).arg(stats.binned);
+    qInfo().noquote() << QString("Software preview: %1 ms (vertices %2, setup %3, raster %4), "
+                                 "%5% of %6 blocks culled by depth")
+                             .arg(best, 0, 'f', 2).arg(stats.transformMs, 0, 'f', 2)
+                             .arg(stats.setupMs, 0, 'f', 2).arg(stats.rasterMs, 0, 'f', 2)
+                             .arg(stats.blocks ? 100.0 * stats.blocksCulled / stats.blocks : 0.0, 0, 'f', 1)
+                             .arg(stats.blocks);
+
+    const QString output = parser.value("output");
+    if (!rasterizer.image().save(output)) {
+        qWarning() << "Unable to write" << output;
+        return 1;
+    }
+    qInfo() << "Software preview written to" << output;
+    return 0;
+}
@@ -0,0 +1,147 @@
+#include "sphereinstances.h"
+#include <QDebug>
+#include <vector>
+#include "gpu_stucts.h"
+#include "scene/mesh.h"
+#include "scene/scene.h"
+#include "renderer/memorytracker.h"
+
+SphereInstances::SphereInstances()
+{
+}
+
+void SphereInstances::upload(const Scene &scene, bool withBvh)
+{
+    if (!m_initialized) {
+        initializeOpenGLFunctions();
+        m_initialized = true;
+    }
+
+    if (scene.revision() == m_revision && (m_hasBvh || !withBvh))
+        return;
+    m_revision = scene.revision();
+    m_hasBvh = withBvh;
+
+    const QVector<SphereInstance> &spheres = scene.spheres();
+    const QVector<Material> &materials = scene.materials();
+    m_count = spheres.size();
+
+    // Instances in BVH leaf order for the tracer, scene order otherwise.
+    std::vector<quint32> order(spheres.size());
+    m_bvh.clear();
+    if (withBvh && !spheres.isEmpty()) {
+        QVector<Bvh::Primitive> bounds(spheres.size());
+        for (int i = 0; i < spheres.size(); ++i) {
+            QVector3D r(spheres[i].radius, spheres[i].radius, spheres[i].radius);
+            bounds[i] = { spheres[i].center - r, spheres[i].center + r };
+        }
+        m_bvh.build(bounds);
+        order.assign(m_bvh.primitives().begin(), m_bvh.primitives().end());
+    } else {
+        for (int i = 0; i < spheres.size(); ++i)
+            order[i] = quint32(i);
+    }
+
+    std::vector<GpuSphere> gpuSpheres;
+    gpuSpheres.reserve(spheres.size() + 1);
+    for (quint32 i : order) {
+        const SphereInstance &s = spheres[i];
+        GpuSphere g;
+        g.cx = s.center.x(); g.cy = s.center.y(); g.cz = s.center.z();
+        g.radius = s.radius;
+        g.materialId = quint32(qBound(0, s.materialId, qMax(0, materials.size() - 1)));
+        g.pad0 = g.pad1 = g.pad2 = 0;
+        gpuSpheres.push_back(g);
+    }
+
+    std::vector<GpuMaterial> gpuMaterials;
+    gpuMaterials.reserve(materials.size() + 1);
+    for (const Material &m : materials) {
+        GpuMaterial g;
+        g.diffuseR = m.color.x(); g.diffuseG = m.color.y(); g.diffuseB = m.color.z();
+        g.kd = m.kd;
+        g.specularR = m.specularColor.x(); g.specularG = m.specularColor.y(); g.specularB = m.specularColor.z();
+        g.ks = m.ks;
+        g.shininess = m.shininess;
+        g.pad1 = g.pad2 = g.pad3 = 0.0f;
+        gpuMaterials.push_back(g);
+    }
+
+    // Keep every binding backed by storage, even for an empty scene.
+    if (gpuSpheres.empty()) gpuSpheres.push_back(GpuSphere {});
+    if (gpuMaterials.empty()) gpuMaterials.push_back(GpuMaterial {});
+
+    if (!m_instanceBuffer) glCreateBuffers(1, &m_instanceBuffer);
+    glNamedBufferData(m_instanceBuffer, sizeof(GpuSphere) * gpuSpheres.size(), gpuSpheres.data(), GL_STATIC_DRAW);
+
+    if (!m_materialBuffer) glCreateBuffers(1, &m_materialBuffer);
+    glNamedBufferData(m_materialBuffer, sizeof(GpuMaterial) * gpuMaterials.size(), gpuMaterials.data(), GL_STATIC_DRAW);
+
+    if (withBvh) {
+        std::vector<Bvh::Node> nodes(m_bvh.nodes().begin(), m_bvh.nodes().end());
+        if (nodes.empty()) nodes.push_back(Bvh::Node {});
+        if (!m_bvhBuffer) glCreateBuffers(1, &m_bvhBuffer);
+        glNamedBufferData(m_bvhBuffer, sizeof(Bvh::Node) * nodes.size(), nodes.data(), GL_STATIC_DRAW);
+    }
+
+    MemoryTracker &mem = MemoryTracker::instance();
+    mem.track(this, "instances", "spheres", MemoryTracker::GpuBuffer, qint64(sizeof(GpuSphere)) * gpuSpheres.size());
+    mem.track(this, "materials", "spheres", MemoryTracker::GpuBuffer, qint64(sizeof(GpuMaterial)) * gpuMaterials.size());
+    if (withBvh) {
+        mem.track(this, "bvh", "spheres", MemoryTracker::GpuBuffer, qint64(sizeof(Bvh::Node)) * m_bvh.nodes().size());
+        mem.track(this, "cpuBvh", "spheres", MemoryTracker::Cpu,
+                  qint64(sizeof(Bvh::Node)) * m_bvh.nodes().size() + qint64(sizeof(quint32)) * m_bvh.primitives().size());
+    }
+
+    if (m_count > 1000)
+        qDebug() << "Spheres:" << m_count << "instances," << sizeof(GpuSphere) * m_count / 1024 << "KiB"
+                 << (withBvh ? QString("BVH %1 nodes, depth %2").arg(m_bvh.nodes().size()).arg(m_bvh.depth())
+                             : QString());
+}
+
+void SphereInstances::bind(GLuint instanceBinding, GLuint materialBinding)
+{
+    if (!m_initialized)
+        return;
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, instanceBinding, m_instanceBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, materialBinding, m_materialBuffer);
+}
+
+void SphereInstances::bindBvh(GLuint binding)
+{
+    if (!m_initialized)
+        return;
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, m_bvhBuffer);
+}
+
+void SphereInstances::draw(QOpenGLShaderProgram *program)
+{
+    if (m_count == 0)
+        return;
+
+    if (!m_unitSphere) {
+        m_unitSphere = new Mesh();
+        m_unitSphere->initialize(Mesh::sphereGeometry(1.0f, RasterStacks, RasterSlices));
+        m_unitSphere->setName("unit sphere");
+    }
+
+    program->setUniformValue("posMin", m_unitSphere->bounds().min);
+    program->setUniformValue("posExtent", m_unitSphere->bounds().extent);
+    bind(1, 10);
+    m_unitSphere->renderInstanced(m_count);
+}
+
+void SphereInstances::destroy()
+{
+    delete m_unitSphere;
+    m_unitSphere = nullptr;
+
+    if (!m_initialized)
+        return;
+    if (m_instanceBuffer) glDeleteBuffers(1, &m_instanceBuffer);
+    if (m_materialBuffer) glDeleteBuffers(1, &m_materialBuffer);
+    if (m_bvhBuffer) glDeleteBuffers(1, &m_bvhBuffer);
+    m_instanceBuffer = m_materialBuffer = m_bvhBuffer = 0;
+    m_revision = 0;
+    MemoryTracker::instance().release(this);
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <QOpenGLFunctions_4_5_Core>
+#include <QOpenGLShaderProgram>
+#include "scene/bvh.h"
+
+class Mesh;
+class Scene;
+
+// GPU copy of a scene's sphere instances: an SSBO of GpuSphere (center,
+// radius, material id) and one of GpuMaterial. The rasterizer draws a shared
+// unit sphere with glDrawElementsInstanced and positions it in sphere.vert;
+// the tracer additionally gets a BVH over the spheres, with the instances
+// stored in its leaf order. Nothing is allocated per sphere on the CPU side
+// beyond the instance record, so scenes of 100k+ spheres stay cheap.
+// Needs a current OpenGL 4.5 context; call destroy() before it goes away.
+class SphereInstances : protected QOpenGLFunctions_4_5_Core
+{
+public:
+    SphereInstances();
+
+    // Re-uploads only when the scene revision changed.
+    void upload(const Scene &scene, bool withBvh);
+
+    void bind(GLuint instanceBinding, GLuint materialBinding);
+    void bindBvh(GLuint binding);
+
+    // Instanced raster draw; program must be bound and use sphere.vert.
+    void draw(QOpenGLShaderProgram *program);
+
+    int count() const { return m_count; }
+    void destroy();
+
+    static constexpr int RasterStacks = 12;
+    static constexpr int RasterSlices = 16;
+
+private:
+    bool m_initialized = false;
+    quint64 m_revision = 0;
+    bool m_hasBvh = false;
+    int m_count = 0;
+
+    GLuint m_instanceBuffer = 0;
+    GLuint m_materialBuffer = 0;
+    GLuint m_bvhBuffer = 0;
+    Bvh m_bvh;
+
+    Mesh *m_unitSphere = nullptr;
+};
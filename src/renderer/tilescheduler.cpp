@@ -0,0 +1,103 @@
+#include "tilescheduler.h"
+#include <algorithm>
+#include <cmath>
+
+void TileScheduler::resize(int width, int height)
+{
+    m_width = qMax(1, width);
+    m_height = qMax(1, height);
+    m_tilesX = (m_width + TileSize - 1) / TileSize;
+    m_tilesY = (m_height + TileSize - 1) / TileSize;
+
+    m_samples.fill(0u, m_tilesX * m_tilesY);
+    m_minSamples = 0;
+    updateDistances();
+}
+
+void TileScheduler::reset()
+{
+    m_samples.fill(0u);
+    m_minSamples = 0;
+}
+
+void TileScheduler::setFocus(float x, float y)
+{
+    m_hasFocus = true;
+    m_focusX = x;
+    m_focusY = y;
+    updateDistances();
+}
+
+void TileScheduler::clearFocus()
+{
+    if (!m_hasFocus)
+        return;
+    m_hasFocus = false;
+    updateDistances();
+}
+
+void TileScheduler::updateDistances()
+{
+    float fx = m_hasFocus ? m_focusX : m_width * 0.5f;
+    float fy = m_hasFocus ? m_focusY : m_height * 0.5f;
+    float norm = 1.0f / std::sqrt(float(m_width) * m_width + float(m_height) * m_height);
+
+    m_distance.resize(m_tilesX * m_tilesY);
+    for (int ty = 0; ty < m_tilesY; ++ty) {
+        for (int tx = 0; tx < m_tilesX; ++tx) {
+            float cx = (tx + 0.5f) * TileSize - fx;
+            float cy = (ty + 0.5f) * TileSize - fy;
+            m_distance[ty * m_tilesX + tx] = std::sqrt(cx * cx + cy * cy) * norm;
+        }
+    }
+}
+
+void TileScheduler::updateMinSamples()
+{
+    quint32 lo = m_samples.isEmpty() ? 0u : m_samples[0];
+    for (quint32 s : m_samples)
+        lo = qMin(lo, s);
+    m_minSamples = int(lo);
+}
+
+const QVector<TileScheduler::Job>& TileScheduler::schedule()
+{
+    const int total = m_samples.size();
+
+    m_candidates.clear();
+    for (int i = 0; i < total; ++i) {
+        if (m_sampleCap > 0 && m_samples[i] >= quint32(m_sampleCap))
+            continue;
+        m_candidates.append({ float(m_samples[i]) + FocusWeight * m_distance[i], i });
+    }
+
+    int budget = m_candidates.size();
+    if (m_budgetMs > 0.0) {
+        budget = m_msPerTile > 0.0 ? int(m_budgetMs / m_msPerTile) : InitialTilesPerFrame;
+        budget = qBound(qMin(MinTilesPerFrame, int(m_candidates.size())), budget, int(m_candidates.size()));
+    }
+
+    if (budget < m_candidates.size()) {
+        std::nth_element(m_candidates.begin(), m_candidates.begin() + budget, m_candidates.end(),
+                         [](const QPair<float, int> &a, const QPair<float, int> &b) { return a.first < b.first; });
+    }
+
+    m_jobs.resize(budget);
+    for (int k = 0; k < budget; ++k) {
+        int i = m_candidates[k].second;
+        m_jobs[k].tile = quint32(i % m_tilesX) | (quint32(i / m_tilesX) << 16);
+        m_jobs[k].sampleIndex = m_samples[i]++;
+    }
+
+    updateMinSamples();
+    return m_jobs;
+}
+
+void TileScheduler::reportGpuTime(int tileCount, double ms)
+{
+    if (tileCount <= 0 || ms <= 0.0)
+        return;
+
+    double perTile = ms / tileCount;
+    m_msPerTile = m_msPerTile < 0.0 ? perTile : 0.8 * m_msPerTile + 0.2 * perTile;
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <QPair>
+#include <QVector>
+
+// Chooses which 16x16 tiles of the accumulation image get a sample in the
+// next dispatch. With a time budget only as many tiles as the measured GPU
+// cost per tile allows are traced per frame, so the frame rate no longer
+// depends on the resolution and the image fills in progressively.
+//
+// Tiles are ranked by samples + FocusWeight * distance to the focus point
+// (cursor, or the screen center), so the least sampled tiles go first and,
+// among equals, the ones the user is looking at. Every pixel of a tile gets
+// the same number of samples and the tracer averages per tile count, which
+// keeps the accumulation unbiased however unevenly tiles are visited.
+class TileScheduler
+{
+public:
+    static constexpr int TileSize = 16;
+    static constexpr float FocusWeight = 4.0f;
+    static constexpr int MinTilesPerFrame = 64;
+    static constexpr int InitialTilesPerFrame = 1024;
+
+    // One entry of the tile list SSBO read by raytrace.comp.
+    struct Job {
+        quint32 tile;         // x | y << 16, in tiles
+        quint32 sampleIndex;  // samples the tile already has
+    };
+
+    void resize(int width, int height);
+    void reset();
+
+    // Pixel coordinates with y up, as in the accumulation image.
+    void setFocus(float x, float y);
+    void clearFocus();
+
+    // 0 disables the budget: every tile gets one sample per frame.
+    void setBudgetMs(double ms) { m_budgetMs = ms; }
+    double budgetMs() const { return m_budgetMs; }
+
+    // Tiles at or above spp samples are no longer scheduled; 0 = no cap.
+    void setSampleCap(int spp) { m_sampleCap = spp; }
+
+    // Tiles for the next dispatch; their sample counts are advanced.
+    const QVector<Job>& schedule();
+
+    // Measured GPU time of an earlier dispatch of tileCount tiles.
+    void reportGpuTime(int tileCount, double ms);
+
+    // Samples every pixel has received (the least sampled tile).
+    int minSamples() const { return m_minSamples; }
+    int tileCount() const { return m_samples.size(); }
+    double msPerTile() const { return m_msPerTile; }
+
+private:
+    void updateDistances();
+    void updateMinSamples();
+
+    int m_width = 1;
+    int m_height = 1;
+    int m_tilesX = 1;
+    int m_tilesY = 1;
+
+    QVector<quint32> m_samples;
+    QVector<float> m_distance;      // to the focus, 0..1
+    QVector<QPair<float, int>> m_candidates;
+    QVector<Job> m_jobs;
+
+    bool m_hasFocus = false;
+    float m_focusX = 0.0f;
+    float m_focusY = 0.0f;
+
+    double m_budgetMs = 0.0;
+    double m_msPerTile = -1.0;      // EMA, < 0 until the first measurement
+    int m_sampleCap = 0;
+    int m_minSamples = 0;
+};
@@ -0,0 +1,112 @@
+#include "upscaler.h"
+#include <QDebug>
+#include "renderer/memorytracker.h"
+
+bool Upscaler::initialize()
+{
+    initializeOpenGLFunctions();
+
+    m_program = new QOpenGLShaderProgram();
+    if (!m_program->addShaderFromSourceFile(QOpenGLShader::Vertex, "src/shaders/screen.vert"))
+        qWarning() << "Screen vertex compile error:" << m_program->log();
+    if (!m_program->addShaderFromSourceFile(QOpenGLShader::Fragment, "src/shaders/upscale.frag"))
+        qWarning() << "Upscale frag compile error:" << m_program->log();
+    if (!m_program->link()) {
+        qWarning() << "Upscale program link error:" << m_program->log();
+        return false;
+    }
+    glCreateFramebuffers(1, &m_displayFbo);
+    return true;
+}
+
+void Upscaler::resizeDisplay(int width, int height)
+{
+    if (width == m_displayWidth && height == m_displayHeight)
+        return;
+
+    if (m_display) glDeleteTextures(1, &m_display);
+    glCreateTextures(GL_TEXTURE_2D, 1, &m_display);
+    glTextureStorage2D(m_display, 1, GL_SRGB8_ALPHA8, width, height);
+    glTextureParameteri(m_display, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTextureParameteri(m_display, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glNamedFramebufferTexture(m_displayFbo, GL_COLOR_ATTACHMENT0, m_display, 0);
+
+    m_displayWidth = width;
+    m_displayHeight = height;
+    m_hasResolved = false;
+    MemoryTracker::instance().track(this, "display", "upscaler", MemoryTracker::GpuTexture,
+                                    qint64(width) * height * 4);
+}
+
+bool Upscaler::sameFrame(const PathTracer::Frame &frame) const
+{
+    const PathTracer::Frame &r = m_resolved;
+    return m_hasResolved && r.revision == frame.revision && r.mode == frame.mode
+        && r.generation == frame.generation && r.fallbackGeneration == frame.fallbackGeneration
+        && r.hasFallback == frame.hasFallback && r.previewValid == frame.previewValid
+        && r.color == frame.color && r.width == frame.width && r.height == frame.height;
+}
+
+void Upscaler::draw(const PathTracer::Frame &frame, GLuint quadVao)
+{
+    if (!m_program || frame.width <= 0 || frame.height <= 0)
+        return;
+
+    GLint target = 0;
+    GLint viewport[4] = {};
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &target);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    resizeDisplay(frame.width, frame.height);
+
+    if (!sameFrame(frame)) {
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_displayFbo);
+        glViewport(0, 0, frame.width, frame.height);
+        glEnable(GL_FRAMEBUFFER_SRGB);
+        glDisable(GL_DEPTH_TEST);
+
+        m_program->bind();
+        m_program->setUniformValue("u_mode", int(frame.mode));
+        m_program->setUniformValue("u_generation", GLuint(frame.generation));
+        m_program->setUniformValue("u_fallbackGeneration", GLuint(frame.fallbackGeneration));
+        m_program->setUniformValue("u_hasFallback", int(frame.hasFallback));
+        m_program->setUniformValue("u_previewValid", int(frame.previewValid));
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, frame.color);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, frame.previewColor);
+        glBindTextureUnit(1, frame.guide);
+        glBindTextureUnit(3, frame.previewGuide);
+
+        glBindVertexArray(quadVao);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+
+        glBindTextureUnit(1, 0);
+        glBindTextureUnit(3, 0);
+        m_program->release();
+        glDisable(GL_FRAMEBUFFER_SRGB);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+        m_resolved = frame;
+        m_hasResolved = true;
+    }
+
+    // Without GL_FRAMEBUFFER_SRGB the blit copies the encoded bytes as is.
+    glBlitNamedFramebuffer(m_displayFbo, target, 0, 0, frame.width, frame.height,
+                           viewport[0], viewport[1], viewport[0] + viewport[2], viewport[1] + viewport[3],
+                           GL_COLOR_BUFFER_BIT, GL_LINEAR);
+}
+
+void Upscaler::destroy()
+{
+    delete m_program;
+    m_program = nullptr;
+    if (m_display) glDeleteTextures(1, &m_display);
+    if (m_displayFbo) glDeleteFramebuffers(1, &m_displayFbo);
+    m_display = 0;
+    m_displayFbo = 0;
+    m_displayWidth = 0;
+    m_displayHeight = 0;
+    m_hasResolved = false;
+    MemoryTracker::instance().release(this);
+}
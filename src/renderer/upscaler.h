@@ -0,0 +1,33 @@
+#pragma once
+#include <QOpenGLFunctions_4_5_Core>
+#include <QOpenGLShaderProgram>
+#include "renderer/pathtracer.h"
+
+// Screen pass of the path tracer: resolves PathTracer::Frame at full
+// resolution into an RGBA8 sRGB display image, then copies that to the
+// current framebuffer. Scaled previews are upsampled with a depth/normal-
+// aware filter, checkerboard frames get their missing half reconstructed
+// from the traced neighbours, and pixels not retraced yet since the last
+// reset fall back to the previous image (upscale.frag). The resolve also
+// tone maps like the PNG export; it is skipped while the frame is
+// unchanged, so an idle view only costs the copy.
+// Needs a current OpenGL 4.5 context; call destroy() before it goes away.
+class Upscaler : protected QOpenGLFunctions_4_5_Core
+{
+public:
+    bool initialize();
+    void draw(const PathTracer::Frame &frame, GLuint quadVao);
+    void destroy();
+
+private:
+    void resizeDisplay(int width, int height);
+    bool sameFrame(const PathTracer::Frame &frame) const;
+
+    QOpenGLShaderProgram *m_program = nullptr;
+    GLuint m_display = 0;
+    GLuint m_displayFbo = 0;
+    int m_displayWidth = 0;
+    int m_displayHeight = 0;
+    PathTracer::Frame m_resolved;
+    bool m_hasResolved = false;
+};
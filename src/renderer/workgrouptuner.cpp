@@ -0,0 +1,188 @@
+#include "workgrouptuner.h"
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QSettings>
+#include <algorithm>
+#include "renderer/gputimer.h"
+
+WorkgroupTuner::WorkgroupTuner()
+{
+}
+
+WorkgroupTuner::WorkgroupTuner(const Settings &settings)
+    : m_settings(settings)
+{
+}
+
+// Tiles are 16 pixels wide, so wider 2D shapes (32x4, 64x2) cannot cover
+// one; the linear Morton groups stand in for them.
+QVector<PathTracer::Workgroup> WorkgroupTuner::candidates()
+{
+    return {
+        { 16, 16, false },
+        { 8, 8, false },
+        { 16, 8, false },
+        { 8, 16, false },
+        { 16, 4, false },
+        { 64, 1, true },
+        { 128, 1, true },
+        { 256, 1, true },
+    };
+}
+
+QVector<WorkgroupTuner::Result> WorkgroupTuner::run(PathTracer &tracer, const Camera &camera, float fovDeg)
+{
+    QVector<Result> results;
+    QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
+
+    const PathTracer::Workgroup original = tracer.workgroup();
+    const double tileBudget = tracer.tileBudget();
+    const int sampleCap = tracer.sampleCap();
+    const PathTracer::Resolution resolution = tracer.resolution();
+    const float renderScale = tracer.renderScale();
+    const bool hybrid = tracer.hybrid();
+
+    // Whole frames of traced camera rays, whatever the interactive settings.
+    tracer.setTileBudget(0.0);
+    tracer.setSampleCap(0);
+    tracer.setHybrid(false);
+    tracer.setResolution(PathTracer::Scaled, m_settings.scale);
+
+    GpuTimer timer;
+    timer.initialize();
+
+    for (const PathTracer::Workgroup &candidate : candidates()) {
+        Result result;
+        result.workgroup = candidate;
+        if (!tracer.setWorkgroup(candidate)) {
+            results.append(result);
+            continue;
+        }
+
+        tracer.resetAccumulation();
+        for (int i = 0; i < m_settings.warmupFrames; ++i)
+            tracer.traceFrame(camera, fovDeg);
+        f->glFinish();
+
+        QVector<double> times;
+        double total = 0.0;
+        for (int i = 0; i < m_settings.frames && total < m_settings.maxMsPerCandidate; ++i) {
+            timer.begin(i);
+            tracer.traceFrame(camera, fovDeg);
+            timer.end();
+            for (const QPair<int, double> &t : timer.collectBlocking()) {
+                times.append(t.second);
+                total += t.second;
+            }
+        }
+
+        if (!times.isEmpty()) {
+            std::sort(times.begin(), times.end());
+            result.msPerFrame = times[times.size() / 2];
+        }
+        results.append(result);
+    }
+    timer.destroy();
+
+    // Fastest first; shapes that failed go last.
+    std::stable_sort(results.begin(), results.end(), [](const Result &a, const Result &b) {
+        if ((a.msPerFrame > 0.0) != (b.msPerFrame > 0.0))
+            return a.msPerFrame > 0.0;
+        return a.msPerFrame < b.msPerFrame;
+    });
+
+    if (results.isEmpty() || results.first().msPerFrame <= 0.0 || !tracer.setWorkgroup(results.first().workgroup))
+        tracer.setWorkgroup(original);
+
+    tracer.setResolution(resolution, renderScale);
+    tracer.setHybrid(hybrid);
+    tracer.setSampleCap(sampleCap);
+    tracer.setTileBudget(tileBudget);
+    tracer.resetAccumulation();
+    return results;
+}
+
+QString WorkgroupTuner::report(const QVector<Result> &results) const
+{
+    QString text = QString("Workgroup tuning on %1 (%2% resolution)\n")
+                       .arg(deviceKey()).arg(int(m_settings.scale * 100.0f));
+    const double best = results.isEmpty() ? 0.0 : results.first().msPerFrame;
+    for (const Result &r : results) {
+        if (r.msPerFrame <= 0.0) {
+            text += QString("  %1  failed to compile\n").arg(r.workgroup.name(), -12);
+            continue;
+        }
+        text += QString("  %1  %2 ms/frame  %3x\n")
+                    .arg(r.workgroup.name(), -12)
+                    .arg(r.msPerFrame, 8, 'f', 2)
+                    .arg(r.msPerFrame / best, 0, 'f', 2);
+    }
+    return text;
+}
+
+QString WorkgroupTuner::deviceKey()
+{
+    QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
+    return QString("%1 / %2 / %3")
+        .arg((const char*)f->glGetString(GL_VENDOR))
+        .arg((const char*)f->glGetString(GL_RENDERER))
+        .arg((const char*)f->glGetString(GL_VERSION));
+}
+
+// Device strings contain slashes and spaces: groups are named by their hash
+// and keep the readable key alongside.
+static QString settingsGroup()
+{
+    QByteArray hash = QCryptographicHash::hash(WorkgroupTuner::deviceKey().toUtf8(), QCryptographicHash::Sha1);
+    return "workgroups/" + QString::fromLatin1(hash.toHex().left(16));
+}
+
+bool WorkgroupTuner::load(PathTracer::Workgroup &workgroup)
+{
+    QSettings settings(QSettings::IniFormat, QSettings::UserScope, "RayTracingGPU", "tuning");
+    settings.beginGroup(settingsGroup());
+    if (!settings.contains("x"))
+        return false;
+
+    PathTracer::Workgroup stored;
+    stored.x = settings.value("x").toInt();
+    stored.y = settings.value("y").toInt();
+    stored.morton = settings.value("morton").toBool();
+    if (!stored.valid())
+        return false;
+    workgroup = stored;
+    return true;
+}
+
+void WorkgroupTuner::save(const PathTracer::Workgroup &workgroup, double msPerFrame)
+{
+    QSettings settings(QSettings::IniFormat, QSettings::UserScope, "RayTracingGPU", "tuning");
+    settings.beginGroup(settingsGroup());
+    settings.setValue("device", deviceKey());
+    settings.setValue("x", workgroup.x);
+    settings.setValue("y", workgroup.y);
+    settings.setValue("morton", workgroup.morton);
+    settings.setValue("msPerFrame", msPerFrame);
+}
+
+PathTracer::Workgroup WorkgroupTuner::apply(PathTracer &tracer, const Camera &camera, float fovDeg, bool retune)
+{
+    PathTracer::Workgroup workgroup;
+    if (!retune && load(workgroup)) {
+        if (tracer.setWorkgroup(workgroup)) {
+            qDebug() << "Compute workgroup" << workgroup.name() << "(tuned for this device)";
+            return workgroup;
+        }
+        qWarning() << "Stored compute workgroup" << workgroup.name() << "no longer builds: tuning again";
+    }
+
+    qInfo() << "Tuning the compute workgroup for" << deviceKey();
+    WorkgroupTuner tuner;
+    QVector<Result> results = tuner.run(tracer, camera, fovDeg);
+    qInfo().noquote() << tuner.report(results);
+    if (!results.isEmpty() && results.first().msPerFrame > 0.0)
+        save(results.first().workgroup, results.first().msPerFrame);
+    return tracer.workgroup();
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <QString>
+#include <QVector>
+#include "renderer/camera.h"
+#include "renderer/pathtracer.h"
+
+// Finds the compute workgroup shape that traces fastest on this device.
+// Every candidate is compiled into the tracer and timed with GL_TIME_ELAPSED
+// queries on the scene it holds, from the given camera, at a reduced
+// resolution. The winner is stored per GL vendor, renderer and driver
+// version, so later runs on the same machine start with it directly.
+// Needs a current OpenGL 4.5 context.
+class WorkgroupTuner
+{
+public:
+    struct Settings {
+        // Traced at this fraction of the tracer's resolution.
+        float scale = 0.5f;
+        int warmupFrames = 1;
+        int frames = 5;
+        // A candidate stops early once its frames used this much GPU time.
+        double maxMsPerCandidate = 1500.0;
+    };
+
+    struct Result {
+        PathTracer::Workgroup workgroup;
+        // Median over the timed frames; 0 when the shape did not compile.
+        double msPerFrame = 0.0;
+    };
+
+    WorkgroupTuner();
+    explicit WorkgroupTuner(const Settings &settings);
+
+    static QVector<PathTracer::Workgroup> candidates();
+
+    // Times every candidate, fastest first. The tracer is left on the
+    // fastest with its other settings restored and its accumulation reset.
+    QVector<Result> run(PathTracer &tracer, const Camera &camera, float fovDeg);
+    QString report(const QVector<Result> &results) const;
+
+    // GL_VENDOR, GL_RENDERER and GL_VERSION of the current context.
+    static QString deviceKey();
+    static bool load(PathTracer::Workgroup &workgroup);
+    static void save(const PathTracer::Workgroup &workgroup, double msPerFrame);
+
+    // Sets the stored shape for this device, tuning first when there is
+    // none or retune is set. Returns the shape the tracer ends up with.
+    static PathTracer::Workgroup apply(PathTracer &tracer, const Camera &camera, float fovDeg, bool retune);
+
+private:
+    Settings m_settings;
+};
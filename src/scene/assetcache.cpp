@@ -0,0 +1,297 @@
+#include "assetcache.h"
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QOpenGLContext>
+#include <QStandardPaths>
+#include <algorithm>
+#include "mesh.h"
+#include "meshasset.h"
+#include "meshloader.h"
+
+AssetCache& AssetCache::instance()
+{
+    static AssetCache cache;
+    return cache;
+}
+
+QString AssetCache::cacheDirectory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/assets";
+}
+
+QString AssetCache::cachePath(const QByteArray &hash)
+{
+    return QDir(cacheDirectory()).filePath(QString::fromLatin1(hash) + ".mesh");
+}
+
+void AssetCache::setBudget(qint64 cpuBytes, qint64 gpuBytes)
+{
+    QMutexLocker lock(&m_mutex);
+    m_cpuBudget = qMax<qint64>(0, cpuBytes);
+    m_gpuBudget = qMax<qint64>(0, gpuBytes);
+    trimLocked();
+}
+
+qint64 AssetCache::cpuBudget() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_cpuBudget;
+}
+
+qint64 AssetCache::gpuBudget() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_gpuBudget;
+}
+
+// Hashing reads the whole file, but far faster than parsing it; the result
+// is reused until the file changes.
+QByteArray AssetCache::contentHash(const QString &path)
+{
+    QFileInfo info(path);
+    {
+        QMutexLocker lock(&m_mutex);
+        auto it = m_files.constFind(path);
+        if (it != m_files.constEnd() && it->size == info.size() && it->modified == info.lastModified())
+            return it->hash;
+    }
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    if (!hash.addData(&file))
+        return QByteArray();
+
+    FileHash entry;
+    entry.size = info.size();
+    entry.modified = info.lastModified();
+    entry.hash = hash.result().toHex();
+
+    QMutexLocker lock(&m_mutex);
+    m_files.insert(path, entry);
+    return entry.hash;
+}
+
+QSharedPointer<MeshAsset> AssetCache::acquire(const QString &path)
+{
+    QFileInfo info(path);
+    const QString canonical = info.canonicalFilePath();
+    if (canonical.isEmpty() || !info.isFile()) {
+        qWarning() << "Mesh file not found:" << path;
+        return QSharedPointer<MeshAsset>();
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    const QByteArray hash = contentHash(canonical);
+    if (hash.isEmpty()) {
+        qWarning() << "Unable to read mesh file:" << path;
+        return QSharedPointer<MeshAsset>();
+    }
+
+    // Entries whose released CPU copy cannot be restored cannot seed new
+    // meshes: load a fresh one.
+    {
+        QMutexLocker lock(&m_mutex);
+        auto it = m_entries.find(hash);
+        if (it != m_entries.end() && it->asset->cpuGeometryAvailable()) {
+            ++it->users;
+            it->lastUsed = ++m_clock;
+            ++m_stats.hits;
+            qDebug() << "Asset" << info.fileName() << "shared with" << it->path;
+            return it->asset;
+        }
+    }
+
+    QSharedPointer<MeshAsset> asset = QSharedPointer<MeshAsset>::create();
+    const QString binary = cachePath(hash);
+    const bool fromDisk = asset->readPacked(binary);
+    if (!fromDisk) {
+        Mesh::Geometry geometry;
+        if (!MeshLoader::load(canonical, geometry))
+            return QSharedPointer<MeshAsset>();
+        asset->setGeometry(geometry);
+        saveBinary(binary, *asset);
+    }
+    asset->setName(info.fileName());
+    qDebug() << "Asset" << info.fileName() << (fromDisk ? "read from the binary cache" : "parsed")
+             << "in" << timer.elapsed() << "ms";
+
+    QMutexLocker lock(&m_mutex);
+    auto it = m_entries.find(hash);
+    if (it != m_entries.end()) {
+        // Loaded by another thread meanwhile; ours was never uploaded.
+        if (it->asset->cpuGeometryAvailable()) {
+            ++it->users;
+            it->lastUsed = ++m_clock;
+            ++m_stats.hits;
+            return it->asset;
+        }
+        retire(it->asset);
+        m_entries.erase(it);
+    }
+
+    Entry entry;
+    entry.asset = asset;
+    entry.path = canonical;
+    entry.users = 1;
+    entry.lastUsed = ++m_clock;
+    m_entries.insert(hash, entry);
+    if (fromDisk)
+        ++m_stats.diskHits;
+    else
+        ++m_stats.misses;
+    trimLocked();
+    return asset;
+}
+
+Mesh* AssetCache::createMesh(const QString &path)
+{
+    QSharedPointer<MeshAsset> asset = acquire(path);
+    if (!asset)
+        return nullptr;
+    Mesh *mesh = new Mesh();
+    mesh->initialize(asset);
+    mesh->setName(QFileInfo(path).fileName());
+    return mesh;
+}
+
+void AssetCache::release(const MeshAsset *asset)
+{
+    if (!asset)
+        return;
+    QMutexLocker lock(&m_mutex);
+    for (Entry &entry : m_entries) {
+        if (entry.asset.data() != asset)
+            continue;
+        if (entry.users > 0)
+            --entry.users;
+        entry.lastUsed = ++m_clock;
+        trimLocked();
+        return;
+    }
+}
+
+bool AssetCache::contains(const MeshAsset *asset) const
+{
+    QMutexLocker lock(&m_mutex);
+    for (const Entry &entry : m_entries)
+        if (entry.asset.data() == asset)
+            return true;
+    return false;
+}
+
+void AssetCache::trim()
+{
+    QMutexLocker lock(&m_mutex);
+    trimLocked();
+}
+
+static bool canFreeGpu(const MeshAsset &asset)
+{
+    if (!asset.uploaded())
+        return true;
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    return context && context->shareGroup() == asset.shareGroup();
+}
+
+void AssetCache::retire(const QSharedPointer<MeshAsset> &asset)
+{
+    if (!canFreeGpu(*asset))
+        m_retired.append(asset);
+}
+
+void AssetCache::trimLocked()
+{
+    // Meshes may still hold retired assets; then the last of them frees it.
+    for (int i = m_retired.size() - 1; i >= 0; --i)
+        if (canFreeGpu(*m_retired[i]))
+            m_retired.removeAt(i);
+
+    qint64 cpu = 0;
+    qint64 gpu = 0;
+    QVector<QByteArray> unused;
+    for (auto it = m_entries.constBegin(); it != m_entries.constEnd(); ++it) {
+        cpu += it->asset->cpuBytes();
+        gpu += it->asset->gpuBytes();
+        if (it->users == 0)
+            unused.append(it.key());
+    }
+    std::sort(unused.begin(), unused.end(), [this](const QByteArray &a, const QByteArray &b) {
+        return m_entries[a].lastUsed < m_entries[b].lastUsed;
+    });
+
+    auto evict = [&](const QByteArray &key) {
+        Entry entry = m_entries.take(key);
+        cpu -= entry.asset->cpuBytes();
+        gpu -= entry.asset->gpuBytes();
+        retire(entry.asset);
+        ++m_stats.evictions;
+    };
+
+    // Without a CPU copy to restore an unused asset can never be handed
+    // out again.
+    for (int i = unused.size() - 1; i >= 0; --i) {
+        if (!m_entries[unused[i]].asset->cpuGeometryAvailable()) {
+            evict(unused[i]);
+            unused.removeAt(i);
+        }
+    }
+
+    for (const QByteArray &key : unused) {
+        if (gpu <= m_gpuBudget)
+            break;
+        MeshAsset &asset = *m_entries[key].asset;
+        if (!asset.uploaded() || !canFreeGpu(asset))
+            continue;
+        gpu -= asset.gpuBytes();
+        asset.releaseGpu();
+        ++m_stats.gpuEvictions;
+    }
+
+    for (const QByteArray &key : unused) {
+        if (cpu <= m_cpuBudget)
+            break;
+        evict(key);
+    }
+}
+
+AssetCache::Stats AssetCache::stats() const
+{
+    QMutexLocker lock(&m_mutex);
+    Stats stats = m_stats;
+    for (const Entry &entry : m_entries) {
+        ++stats.assets;
+        stats.inUse += entry.users > 0 ? 1 : 0;
+        stats.uploaded += entry.asset->uploaded() ? 1 : 0;
+        stats.cpuBytes += entry.asset->cpuBytes();
+        stats.gpuBytes += entry.asset->gpuBytes();
+    }
+    return stats;
+}
+
+QString AssetCache::summary() const
+{
+    const Stats s = stats();
+    auto mib = [](qint64 bytes) { return QString::number(bytes / (1024.0 * 1024.0), 'f', 1); };
+    return QString("Assets: %1 resident (%2 in use), CPU %3 / %4 MiB, GPU %5 / %6 MiB; "
+                   "%7 shared, %8 from disk, %9 parsed, %10 evicted, %11 unloaded from GPU")
+        .arg(s.assets).arg(s.inUse)
+        .arg(mib(s.cpuBytes), mib(cpuBudget()), mib(s.gpuBytes), mib(gpuBudget()))
+        .arg(s.hits).arg(s.diskHits).arg(s.misses).arg(s.evictions).arg(s.gpuEvictions);
+}
+
+void AssetCache::saveBinary(const QString &path, MeshAsset &asset)
+{
+    if (!QDir().mkpath(cacheDirectory())) {
+        qWarning() << "Unable to create asset cache directory:" << cacheDirectory();
+        return;
+    }
+    if (!asset.writePacked(path))
+        qWarning() << "Unable to write asset cache:" << path;
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include <QByteArray>
+#include <QDateTime>
+#include <QHash>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+
+class Mesh;
+class MeshAsset;
+
+// Process-wide cache of mesh assets, so a file opened again (or another
+// file with the same content) shares the geometry already in memory
+// instead of being parsed and uploaded once per Mesh.
+//
+// Assets are keyed by the SHA-1 of the file content; the hash of a path is
+// remembered while its size and modification time stay the same. Every
+// acquire() counts a user, which the Mesh built on the asset gives back
+// when it is destroyed. Unused assets stay resident until the cache goes
+// over one of its budgets, then the least recently used ones go first:
+// over the GPU budget their buffers are freed (the CPU copy stays and is
+// uploaded again on the next use), over the CPU budget the whole asset.
+// Assets in use are never evicted, so the budgets can be exceeded.
+//
+// Parsed meshes are also written packed to a binary cache on disk
+// (CacheLocation/assets/<hash>.mesh, MeshAsset::writePacked), which is
+// what an evicted asset is reloaded from: a straight read, without parsing
+// or normal generation. A CPU copy the tracer released is restored from
+// the same file by whoever needs it next.
+//
+// Thread-safe; the sizes of the assets are read under their own lock. GL buffers are only freed on a thread whose current
+// context shares them; assets evicted elsewhere are kept until the next
+// trim() on such a thread.
+class AssetCache
+{
+public:
+    struct Stats {
+        int assets = 0;       // resident
+        int inUse = 0;
+        int uploaded = 0;
+        qint64 cpuBytes = 0;
+        qint64 gpuBytes = 0;
+        int hits = 0;         // served from memory
+        int diskHits = 0;     // read from the binary cache
+        int misses = 0;       // parsed from the source file
+        int gpuEvictions = 0;
+        int evictions = 0;
+    };
+
+    static AssetCache& instance();
+
+    // Bytes all cached assets may hold; only unused ones are evicted to
+    // get back under them.
+    void setBudget(qint64 cpuBytes, qint64 gpuBytes);
+    qint64 cpuBudget() const;
+    qint64 gpuBudget() const;
+
+    // Shared geometry of the mesh file at path, with one user counted for
+    // the caller: hand it to Mesh::initialize, or give it back with
+    // release(). Null (with a warning) when the file cannot be read.
+    QSharedPointer<MeshAsset> acquire(const QString &path);
+    // New mesh on the asset of path, named after the file; null on failure.
+    Mesh* createMesh(const QString &path);
+    // Gives back one user of asset; ignores assets the cache does not own.
+    void release(const MeshAsset *asset);
+    bool contains(const MeshAsset *asset) const;
+
+    // Applies the budgets; also called by acquire(), release() and setBudget().
+    void trim();
+
+    Stats stats() const;
+    // One line for logs.
+    QString summary() const;
+
+    static QString cacheDirectory();
+
+private:
+    AssetCache() = default;
+
+    struct Entry {
+        QSharedPointer<MeshAsset> asset;
+        QString path;
+        int users = 0;
+        quint64 lastUsed = 0;
+    };
+    struct FileHash {
+        qint64 size = -1;
+        QDateTime modified;
+        QByteArray hash;
+    };
+
+    QByteArray contentHash(const QString &path);
+    static QString cachePath(const QByteArray &hash);
+    static void saveBinary(const QString &path, MeshAsset &asset);
+    // Both need m_mutex held.
+    void trimLocked();
+    // Drops asset, keeping it alive while no context can free its buffers.
+    void retire(const QSharedPointer<MeshAsset> &asset);
+
+    mutable QMutex m_mutex;
+    QHash<QByteArray, Entry> m_entries;
+    QHash<QString, FileHash> m_files;
+    QVector<QSharedPointer<MeshAsset>> m_retired;
+    qint64 m_cpuBudget = qint64(1) << 30;
+    qint64 m_gpuBudget = qint64(1) << 30;
+    quint64 m_clock = 0;
+    Stats m_stats;
+};
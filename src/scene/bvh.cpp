@@ -0,0 +1,172 @@
+#include "bvh.h"
+#include <algorithm>
+#include <cfloat>
+
+namespace {
+
+struct Box {
+    QVector3D min { FLT_MAX, FLT_MAX, FLT_MAX };
+    QVector3D max { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+    void grow(const QVector3D &p)
+    {
+        min = QVector3D(qMin(min.x(), p.x()), qMin(min.y(), p.y()), qMin(min.z(), p.z()));
+        max = QVector3D(qMax(max.x(), p.x()), qMax(max.y(), p.y()), qMax(max.z(), p.z()));
+    }
+
+    void grow(const Box &b)
+    {
+        grow(b.min);
+        grow(b.max);
+    }
+
+    bool isEmpty() const { return min.x() > max.x(); }
+
+    float area() const
+    {
+        if (isEmpty())
+            return 0.0f;
+        QVector3D e = max - min;
+        return 2.0f * (e.x() * e.y() + e.y() * e.z() + e.z() * e.x());
+    }
+};
+
+}
+
+void Bvh::clear()
+{
+    m_nodes.clear();
+    m_order.clear();
+    m_depth = 0;
+}
+
+void Bvh::build(const QVector<Bvh::Primitive> &primitives)
+{
+    clear();
+    const int n = primitives.size();
+    if (n == 0)
+        return;
+
+    QVector<QVector3D> centroids(n);
+    m_order.resize(n);
+    for (int i = 0; i < n; ++i) {
+        centroids[i] = (primitives[i].min + primitives[i].max) * 0.5f;
+        m_order[i] = quint32(i);
+    }
+
+    m_nodes.reserve(2 * n);
+    m_nodes.append(Node { { 0, 0, 0 }, 0u, { 0, 0, 0 }, quint32(n) });
+
+    struct Pending { int node; int depth; };
+    QVector<Pending> stack;
+    stack.append({ 0, 1 });
+
+    while (!stack.isEmpty()) {
+        Pending item = stack.takeLast();
+        m_depth = qMax(m_depth, item.depth);
+
+        const int first = int(m_nodes[item.node].leftFirst);
+        const int count = int(m_nodes[item.node].count);
+
+        Box bounds, centroidBounds;
+        for (int i = first; i < first + count; ++i) {
+            const Primitive &p = primitives[m_order[i]];
+            bounds.grow(p.min);
+            bounds.grow(p.max);
+            centroidBounds.grow(centroids[m_order[i]]);
+        }
+
+        Node &node = m_nodes[item.node];
+        node.min[0] = bounds.min.x(); node.min[1] = bounds.min.y(); node.min[2] = bounds.min.z();
+        node.max[0] = bounds.max.x(); node.max[1] = bounds.max.y(); node.max[2] = bounds.max.z();
+
+        // Degenerate inputs can keep splitting off a single primitive; past
+        // MaxDepth the node stays a larger leaf rather than overflowing the
+        // shader's traversal stack.
+        if (count <= MaxLeafSize || item.depth >= MaxDepth)
+            continue;
+
+        // Binned SAH over the centroid bounds on all three axes. Nodes above
+        // MaxLeafSize are split down to MaxDepth, so leaf size bounds the
+        // per-ray cost.
+        int bestAxis = -1;
+        int bestSplit = 0;
+        float bestCost = FLT_MAX;
+        QVector3D extent = centroidBounds.max - centroidBounds.min;
+
+        for (int axis = 0; axis < 3; ++axis) {
+            if (extent[axis] <= 0.0f)
+                continue;
+
+            Box binBounds[BinCount];
+            int binCount[BinCount] = {};
+            float scale = BinCount / extent[axis];
+            for (int i = first; i < first + count; ++i) {
+                int b = qMin(BinCount - 1, int((centroids[m_order[i]][axis] - centroidBounds.min[axis]) * scale));
+                const Primitive &p = primitives[m_order[i]];
+                binBounds[b].grow(p.min);
+                binBounds[b].grow(p.max);
+                ++binCount[b];
+            }
+
+            float leftArea[BinCount - 1];
+            int leftCount[BinCount - 1];
+            Box acc;
+            int sum = 0;
+            for (int b = 0; b < BinCount - 1; ++b) {
+                acc.grow(binBounds[b]);
+                sum += binCount[b];
+                leftArea[b] = acc.area();
+                leftCount[b] = sum;
+            }
+
+            acc = Box();
+            sum = 0;
+            for (int b = BinCount - 1; b > 0; --b) {
+                acc.grow(binBounds[b]);
+                sum += binCount[b];
+                float cost = leftArea[b - 1] * leftCount[b - 1] + acc.area() * sum;
+                if (leftCount[b - 1] > 0 && sum > 0 && cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = b;
+                }
+            }
+        }
+
+        // All centroids coincide: nothing to separate.
+        if (extent.x() <= 0.0f && extent.y() <= 0.0f && extent.z() <= 0.0f)
+            continue;
+
+        auto begin = m_order.begin() + first;
+        auto end = begin + count;
+        int leftCount = 0;
+        if (bestAxis >= 0) {
+            float scale = BinCount / extent[bestAxis];
+            float lo = centroidBounds.min[bestAxis];
+            auto middle = std::partition(begin, end, [&](quint32 p) {
+                int b = qMin(BinCount - 1, int((centroids[p][bestAxis] - lo) * scale));
+                return b < bestSplit;
+            });
+            leftCount = int(middle - begin);
+        } else {
+            // Every centroid fell into one bin: median split on the widest axis.
+            int axis = extent.x() > extent.y() ? (extent.x() > extent.z() ? 0 : 2)
+                                               : (extent.y() > extent.z() ? 1 : 2);
+            leftCount = count / 2;
+            std::nth_element(begin, begin + leftCount, end, [&](quint32 a, quint32 b) {
+                return centroids[a][axis] < centroids[b][axis];
+            });
+        }
+
+        int left = m_nodes.size();
+        m_nodes.append(Node { { 0, 0, 0 }, quint32(first), { 0, 0, 0 }, quint32(leftCount) });
+        m_nodes.append(Node { { 0, 0, 0 }, quint32(first + leftCount), { 0, 0, 0 }, quint32(count - leftCount) });
+
+        m_nodes[item.node].leftFirst = quint32(left);
+        m_nodes[item.node].count = 0;
+
+        stack.append({ left, item.depth + 1 });
+        stack.append({ left + 1, item.depth + 1 });
+    }
+}
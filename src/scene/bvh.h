@@ -0,0 +1,47 @@
+#pragma once
+#include <QVector>
+#include <QVector3D>
+
+// Bounding volume hierarchy over arbitrary primitives given by their AABBs,
+// built on the CPU with binned SAH and stored flat so it can be uploaded to
+// an SSBO as is (see BvhNode in raytrace.comp).
+//
+// Interior nodes have count == 0 and their children at leftFirst and
+// leftFirst + 1; leaves reference primitives()[leftFirst, leftFirst + count).
+class Bvh
+{
+public:
+    struct Node {
+        float min[3];
+        quint32 leftFirst;
+        float max[3];
+        quint32 count;
+    };
+    static_assert(sizeof(Node) == 32, "Node matches the std430 layout of BvhNode");
+
+    struct Primitive {
+        QVector3D min;
+        QVector3D max;
+    };
+
+    static constexpr int MaxLeafSize = 4;
+    static constexpr int BinCount = 12;
+    // Deepest level build() creates (the root is level 1). raytrace.comp
+    // sizes its traversal stacks from this, and a depth-first walk that
+    // pushes both children never holds more than MaxDepth entries.
+    static constexpr int MaxDepth = 64;
+
+    void build(const QVector<Primitive> &primitives);
+    void clear();
+
+    bool isEmpty() const { return m_nodes.isEmpty(); }
+    const QVector<Node>& nodes() const { return m_nodes; }
+    // Primitive indices in leaf order.
+    const QVector<quint32>& primitives() const { return m_order; }
+    int depth() const { return m_depth; }
+
+private:
+    QVector<Node> m_nodes;
+    QVector<quint32> m_order;
+    int m_depth = 0;
+};
@@ -0,0 +1,566 @@
+#include "clusteredmesh.h"
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QStandardPaths>
+#include <QtConcurrent>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include "meshloader.h"
+#include "renderer/memorytracker.h"
+
+namespace {
+
+constexpr quint32 FormatVersion = 1;
+const char IndexFile[] = "index.bin";
+const char DataFile[] = "clusters.bin";
+
+// index.bin: the header, then one entry per cluster. Native byte order;
+// the cache never leaves the machine that built it.
+struct IndexHeader {
+    char magic[4];
+    quint32 version;
+    quint32 clusterCount;
+    quint32 trianglesPerCluster;
+    quint64 triangleCount;
+};
+
+struct IndexEntry {
+    float min[3];
+    float max[3];
+    float quantizationMin[3];
+    float quantizationExtent[3];
+    quint64 offset;
+    quint32 vertexCount, triangleCount, nodeCount, pad;
+};
+
+// A triangle in the bucketed scratch file: positions and shading normals.
+struct SoupTriangle {
+    float p[3][3];
+    quint32 normal[3];
+};
+static_assert(sizeof(SoupTriangle) == 48, "SoupTriangle is written to disk as is");
+
+// Scratch file mapped read-write. The OS pages it in and out, so it does not
+// count against memory however large the mesh is.
+class ScratchMap
+{
+public:
+    uchar* create(const QString &path, qint64 bytes)
+    {
+        m_file.setFileName(path);
+        if (!m_file.open(QIODevice::ReadWrite | QIODevice::Truncate) || !m_file.resize(bytes)) {
+            qWarning() << "Unable to create scratch file:" << path;
+            return nullptr;
+        }
+        return m_file.map(0, bytes);
+    }
+
+    uchar* open(const QString &path, qint64 bytes)
+    {
+        m_file.setFileName(path);
+        if (!m_file.open(QIODevice::ReadWrite) || m_file.size() < bytes) {
+            qWarning() << "Unable to map scratch file:" << path;
+            return nullptr;
+        }
+        return m_file.map(0, bytes);
+    }
+
+    // Unmaps and deletes the file.
+    void remove()
+    {
+        m_file.close();
+        m_file.remove();
+    }
+
+private:
+    QFile m_file;
+};
+
+// Deletes a build's scratch files however build() returns. Declared before
+// the files and maps, so it runs after they are closed.
+class ScratchFiles
+{
+public:
+    explicit ScratchFiles(const QDir &dir) : m_dir(dir) {}
+    ~ScratchFiles()
+    {
+        for (const char *name : { "positions.tmp", "normals.tmp", "triangles.tmp", "index.tmp" })
+            QFile::remove(m_dir.filePath(name));
+    }
+
+private:
+    QDir m_dir;
+};
+
+quint32 expandBits(quint32 v)
+{
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+// 30-bit Morton code of a point given in 0..1 per axis.
+quint32 morton(const QVector3D &p)
+{
+    auto q = [](float v) { return quint32(qBound(0.0f, v * 1023.0f, 1023.0f)); };
+    return (expandBits(q(p.x())) << 2) | (expandBits(q(p.y())) << 1) | expandBits(q(p.z()));
+}
+
+// Vertices are shared within a cluster when position and normal match exactly.
+struct VertexKey {
+    quint32 x, y, z, normal;
+    bool operator==(const VertexKey &o) const { return x == o.x && y == o.y && z == o.z && normal == o.normal; }
+};
+
+size_t qHash(const VertexKey &k, size_t seed = 0)
+{
+    return qHashMulti(seed, k.x, k.y, k.z, k.normal);
+}
+
+VertexKey vertexKey(const SoupTriangle &t, int corner)
+{
+    VertexKey key;
+    std::memcpy(&key.x, &t.p[corner][0], sizeof(float));
+    std::memcpy(&key.y, &t.p[corner][1], sizeof(float));
+    std::memcpy(&key.z, &t.p[corner][2], sizeof(float));
+    key.normal = t.normal[corner];
+    return key;
+}
+
+struct ClusterInput {
+    QVector<QVector3D> positions;
+    QVector<QVector3D> normals;
+    QVector<unsigned int> indices;
+};
+
+struct BuiltCluster {
+    QByteArray bytes;
+    IndexEntry entry = {};
+};
+
+// Quantizes, builds the cluster BVH and lays the cluster out as the pool
+// expects it: vertices, triangles in leaf order, nodes.
+BuiltCluster buildCluster(const ClusterInput &in)
+{
+    const VertexFormat::Bounds bounds = VertexFormat::computeBounds(in.positions);
+    const QVector<VertexFormat::PackedVertex> vertices = VertexFormat::pack(in.positions, in.normals, bounds);
+
+    // Over the dequantized positions, as the tracer sees them (see Mesh::bvh).
+    QVector<Bvh::Primitive> triangles(in.indices.size() / 3);
+    for (int t = 0; t < triangles.size(); ++t) {
+        QVector3D a = VertexFormat::decodePosition(vertices[in.indices[3 * t]], bounds);
+        QVector3D b = VertexFormat::decodePosition(vertices[in.indices[3 * t + 1]], bounds);
+        QVector3D c = VertexFormat::decodePosition(vertices[in.indices[3 * t + 2]], bounds);
+        triangles[t].min = QVector3D(qMin(a.x(), qMin(b.x(), c.x())), qMin(a.y(), qMin(b.y(), c.y())),
+                                     qMin(a.z(), qMin(b.z(), c.z())));
+        triangles[t].max = QVector3D(qMax(a.x(), qMax(b.x(), c.x())), qMax(a.y(), qMax(b.y(), c.y())),
+                                     qMax(a.z(), qMax(b.z(), c.z())));
+    }
+    Bvh bvh;
+    bvh.build(triangles);
+
+    BuiltCluster out;
+    QByteArray &bytes = out.bytes;
+    bytes.reserve(vertices.size() * int(sizeof(VertexFormat::PackedVertex)) + in.indices.size() * 4
+                  + bvh.nodes().size() * int(sizeof(Bvh::Node)));
+    bytes.append(reinterpret_cast<const char*>(vertices.constData()),
+                 vertices.size() * int(sizeof(VertexFormat::PackedVertex)));
+    for (quint32 t : bvh.primitives())
+        bytes.append(reinterpret_cast<const char*>(&in.indices[3 * t]), 3 * int(sizeof(quint32)));
+    bytes.append(reinterpret_cast<const char*>(bvh.nodes().constData()), bvh.nodes().size() * int(sizeof(Bvh::Node)));
+
+    IndexEntry &e = out.entry;
+    const Bvh::Node &root = bvh.nodes().first();
+    for (int k = 0; k < 3; ++k) {
+        e.min[k] = root.min[k];
+        e.max[k] = root.max[k];
+        e.quantizationMin[k] = bounds.min[k];
+        e.quantizationExtent[k] = bounds.extent[k];
+    }
+    e.vertexCount = quint32(vertices.size());
+    e.triangleCount = quint32(triangles.size());
+    e.nodeCount = quint32(bvh.nodes().size());
+    return out;
+}
+
+}
+
+qint64 ClusteredMesh::Cluster::bytes() const
+{
+    return qint64(vertexCount) * sizeof(VertexFormat::PackedVertex) + qint64(triangleCount) * 3 * sizeof(quint32)
+         + qint64(nodeCount) * sizeof(Bvh::Node);
+}
+
+ClusteredMesh::ClusteredMesh()
+{
+    modelMatrix.setToIdentity();
+}
+
+ClusteredMesh::~ClusteredMesh()
+{
+    MemoryTracker::instance().release(this);
+}
+
+void ClusteredMesh::setName(const QString &name)
+{
+    m_name = name;
+    MemoryTracker::instance().setLabel(this, name);
+}
+
+QString ClusteredMesh::cacheDirectory(const QString &source, const Options &options)
+{
+    QFileInfo info(source);
+    QString root = options.cacheRoot.isEmpty()
+        ? QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/clusters" : options.cacheRoot;
+
+    QByteArray key = QString("%1|%2|%3|%4|%5").arg(info.absoluteFilePath()).arg(info.size())
+                         .arg(info.lastModified().toMSecsSinceEpoch()).arg(options.trianglesPerCluster)
+                         .arg(FormatVersion).toUtf8();
+    QString hash = QString::fromLatin1(QCryptographicHash::hash(key, QCryptographicHash::Md5).toHex().left(16));
+    return QDir(root).filePath(info.completeBaseName() + "-" + hash);
+}
+
+bool ClusteredMesh::open(const QString &source, const Options &options)
+{
+    m_directory = cacheDirectory(source, options);
+    if (!readIndex()) {
+        if (!build(source, m_directory, options.trianglesPerCluster) || !readIndex())
+            return false;
+    }
+    setName(QFileInfo(source).fileName());
+    return true;
+}
+
+bool ClusteredMesh::build(const QString &source, const QString &directory, int trianglesPerCluster)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    const quint32 maxTriangles = quint32(qBound(64, trianglesPerCluster, 1 << 20));
+    const quint32 maxVertices = maxTriangles;
+
+    QDir dir(directory);
+    if (!QDir().mkpath(directory)) {
+        qWarning() << "Unable to create cluster directory:" << directory;
+        return false;
+    }
+    QFile::remove(dir.filePath(IndexFile));
+    ScratchFiles scratch(dir);
+
+    // Pass 1: positions to a scratch file, and the bounds.
+    QFile positionsFile(dir.filePath("positions.tmp"));
+    if (!positionsFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Unable to write scratch file:" << positionsFile.fileName();
+        return false;
+    }
+    std::vector<float> buffer;
+    buffer.reserve(3 << 16);
+    qint64 vertexCount = 0;
+    bool written = true;
+    QVector3D lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+    auto flush = [&]() {
+        const qint64 bytes = qint64(buffer.size() * sizeof(float));
+        written = written && positionsFile.write(reinterpret_cast<const char*>(buffer.data()), bytes) == bytes;
+        buffer.clear();
+    };
+
+    MeshLoader::Visitor vertexPass;
+    vertexPass.vertex = [&](const QVector3D &p) {
+        buffer.insert(buffer.end(), { p.x(), p.y(), p.z() });
+        lo = QVector3D(qMin(lo.x(), p.x()), qMin(lo.y(), p.y()), qMin(lo.z(), p.z()));
+        hi = QVector3D(qMax(hi.x(), p.x()), qMax(hi.y(), p.y()), qMax(hi.z(), p.z()));
+        ++vertexCount;
+        if (buffer.size() >= (3 << 16))
+            flush();
+    };
+    if (!MeshLoader::scan(source, vertexPass))
+        return false;
+    flush();
+    positionsFile.close();
+    if (!written || vertexCount == 0 || vertexCount >= 0xFFFFFFFFll) {
+        qWarning() << "Unable to cluster" << source << ":" << vertexCount << "vertices";
+        return false;
+    }
+
+    ScratchMap positionsMap, normalsMap, soupMap;
+    const float *positions = reinterpret_cast<const float*>(
+        positionsMap.open(dir.filePath("positions.tmp"), vertexCount * 3 * qint64(sizeof(float))));
+    float *normals = reinterpret_cast<float*>(
+        normalsMap.create(dir.filePath("normals.tmp"), vertexCount * 3 * qint64(sizeof(float))));
+    if (!positions || !normals)
+        return false;
+
+    auto position = [positions](quint32 i) {
+        return QVector3D(positions[3 * i], positions[3 * i + 1], positions[3 * i + 2]);
+    };
+
+    // About eight clusters per cell for the usual two triangles per vertex.
+    const int grid = qBound(1, int(std::ceil(std::cbrt(2.0 * vertexCount / (8.0 * maxTriangles)))), 64);
+    const QVector3D extent = hi - lo;
+    const QVector3D scale(1.0f / qMax(extent.x(), 1e-20f), 1.0f / qMax(extent.y(), 1e-20f),
+                          1.0f / qMax(extent.z(), 1e-20f));
+    auto normalized = [&](const QVector3D &p) { return (p - lo) * scale; };
+    auto cellOf = [&](const QVector3D &p) {
+        QVector3D u = normalized(p) * float(grid);
+        int x = qBound(0, int(u.x()), grid - 1);
+        int y = qBound(0, int(u.y()), grid - 1);
+        int z = qBound(0, int(u.z()), grid - 1);
+        return (z * grid + y) * grid + x;
+    };
+
+    // Fan-triangulates a face and hands every triangle with valid corners to fn.
+    qint64 dropped = 0;
+    auto triangles = [&](const unsigned int *corners, int n, auto &&fn) {
+        for (int k = 2; k < n; ++k) {
+            const quint32 a = corners[0], b = corners[k - 1], c = corners[k];
+            if (a >= vertexCount || b >= vertexCount || c >= vertexCount) {
+                ++dropped;
+                continue;
+            }
+            fn(a, b, c);
+        }
+    };
+
+    // Pass 2: area-weighted normals and triangles per cell.
+    QVector<qint64> cellCounts(grid * grid * grid, 0);
+    qint64 triangleCount = 0;
+    MeshLoader::Visitor countPass;
+    countPass.face = [&](const unsigned int *corners, int n) {
+        triangles(corners, n, [&](quint32 a, quint32 b, quint32 c) {
+            QVector3D pa = position(a), pb = position(b), pc = position(c);
+            QVector3D fn = QVector3D::crossProduct(pb - pa, pc - pa);
+            for (quint32 v : { a, b, c })
+                for (int k = 0; k < 3; ++k)
+                    normals[3 * v + k] += fn[k];
+            ++cellCounts[cellOf((pa + pb + pc) / 3.0f)];
+            ++triangleCount;
+        });
+    };
+    if (!MeshLoader::scan(source, countPass))
+        return false;
+    if (triangleCount == 0) {
+        qWarning() << "Mesh has no triangles:" << source;
+        return false;
+    }
+    const qint64 droppedFaces = dropped;
+
+    QVector<qint64> cellStart(cellCounts.size());
+    qint64 sum = 0;
+    for (int c = 0; c < cellCounts.size(); ++c) {
+        cellStart[c] = sum;
+        sum += cellCounts[c];
+    }
+
+    // Pass 3: triangles into their cell's range of the scratch soup.
+    SoupTriangle *soup = reinterpret_cast<SoupTriangle*>(
+        soupMap.create(dir.filePath("triangles.tmp"), triangleCount * qint64(sizeof(SoupTriangle))));
+    if (!soup)
+        return false;
+    QVector<qint64> cursor = cellStart;
+    MeshLoader::Visitor bucketPass;
+    bucketPass.face = [&](const unsigned int *corners, int n) {
+        triangles(corners, n, [&](quint32 a, quint32 b, quint32 c) {
+            SoupTriangle t;
+            const quint32 v[3] = { a, b, c };
+            QVector3D centroid;
+            for (int i = 0; i < 3; ++i) {
+                QVector3D p = position(v[i]);
+                centroid += p;
+                t.p[i][0] = p.x(); t.p[i][1] = p.y(); t.p[i][2] = p.z();
+                t.normal[i] = VertexFormat::encodeNormal(
+                    QVector3D(normals[3 * v[i]], normals[3 * v[i] + 1], normals[3 * v[i] + 2]));
+            }
+            soup[cursor[cellOf(centroid / 3.0f)]++] = t;
+        });
+    };
+    if (!MeshLoader::scan(source, bucketPass))
+        return false;
+    normalsMap.remove();
+
+    // Cells are read back a slice at a time, ordered along a Morton curve
+    // and cut into clusters; the slice's clusters are built in parallel.
+    QFile data(dir.filePath(DataFile));
+    if (!data.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Unable to write cluster data:" << data.fileName();
+        return false;
+    }
+
+    const qint64 sliceTriangles = qint64(maxTriangles) * 32;
+    QVector<IndexEntry> entries;
+    qint64 processed = 0;
+    int reported = 0;
+
+    for (int cell = 0; cell < cellCounts.size(); ++cell) {
+        const qint64 cellEnd = cellStart[cell] + cellCounts[cell];
+        for (qint64 begin = cellStart[cell]; begin < cellEnd; begin += sliceTriangles) {
+            const qint64 end = qMin(cellEnd, begin + sliceTriangles);
+
+            std::vector<QPair<quint32, qint64>> order;
+            order.reserve(size_t(end - begin));
+            for (qint64 i = begin; i < end; ++i) {
+                const SoupTriangle &t = soup[i];
+                QVector3D centroid((t.p[0][0] + t.p[1][0] + t.p[2][0]) / 3.0f,
+                                   (t.p[0][1] + t.p[1][1] + t.p[2][1]) / 3.0f,
+                                   (t.p[0][2] + t.p[1][2] + t.p[2][2]) / 3.0f);
+                order.push_back({ morton(normalized(centroid)), i });
+            }
+            std::sort(order.begin(), order.end());
+
+            QVector<ClusterInput> inputs;
+            ClusterInput current;
+            QHash<VertexKey, unsigned int> remap;
+            for (const auto &item : order) {
+                const SoupTriangle &t = soup[item.second];
+                VertexKey keys[3] = { vertexKey(t, 0), vertexKey(t, 1), vertexKey(t, 2) };
+                int fresh = 0;
+                for (const VertexKey &key : keys)
+                    fresh += remap.contains(key) ? 0 : 1;
+
+                if (quint32(current.indices.size() / 3) >= maxTriangles
+                    || quint32(current.positions.size() + fresh) > maxVertices) {
+                    inputs.append(std::move(current));
+                    current = ClusterInput();
+                    remap.clear();
+                }
+
+                for (int i = 0; i < 3; ++i) {
+                    auto it = remap.find(keys[i]);
+                    if (it == remap.end()) {
+                        it = remap.insert(keys[i], unsigned(current.positions.size()));
+                        current.positions.append(QVector3D(t.p[i][0], t.p[i][1], t.p[i][2]));
+                        current.normals.append(VertexFormat::decodeNormal(t.normal[i]));
+                    }
+                    current.indices.append(*it);
+                }
+            }
+            if (!current.indices.isEmpty())
+                inputs.append(std::move(current));
+
+            const QVector<BuiltCluster> built = QtConcurrent::blockingMapped(inputs, buildCluster);
+            for (const BuiltCluster &b : built) {
+                IndexEntry e = b.entry;
+                e.offset = quint64(data.pos());
+                if (data.write(b.bytes) != b.bytes.size()) {
+                    qWarning() << "Unable to write cluster data:" << data.fileName();
+                    return false;
+                }
+                entries.append(e);
+            }
+
+            processed += end - begin;
+            const int percent = int(100 * processed / triangleCount);
+            if (percent >= reported + 10) {
+                reported = percent - percent % 10;
+                qInfo().noquote() << QString("Clustering %1: %2%").arg(QFileInfo(source).fileName()).arg(reported);
+            }
+        }
+    }
+    data.close();
+    positionsMap.remove();
+    soupMap.remove();
+
+    // The index is written last and renamed into place: its presence marks
+    // a complete cluster set.
+    IndexHeader header = { { 'O', 'O', 'C', '1' }, FormatVersion, quint32(entries.size()), maxTriangles,
+                           quint64(triangleCount) };
+    QFile index(dir.filePath("index.tmp"));
+    if (!index.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Unable to write cluster index:" << index.fileName();
+        return false;
+    }
+    index.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    index.write(reinterpret_cast<const char*>(entries.constData()), qint64(entries.size()) * sizeof(IndexEntry));
+    index.close();
+    if (!QFile::rename(index.fileName(), dir.filePath(IndexFile))) {
+        qWarning() << "Unable to finish cluster index in" << directory;
+        return false;
+    }
+
+    if (droppedFaces)
+        qWarning() << "Mesh" << source << ": dropped" << droppedFaces << "faces with out-of-range vertices";
+    qInfo().noquote() << QString("Clustered %1: %2 triangles into %3 clusters (grid %4^3) in %5 s")
+                             .arg(QFileInfo(source).fileName()).arg(triangleCount).arg(entries.size())
+                             .arg(grid).arg(timer.elapsed() / 1000.0, 0, 'f', 1);
+    return true;
+}
+
+bool ClusteredMesh::readIndex()
+{
+    QFile index(QDir(m_directory).filePath(IndexFile));
+    if (!index.open(QIODevice::ReadOnly))
+        return false;
+
+    IndexHeader header;
+    if (index.read(reinterpret_cast<char*>(&header), sizeof(header)) != qint64(sizeof(header))
+        || std::memcmp(header.magic, "OOC1", 4) != 0 || header.version != FormatVersion)
+        return false;
+
+    QVector<IndexEntry> entries(int(header.clusterCount));
+    const qint64 bytes = qint64(entries.size()) * sizeof(IndexEntry);
+    if (entries.isEmpty() || index.read(reinterpret_cast<char*>(entries.data()), bytes) != bytes)
+        return false;
+
+    QVector<Cluster> clusters(entries.size());
+    QVector<Bvh::Primitive> bounds(entries.size());
+    quint64 dataEnd = 0;
+    for (int i = 0; i < entries.size(); ++i) {
+        const IndexEntry &e = entries[i];
+        Cluster &c = clusters[i];
+        c.min = QVector3D(e.min[0], e.min[1], e.min[2]);
+        c.max = QVector3D(e.max[0], e.max[1], e.max[2]);
+        c.quantization.min = QVector3D(e.quantizationMin[0], e.quantizationMin[1], e.quantizationMin[2]);
+        c.quantization.extent = QVector3D(e.quantizationExtent[0], e.quantizationExtent[1], e.quantizationExtent[2]);
+        c.offset = e.offset;
+        c.vertexCount = e.vertexCount;
+        c.triangleCount = e.triangleCount;
+        c.nodeCount = e.nodeCount;
+        bounds[i] = { c.min, c.max };
+        dataEnd = qMax(dataEnd, c.offset + quint64(c.bytes()));
+    }
+    if (QFileInfo(QDir(m_directory).filePath(DataFile)).size() < qint64(dataEnd)) {
+        qWarning() << "Cluster data shorter than its index in" << m_directory;
+        return false;
+    }
+
+    // Clusters are stored in the top-level BVH's leaf order, like sphere instances.
+    m_topLevel.build(bounds);
+    m_clusters.resize(clusters.size());
+    for (int i = 0; i < clusters.size(); ++i)
+        m_clusters[i] = clusters[int(m_topLevel.primitives()[i])];
+
+    m_triangleCount = qint64(header.triangleCount);
+    m_maxVertices = m_maxTriangles = m_maxNodes = 0;
+    for (const Cluster &c : m_clusters) {
+        m_maxVertices = qMax(m_maxVertices, c.vertexCount);
+        m_maxTriangles = qMax(m_maxTriangles, c.triangleCount);
+        m_maxNodes = qMax(m_maxNodes, c.nodeCount);
+    }
+
+    MemoryTracker::instance().track(this, "index", "clusters", MemoryTracker::Cpu,
+                                    qint64(m_clusters.size()) * sizeof(Cluster)
+                                        + qint64(m_topLevel.nodes().size()) * sizeof(Bvh::Node));
+    return true;
+}
+
+bool ClusteredMesh::readCluster(const QString &directory, const Cluster &cluster, QByteArray &bytes)
+{
+    QFile data(QDir(directory).filePath(DataFile));
+    if (!data.open(QIODevice::ReadOnly) || !data.seek(qint64(cluster.offset))) {
+        qWarning() << "Unable to read cluster data from" << directory;
+        return false;
+    }
+    bytes = data.read(cluster.bytes());
+    return bytes.size() == cluster.bytes();
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <QByteArray>
+#include <QMatrix4x4>
+#include <QString>
+#include <QVector>
+#include "bvh.h"
+#include "material.h"
+#include "vertexformat.h"
+
+// A triangle mesh larger than memory, kept on disk as spatial clusters that
+// the tracer pages in and out of a fixed GPU pool on demand (ClusterPool).
+//
+// build() streams the source through MeshLoader::scan and never holds more
+// than one slice of triangles: positions and area-weighted normals go to
+// mapped scratch files, triangles are bucketed by centroid into a grid of
+// cells, and every cell is cut along a Morton curve into clusters of at
+// most trianglesPerCluster triangles and as many vertices. Each cluster is
+// stored in the tracer's layout: quantized vertices, triangles in BVH leaf
+// order and its own BVH. open() only reads the index and builds the
+// top-level BVH over the cluster bounds.
+//
+// Out-of-core meshes are only drawn by the path tracer and take the
+// material color (vertex colors are not kept).
+class ClusteredMesh
+{
+public:
+    struct Options {
+        int trianglesPerCluster = 8192;
+        // Where cluster sets are kept; empty for the user cache directory.
+        QString cacheRoot;
+    };
+
+    struct Cluster {
+        QVector3D min;
+        QVector3D max;
+        VertexFormat::Bounds quantization;
+        quint64 offset = 0;
+        quint32 vertexCount = 0;
+        quint32 triangleCount = 0;
+        quint32 nodeCount = 0;
+
+        // Size on disk and in a pool slot: vertices, triangles, BVH nodes.
+        qint64 bytes() const;
+    };
+
+    ClusteredMesh();
+    ~ClusteredMesh();
+
+    // Opens the cluster set of source, building it first when the cache has
+    // none for this file, its size and modification time.
+    bool open(const QString &source, const Options &options = Options());
+    static QString cacheDirectory(const QString &source, const Options &options);
+    static bool build(const QString &source, const QString &directory, int trianglesPerCluster);
+
+    // Reads one cluster of the set in directory as stored: packed vertices,
+    // triangles (three local indices each, leaf order), BVH nodes. Only
+    // touches its arguments, so loads can outlive the mesh on a worker thread.
+    static bool readCluster(const QString &directory, const Cluster &cluster, QByteArray &bytes);
+
+    // In the leaf order of topLevel(): leaves own clusters [leftFirst, leftFirst + count).
+    const QVector<Cluster>& clusters() const { return m_clusters; }
+    const Bvh& topLevel() const { return m_topLevel; }
+    qint64 triangleCount() const { return m_triangleCount; }
+
+    // Largest cluster, which sizes the pool slots.
+    quint32 maxVertices() const { return m_maxVertices; }
+    quint32 maxTriangles() const { return m_maxTriangles; }
+    quint32 maxNodes() const { return m_maxNodes; }
+
+    void setName(const QString &name);
+    const QString& name() const { return m_name; }
+    const QString& directory() const { return m_directory; }
+
+    Material material() const { return m_material; }
+    void addMaterial(const Material &m) { m_material = m; }
+    QMatrix4x4 modelMatrix;
+
+private:
+    bool readIndex();
+
+    QString m_directory;
+    QString m_name;
+    Material m_material;
+    QVector<Cluster> m_clusters;
+    Bvh m_topLevel;
+    qint64 m_triangleCount = 0;
+    quint32 m_maxVertices = 0;
+    quint32 m_maxTriangles = 0;
+    quint32 m_maxNodes = 0;
+};
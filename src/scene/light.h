@@ -6,4 +6,6 @@ struct Light
     QVector3D position;
     QVector3D color;
     float intensity;
+    // 0 for a point light; otherwise a sphere the path tracer can hit.
+    float radius = 0.0f;
 };
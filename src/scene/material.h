@@ -2,9 +2,9 @@
 #include <QVector3D>
 struct Material
 {
-    QVector3D color;
-    QVector3D specularColor;
-    float shininess;
-    float kd;
-    float ks;
+    QVector3D color { 1.0f, 1.0f, 1.0f };
+    QVector3D specularColor { 1.0f, 1.0f, 1.0f };
+    float shininess = 32.0f;
+    float kd = 0.9f;
+    float ks = 0.0f;
 };
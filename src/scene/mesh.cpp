@@ -1,10 +1,13 @@
 #include "mesh.h"
-#include <QOpenGLFunctions>
+#include <QOpenGLExtraFunctions>
+#include <QFloat16>
+#include <cmath>
+#include "assetcache.h"
+#include "renderer/memorytracker.h"
 
 Mesh::Mesh()
-    : m_vbo(QOpenGLBuffer::VertexBuffer),
-    m_ibo(QOpenGLBuffer::IndexBuffer),
-    m_indexCount(0)
+    : m_asset(QSharedPointer<MeshAsset>::create()),
+    m_bakedVbo(QOpenGLBuffer::VertexBuffer)
 {
     modelMatrix.setToIdentity();
 }
@@ -12,8 +15,23 @@ Mesh::Mesh()
 Mesh::~Mesh()
 {
     m_vao.destroy();
-    m_vbo.destroy();
-    m_ibo.destroy();
+    m_bakedVbo.destroy();
+    if (m_lightmap && QOpenGLContext::currentContext())
+        QOpenGLContext::currentContext()->functions()->glDeleteTextures(1, &m_lightmap);
+    MemoryTracker::instance().release(this);
+    // Drop our reference first, so the cache may free the asset right away.
+    const MeshAsset *asset = m_asset.data();
+    m_asset.reset();
+    AssetCache::instance().release(asset);
+}
+
+void Mesh::setName(const QString &name)
+{
+    m_name = name;
+    MemoryTracker::instance().setLabel(this, name);
+    // Cached assets are named after their file.
+    if (!AssetCache::instance().contains(m_asset.data()))
+        m_asset->setName(name);
 }
 
 void Mesh::addMaterial(const Material& m)
@@ -21,48 +39,200 @@ void Mesh::addMaterial(const Material& m)
     m_material=m;
 }
 
-void Mesh::initialize(const QVector<Vertex> &vertices, const QVector<unsigned int> &indices)
+Mesh::Geometry Mesh::sphereGeometry(float radius, int stacks, int slices)
 {
+    Geometry geometry;
 
-    m_Vertices = vertices;
-    m_Indices = indices;
-    QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
+    for (int i = 0; i <= stacks; ++i) {
+        float v = float(i) / stacks;
+        float phi = v * M_PI;
+
+        for (int j = 0; j <= slices; ++j) {
+            float u = float(j) / slices;
+            float theta = u * 2.0f * M_PI;
+
+            QVector3D n(std::sin(phi) * std::cos(theta), std::cos(phi), std::sin(phi) * std::sin(theta));
+            geometry.positions.append(n * radius);
+            geometry.normals.append(n);
+        }
+    }
+
+    for (int i = 0; i < stacks; ++i) {
+        for (int j = 0; j < slices; ++j) {
+            int a =  i    * (slices+1) + j;
+            int b =  i    * (slices+1) + j+1;
+            int c = (i+1) * (slices+1) + j;
+            int d = (i+1) * (slices+1) + j+1;
+
+            geometry.indices.append(a);
+            geometry.indices.append(c);
+            geometry.indices.append(b);
+
+            geometry.indices.append(b);
+            geometry.indices.append(c);
+            geometry.indices.append(d);
+        }
+    }
+    return geometry;
+}
+
+int Mesh::bytesPerVertex() const
+{
+    return int(sizeof(VertexFormat::PackedVertex)) + (hasColors() ? int(sizeof(quint32)) : 0);
+}
+
+void Mesh::initialize(const Geometry &geometry)
+{
+    QSharedPointer<MeshAsset> asset = QSharedPointer<MeshAsset>::create();
+    asset->setGeometry(geometry);
+    asset->setName(m_name);
+    setAsset(asset);
+}
+
+void Mesh::initialize(const QSharedPointer<MeshAsset> &asset)
+{
+    if (asset)
+        setAsset(asset);
+}
+
+void Mesh::setAsset(const QSharedPointer<MeshAsset> &asset)
+{
+    if (m_vao.isCreated()) {
+        if (m_baked != NotBaked)
+            clearBaked();
+        m_vao.destroy();
+    }
+    const MeshAsset *previous = m_asset.data();
+    m_asset = asset;
+    AssetCache::instance().release(previous);
+
+    // GPU-less tools (SoftwareRasterizer) only need the CPU geometry.
+    if (QOpenGLContext::currentContext())
+        prepare();
+}
+
+bool Mesh::prepare()
+{
+    if (m_vao.isCreated())
+        return true;
+    if (indexCount() == 0 || !QOpenGLContext::currentContext() || !m_asset->upload())
+        return false;
 
     m_vao.create();
     m_vao.bind();
+    m_asset->bindAttributes(QOpenGLContext::currentContext()->functions());
+    m_vao.release();
+    return true;
+}
 
-    m_vbo.create();
-    m_vbo.bind();
-    m_vbo.allocate(vertices.constData(), vertices.size() * sizeof(Vertex));
+void Mesh::render()
+{
+    if (!prepare())
+        return;
 
-    m_ibo.create();
-    m_ibo.bind();
-    m_ibo.allocate(indices.constData(), indices.size() * sizeof(unsigned int));
-    m_indexCount = indices.size();
+    QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
+
+    m_vao.bind();
+    if (!hasColors())
+        f->glVertexAttrib3f(1, m_material.color.x(), m_material.color.y(), m_material.color.z());
+
+    f->glDrawElements(GL_TRIANGLES, indexCount(), GL_UNSIGNED_INT, nullptr);
 
     m_vao.release();
-    m_vbo.release();
-    m_ibo.release();
 }
 
-void Mesh::render()
+void Mesh::renderInstanced(int instanceCount)
+{
+    if (instanceCount <= 0 || !prepare())
+        return;
+
+    QOpenGLExtraFunctions *f = QOpenGLContext::currentContext()->extraFunctions();
+
+    m_vao.bind();
+    f->glDrawElementsInstanced(GL_TRIANGLES, indexCount(), GL_UNSIGNED_INT, nullptr, instanceCount);
+    m_vao.release();
+}
+
+// Half floats, padded to 8 bytes: bakes are smooth and tonemapped anyway.
+void Mesh::setBakedVertices(const float *rgb)
 {
+    if (!prepare())
+        return;
+    if (m_baked == BakedLightmap)
+        clearBaked();
+
+    const int vertexCount = this->vertexCount();
+    QVector<qfloat16> packed(vertexCount * 4);
+    for (int i = 0; i < vertexCount; ++i) {
+        for (int c = 0; c < 3; ++c)
+            packed[i * 4 + c] = qfloat16(rgb[i * 3 + c]);
+        packed[i * 4 + 3] = qfloat16(1.0f);
+    }
+
+    QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
     m_vao.bind();
-    m_vbo.bind();
-    m_ibo.bind();
+    if (!m_bakedVbo.isCreated()) {
+        m_bakedVbo.create();
+        m_bakedVbo.bind();
+        m_bakedVbo.allocate(packed.constData(), packed.size() * int(sizeof(qfloat16)));
+        f->glEnableVertexAttribArray(3);
+        f->glVertexAttribPointer(3, 3, GL_HALF_FLOAT, GL_FALSE, 4 * sizeof(qfloat16), nullptr);
+    } else {
+        m_bakedVbo.bind();
+        m_bakedVbo.write(0, packed.constData(), packed.size() * int(sizeof(qfloat16)));
+    }
+    m_vao.release();
+    m_bakedVbo.release();
+
+    m_baked = BakedVertices;
+    MemoryTracker::instance().track(this, "baked", "mesh", MemoryTracker::GpuBuffer,
+                                    qint64(packed.size()) * sizeof(qfloat16));
+}
+
+void Mesh::setBakedLightmap(int resolution, const float *rgb)
+{
+    if (m_baked == BakedVertices)
+        clearBaked();
 
     QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
-    f->glEnableVertexAttribArray(0);
-    f->glEnableVertexAttribArray(1);
-    f->glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), reinterpret_cast<const void*>(offsetof(Vertex, pos)));
-    f->glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), reinterpret_cast<const void*>(offsetof(Vertex, color)));
+    if (!m_lightmap) {
+        f->glGenTextures(1, &m_lightmap);
+        f->glBindTexture(GL_TEXTURE_2D, m_lightmap);
+        f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    } else {
+        f->glBindTexture(GL_TEXTURE_2D, m_lightmap);
+    }
 
-    f->glDrawElements(GL_TRIANGLES, m_indexCount, GL_UNSIGNED_INT, nullptr);
+    if (resolution != m_lightmapResolution) {
+        f->glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, resolution, resolution, 0, GL_RGB, GL_FLOAT, rgb);
+        m_lightmapResolution = resolution;
+    } else {
+        f->glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, resolution, resolution, GL_RGB, GL_FLOAT, rgb);
+    }
+    f->glBindTexture(GL_TEXTURE_2D, 0);
 
-    f->glDisableVertexAttribArray(0);
-    f->glDisableVertexAttribArray(1);
+    m_baked = BakedLightmap;
+    MemoryTracker::instance().track(this, "baked", "mesh", MemoryTracker::GpuTexture,
+                                    qint64(resolution) * resolution * 3 * sizeof(qfloat16));
+}
 
-    m_ibo.release();
-    m_vbo.release();
-    m_vao.release();
+void Mesh::clearBaked()
+{
+    QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
+    if (m_bakedVbo.isCreated()) {
+        m_vao.bind();
+        f->glDisableVertexAttribArray(3);
+        m_vao.release();
+        m_bakedVbo.destroy();
+    }
+    if (m_lightmap) {
+        f->glDeleteTextures(1, &m_lightmap);
+        m_lightmap = 0;
+        m_lightmapResolution = 0;
+    }
+    m_baked = NotBaked;
+    MemoryTracker::instance().track(this, "baked", "mesh", MemoryTracker::GpuBuffer, 0);
 }
@@ -3,34 +3,96 @@
 #include <QOpenGLVertexArrayObject>
 #include <QVector3D>
 #include <QMatrix4x4>
+#include <QSharedPointer>
 #include "material.h"
+#include "meshasset.h"
 
+// A drawable instance of a MeshAsset: transform, material, baked lighting
+// and a vertex array over the asset's buffers. Meshes opened from the same
+// file content share one asset (AssetCache); the geometry accessors below
+// read through to it.
 class Mesh
 {
 public:
-    struct Vertex {
-        QVector3D pos;
-        QVector3D color;
-    };
+    using Geometry = MeshAsset::Geometry;
 
     Mesh();
     ~Mesh();
 
-    void initialize(const QVector<Vertex>& vertices, const QVector<unsigned int>& indices);
+    // UV sphere centered on the origin, with exact normals.
+    static Geometry sphereGeometry(float radius, int stacks, int slices);
+
+    // Packs the geometry into a private asset and uploads it. Without a
+    // current context only the CPU copy is kept; render() then uploads it
+    // on first use.
+    void initialize(const Geometry &geometry);
+    // Draws asset, whose AssetCache reference (from acquire()) this mesh
+    // takes over and gives back when it is destroyed.
+    void initialize(const QSharedPointer<MeshAsset> &asset);
+    const MeshAsset* asset() const { return m_asset.data(); }
     void render();
+    // Draws instanceCount copies; the vertex shader positions them.
+    void renderInstanced(int instanceCount);
     Material material(){return m_material;}
     QMatrix4x4 modelMatrix;
 
     void addMaterial(const Material& m);
-    bool isSphere=false;
 
-    QVector<Vertex> m_Vertices;
-    QVector<unsigned int> m_Indices;
+    int vertexCount() const { return m_asset->vertexCount(); }
+    int indexCount() const { return m_asset->indexCount(); }
+    bool hasColors() const { return m_asset->hasColors(); }
+    int bytesPerVertex() const;
+
+    // Shown in memory reports.
+    void setName(const QString &name);
+    const QString& name() const { return m_name; }
+
+    // Quantization box: position = min + q / 65535 * extent.
+    const VertexFormat::Bounds& bounds() const { return m_asset->bounds(); }
+    QVector3D position(int i) const { return m_asset->position(i); }
+    QVector3D normal(int i) const { return m_asset->normal(i); }
+
+    const QVector<VertexFormat::PackedVertex>& packedVertices() const { return m_asset->packedVertices(); }
+    const QVector<quint32>& packedColors() const { return m_asset->packedColors(); }
+    const QVector<unsigned int>& indices() const { return m_asset->indices(); }
 
+    // Object-space triangle BVH over the decoded positions, built on first use.
+    const Bvh& bvh() { return m_asset->bvh(); }
+
+    // Frees the CPU copies of the vertices, indices, colors and BVH once
+    // they live on the GPU, for every mesh sharing the asset. Counts and
+    // bounds stay valid; the accessors above return empty data and
+    // position() must no longer be called until restoreCpuGeometry()
+    // read them back (MeshAsset::restoreCpuGeometry).
+    void releaseCpuGeometry() { m_asset->releaseCpuGeometry(); }
+    bool hasCpuGeometry() const { return m_asset->hasCpuGeometry(); }
+    bool restoreCpuGeometry() { return m_asset->restoreCpuGeometry(); }
+    int bvhNodeCount() const { return m_asset->bvhNodeCount(); }
+
+    // Path-traced lighting for the rasterizer (IrradianceBaker): the
+    // radiance a white Lambert surface would reflect, which basic.frag
+    // scales by the albedo. Quads get a lightmap spanning their corners in
+    // vertex order, other meshes one value per vertex (attribute 3).
+    // rgb holds three floats per texel or vertex. Need a current context.
+    enum Baked { NotBaked, BakedVertices, BakedLightmap };
+    void setBakedVertices(const float *rgb);
+    void setBakedLightmap(int resolution, const float *rgb);
+    void clearBaked();
+    Baked baked() const { return m_baked; }
+    GLuint lightmap() const { return m_lightmap; }
 private:
-    QOpenGLBuffer m_vbo;
-    QOpenGLBuffer m_ibo;
+    // Uploads the asset when needed and builds the vertex array over its
+    // buffers; false when there is nothing to draw.
+    bool prepare();
+    void setAsset(const QSharedPointer<MeshAsset> &asset);
+
+    QSharedPointer<MeshAsset> m_asset;
+    QOpenGLBuffer m_bakedVbo;
     QOpenGLVertexArrayObject m_vao;
-    int m_indexCount;
     Material m_material;
+    QString m_name;
+
+    Baked m_baked = NotBaked;
+    GLuint m_lightmap = 0;
+    int m_lightmapResolution = 0;
 };
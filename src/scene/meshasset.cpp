@@ -0,0 +1,324 @@
+#include "meshasset.h"
+#include <QDebug>
+#include <QFile>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QSaveFile>
+#include <algorithm>
+#include "renderer/memorytracker.h"
+
+MeshAsset::MeshAsset()
+    : m_vbo(QOpenGLBuffer::VertexBuffer),
+    m_colorVbo(QOpenGLBuffer::VertexBuffer),
+    m_ibo(QOpenGLBuffer::IndexBuffer)
+{
+}
+
+MeshAsset::~MeshAsset()
+{
+    m_vbo.destroy();
+    m_colorVbo.destroy();
+    m_ibo.destroy();
+    MemoryTracker::instance().release(this);
+}
+
+void MeshAsset::setName(const QString &name)
+{
+    m_name = name;
+    MemoryTracker::instance().setLabel(this, name);
+}
+
+void MeshAsset::setGeometry(const Geometry &geometry)
+{
+    QVector<QVector3D> normals = geometry.normals;
+    if (normals.size() != geometry.positions.size())
+        normals = VertexFormat::generateNormals(geometry.positions, geometry.indices);
+
+    VertexFormat::Bounds bounds = VertexFormat::computeBounds(geometry.positions);
+    QVector<quint32> colors;
+    if (geometry.colors.size() == geometry.positions.size()) {
+        colors.reserve(geometry.colors.size());
+        for (const QVector3D &c : geometry.colors)
+            colors.append(VertexFormat::encodeColor(c));
+    }
+    setPacked(bounds, VertexFormat::pack(geometry.positions, normals, bounds), colors, geometry.indices);
+}
+
+void MeshAsset::setPacked(const VertexFormat::Bounds &bounds, QVector<VertexFormat::PackedVertex> vertices,
+                          QVector<quint32> colors, QVector<unsigned int> indices)
+{
+    QMutexLocker lock(&m_mutex);
+    m_bounds = bounds;
+    m_vertices = std::move(vertices);
+    m_colors = std::move(colors);
+    m_indices = std::move(indices);
+    m_bvh.clear();
+    m_bvhNodeCount = 0;
+
+    m_vertexCount = m_vertices.size();
+    m_indexCount = m_indices.size();
+    m_hasColors = !m_colors.isEmpty();
+    m_hasCpuGeometry = true;
+    trackCpu();
+}
+
+void MeshAsset::trackCpu()
+{
+    MemoryTracker &mem = MemoryTracker::instance();
+    mem.track(this, "vertices", "mesh", MemoryTracker::Cpu, qint64(m_vertices.size()) * sizeof(VertexFormat::PackedVertex));
+    mem.track(this, "indices", "mesh", MemoryTracker::Cpu, qint64(m_indices.size()) * sizeof(unsigned int));
+    mem.track(this, "colors", "mesh", MemoryTracker::Cpu, qint64(m_colors.size()) * sizeof(quint32));
+    mem.track(this, "bvh", "mesh", MemoryTracker::Cpu,
+              qint64(m_bvh.nodes().size()) * sizeof(Bvh::Node) + qint64(m_bvh.primitives().size()) * sizeof(quint32));
+}
+
+bool MeshAsset::readPacked(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    quint32 header[4] = {};
+    float bounds[6] = {};
+    if (file.read(reinterpret_cast<char*>(header), sizeof(header)) != qint64(sizeof(header))
+        || file.read(reinterpret_cast<char*>(bounds), sizeof(bounds)) != qint64(sizeof(bounds))
+        || header[0] != PackedMagic || (header[3] != 0 && header[3] != header[1])) {
+        qWarning() << "Ignoring invalid packed mesh" << path;
+        return false;
+    }
+
+    const qint64 vertexBytes = qint64(header[1]) * sizeof(VertexFormat::PackedVertex);
+    const qint64 indexBytes = qint64(header[2]) * sizeof(unsigned int);
+    const qint64 colorBytes = qint64(header[3]) * sizeof(quint32);
+    if (file.size() != qint64(sizeof(header) + sizeof(bounds)) + vertexBytes + indexBytes + colorBytes) {
+        qWarning() << "Ignoring truncated packed mesh" << path;
+        return false;
+    }
+
+    QVector<VertexFormat::PackedVertex> vertices(header[1]);
+    QVector<unsigned int> indices(header[2]);
+    QVector<quint32> colors(header[3]);
+    if (file.read(reinterpret_cast<char*>(vertices.data()), vertexBytes) != vertexBytes
+        || file.read(reinterpret_cast<char*>(indices.data()), indexBytes) != indexBytes
+        || file.read(reinterpret_cast<char*>(colors.data()), colorBytes) != colorBytes)
+        return false;
+
+    // The BVH build and the upload index vertices straight from this.
+    const bool indicesValid = indices.size() % 3 == 0
+        && std::all_of(indices.cbegin(), indices.cend(), [&](unsigned int i) { return i < header[1]; });
+    if (!indicesValid) {
+        qWarning() << "Ignoring packed mesh with invalid indices" << path;
+        return false;
+    }
+
+    VertexFormat::Bounds box;
+    box.min = QVector3D(bounds[0], bounds[1], bounds[2]);
+    box.extent = QVector3D(bounds[3], bounds[4], bounds[5]);
+    setPacked(box, std::move(vertices), std::move(colors), std::move(indices));
+
+    QMutexLocker lock(&m_mutex);
+    m_packedFile = path;
+    return true;
+}
+
+bool MeshAsset::writePacked(const QString &path)
+{
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    QMutexLocker lock(&m_mutex);
+    if (!m_hasCpuGeometry)
+        return false;
+    const quint32 header[4] = { PackedMagic, quint32(m_vertices.size()), quint32(m_indices.size()),
+                                quint32(m_colors.size()) };
+    const float bounds[6] = { m_bounds.min.x(), m_bounds.min.y(), m_bounds.min.z(),
+                              m_bounds.extent.x(), m_bounds.extent.y(), m_bounds.extent.z() };
+    file.write(reinterpret_cast<const char*>(header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(bounds), sizeof(bounds));
+    file.write(reinterpret_cast<const char*>(m_vertices.constData()),
+               qint64(m_vertices.size()) * sizeof(VertexFormat::PackedVertex));
+    file.write(reinterpret_cast<const char*>(m_indices.constData()), qint64(m_indices.size()) * sizeof(unsigned int));
+    file.write(reinterpret_cast<const char*>(m_colors.constData()), qint64(m_colors.size()) * sizeof(quint32));
+    if (!file.commit())
+        return false;
+    m_packedFile = path;
+    return true;
+}
+
+QString MeshAsset::packedFile() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_packedFile;
+}
+
+bool MeshAsset::upload()
+{
+    if (uploaded())
+        return true;
+    if (m_indexCount == 0 || !QOpenGLContext::currentContext() || !restoreCpuGeometry())
+        return false;
+
+    QMutexLocker lock(&m_mutex);
+    const int stride = sizeof(VertexFormat::PackedVertex);
+    m_vbo.create();
+    m_vbo.bind();
+    m_vbo.allocate(m_vertices.constData(), m_vertices.size() * stride);
+    m_vbo.release();
+
+    if (m_hasColors) {
+        m_colorVbo.create();
+        m_colorVbo.bind();
+        m_colorVbo.allocate(m_colors.constData(), m_colors.size() * int(sizeof(quint32)));
+        m_colorVbo.release();
+    }
+
+    // Not bound as the element buffer here: that would change the binding
+    // of whatever vertex array is current.
+    m_ibo.create();
+    m_ibo.setUsagePattern(QOpenGLBuffer::StaticDraw);
+    QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
+    f->glBindBuffer(GL_COPY_WRITE_BUFFER, m_ibo.bufferId());
+    f->glBufferData(GL_COPY_WRITE_BUFFER, GLsizeiptr(m_indices.size()) * sizeof(unsigned int),
+                    m_indices.constData(), GL_STATIC_DRAW);
+    f->glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    m_shareGroup = QOpenGLContext::currentContext()->shareGroup();
+
+    MemoryTracker &mem = MemoryTracker::instance();
+    mem.track(this, "vbo", "mesh", MemoryTracker::GpuBuffer, qint64(m_vertexCount) * stride);
+    mem.track(this, "colorVbo", "mesh", MemoryTracker::GpuBuffer, m_hasColors ? qint64(m_vertexCount) * sizeof(quint32) : 0);
+    mem.track(this, "ibo", "mesh", MemoryTracker::GpuBuffer, qint64(m_indexCount) * sizeof(unsigned int));
+    return true;
+}
+
+bool MeshAsset::uploaded() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_vbo.isCreated();
+}
+
+void MeshAsset::releaseGpu()
+{
+    QMutexLocker lock(&m_mutex);
+    if (!m_vbo.isCreated())
+        return;
+    m_vbo.destroy();
+    m_colorVbo.destroy();
+    m_ibo.destroy();
+    m_shareGroup = nullptr;
+
+    MemoryTracker &mem = MemoryTracker::instance();
+    for (const char *name : { "vbo", "colorVbo", "ibo" })
+        mem.track(this, name, "mesh", MemoryTracker::GpuBuffer, 0);
+}
+
+void MeshAsset::bindAttributes(QOpenGLFunctions *f)
+{
+    const GLsizei stride = sizeof(VertexFormat::PackedVertex);
+    m_vbo.bind();
+    f->glEnableVertexAttribArray(0);
+    f->glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride,
+                             reinterpret_cast<const void*>(offsetof(VertexFormat::PackedVertex, position)));
+    f->glEnableVertexAttribArray(2);
+    f->glVertexAttribPointer(2, 2, GL_SHORT, GL_TRUE, stride,
+                             reinterpret_cast<const void*>(offsetof(VertexFormat::PackedVertex, normal)));
+    m_vbo.release();
+
+    // Without a color stream attribute 1 stays disabled and Mesh::render()
+    // feeds the material color as a constant.
+    if (m_hasColors) {
+        m_colorVbo.bind();
+        f->glEnableVertexAttribArray(1);
+        f->glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(quint32), nullptr);
+        m_colorVbo.release();
+    } else {
+        f->glDisableVertexAttribArray(1);
+    }
+
+    // Part of the vertex array state: stays bound.
+    m_ibo.bind();
+}
+
+const Bvh& MeshAsset::bvh()
+{
+    QMutexLocker lock(&m_mutex);
+    if (m_bvh.isEmpty() && m_hasCpuGeometry && m_indices.size() >= 3) {
+        QVector<Bvh::Primitive> triangles(m_indices.size() / 3);
+        for (int t = 0; t < triangles.size(); ++t) {
+            QVector3D a = position(m_indices[3 * t]);
+            QVector3D b = position(m_indices[3 * t + 1]);
+            QVector3D c = position(m_indices[3 * t + 2]);
+            triangles[t].min = QVector3D(qMin(a.x(), qMin(b.x(), c.x())),
+                                         qMin(a.y(), qMin(b.y(), c.y())),
+                                         qMin(a.z(), qMin(b.z(), c.z())));
+            triangles[t].max = QVector3D(qMax(a.x(), qMax(b.x(), c.x())),
+                                         qMax(a.y(), qMax(b.y(), c.y())),
+                                         qMax(a.z(), qMax(b.z(), c.z())));
+        }
+        m_bvh.build(triangles);
+        m_bvhNodeCount = m_bvh.nodes().size();
+        trackCpu();
+    }
+    return m_bvh;
+}
+
+void MeshAsset::releaseCpuGeometry()
+{
+    QMutexLocker lock(&m_mutex);
+    if (!m_hasCpuGeometry)
+        return;
+
+    m_vertices = QVector<VertexFormat::PackedVertex>();
+    m_indices = QVector<unsigned int>();
+    m_colors = QVector<quint32>();
+    m_bvh = Bvh();
+    m_hasCpuGeometry = false;
+    trackCpu();
+}
+
+bool MeshAsset::hasCpuGeometry() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_hasCpuGeometry;
+}
+
+bool MeshAsset::cpuGeometryAvailable() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_hasCpuGeometry || !m_packedFile.isEmpty();
+}
+
+bool MeshAsset::restoreCpuGeometry()
+{
+    if (hasCpuGeometry())
+        return true;
+    const QString path = packedFile();
+    if (path.isEmpty())
+        return false;
+    if (!readPacked(path)) {
+        qWarning() << "Unable to restore the geometry of" << m_name << "from" << path;
+        return false;
+    }
+    qDebug() << "Restored the CPU geometry of" << m_name << "from" << path;
+    return true;
+}
+
+qint64 MeshAsset::cpuBytes() const
+{
+    QMutexLocker lock(&m_mutex);
+    return qint64(m_vertices.size()) * sizeof(VertexFormat::PackedVertex)
+           + qint64(m_indices.size()) * sizeof(unsigned int)
+           + qint64(m_colors.size()) * sizeof(quint32)
+           + qint64(m_bvh.nodes().size()) * sizeof(Bvh::Node)
+           + qint64(m_bvh.primitives().size()) * sizeof(quint32);
+}
+
+qint64 MeshAsset::gpuBytes() const
+{
+    QMutexLocker lock(&m_mutex);
+    if (!m_vbo.isCreated())
+        return 0;
+    return qint64(m_vertexCount) * (sizeof(VertexFormat::PackedVertex) + (m_hasColors ? sizeof(quint32) : 0))
+           + qint64(m_indexCount) * sizeof(unsigned int);
+}
@@ -0,0 +1,124 @@
+#pragma once
+#include <QMutex>
+#include <QOpenGLBuffer>
+#include <QString>
+#include <QVector>
+#include <QVector3D>
+#include "bvh.h"
+#include "vertexformat.h"
+
+class QOpenGLContextGroup;
+class QOpenGLFunctions;
+
+// Geometry shared by every Mesh drawn from the same data: the packed
+// vertices, optional colors, indices and BVH on the CPU, and the vertex
+// and index buffers on the GPU. A Mesh adds its transform, material,
+// baked lighting and its own vertex array object over these buffers.
+// AssetCache hands out one asset per file content; Mesh::initialize with
+// plain geometry makes a private one.
+//
+// Either half can be dropped while the other stays: the tracer releases
+// the CPU copy once it is on the GPU, the cache releases the GPU buffers
+// of unused assets under its budget. The counts and bounds always stay. A
+// released CPU copy comes back from the asset's packed file, when it was
+// read from or written to one (the cache's binary files).
+//
+// The render thread changes an asset while AssetCache reads its sizes from
+// others: what both touch is guarded by the asset's own mutex.
+class MeshAsset
+{
+public:
+    // Source geometry as loaded or generated. colors stays empty unless the
+    // file provides them; normals are generated when empty.
+    struct Geometry {
+        QVector<QVector3D> positions;
+        QVector<QVector3D> normals;
+        QVector<QVector3D> colors;
+        QVector<unsigned int> indices;
+    };
+
+    MeshAsset();
+    ~MeshAsset();
+
+    // Packs geometry into the quantized vertex format (CPU only).
+    void setGeometry(const Geometry &geometry);
+    // Already packed data, e.g. from the asset cache on disk.
+    void setPacked(const VertexFormat::Bounds &bounds, QVector<VertexFormat::PackedVertex> vertices,
+                   QVector<quint32> colors, QVector<unsigned int> indices);
+
+    // The packed form on disk: a header (magic, vertex, index and color
+    // counts, bounds as six floats), then the vertices, indices and
+    // colors. Either call remembers path as the packed file.
+    bool readPacked(const QString &path);
+    bool writePacked(const QString &path);
+    QString packedFile() const;
+
+    // Creates the GL buffers from the CPU copy (restored when released);
+    // needs a current context. Does nothing when they exist, false when
+    // there is nothing to upload.
+    bool upload();
+    bool uploaded() const;
+    // Frees the GL buffers; needs a context of the group they were made in.
+    void releaseGpu();
+    // Share group of the context the buffers were made in.
+    QOpenGLContextGroup* shareGroup() const { return m_shareGroup; }
+    // Points the attributes of basic.vert (0 position, 1 color, 2 normal)
+    // and the element buffer of the bound vertex array at this asset.
+    void bindAttributes(QOpenGLFunctions *f);
+
+    int vertexCount() const { return m_vertexCount; }
+    int indexCount() const { return m_indexCount; }
+    bool hasColors() const { return m_hasColors; }
+    const VertexFormat::Bounds& bounds() const { return m_bounds; }
+    QVector3D position(int i) const { return VertexFormat::decodePosition(m_vertices[i], m_bounds); }
+    QVector3D normal(int i) const { return VertexFormat::decodeNormal(m_vertices[i].normal); }
+
+    const QVector<VertexFormat::PackedVertex>& packedVertices() const { return m_vertices; }
+    const QVector<quint32>& packedColors() const { return m_colors; }
+    const QVector<unsigned int>& indices() const { return m_indices; }
+
+    // Built on first use.
+    const Bvh& bvh();
+    int bvhNodeCount() const { return m_bvhNodeCount; }
+
+    void releaseCpuGeometry();
+    bool hasCpuGeometry() const;
+    // Reads a released CPU copy back from the packed file; false when there
+    // is none to read.
+    bool restoreCpuGeometry();
+    // The CPU copy is there or can be restored.
+    bool cpuGeometryAvailable() const;
+
+    // What the CPU copy and the GL buffers hold right now.
+    qint64 cpuBytes() const;
+    qint64 gpuBytes() const;
+
+    // Shown in memory reports.
+    void setName(const QString &name);
+    const QString& name() const { return m_name; }
+
+private:
+    static constexpr quint32 PackedMagic = 0x4D534131; // "MSA1"
+
+    void trackCpu();
+
+    QOpenGLBuffer m_vbo;
+    QOpenGLBuffer m_colorVbo;
+    QOpenGLBuffer m_ibo;
+    QOpenGLContextGroup *m_shareGroup = nullptr;
+    mutable QMutex m_mutex;
+
+    int m_vertexCount = 0;
+    int m_indexCount = 0;
+    int m_bvhNodeCount = 0;
+    bool m_hasColors = false;
+    bool m_hasCpuGeometry = false;
+    QString m_name;
+    QString m_packedFile;
+
+    VertexFormat::Bounds m_bounds;
+    QVector<VertexFormat::PackedVertex> m_vertices;
+    QVector<quint32> m_colors;
+    QVector<unsigned int> m_indices;
+    Bvh m_bvh;
+};
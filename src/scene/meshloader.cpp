@@ -0,0 +1,1214 @@
+#include "meshloader.h"
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QThread>
+#include <QtConcurrent>
+#include <algorithm>
+#include <charconv>
+#include <climits>
+#include <cstring>
+#include <functional>
+#include "scene/parallel.h"
+
+namespace {
+
+// The whole file, memory-mapped when the platform allows it and read
+// into memory otherwise. Parsers work on [begin(), end()) in place.
+class MappedFile
+{
+public:
+    bool open(const QString &path)
+    {
+        m_file.setFileName(path);
+        if (!m_file.open(QIODevice::ReadOnly)) {
+            qWarning() << "Unable to open mesh file:" << path;
+            return false;
+        }
+
+        m_size = m_file.size();
+        m_data = m_size > 0 ? m_file.map(0, m_size) : nullptr;
+        if (!m_data) {
+            m_copy = m_file.readAll();
+            m_data = reinterpret_cast<const uchar*>(m_copy.constData());
+            m_size = m_copy.size();
+        }
+        return true;
+    }
+
+    const char* begin() const { return reinterpret_cast<const char*>(m_data); }
+    const char* end() const { return begin() + m_size; }
+    qint64 size() const { return m_size; }
+
+private:
+    QFile m_file;
+    const uchar *m_data = nullptr;
+    qint64 m_size = 0;
+    QByteArray m_copy;
+};
+
+// ---------------------------------------------------------------------------
+// Text scanning
+// ---------------------------------------------------------------------------
+
+bool isBlank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+bool isSpace(char c) { return isBlank(c) || c == '\n' || c == '\f' || c == '\v'; }
+
+void skipBlanks(const char *&p, const char *end)
+{
+    while (p < end && isBlank(*p)) ++p;
+}
+
+void skipWhitespace(const char *&p, const char *end)
+{
+    while (p < end && isSpace(*p)) ++p;
+}
+
+const char* lineEnd(const char *p, const char *end)
+{
+    const char *nl = static_cast<const char*>(std::memchr(p, '\n', size_t(end - p)));
+    return nl ? nl : end;
+}
+
+// std::from_chars is locale independent and does not allocate; it only
+// rejects the leading '+' some exporters write.
+template <typename T>
+bool parseNumber(const char *&p, const char *end, T &value)
+{
+    if (p < end && *p == '+') ++p;
+    auto result = std::from_chars(p, end, value);
+    if (result.ec != std::errc())
+        return false;
+    p = result.ptr;
+    return true;
+}
+
+// Fan-triangulates the polygon whose corners are produced by corner(k).
+template <typename Corner>
+void appendFan(QVector<unsigned int> &indices, qint64 n, Corner corner)
+{
+    if (n < 3)
+        return;
+    unsigned int first = corner(0);
+    unsigned int prev = corner(1);
+    for (qint64 k = 2; k < n; ++k) {
+        unsigned int cur = corner(k);
+        indices.append(first);
+        indices.append(prev);
+        indices.append(cur);
+        prev = cur;
+    }
+}
+
+const unsigned int InvalidIndex = 0xFFFFFFFFu;
+
+unsigned int toIndex(double v)
+{
+    return v >= 0.0 && v < double(InvalidIndex) ? unsigned(v) : InvalidIndex;
+}
+
+// Drops faces that reference missing vertices and generates normals when
+// the file had none. Shared by all readers.
+bool finish(const QString &path, Mesh::Geometry &geometry)
+{
+    const unsigned int vertexCount = unsigned(geometry.positions.size());
+    QVector<unsigned int> &idx = geometry.indices;
+
+    int kept = 0;
+    for (int t = 0; t + 2 < idx.size(); t += 3) {
+        if (idx[t] < vertexCount && idx[t + 1] < vertexCount && idx[t + 2] < vertexCount) {
+            idx[kept++] = idx[t];
+            idx[kept++] = idx[t + 1];
+            idx[kept++] = idx[t + 2];
+        }
+    }
+    if (kept != idx.size()) {
+        qWarning() << "Mesh" << path << ": dropped" << (idx.size() - kept) / 3
+                   << "faces with out-of-range vertices";
+        idx.resize(kept);
+    }
+
+    if (geometry.positions.isEmpty() || idx.isEmpty()) {
+        qWarning() << "Mesh has no triangles:" << path;
+        return false;
+    }
+
+    if (geometry.normals.size() != geometry.positions.size())
+        geometry.normals = VertexFormat::generateNormals(geometry.positions, idx);
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// PLY
+// ---------------------------------------------------------------------------
+
+enum class PlyType { Invalid, Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64 };
+
+PlyType plyType(const QByteArray &name)
+{
+    if (name == "char" || name == "int8") return PlyType::Int8;
+    if (name == "uchar" || name == "uint8") return PlyType::UInt8;
+    if (name == "short" || name == "int16") return PlyType::Int16;
+    if (name == "ushort" || name == "uint16") return PlyType::UInt16;
+    if (name == "int" || name == "int32") return PlyType::Int32;
+    if (name == "uint" || name == "uint32") return PlyType::UInt32;
+    if (name == "float" || name == "float32") return PlyType::Float32;
+    if (name == "double" || name == "float64") return PlyType::Float64;
+    return PlyType::Invalid;
+}
+
+int plySize(PlyType type)
+{
+    switch (type) {
+    case PlyType::Int8: case PlyType::UInt8:     return 1;
+    case PlyType::Int16: case PlyType::UInt16:   return 2;
+    case PlyType::Int32: case PlyType::UInt32:
+    case PlyType::Float32:                       return 4;
+    case PlyType::Float64:                       return 8;
+    default:                                     return 0;
+    }
+}
+
+// Scale that brings an integer color channel to 0..1.
+float plyColorScale(PlyType type)
+{
+    switch (type) {
+    case PlyType::UInt8:  return 1.0f / 255.0f;
+    case PlyType::UInt16: return 1.0f / 65535.0f;
+    default:              return 1.0f;
+    }
+}
+
+template <typename T>
+T readRaw(const char *p, bool swap)
+{
+    char bytes[sizeof(T)];
+    std::memcpy(bytes, p, sizeof(T));
+    if (swap)
+        std::reverse(bytes, bytes + sizeof(T));
+    T value;
+    std::memcpy(&value, bytes, sizeof(T));
+    return value;
+}
+
+double readBinary(const char *p, PlyType type, bool swap)
+{
+    switch (type) {
+    case PlyType::Int8:    return readRaw<qint8>(p, swap);
+    case PlyType::UInt8:   return readRaw<quint8>(p, swap);
+    case PlyType::Int16:   return readRaw<qint16>(p, swap);
+    case PlyType::UInt16:  return readRaw<quint16>(p, swap);
+    case PlyType::Int32:   return readRaw<qint32>(p, swap);
+    case PlyType::UInt32:  return readRaw<quint32>(p, swap);
+    case PlyType::Float32: return readRaw<float>(p, swap);
+    case PlyType::Float64: return readRaw<double>(p, swap);
+    default:               return 0.0;
+    }
+}
+
+struct PlyProperty {
+    QByteArray name;
+    PlyType type = PlyType::Invalid;
+    bool isList = false;
+    PlyType countType = PlyType::Invalid;
+};
+
+struct PlyElement {
+    QByteArray name;
+    qint64 count = 0;
+    QVector<PlyProperty> properties;
+
+    int indexOf(const char *name) const
+    {
+        for (int i = 0; i < properties.size(); ++i)
+            if (properties[i].name == name) return i;
+        return -1;
+    }
+
+    // Record size, or -1 when a list makes records variable-length.
+    int stride() const
+    {
+        int size = 0;
+        for (const PlyProperty &p : properties) {
+            if (p.isList) return -1;
+            size += plySize(p.type);
+        }
+        return size;
+    }
+};
+
+struct PlyHeader {
+    bool binary = false;
+    bool swap = false;
+    QVector<PlyElement> elements;
+    const char *data = nullptr;
+};
+
+bool parsePlyHeader(const char *begin, const char *end, PlyHeader &header)
+{
+    const char *p = begin;
+    bool first = true;
+    bool hasFormat = false;
+
+    while (p < end) {
+        const char *eol = lineEnd(p, end);
+        QList<QByteArray> f = QByteArray(p, int(eol - p)).simplified().split(' ');
+        p = eol < end ? eol + 1 : end;
+
+        if (first) {
+            if (f[0] != "ply")
+                return false;
+            first = false;
+            continue;
+        }
+
+        const QByteArray &tag = f[0];
+        if (tag == "format" && f.size() >= 2) {
+            hasFormat = true;
+            header.binary = f[1] != "ascii";
+            const bool bigEndian = f[1] == "binary_big_endian";
+            header.swap = header.binary && bigEndian != (Q_BYTE_ORDER == Q_BIG_ENDIAN);
+            if (f[1] != "ascii" && f[1] != "binary_little_endian" && !bigEndian)
+                return false;
+        } else if (tag == "element" && f.size() >= 3) {
+            PlyElement e;
+            e.name = f[1];
+            e.count = f[2].toLongLong();
+            header.elements.append(e);
+        } else if (tag == "property" && !header.elements.isEmpty()) {
+            PlyProperty prop;
+            if (f.size() >= 5 && f[1] == "list") {
+                prop.isList = true;
+                prop.countType = plyType(f[2]);
+                prop.type = plyType(f[3]);
+                prop.name = f[4];
+                if (prop.countType == PlyType::Invalid)
+                    return false;
+            } else if (f.size() >= 3) {
+                prop.type = plyType(f[1]);
+                prop.name = f[2];
+            }
+            if (prop.type == PlyType::Invalid)
+                return false;
+            header.elements.last().properties.append(prop);
+        } else if (tag == "end_header") {
+            header.data = p;
+            return hasFormat;
+        }
+        // comment, obj_info and unknown lines are skipped
+    }
+    return false;
+}
+
+// Property indices of the vertex attributes we read; -1 when absent.
+struct PlyVertexLayout {
+    int position[3] = { -1, -1, -1 };
+    int normal[3] = { -1, -1, -1 };
+    int color[3] = { -1, -1, -1 };
+
+    explicit PlyVertexLayout(const PlyElement &e)
+    {
+        const char *p[3] = { "x", "y", "z" };
+        const char *n[3] = { "nx", "ny", "nz" };
+        const char *c[3] = { "red", "green", "blue" };
+        for (int i = 0; i < 3; ++i) {
+            position[i] = e.indexOf(p[i]);
+            normal[i] = e.indexOf(n[i]);
+            color[i] = e.indexOf(c[i]);
+        }
+    }
+
+    bool hasPosition() const { return position[0] >= 0 && position[1] >= 0 && position[2] >= 0; }
+    bool hasNormal() const { return normal[0] >= 0 && normal[1] >= 0 && normal[2] >= 0; }
+    bool hasColor() const { return color[0] >= 0 && color[1] >= 0 && color[2] >= 0; }
+};
+
+// Stores one vertex given its property values (ascii and variable-length
+// binary records).
+void storePlyVertex(Mesh::Geometry &g, int i, const PlyElement &e, const PlyVertexLayout &layout,
+                    const QVector<double> &values)
+{
+    g.positions[i] = QVector3D(values[layout.position[0]], values[layout.position[1]], values[layout.position[2]]);
+    if (layout.hasNormal())
+        g.normals[i] = QVector3D(values[layout.normal[0]], values[layout.normal[1]], values[layout.normal[2]]);
+    if (layout.hasColor()) {
+        QVector3D c;
+        for (int k = 0; k < 3; ++k)
+            c[k] = float(values[layout.color[k]]) * plyColorScale(e.properties[layout.color[k]].type);
+        g.colors[i] = c;
+    }
+}
+
+// Fixed-stride binary vertices, decoded in parallel straight from the map.
+void readPlyVerticesFixed(const char *data, const PlyElement &e, const PlyVertexLayout &layout,
+                          bool swap, Mesh::Geometry &g)
+{
+    QVector<int> offsets(e.properties.size());
+    int offset = 0;
+    for (int i = 0; i < e.properties.size(); ++i) {
+        offsets[i] = offset;
+        offset += plySize(e.properties[i].type);
+    }
+    const int stride = offset;
+
+    auto read = [&](const char *record, int prop) {
+        return float(readBinary(record + offsets[prop], e.properties[prop].type, swap));
+    };
+
+    float colorScale[3];
+    for (int k = 0; k < 3; ++k)
+        colorScale[k] = layout.color[k] >= 0 ? plyColorScale(e.properties[layout.color[k]].type) : 1.0f;
+
+    parallelRanges(int(e.count), [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            const char *record = data + qint64(i) * stride;
+            g.positions[i] = QVector3D(read(record, layout.position[0]), read(record, layout.position[1]),
+                                       read(record, layout.position[2]));
+            if (layout.hasNormal())
+                g.normals[i] = QVector3D(read(record, layout.normal[0]), read(record, layout.normal[1]),
+                                         read(record, layout.normal[2]));
+            if (layout.hasColor())
+                g.colors[i] = QVector3D(read(record, layout.color[0]) * colorScale[0],
+                                        read(record, layout.color[1]) * colorScale[1],
+                                        read(record, layout.color[2]) * colorScale[2]);
+        }
+    });
+}
+
+// Receives the body of a PLY file. block may decode a fixed-stride vertex
+// element in one go and return true; otherwise vertex gets each record's
+// property values. face gets every polygon of the face element.
+struct PlySink {
+    std::function<bool(const char *data, const PlyElement &e)> block;
+    std::function<void(qint64 record, const QVector<double> &values)> vertex;
+    std::function<void(const unsigned int *corners, int count)> face;
+};
+
+int faceListIndex(const PlyElement &e)
+{
+    int index = e.indexOf("vertex_indices");
+    return index >= 0 ? index : e.indexOf("vertex_index");
+}
+
+bool readPlyBinary(const QString &path, const PlyHeader &header, const char *end, const PlySink &sink)
+{
+    const char *p = header.data;
+    const bool swap = header.swap;
+    std::vector<unsigned int> corners;
+
+    for (const PlyElement &e : header.elements) {
+        const int stride = e.stride();
+        const bool isVertex = e.name == "vertex";
+        const bool isFace = e.name == "face";
+
+        if (stride >= 0 && (end - p) / qMax(1, stride) < e.count) {
+            qWarning() << "Truncated PLY file:" << path;
+            return false;
+        }
+
+        if (isVertex && stride > 0 && sink.block && sink.block(p, e)) {
+            p += e.count * stride;
+            continue;
+        }
+        if ((!isVertex || !sink.vertex) && (!isFace || !sink.face) && stride >= 0) {
+            p += e.count * stride;
+            continue;
+        }
+
+        // Variable-length records: walk them one property at a time.
+        const int faceList = faceListIndex(e);
+        QVector<double> values(e.properties.size());
+
+        for (qint64 r = 0; r < e.count; ++r) {
+            for (int k = 0; k < e.properties.size(); ++k) {
+                const PlyProperty &prop = e.properties[k];
+                if (!prop.isList) {
+                    const int size = plySize(prop.type);
+                    if (end - p < size) {
+                        qWarning() << "Truncated PLY file:" << path;
+                        return false;
+                    }
+                    values[k] = readBinary(p, prop.type, swap);
+                    p += size;
+                    continue;
+                }
+
+                const int countSize = plySize(prop.countType);
+                const int itemSize = plySize(prop.type);
+                if (end - p < countSize) {
+                    qWarning() << "Truncated PLY file:" << path;
+                    return false;
+                }
+                const qint64 n = qint64(readBinary(p, prop.countType, swap));
+                p += countSize;
+                if (n < 0 || (end - p) / itemSize < n) {
+                    qWarning() << "Truncated PLY file:" << path;
+                    return false;
+                }
+                if (isFace && k == faceList && sink.face) {
+                    corners.resize(size_t(n));
+                    for (qint64 c = 0; c < n; ++c)
+                        corners[c] = toIndex(readBinary(p + c * itemSize, prop.type, swap));
+                    sink.face(corners.data(), int(n));
+                }
+                p += n * itemSize;
+            }
+            if (isVertex && sink.vertex)
+                sink.vertex(r, values);
+        }
+    }
+    return true;
+}
+
+bool readPlyAscii(const QString &path, const PlyHeader &header, const char *end, const PlySink &sink)
+{
+    const char *p = header.data;
+    std::vector<unsigned int> corners;
+
+    for (const PlyElement &e : header.elements) {
+        const bool isVertex = e.name == "vertex";
+        const bool isFace = e.name == "face";
+        const int faceList = faceListIndex(e);
+        QVector<double> values(e.properties.size());
+
+        for (qint64 r = 0; r < e.count; ++r) {
+            for (int k = 0; k < e.properties.size(); ++k) {
+                const PlyProperty &prop = e.properties[k];
+                double v = 0.0;
+                skipWhitespace(p, end);
+                if (!parseNumber(p, end, v)) {
+                    qWarning() << "Malformed PLY data in" << path;
+                    return false;
+                }
+                if (!prop.isList) {
+                    values[k] = v;
+                    continue;
+                }
+
+                corners.clear();
+                for (qint64 c = 0; c < qint64(v); ++c) {
+                    double item = 0.0;
+                    skipWhitespace(p, end);
+                    if (!parseNumber(p, end, item)) {
+                        qWarning() << "Malformed PLY data in" << path;
+                        return false;
+                    }
+                    corners.push_back(toIndex(item));
+                }
+                if (isFace && k == faceList && sink.face)
+                    sink.face(corners.data(), int(corners.size()));
+            }
+            if (isVertex && sink.vertex)
+                sink.vertex(r, values);
+        }
+    }
+    return true;
+}
+
+// Maps path and parses its PLY header; shared by load and scan.
+bool openPly(const QString &path, MappedFile &file, PlyHeader &header)
+{
+    if (!file.open(path))
+        return false;
+    if (!parsePlyHeader(file.begin(), file.end(), header)) {
+        qWarning() << "Invalid PLY header:" << path;
+        return false;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// OBJ
+// ---------------------------------------------------------------------------
+
+struct ObjChunk {
+    const char *begin = nullptr;
+    const char *end = nullptr;
+    qint64 positions = 0;
+    qint64 triangles = 0;
+    qint64 positionBase = 0;
+    qint64 triangleBase = 0;
+};
+
+// Keyword of the line starting at p ("v", "f", ...): one letter then a blank.
+bool objKeyword(const char *p, const char *eol, char key)
+{
+    return eol - p >= 2 && p[0] == key && isBlank(p[1]);
+}
+
+int countTokens(const char *p, const char *eol)
+{
+    int n = 0;
+    while (p < eol) {
+        skipBlanks(p, eol);
+        if (p >= eol) break;
+        ++n;
+        while (p < eol && !isBlank(*p)) ++p;
+    }
+    return n;
+}
+
+void countObjChunk(ObjChunk &chunk)
+{
+    for (const char *p = chunk.begin; p < chunk.end;) {
+        const char *eol = lineEnd(p, chunk.end);
+        skipBlanks(p, eol);
+        if (objKeyword(p, eol, 'v'))
+            ++chunk.positions;
+        else if (objKeyword(p, eol, 'f'))
+            chunk.triangles += qMax(0, countTokens(p + 1, eol) - 2);
+        p = eol + 1;
+    }
+}
+
+// One face corner; relative (negative) indices count back from the
+// vertexCount vertices seen so far. Texture and normal indices are skipped.
+unsigned int objCorner(const char *&p, const char *eol, qint64 vertexCount)
+{
+    long long index = 0;
+    const char *token = p;
+    bool ok = parseNumber(p, eol, index);
+    while (p < eol && !isBlank(*p)) ++p;
+    if (!ok || p == token || index == 0)
+        return InvalidIndex;
+    long long resolved = index > 0 ? index - 1 : vertexCount + index;
+    return resolved >= 0 && resolved < InvalidIndex ? unsigned(resolved) : InvalidIndex;
+}
+
+void parseObjChunk(const ObjChunk &chunk, bool hasColors, Mesh::Geometry &g)
+{
+    qint64 vertex = chunk.positionBase;
+    unsigned int *out = g.indices.data() + chunk.triangleBase * 3;
+
+    auto corner = [&](const char *&p, const char *eol) { return objCorner(p, eol, vertex); };
+
+    for (const char *p = chunk.begin; p < chunk.end;) {
+        const char *eol = lineEnd(p, chunk.end);
+        skipBlanks(p, eol);
+
+        if (objKeyword(p, eol, 'v')) {
+            float xyz[3] = {};
+            const char *q = p + 1;
+            for (float &v : xyz) {
+                skipBlanks(q, eol);
+                parseNumber(q, eol, v);
+            }
+            g.positions[vertex] = QVector3D(xyz[0], xyz[1], xyz[2]);
+            if (hasColors) {
+                float rgb[3] = { 1.0f, 1.0f, 1.0f };
+                for (float &v : rgb) {
+                    skipBlanks(q, eol);
+                    parseNumber(q, eol, v);
+                }
+                g.colors[vertex] = QVector3D(rgb[0], rgb[1], rgb[2]);
+            }
+            ++vertex;
+        } else if (objKeyword(p, eol, 'f')) {
+            // Same token count as countObjChunk, so the chunk fills exactly its range.
+            const char *q = p + 1;
+            const int n = countTokens(q, eol);
+            if (n >= 3) {
+                skipBlanks(q, eol);
+                unsigned int first = corner(q, eol);
+                skipBlanks(q, eol);
+                unsigned int prev = corner(q, eol);
+                for (int k = 2; k < n; ++k) {
+                    skipBlanks(q, eol);
+                    unsigned int cur = corner(q, eol);
+                    *out++ = first;
+                    *out++ = prev;
+                    *out++ = cur;
+                    prev = cur;
+                }
+            }
+        }
+        p = eol + 1;
+    }
+}
+
+// The r g b vertex color extension is detected on the first vertex.
+bool objHasColors(const char *p, const char *end)
+{
+    while (p < end) {
+        const char *eol = lineEnd(p, end);
+        skipBlanks(p, eol);
+        if (objKeyword(p, eol, 'v'))
+            return countTokens(p + 1, eol) >= 6;
+        p = eol + 1;
+    }
+    return false;
+}
+
+// ---------------------------------------------------------------------------
+// Streaming scans (MeshLoader::scan)
+// ---------------------------------------------------------------------------
+
+// Skips blank and '#' comment lines; false at the end of the file.
+bool skipToContent(const char *&p, const char *end)
+{
+    while (p < end) {
+        skipWhitespace(p, end);
+        if (p < end && *p == '#') {
+            p = lineEnd(p, end);
+            continue;
+        }
+        break;
+    }
+    return p < end;
+}
+
+bool scanOff(const QString &path, const MappedFile &file, const MeshLoader::Visitor &visitor)
+{
+    const char *p = file.begin();
+    const char *end = file.end();
+
+    const char *tag = p;
+    if (skipToContent(p, end))
+        for (tag = p; p < end && !isSpace(*p); ++p) {}
+    const QByteArray header(tag, int(p - tag));
+    if (header != "OFF" && header != "COFF") {
+        qWarning() << "Invalid OFF file:" << path;
+        return false;
+    }
+
+    long long counts[3] = {};
+    for (long long &count : counts)
+        if (!skipToContent(p, end) || !parseNumber(p, end, count) || count < 0) {
+            qWarning() << "Invalid OFF header:" << path;
+            return false;
+        }
+
+    for (long long i = 0; i < counts[0]; ++i) {
+        float xyz[3];
+        for (float &v : xyz)
+            if (!skipToContent(p, end) || !parseNumber(p, end, v)) {
+                qWarning() << "Malformed OFF vertex in" << path;
+                return false;
+            }
+        if (visitor.vertex)
+            visitor.vertex(QVector3D(xyz[0], xyz[1], xyz[2]));
+        p = lineEnd(p, end);   // COFF colors
+    }
+    if (!visitor.face)
+        return true;
+
+    std::vector<unsigned int> corners;
+    for (long long i = 0; i < counts[1]; ++i) {
+        long long n = 0;
+        if (!skipToContent(p, end) || !parseNumber(p, end, n) || n < 0) {
+            qWarning() << "Malformed OFF face in" << path;
+            return false;
+        }
+        corners.resize(size_t(n));
+        for (unsigned int &c : corners) {
+            long long index = -1;
+            skipWhitespace(p, end);
+            parseNumber(p, end, index);
+            c = index >= 0 && index < InvalidIndex ? unsigned(index) : InvalidIndex;
+        }
+        visitor.face(corners.data(), int(n));
+        p = lineEnd(p, end);   // face colors
+    }
+    return true;
+}
+
+bool scanPly(const QString &path, const MeshLoader::Visitor &visitor)
+{
+    MappedFile file;
+    PlyHeader header;
+    if (!openPly(path, file, header))
+        return false;
+
+    const PlyElement *vertices = nullptr;
+    for (const PlyElement &e : header.elements)
+        if (e.name == "vertex") vertices = &e;
+    if (!vertices || !PlyVertexLayout(*vertices).hasPosition()) {
+        qWarning() << "PLY file without usable vertices:" << path;
+        return false;
+    }
+
+    const PlyVertexLayout layout(*vertices);
+    PlySink sink;
+    if (visitor.vertex)
+        sink.vertex = [&](qint64, const QVector<double> &values) {
+            visitor.vertex(QVector3D(values[layout.position[0]], values[layout.position[1]],
+                                     values[layout.position[2]]));
+        };
+    sink.face = visitor.face;
+
+    return header.binary ? readPlyBinary(path, header, file.end(), sink)
+                         : readPlyAscii(path, header, file.end(), sink);
+}
+
+bool scanObj(const MappedFile &file, const MeshLoader::Visitor &visitor)
+{
+    qint64 vertices = 0;
+    std::vector<unsigned int> corners;
+
+    for (const char *p = file.begin(); p < file.end();) {
+        const char *eol = lineEnd(p, file.end());
+        skipBlanks(p, eol);
+
+        if (objKeyword(p, eol, 'v')) {
+            if (visitor.vertex) {
+                float xyz[3] = {};
+                const char *q = p + 1;
+                for (float &v : xyz) {
+                    skipBlanks(q, eol);
+                    parseNumber(q, eol, v);
+                }
+                visitor.vertex(QVector3D(xyz[0], xyz[1], xyz[2]));
+            }
+            ++vertices;
+        } else if (visitor.face && objKeyword(p, eol, 'f')) {
+            corners.clear();
+            const char *q = p + 1;
+            for (skipBlanks(q, eol); q < eol; skipBlanks(q, eol))
+                corners.push_back(objCorner(q, eol, vertices));
+            if (corners.size() >= 3)
+                visitor.face(corners.data(), int(corners.size()));
+        }
+        p = eol + 1;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Writers
+// ---------------------------------------------------------------------------
+
+void appendFloat(QByteArray &out, float v)
+{
+    out += QByteArray::number(v, 'g', 9);
+}
+
+bool writeFile(const QString &path, const QByteArray &data)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size()) {
+        qWarning() << "Unable to write mesh file:" << path;
+        return false;
+    }
+    return true;
+}
+
+bool saveOff(const QString &path, const Mesh::Geometry &g)
+{
+    const bool colors = g.colors.size() == g.positions.size();
+    QByteArray out;
+    out.reserve(g.positions.size() * 40 + g.indices.size() * 8);
+    out += colors ? "COFF\n" : "OFF\n";
+    out += QByteArray::number(g.positions.size()) + ' ' + QByteArray::number(g.indices.size() / 3) + " 0\n";
+    for (int i = 0; i < g.positions.size(); ++i) {
+        for (int k = 0; k < 3; ++k) {
+            appendFloat(out, g.positions[i][k]);
+            out += ' ';
+        }
+        if (colors) {
+            for (int k = 0; k < 3; ++k) {
+                appendFloat(out, g.colors[i][k]);
+                out += ' ';
+            }
+            out += '1';
+        }
+        out += '\n';
+    }
+    for (int t = 0; t + 2 < g.indices.size(); t += 3)
+        out += "3 " + QByteArray::number(g.indices[t]) + ' ' + QByteArray::number(g.indices[t + 1]) + ' '
+             + QByteArray::number(g.indices[t + 2]) + '\n';
+    return writeFile(path, out);
+}
+
+bool savePly(const QString &path, const Mesh::Geometry &g, bool binary)
+{
+    const bool colors = g.colors.size() == g.positions.size();
+    const bool normals = g.normals.size() == g.positions.size();
+    const int triangles = g.indices.size() / 3;
+
+    QByteArray out;
+    out += "ply\n";
+    out += binary ? (Q_BYTE_ORDER == Q_BIG_ENDIAN ? "format binary_big_endian 1.0\n"
+                                                  : "format binary_little_endian 1.0\n")
+                  : "format ascii 1.0\n";
+    out += "element vertex " + QByteArray::number(g.positions.size()) + '\n';
+    out += "property float x\nproperty float y\nproperty float z\n";
+    if (normals)
+        out += "property float nx\nproperty float ny\nproperty float nz\n";
+    if (colors)
+        out += "property uchar red\nproperty uchar green\nproperty uchar blue\n";
+    out += "element face " + QByteArray::number(triangles) + '\n';
+    out += "property list uchar int vertex_indices\nend_header\n";
+
+    auto channel = [](float v) { return quint8(qBound(0, int(v * 255.0f + 0.5f), 255)); };
+
+    for (int i = 0; i < g.positions.size(); ++i) {
+        float f[6];
+        int nf = 0;
+        for (int k = 0; k < 3; ++k) f[nf++] = g.positions[i][k];
+        if (normals)
+            for (int k = 0; k < 3; ++k) f[nf++] = g.normals[i][k];
+
+        if (binary) {
+            out.append(reinterpret_cast<const char*>(f), nf * int(sizeof(float)));
+            if (colors)
+                for (int k = 0; k < 3; ++k) out += char(channel(g.colors[i][k]));
+        } else {
+            for (int k = 0; k < nf; ++k) {
+                appendFloat(out, f[k]);
+                out += ' ';
+            }
+            if (colors)
+                for (int k = 0; k < 3; ++k) out += QByteArray::number(channel(g.colors[i][k])) + ' ';
+            out += '\n';
+        }
+    }
+
+    for (int t = 0; t < triangles; ++t) {
+        if (binary) {
+            out += char(3);
+            qint32 v[3] = { qint32(g.indices[3 * t]), qint32(g.indices[3 * t + 1]), qint32(g.indices[3 * t + 2]) };
+            out.append(reinterpret_cast<const char*>(v), sizeof(v));
+        } else {
+            out += "3 " + QByteArray::number(g.indices[3 * t]) + ' ' + QByteArray::number(g.indices[3 * t + 1])
+                 + ' ' + QByteArray::number(g.indices[3 * t + 2]) + '\n';
+        }
+    }
+    return writeFile(path, out);
+}
+
+bool saveObj(const QString &path, const Mesh::Geometry &g)
+{
+    const bool colors = g.colors.size() == g.positions.size();
+    QByteArray out;
+    out.reserve(g.positions.size() * 40 + g.indices.size() * 8);
+    for (int i = 0; i < g.positions.size(); ++i) {
+        out += 'v';
+        for (int k = 0; k < 3; ++k) {
+            out += ' ';
+            appendFloat(out, g.positions[i][k]);
+        }
+        if (colors)
+            for (int k = 0; k < 3; ++k) {
+                out += ' ';
+                appendFloat(out, g.colors[i][k]);
+            }
+        out += '\n';
+    }
+    for (int t = 0; t + 2 < g.indices.size(); t += 3)
+        out += "f " + QByteArray::number(g.indices[t] + 1) + ' ' + QByteArray::number(g.indices[t + 1] + 1) + ' '
+             + QByteArray::number(g.indices[t + 2] + 1) + '\n';
+    return writeFile(path, out);
+}
+
+}
+
+namespace MeshLoader {
+
+Format formatOf(const QString &path)
+{
+    const QString suffix = QFileInfo(path).suffix().toLower();
+    if (suffix == "off") return Off;
+    if (suffix == "obj") return Obj;
+    if (suffix != "ply") return Unknown;
+
+    QFile file(path);
+    if (file.open(QIODevice::ReadOnly) && file.read(256).contains("format ascii"))
+        return PlyAscii;
+    return PlyBinary;
+}
+
+QString formatName(Format format)
+{
+    switch (format) {
+    case Off:       return "OFF";
+    case PlyAscii:  return "PLY ascii";
+    case PlyBinary: return "PLY binary";
+    case Obj:       return "OBJ";
+    default:        return "?";
+    }
+}
+
+QString fileFilter()
+{
+    return "Meshes (*.off *.ply *.obj);;OFF Files (*.off);;PLY Files (*.ply);;OBJ Files (*.obj)";
+}
+
+bool load(const QString &path, Mesh::Geometry &geometry)
+{
+    switch (formatOf(path)) {
+    case Off:       return loadOff(path, geometry);
+    case PlyAscii:
+    case PlyBinary: return loadPly(path, geometry);
+    case Obj:       return loadObj(path, geometry);
+    default:
+        qWarning() << "Unsupported mesh format:" << path;
+        return false;
+    }
+}
+
+bool loadOff(const QString &fileName, Mesh::Geometry &geometry)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Unable to open OFF file:" << fileName;
+        return false;
+    }
+
+    QTextStream in(&file);
+
+    // COFF carries an RGBA color after each vertex position.
+    QString header;
+    in >> header;
+    if (header != "OFF" && header != "COFF") {
+        qWarning() << "Invalid OFF file:" << fileName;
+        return false;
+    }
+    const bool hasColors = header == "COFF";
+
+    int vertexCount = 0;
+    int faceCount = 0;
+    int edgeCount = 0;
+    in >> vertexCount >> faceCount >> edgeCount;
+
+    if (vertexCount <= 0 || faceCount <= 0) {
+        qWarning() << "Invalid mesh size";
+        return false;
+    }
+
+    geometry = Mesh::Geometry();
+    geometry.positions.reserve(vertexCount);
+    geometry.indices.reserve(faceCount * 3);
+    if (hasColors)
+        geometry.colors.reserve(vertexCount);
+
+    bool colorBytes = false;
+    for (int i = 0; i < vertexCount; ++i) {
+        float x, y, z;
+        in >> x >> y >> z;
+        geometry.positions.append(QVector3D(x, y, z));
+
+        if (hasColors) {
+            float r, g, b, a;
+            in >> r >> g >> b >> a;
+            colorBytes = colorBytes || r > 1.0f || g > 1.0f || b > 1.0f;
+            geometry.colors.append(QVector3D(r, g, b));
+        }
+    }
+
+    // Colors are either 0..1 floats or 0..255 integers.
+    if (colorBytes)
+        for (QVector3D &c : geometry.colors)
+            c /= 255.0f;
+
+    // Polygons used to desynchronise the stream; read every corner and fan them.
+    QVector<unsigned int> corners;
+    for (int i = 0; i < faceCount && !in.atEnd(); ++i) {
+        int n = 0;
+        in >> n;
+        corners.resize(qMax(0, n));
+        for (unsigned int &c : corners) {
+            int index = -1;
+            in >> index;
+            c = static_cast<unsigned int>(index);
+        }
+        appendFan(geometry.indices, corners.size(), [&](qint64 k) { return corners[int(k)]; });
+        in.readLine();   // optional per-face color
+    }
+
+    return finish(fileName, geometry);
+}
+
+bool loadPly(const QString &path, Mesh::Geometry &geometry)
+{
+    MappedFile file;
+    PlyHeader header;
+    if (!openPly(path, file, header))
+        return false;
+
+    const PlyElement *vertices = nullptr;
+    qint64 faceCount = 0;
+    for (const PlyElement &e : header.elements) {
+        if (e.name == "vertex") vertices = &e;
+        if (e.name == "face") faceCount = e.count;
+    }
+    if (!vertices || !PlyVertexLayout(*vertices).hasPosition() || vertices->count > INT_MAX / 2) {
+        qWarning() << "PLY file without usable vertices:" << path;
+        return false;
+    }
+
+    const PlyVertexLayout layout(*vertices);
+    const int vertexCount = int(vertices->count);
+    geometry = Mesh::Geometry();
+    geometry.positions.resize(vertexCount);
+    if (layout.hasNormal())
+        geometry.normals.resize(vertexCount);
+    if (layout.hasColor())
+        geometry.colors.resize(vertexCount);
+    geometry.indices.reserve(int(qMin<qint64>(faceCount * 3, INT_MAX / 2)));
+
+    PlySink sink;
+    sink.block = [&](const char *data, const PlyElement &e) {
+        readPlyVerticesFixed(data, e, layout, header.swap, geometry);
+        return true;
+    };
+    sink.vertex = [&](qint64 r, const QVector<double> &values) {
+        storePlyVertex(geometry, int(r), *vertices, layout, values);
+    };
+    sink.face = [&](const unsigned int *corners, int n) {
+        appendFan(geometry.indices, n, [corners](qint64 c) { return corners[c]; });
+    };
+
+    bool ok = header.binary ? readPlyBinary(path, header, file.end(), sink)
+                            : readPlyAscii(path, header, file.end(), sink);
+    return ok && finish(path, geometry);
+}
+
+bool loadObj(const QString &path, Mesh::Geometry &geometry)
+{
+    MappedFile file;
+    if (!file.open(path))
+        return false;
+
+    // Newline-aligned chunks of roughly equal size.
+    const qint64 size = file.size();
+    const int chunkCount = int(qBound<qint64>(1, size / (1 << 20), QThread::idealThreadCount() * 4));
+    QVector<ObjChunk> chunks(chunkCount);
+    const char *cursor = file.begin();
+    for (int i = 0; i < chunkCount; ++i) {
+        const char *target = i + 1 == chunkCount ? file.end() : file.begin() + size * (i + 1) / chunkCount;
+        const char *end = qMax(cursor, target);
+        if (end < file.end())
+            end = qMin(file.end(), lineEnd(end, file.end()) + 1);
+        chunks[i].begin = cursor;
+        chunks[i].end = end;
+        cursor = end;
+    }
+
+    QtConcurrent::blockingMap(chunks, countObjChunk);
+
+    qint64 positions = 0, triangles = 0;
+    for (ObjChunk &chunk : chunks) {
+        chunk.positionBase = positions;
+        chunk.triangleBase = triangles;
+        positions += chunk.positions;
+        triangles += chunk.triangles;
+    }
+    if (positions > INT_MAX / 2 || triangles * 3 > INT_MAX / 2) {
+        qWarning() << "OBJ file too large:" << path;
+        return false;
+    }
+
+    const bool hasColors = objHasColors(file.begin(), file.end());
+    geometry = Mesh::Geometry();
+    geometry.positions.resize(int(positions));
+    if (hasColors)
+        geometry.colors.resize(int(positions));
+    geometry.indices.resize(int(triangles * 3));
+
+    QtConcurrent::blockingMap(chunks, [&](const ObjChunk &chunk) { parseObjChunk(chunk, hasColors, geometry); });
+
+    return finish(path, geometry);
+}
+
+bool scan(const QString &path, const Visitor &visitor)
+{
+    switch (formatOf(path)) {
+    case PlyAscii:
+    case PlyBinary:
+        return scanPly(path, visitor);
+    case Off:
+    case Obj: {
+        MappedFile file;
+        if (!file.open(path))
+            return false;
+        return formatOf(path) == Off ? scanOff(path, file, visitor) : scanObj(file, visitor);
+    }
+    default:
+        qWarning() << "Unsupported mesh format:" << path;
+        return false;
+    }
+}
+
+bool save(const QString &path, const Mesh::Geometry &geometry, Format format)
+{
+    switch (format) {
+    case Off:       return saveOff(path, geometry);
+    case PlyAscii:  return savePly(path, geometry, false);
+    case PlyBinary: return savePly(path, geometry, true);
+    case Obj:       return saveObj(path, geometry);
+    default:        return false;
+    }
+}
+
+int runBenchmark(const QStringList &paths, int repeats)
+{
+    QTemporaryDir dir;
+    if (!dir.isValid()) {
+        qWarning() << "Load benchmark: unable to create a temporary directory";
+        return 1;
+    }
+
+    const Format formats[] = { Off, PlyAscii, PlyBinary, Obj };
+    const char *suffixes[] = { ".off", "_ascii.ply", "_binary.ply", ".obj" };
+    int failures = 0;
+
+    for (const QString &path : paths) {
+        Mesh::Geometry source;
+        if (!load(path, source)) {
+            ++failures;
+            continue;
+        }
+        // Written without normals: every reader pays for the same generation.
+        source.normals.clear();
+
+        qInfo().noquote() << QString("%1: %2 vertices, %3 triangles, best of %4")
+                                 .arg(QFileInfo(path).fileName()).arg(source.positions.size())
+                                 .arg(source.indices.size() / 3).arg(repeats);
+        qInfo().noquote() << "  format        size MiB   load ms     MiB/s    Mtri/s   vs OFF";
+
+        double offMs = 0.0;
+        for (int f = 0; f < 4; ++f) {
+            QString file = QDir(dir.path()).filePath(QFileInfo(path).completeBaseName() + suffixes[f]);
+            if (!save(file, source, formats[f])) {
+                ++failures;
+                continue;
+            }
+
+            double best = -1.0;
+            for (int r = 0; r < qMax(1, repeats); ++r) {
+                Mesh::Geometry g;
+                QElapsedTimer timer;
+                timer.start();
+                bool ok = load(file, g);
+                double ms = timer.nsecsElapsed() / 1e6;
+                if (!ok) {
+                    best = -1.0;
+                    break;
+                }
+                best = best < 0.0 ? ms : qMin(best, ms);
+            }
+            if (best < 0.0) {
+                ++failures;
+                continue;
+            }
+            if (formats[f] == Off)
+                offMs = best;
+
+            const double mib = QFileInfo(file).size() / (1024.0 * 1024.0);
+            qInfo().noquote() << QString("  %1 %2 %3 %4 %5 %6x")
+                                     .arg(formatName(formats[f]), -12)
+                                     .arg(mib, 9, 'f', 2)
+                                     .arg(best, 9, 'f', 2)
+                                     .arg(mib / (best / 1000.0), 9, 'f', 1)
+                                     .arg(source.indices.size() / 3 / (best * 1000.0), 9, 'f', 2)
+                                     .arg(offMs > 0.0 ? offMs / best : 0.0, 6, 'f', 1);
+        }
+    }
+    return failures ? 1 : 0;
+}
+
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <QString>
+#include <functional>
+#include <QStringList>
+#include "mesh.h"
+
+// Triangle mesh import and export. Every reader fills Mesh::Geometry in
+// place: arrays are sized once from the header (PLY, OFF) or from a
+// counting pass (OBJ) and written at their final position, so a loaded mesh
+// is never held twice. Polygons are fan-triangulated, out-of-range faces
+// are dropped with a warning, and normals are generated when the file has
+// none.
+//
+//   OFF / COFF   QTextStream, as before; kept as the reference path
+//   PLY          ascii, binary_little_endian and binary_big_endian. Binary
+//                files are memory-mapped and read in place; fixed-stride
+//                vertex records are decoded on all cores.
+//   OBJ          memory-mapped and split into newline-aligned chunks. A
+//                parallel counting pass gives every chunk its offsets into
+//                the position and index arrays, a second parallel pass
+//                parses straight into them. Reads v (with the optional
+//                r g b extension) and f; normals and texture coordinates
+//                are ignored, since vertices are shared by position.
+namespace MeshLoader {
+
+enum Format { Unknown, Off, PlyAscii, PlyBinary, Obj };
+
+// Read format from the extension; PLY encodings are told apart by the header.
+Format formatOf(const QString &path);
+QString formatName(Format format);
+// Filter string for file dialogs.
+QString fileFilter();
+
+bool load(const QString &path, Mesh::Geometry &geometry);
+bool loadOff(const QString &path, Mesh::Geometry &geometry);
+bool loadPly(const QString &path, Mesh::Geometry &geometry);
+bool loadObj(const QString &path, Mesh::Geometry &geometry);
+
+// Streaming access for meshes that do not fit in memory: the mapped file is
+// walked sequentially and nothing is kept. Callbacks come in file order
+// with zero-based corners (OBJ faces only reference earlier vertices); an
+// empty callback skips that part of the file where the format allows it.
+struct Visitor {
+    std::function<void(const QVector3D &position)> vertex;
+    std::function<void(const unsigned int *corners, int count)> face;
+};
+bool scan(const QString &path, const Visitor &visitor);
+
+bool save(const QString &path, const Mesh::Geometry &geometry, Format format);
+
+// --load-benchmark: converts each mesh to every format in a temporary
+// directory and reports the load throughput of each reader. Returns the
+// process exit code.
+int runBenchmark(const QStringList &paths, int repeats);
+
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <QPair>
+#include <QVector>
+#include <QtConcurrent>
+
+// Runs fn(begin, end) over [0, count) in chunks of chunkSize on the global
+// thread pool and returns once every chunk is done.
+template <typename Fn>
+void parallelRanges(int count, int chunkSize, Fn fn)
+{
+    QVector<QPair<int, int>> chunks;
+    for (int begin = 0; begin < count; begin += chunkSize)
+        chunks.append({ begin, qMin(count, begin + chunkSize) });
+
+    QtConcurrent::blockingMap(chunks, [&fn](const QPair<int, int> &r) { fn(r.first, r.second); });
+}
+
+template <typename Fn>
+void parallelRanges(int count, Fn fn)
+{
+    parallelRanges(count, 4096, fn);
+}
@@ -1,8 +1,24 @@
 #include "scene.h"
 #include "mesh.h"
+#include "clusteredmesh.h"
+#include <atomic>
+#include <cmath>
+#include "renderer/memorytracker.h"
+
+static std::atomic<quint64> s_nextRevision { 1 };
 
 Scene::Scene()
 {
+    bumpRevision();
+}
+
+void Scene::bumpRevision()
+{
+    m_revision = s_nextRevision++;
+
+    MemoryTracker &mem = MemoryTracker::instance();
+    mem.track(this, "spheres", "scene", MemoryTracker::Cpu, qint64(sizeof(SphereInstance)) * m_spheres.capacity());
+    mem.track(this, "materials", "scene", MemoryTracker::Cpu, qint64(sizeof(Material)) * m_materials.capacity());
 }
 
 Scene::~Scene()
@@ -11,73 +27,59 @@ Scene::~Scene()
         delete m;
     }
     m_meshes.clear();
+    qDeleteAll(m_clusteredMeshes);
+    MemoryTracker::instance().release(this);
 }
 
 void Scene::addMesh(Mesh* m)
 {
     if (m) m_meshes.append(m);
+    bumpRevision();
 }
 
-void Scene::clear()
+void Scene::addClusteredMesh(ClusteredMesh *m)
 {
-    m_meshes.clear();
-    m_lights.clear();
+    if (m) m_clusteredMeshes.append(m);
+    bumpRevision();
 }
 
-void generateSphereMesh(float radius,
-                        int stacks, int slices,
-                        QVector<Mesh::Vertex>& verts,
-                        QVector<unsigned int>& idx)
+// Meshes own GL buffers: call with the render context current.
+void Scene::clear()
 {
-    verts.clear();
-    idx.clear();
-
-    for (int i = 0; i <= stacks; ++i) {
-        float v = float(i) / stacks;
-        float phi = v * M_PI;
-
-        for (int j = 0; j <= slices; ++j) {
-            float u = float(j) / slices;
-            float theta = u * 2.0f * M_PI;
-
-            float x = radius * sin(phi) * cos(theta);
-            float y = radius * cos(phi);
-            float z = radius * sin(phi) * sin(theta);
+    qDeleteAll(m_meshes);
+    m_meshes = QVector<Mesh*>();
+    qDeleteAll(m_clusteredMeshes);
+    m_clusteredMeshes = QVector<ClusteredMesh*>();
+    m_lights = QVector<Light>();
+    m_spheres = QVector<SphereInstance>();
+    m_materials = QVector<Material>();
+    bumpRevision();
+}
 
-            verts.append({ QVector3D(x, y, z),
-                          QVector3D(1,1,1) });
-        }
-    }
+int Scene::addMaterial(const Material &material)
+{
+    m_materials.append(material);
+    return m_materials.size() - 1;
+}
 
-    for (int i = 0; i < stacks; ++i) {
-        for (int j = 0; j < slices; ++j) {
-            int a =  i    * (slices+1) + j;
-            int b =  i    * (slices+1) + j+1;
-            int c = (i+1) * (slices+1) + j;
-            int d = (i+1) * (slices+1) + j+1;
-
-            idx.append(a);
-            idx.append(c);
-            idx.append(b);
-
-            idx.append(b);
-            idx.append(c);
-            idx.append(d);
-        }
-    }
+void Scene::addSphere(const QVector3D &center, float radius, int materialId)
+{
+    m_spheres.append({ center, radius, materialId });
+    bumpRevision();
 }
 
 void Scene::buildPlaneSphere()
 {
-    QVector<Mesh::Vertex> verts;
-    QVector<unsigned int> idx;
+    Mesh::Geometry quad;
+    QVector<QVector3D>& verts = quad.positions;
+    QVector<unsigned int>& idx = quad.indices;
 
-    auto pushQuad = [&](QVector3D a, QVector3D b, QVector3D c, QVector3D d, QVector3D color) {
+    auto pushQuad = [&](QVector3D a, QVector3D b, QVector3D c, QVector3D d) {
         unsigned base = verts.size();
-        verts.append({a, color});
-        verts.append({b, color});
-        verts.append({c, color});
-        verts.append({d, color});
+        verts.append(a);
+        verts.append(b);
+        verts.append(c);
+        verts.append(d);
         idx.append(base+0); idx.append(base+1); idx.append(base+2);
         idx.append(base+2); idx.append(base+3); idx.append(base+0);
     };
@@ -86,8 +88,7 @@ void Scene::buildPlaneSphere()
         {-3,0.,-3},
         {-3,0.,3},
         {3,0.,3},
-        {3,0.,-3},
-        {0.7f, 0.7f, 0.7f}
+        {3,0.,-3}
         );
 
     Material m1;
@@ -100,13 +101,9 @@ void Scene::buildPlaneSphere()
 
     Mesh* plane = new Mesh();
     plane->addMaterial(m1);
-    plane->initialize(verts, idx);
+    plane->initialize(quad);
     addMesh(plane);
 
-    QVector<Mesh::Vertex> sVerts;
-    QVector<unsigned int> sIdx;
-
-    generateSphereMesh(1.0f, 20, 20, sVerts, sIdx);
 
     Material m2;
     m2.color=QVector3D(1.0, 0., 0.);;
@@ -117,12 +114,7 @@ void Scene::buildPlaneSphere()
     m2.shininess = 128;
 
 
-    Mesh* sphere = new Mesh();
-    sphere->addMaterial(m2);
-    sphere->initialize(sVerts, sIdx);
-    sphere->modelMatrix.translate(0, 1, 0);
-    sphere->isSphere=true;
-    addMesh(sphere);
+    addSphere(QVector3D(0, 1, 0), 1.0f, addMaterial(m2));
 
     Light l;
     l.position = QVector3D(2.0f, 4.0f, 2.0f);
@@ -164,21 +156,18 @@ void Scene::buildCornellBox()
 
     auto makeQuad = [&](QVector3D a, QVector3D b, QVector3D c, QVector3D d, Material mat)
     {
-        QVector<Mesh::Vertex> verts;
-        QVector<unsigned int> idx;
+        Mesh::Geometry quad;
+        QVector<unsigned int>& idx = quad.indices;
 
         unsigned int base = 0;
 
-        verts.append({ d, mat.color });
-        verts.append({ c, mat.color });
-        verts.append({ b, mat.color });
-        verts.append({ a, mat.color });
+        quad.positions = { d, c, b, a };
 
         idx.append(base+0); idx.append(base+1); idx.append(base+2);
         idx.append(base+2); idx.append(base+3); idx.append(base+0);
 
         Mesh* m = new Mesh();
-        m->initialize(verts, idx);
+        m->initialize(quad);
         m->modelMatrix.setToIdentity();
         m->addMaterial(mat);
         addMesh(m);
@@ -192,11 +181,6 @@ void Scene::buildCornellBox()
     makeQuad(E, F, B, A, white);     // floor
 
     {
-        Mesh* s1 = new Mesh();
-        s1->isSphere = true;
-        s1->modelMatrix.setToIdentity();
-        s1->modelMatrix.translate(1.0f, -2.0f, 0.5f);
-
         Material m;
         m.color = QVector3D(0.9f, 0.2f, 0.2f);
         m.kd = 0.8f;
@@ -204,16 +188,10 @@ void Scene::buildCornellBox()
         m.specularColor = QVector3D(1,1,1);
         m.shininess = 64;
 
-        s1->addMaterial(m);
-        addMesh(s1);
+        addSphere(QVector3D(1.0f, -2.0f, 0.5f), 1.0f, addMaterial(m));
     }
 
     {
-        Mesh* s2 = new Mesh();
-        s2->isSphere = true;
-        s2->modelMatrix.setToIdentity();
-        s2->modelMatrix.translate(-1.0f, -2.f, -1.0f);
-
         Material m;
         m.color = QVector3D(0.4f, 0.4f, 1.0f);
         m.kd = 0.8f;
@@ -221,15 +199,76 @@ void Scene::buildCornellBox()
         m.specularColor = QVector3D(1,1,1);
         m.shininess = 32;
 
-        s2->addMaterial(m);
-        addMesh(s2);
+        addSphere(QVector3D(-1.0f, -2.f, -1.0f), 1.0f, addMaterial(m));
     }
 
     Light l;
     l.position  = QVector3D(0, 2.8f, 0);
     l.color     = QVector3D(1,1,1);
     l.intensity = 10.0f;
+    l.radius    = 0.2f;
 
     m_lights.append(l);
 }
 
+
+void Scene::buildSphereField(int count, quint32 seed)
+{
+    clear();
+
+    // Jittered grid, so density stays even at any count.
+    const int side = qMax(1, int(std::ceil(std::sqrt(double(count)))));
+    const float spacing = 0.6f;
+    const float half = side * spacing * 0.5f;
+
+    Mesh::Geometry quad;
+    quad.positions = { {-half, 0.f, -half}, {-half, 0.f, half}, {half, 0.f, half}, {half, 0.f, -half} };
+    quad.indices = { 0, 1, 2, 2, 3, 0 };
+
+    Material ground;
+    ground.color = QVector3D(0.6f, 0.6f, 0.6f);
+    ground.kd = 0.9f;
+
+    Mesh* plane = new Mesh();
+    plane->addMaterial(ground);
+    plane->initialize(quad);
+    addMesh(plane);
+
+    const QVector3D palette[] = {
+        {0.85f, 0.25f, 0.2f}, {0.2f, 0.6f, 0.25f}, {0.25f, 0.35f, 0.85f}, {0.9f, 0.75f, 0.2f},
+        {0.6f, 0.3f, 0.75f}, {0.2f, 0.7f, 0.75f}, {0.85f, 0.85f, 0.85f}, {0.9f, 0.5f, 0.15f},
+    };
+    int firstMaterial = m_materials.size();
+    for (const QVector3D &color : palette) {
+        Material m;
+        m.color = color;
+        m.kd = 0.8f;
+        m.ks = 0.3f;
+        m.shininess = 64;
+        addMaterial(m);
+    }
+
+    // xorshift32: deterministic for a given seed
+    quint32 state = seed ? seed : 1u;
+    auto next = [&state]() {
+        state ^= state << 13; state ^= state >> 17; state ^= state << 5;
+        return (state >> 8) * (1.0f / 16777216.0f);
+    };
+
+    m_spheres.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        float radius = spacing * (0.12f + 0.2f * next());
+        float jitter = spacing * 0.5f - radius;
+        float x = -half + (i % side + 0.5f) * spacing + (next() * 2.0f - 1.0f) * jitter;
+        float z = -half + (i / side + 0.5f) * spacing + (next() * 2.0f - 1.0f) * jitter;
+        m_spheres.append({ QVector3D(x, radius, z), radius,
+                           firstMaterial + int(next() * 8.0f) % 8 });
+    }
+    bumpRevision();
+
+    Light l;
+    l.position = QVector3D(0.0f, 8.0f, 0.0f);
+    l.color = QVector3D(1.0f, 1.0f, 1.0f);
+    l.intensity = 60.0f;
+    m_lights.append(l);
+}
@@ -1,10 +1,21 @@
 #pragma once
 
 #include <QVector>
+#include <QVector3D>
 #include "light.h"
+#include "material.h"
 
+class ClusteredMesh;
 class Mesh;
 
+// Spheres are analytic instances rather than meshes: the rasterizer draws
+// one shared unit sphere per instance and the tracer intersects them exactly.
+struct SphereInstance {
+    QVector3D center;
+    float radius;
+    int materialId;
+};
+
 class Scene
 {
 public:
@@ -12,14 +23,34 @@ public:
     ~Scene();
 
     void addMesh(Mesh* m);
+    // Out-of-core meshes, drawn by the path tracer only. Takes ownership.
+    void addClusteredMesh(ClusteredMesh *m);
     void clear();
     const QVector<Mesh*>& meshes() const { return m_meshes; }
+    const QVector<ClusteredMesh*>& clusteredMeshes() const { return m_clusteredMeshes; }
     const QVector<Light>& lights() const { return m_lights; }
 
+    int addMaterial(const Material &material);
+    void addSphere(const QVector3D &center, float radius, int materialId);
+    const QVector<SphereInstance>& spheres() const { return m_spheres; }
+    const QVector<Material>& materials() const { return m_materials; }
+
+    // Changes with every edit of the mesh list and is unique across scenes,
+    // so GPU copies of the geometry are only rebuilt when needed.
+    quint64 revision() const { return m_revision; }
+
     void buildPlaneSphere();
     void buildCornellBox();
+    // Stress scene: count spheres scattered over a ground plane.
+    void buildSphereField(int count, quint32 seed = 1);
 
 private:
     QVector<Mesh*> m_meshes;
+    QVector<ClusteredMesh*> m_clusteredMeshes;
     QVector<Light> m_lights;
+    QVector<SphereInstance> m_spheres;
+    QVector<Material> m_materials;
+    quint64 m_revision = 0;
+
+    void bumpRevision();
 };
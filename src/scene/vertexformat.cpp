@@ -0,0 +1,147 @@
+#include "vertexformat.h"
+#include <cmath>
+#include "scene/parallel.h"
+
+namespace {
+
+quint16 quantize(float value, float min, float extent)
+{
+    if (extent <= 0.0f)
+        return 0;
+    float t = qBound(0.0f, (value - min) / extent, 1.0f);
+    return quint16(std::lround(t * 65535.0f));
+}
+
+float signNotZero(float v)
+{
+    return v >= 0.0f ? 1.0f : -1.0f;
+}
+
+}
+
+namespace VertexFormat {
+
+Bounds computeBounds(const QVector<QVector3D> &positions)
+{
+    if (positions.isEmpty())
+        return { QVector3D(0, 0, 0), QVector3D(0, 0, 0) };
+
+    QVector3D lo = positions[0];
+    QVector3D hi = positions[0];
+    for (const QVector3D &p : positions) {
+        lo = QVector3D(qMin(lo.x(), p.x()), qMin(lo.y(), p.y()), qMin(lo.z(), p.z()));
+        hi = QVector3D(qMax(hi.x(), p.x()), qMax(hi.y(), p.y()), qMax(hi.z(), p.z()));
+    }
+    return { lo, hi - lo };
+}
+
+quint32 encodeNormal(const QVector3D &n)
+{
+    float l1 = std::fabs(n.x()) + std::fabs(n.y()) + std::fabs(n.z());
+    if (l1 <= 0.0f)
+        return encodeNormal(QVector3D(0.0f, 1.0f, 0.0f));
+
+    float x = n.x() / l1;
+    float y = n.y() / l1;
+    if (n.z() < 0.0f) {
+        float ox = (1.0f - std::fabs(y)) * signNotZero(x);
+        float oy = (1.0f - std::fabs(x)) * signNotZero(y);
+        x = ox;
+        y = oy;
+    }
+
+    auto snorm16 = [](float v) {
+        return quint32(quint16(qint16(std::lround(qBound(-1.0f, v, 1.0f) * 32767.0f))));
+    };
+    return snorm16(x) | (snorm16(y) << 16);
+}
+
+QVector3D decodeNormal(quint32 packed)
+{
+    float x = qMax(float(qint16(packed & 0xFFFFu)) / 32767.0f, -1.0f);
+    float y = qMax(float(qint16(packed >> 16)) / 32767.0f, -1.0f);
+    float z = 1.0f - std::fabs(x) - std::fabs(y);
+    float t = qMax(-z, 0.0f);
+    x += x >= 0.0f ? -t : t;
+    y += y >= 0.0f ? -t : t;
+    return QVector3D(x, y, z).normalized();
+}
+
+QVector3D decodePosition(const PackedVertex &v, const Bounds &bounds)
+{
+    QVector3D q(v.position[0], v.position[1], v.position[2]);
+    return bounds.min + q / 65535.0f * bounds.extent;
+}
+
+quint32 encodeColor(const QVector3D &rgb)
+{
+    auto unorm8 = [](float v) { return quint32(std::lround(qBound(0.0f, v, 1.0f) * 255.0f)); };
+    return unorm8(rgb.x()) | (unorm8(rgb.y()) << 8) | (unorm8(rgb.z()) << 16) | (255u << 24);
+}
+
+QVector<QVector3D> generateNormals(const QVector<QVector3D> &positions,
+                                   const QVector<unsigned int> &indices)
+{
+    const int vertexCount = positions.size();
+    const int faceCount = indices.size() / 3;
+
+    // Unnormalized cross products: the length weights each face by its area.
+    QVector<QVector3D> faceNormals(faceCount);
+    parallelRanges(faceCount, [&](int begin, int end) {
+        for (int f = begin; f < end; ++f) {
+            unsigned a = indices[3 * f], b = indices[3 * f + 1], c = indices[3 * f + 2];
+            if (a >= unsigned(vertexCount) || b >= unsigned(vertexCount) || c >= unsigned(vertexCount))
+                continue;
+            faceNormals[f] = QVector3D::crossProduct(positions[b] - positions[a],
+                                                     positions[c] - positions[a]);
+        }
+    });
+
+    // Vertex -> face adjacency (CSR) so every vertex sums its own faces and
+    // the gather needs no atomics.
+    QVector<int> offsets(vertexCount + 1, 0);
+    for (unsigned int v : indices)
+        if (v < unsigned(vertexCount)) ++offsets[v + 1];
+    for (int v = 0; v < vertexCount; ++v)
+        offsets[v + 1] += offsets[v];
+
+    QVector<int> adjacency(offsets[vertexCount]);
+    QVector<int> cursor(offsets.begin(), offsets.end() - 1);
+    for (int i = 0; i < faceCount * 3; ++i) {
+        unsigned int v = indices[i];
+        if (v < unsigned(vertexCount))
+            adjacency[cursor[v]++] = i / 3;
+    }
+
+    QVector<QVector3D> normals(vertexCount);
+    parallelRanges(vertexCount, [&](int begin, int end) {
+        for (int v = begin; v < end; ++v) {
+            QVector3D n(0.0f, 0.0f, 0.0f);
+            for (int k = offsets[v]; k < offsets[v + 1]; ++k)
+                n += faceNormals[adjacency[k]];
+            normals[v] = n.lengthSquared() > 0.0f ? n.normalized() : QVector3D(0.0f, 1.0f, 0.0f);
+        }
+    });
+    return normals;
+}
+
+QVector<PackedVertex> pack(const QVector<QVector3D> &positions,
+                           const QVector<QVector3D> &normals,
+                           const Bounds &bounds)
+{
+    QVector<PackedVertex> packed(positions.size());
+    parallelRanges(positions.size(), [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            const QVector3D &p = positions[i];
+            PackedVertex &v = packed[i];
+            v.position[0] = quantize(p.x(), bounds.min.x(), bounds.extent.x());
+            v.position[1] = quantize(p.y(), bounds.min.y(), bounds.extent.y());
+            v.position[2] = quantize(p.z(), bounds.min.z(), bounds.extent.z());
+            v.pad = 0;
+            v.normal = encodeNormal(i < normals.size() ? normals[i] : QVector3D(0.0f, 1.0f, 0.0f));
+        }
+    });
+    return packed;
+}
+
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <QVector>
+#include <QVector3D>
+
+// Compact vertex layout shared by the rasterizer (basic.vert) and the path
+// tracer (raytrace.comp):
+//   position  3 x 16-bit unorm relative to the mesh AABB, plus 16-bit pad
+//   normal    octahedral, 2 x 16-bit snorm packed in 32 bits
+// 12 bytes per vertex instead of 24 for float position + color. Colors live
+// in an optional RGBA8 stream that only exists when the source file has them.
+namespace VertexFormat {
+
+struct PackedVertex {
+    quint16 position[3];
+    quint16 pad;
+    quint32 normal;
+};
+static_assert(sizeof(PackedVertex) == 12, "PackedVertex is uploaded as three 32-bit words");
+
+// Dequantization: p = min + q / 65535 * extent
+struct Bounds {
+    QVector3D min;
+    QVector3D extent;
+};
+
+Bounds computeBounds(const QVector<QVector3D> &positions);
+
+quint32 encodeNormal(const QVector3D &n);
+QVector3D decodeNormal(quint32 packed);
+QVector3D decodePosition(const PackedVertex &v, const Bounds &bounds);
+quint32 encodeColor(const QVector3D &rgb);
+
+// Area-weighted vertex normals; faces and vertices are processed in parallel.
+QVector<QVector3D> generateNormals(const QVector<QVector3D> &positions,
+                                   const QVector<unsigned int> &indices);
+
+// Quantizes positions and encodes normals, in parallel.
+QVector<PackedVertex> pack(const QVector<QVector3D> &positions,
+                           const QVector<QVector3D> &normals,
+                           const Bounds &bounds);
+
+}
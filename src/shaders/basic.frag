@@ -1,8 +1,38 @@
 #version 450 core
 in vec3 vColor;
+in vec3 vNormal;
+in vec3 vBaked;
+in vec2 vLightmapUv;
 out vec4 FragColor;
 
+// Mesh::Baked
+const int BAKED_VERTICES = 1;
+const int BAKED_LIGHTMAP = 2;
+
+uniform int u_baked;
+uniform sampler2D u_lightmap;
+uniform float u_kd;
+
+// ImageIO::tonemap: the default framebuffer does no sRGB encoding.
+vec3 tonemap(vec3 x)
+{
+    x = max(x, vec3(0.0));
+    x = clamp((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14), 0.0, 1.0);
+    return mix(12.92 * x, 1.055 * pow(x, vec3(1.0 / 2.4)) - 0.055, step(vec3(0.0031308), x));
+}
+
 void main()
 {
-    FragColor = vec4(vColor, 1.0);
+    // Baked radiance is that of a white Lambert surface: scaled by the
+    // albedo it is the path tracer's diffuse shading.
+    if (u_baked != 0) {
+        vec3 white = u_baked == BAKED_LIGHTMAP ? texture(u_lightmap, vLightmapUv).rgb : vBaked;
+        FragColor = vec4(tonemap(vColor * u_kd * white), 1.0);
+        return;
+    }
+
+    // Two-sided key light, enough to read the shape of loaded meshes.
+    vec3 N = normalize(vNormal);
+    float shade = 0.35 + 0.65 * abs(dot(N, normalize(vec3(0.3, 1.0, 0.5))));
+    FragColor = vec4(vColor * shade, 1.0);
 }
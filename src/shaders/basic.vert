@@ -1,15 +1,40 @@
 #version 450 core
-layout(location = 0) in vec3 aPos;
-layout(location = 1) in vec3 aColor;
+// Quantized vertex format (scene/vertexformat.h)
+layout(location = 0) in vec3 aPos;     // 16-bit unorm, relative to the mesh AABB
+layout(location = 1) in vec3 aColor;   // RGBA8 stream, or the material color as a constant
+layout(location = 2) in vec2 aNormal;  // octahedral, 2 x 16-bit snorm
+layout(location = 3) in vec3 aBaked;   // baked radiance per vertex (Mesh::BakedVertices), half floats
 
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 proj;
+uniform mat3 normalMatrix;
+uniform vec3 posMin;
+uniform vec3 posExtent;
 
 out vec3 vColor;
+out vec3 vNormal;
+out vec3 vBaked;
+out vec2 vLightmapUv;
+
+// Quads are baked over their corners in vertex order (IrradianceBaker).
+const vec2 QUAD_UV[4] = vec2[](vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(1.0, 1.0), vec2(0.0, 1.0));
+
+vec3 decodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
 
 void main()
 {
+    vec3 pos = posMin + aPos * posExtent;
     vColor = aColor;
-    gl_Position = proj * view * model * vec4(aPos, 1.0);
+    vNormal = normalMatrix * decodeOctahedral(aNormal);
+    vBaked = aBaked;
+    vLightmapUv = QUAD_UV[gl_VertexID & 3];
+    gl_Position = proj * view * model * vec4(pos, 1.0);
 }
@@ -0,0 +1,27 @@
+#version 450 core
+// First hit for raytrace.comp: position and distance from the camera,
+// then octahedral normal, material reference, RGBA8 color, coverage.
+in vec3 vWorldPos;
+in vec3 vColor;
+in vec3 vNormal;
+
+uniform vec3 cameraPosition;
+uniform uint materialRef;
+
+layout(location = 0) out vec4 outPosition;
+layout(location = 1) out uvec4 outSurface;
+
+uint encodeOctahedral(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.xy;
+    if (n.z < 0.0)
+        e = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return packSnorm2x16(e);
+}
+
+void main()
+{
+    outPosition = vec4(vWorldPos, distance(vWorldPos, cameraPosition));
+    outSurface = uvec4(encodeOctahedral(normalize(vNormal)), materialRef, packUnorm4x8(vec4(vColor, 1.0)), 1u);
+}
@@ -0,0 +1,34 @@
+#version 450 core
+// G-buffer pass of the hybrid tracer (GBuffer): basic.vert's quantized
+// vertex format, with the world-space position passed on.
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aColor;
+layout(location = 2) in vec2 aNormal;
+
+uniform mat4 model;
+uniform mat4 viewProj;
+uniform mat3 normalMatrix;
+uniform vec3 posMin;
+uniform vec3 posExtent;
+
+out vec3 vWorldPos;
+out vec3 vColor;
+out vec3 vNormal;
+
+vec3 decodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+void main()
+{
+    vec4 world = model * vec4(posMin + aPos * posExtent, 1.0);
+    vWorldPos = world.xyz;
+    vColor = aColor;
+    vNormal = normalMatrix * decodeOctahedral(aNormal);
+    gl_Position = viewProj * world;
+}
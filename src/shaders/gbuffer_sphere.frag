@@ -0,0 +1,45 @@
+#version 450 core
+// Exact sphere hit along the camera ray through this fragment; fragments
+// of the enlarged proxy that miss the sphere are dropped.
+in vec3 vWorldPos;
+flat in vec4 vCenterRadius;
+flat in uint vMaterialId;
+
+uniform mat4 viewProj;
+uniform vec3 cameraPosition;
+
+layout(location = 0) out vec4 outPosition;
+layout(location = 1) out uvec4 outSurface;
+
+uint encodeOctahedral(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.xy;
+    if (n.z < 0.0)
+        e = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return packSnorm2x16(e);
+}
+
+void main()
+{
+    vec3 rd = normalize(vWorldPos - cameraPosition);
+    vec3 oc = cameraPosition - vCenterRadius.xyz;
+    float b = dot(oc, rd);
+    float c = dot(oc, oc) - vCenterRadius.w * vCenterRadius.w;
+    float disc = b * b - c;
+    if (disc < 0.0)
+        discard;
+
+    float sq = sqrt(disc);
+    float t = -b - sq > 0.001 ? -b - sq : -b + sq;
+    if (t <= 0.001)
+        discard;
+
+    vec3 pos = cameraPosition + rd * t;
+    vec4 clip = viewProj * vec4(pos, 1.0);
+    gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;
+
+    // Material reference: sphere kind (0) in the top bits, materials[] index.
+    outPosition = vec4(pos, t);
+    outSurface = uvec4(encodeOctahedral(normalize(pos - vCenterRadius.xyz)), vMaterialId, 0u, 1u);
+}
@@ -0,0 +1,35 @@
+#version 450 core
+// G-buffer pass for sphere instances: sphere.vert's instanced unit sphere,
+// enlarged so the tessellation covers the whole silhouette. The fragment
+// shader intersects the exact sphere.
+layout(location = 0) in vec3 aPos;
+
+struct Sphere {
+    vec4 centerRadius;
+    uint materialId;
+    uint pad0, pad1, pad2;
+};
+
+layout(std430, binding = 1) readonly buffer Spheres { Sphere spheres[]; };
+
+uniform mat4 viewProj;
+uniform vec3 posMin;
+uniform vec3 posExtent;
+
+// Flat faces of a 12 x 16 tessellation stay above 0.947 of the radius.
+const float COVER_SCALE = 1.06;
+
+out vec3 vWorldPos;
+flat out vec4 vCenterRadius;
+flat out uint vMaterialId;
+
+void main()
+{
+    Sphere s = spheres[gl_InstanceID];
+    vec3 pos = s.centerRadius.xyz + (posMin + aPos * posExtent) * (s.centerRadius.w * COVER_SCALE);
+
+    vWorldPos = pos;
+    vCenterRadius = s.centerRadius;
+    vMaterialId = s.materialId;
+    gl_Position = viewProj * vec4(pos, 1.0);
+}
@@ -1,11 +0,0 @@
-#version 330
-
-in vec2 uv;
-out vec4 frag;
-
-uniform sampler2D tex;
-
-void main()
-{
-    frag = texture(tex, uv);
-}
@@ -0,0 +1,48 @@
+#version 450 core
+// Instanced unit sphere (SphereInstances): the mesh is the quantized vertex
+// format of basic.vert, each instance is scaled and moved by its GpuSphere.
+layout(location = 0) in vec3 aPos;
+layout(location = 2) in vec2 aNormal;
+
+struct Sphere {
+    vec4 centerRadius;
+    uint materialId;
+    uint pad0, pad1, pad2;
+};
+
+struct Material {
+    vec3 diffuse;   float kd;
+    vec3 specular;  float ks;
+    float shininess;
+    float pad1, pad2, pad3;
+};
+
+layout(std430, binding = 1)  readonly buffer Spheres   { Sphere spheres[]; };
+layout(std430, binding = 10) readonly buffer Materials { Material materials[]; };
+
+uniform mat4 view;
+uniform mat4 proj;
+uniform vec3 posMin;
+uniform vec3 posExtent;
+
+out vec3 vColor;
+out vec3 vNormal;
+
+vec3 decodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+void main()
+{
+    Sphere s = spheres[gl_InstanceID];
+    vec3 pos = s.centerRadius.xyz + (posMin + aPos * posExtent) * s.centerRadius.w;
+
+    vColor = materials[s.materialId].diffuse;
+    vNormal = decodeOctahedral(aNormal);
+    gl_Position = proj * view * vec4(pos, 1.0);
+}
@@ -0,0 +1,159 @@
+#version 430
+
+in vec2 uv;
+out vec4 frag;
+
+// PathTracer::Frame, see renderer/upscaler.cpp. Colors are packed RGB
+// float buffers the size of their guide texture.
+layout(std430, binding = 0) readonly buffer AccumColor { float accumColor[]; };
+layout(binding = 1) uniform usampler2D accumGuide;
+layout(std430, binding = 2) readonly buffer PreviewColor { float previewColor[]; };
+layout(binding = 3) uniform usampler2D previewGuide;
+
+uniform int u_mode;                 // PathTracer::Resolution
+uniform uint u_generation;
+uniform uint u_fallbackGeneration;
+uniform bool u_hasFallback;
+uniform bool u_previewValid;
+
+const int MODE_SCALED = 1;
+const int MODE_CHECKERBOARD = 2;
+
+// Relative depth difference at which a neighbour's weight drops to 1/e,
+// and how sharply differently oriented surfaces are rejected.
+const float DEPTH_SIGMA = 0.05;
+const float NORMAL_POWER = 8.0;
+
+struct Guide {
+    vec3 normal;
+    float depth;
+    uint generation;
+};
+
+vec3 decodeOctahedral(uint packed)
+{
+    vec2 e = unpackSnorm4x8(packed & 0xFFFFu).xy;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
+
+// Guide texel: normal | half depth << 16, generation.
+Guide readGuide(usampler2D guide, ivec2 p)
+{
+    uvec2 g = texelFetch(guide, p, 0).xy;
+    return Guide(decodeOctahedral(g.x), unpackHalf2x16(g.x >> 16).x, g.y);
+}
+
+vec3 accumAt(ivec2 p)
+{
+    int i = (p.y * textureSize(accumGuide, 0).x + p.x) * 3;
+    return vec3(accumColor[i], accumColor[i + 1], accumColor[i + 2]);
+}
+
+vec3 previewAt(ivec2 p)
+{
+    int i = (p.y * textureSize(previewGuide, 0).x + p.x) * 3;
+    return vec3(previewColor[i], previewColor[i + 1], previewColor[i + 2]);
+}
+
+// ImageIO::tonemap without the sRGB curve: the display target is sRGB and
+// the hardware encodes on write.
+vec3 tonemap(vec3 x)
+{
+    x = max(x, vec3(0.0));
+    return clamp((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14), 0.0, 1.0);
+}
+
+float similarity(Guide a, Guide b)
+{
+    float dz = abs(a.depth - b.depth) / max(min(a.depth, b.depth), 1e-3);
+    return exp(-dz / DEPTH_SIGMA) * pow(max(dot(a.normal, b.normal), 0.0), NORMAL_POWER);
+}
+
+// The pixel itself if it belongs to generation, otherwise (when allowed)
+// an edge-directed average of its four neighbours of that generation: the
+// horizontal and vertical pairs are weighted by how well each pair agrees
+// in depth and normal, so the fill follows surfaces instead of crossing
+// silhouettes. Alpha 0 means nothing usable was found.
+vec4 resolveFull(ivec2 p, uint generation, bool reconstruct)
+{
+    Guide g = readGuide(accumGuide, p);
+    if (g.generation == generation)
+        return vec4(accumAt(p), 1.0);
+    if (!reconstruct)
+        return vec4(0.0);
+
+    ivec2 size = textureSize(accumGuide, 0);
+    const ivec2 offsets[4] = ivec2[4](ivec2(-1, 0), ivec2(1, 0), ivec2(0, -1), ivec2(0, 1));
+    Guide n[4];
+    bool valid[4];
+    for (int i = 0; i < 4; ++i) {
+        n[i] = readGuide(accumGuide, clamp(p + offsets[i], ivec2(0), size - 1));
+        valid[i] = n[i].generation == generation;
+    }
+
+    float wh = valid[0] && valid[1] ? similarity(n[0], n[1]) : 0.0;
+    float wv = valid[2] && valid[3] ? similarity(n[2], n[3]) : 0.0;
+
+    vec3 sum = vec3(0.0);
+    float weight = 0.0;
+    for (int i = 0; i < 4; ++i) {
+        if (!valid[i])
+            continue;
+        float w = 1e-3 + (i < 2 ? wh : wv);
+        sum += accumAt(clamp(p + offsets[i], ivec2(0), size - 1)) * w;
+        weight += w;
+    }
+    return weight > 0.0 ? vec4(sum / weight, 1.0) : vec4(0.0);
+}
+
+// Joint bilateral upsampling of the preview. There is no full-resolution
+// guide, so the preview texel nearest to the pixel is the reference: the
+// bilinear taps that lie on another surface are dropped, which keeps
+// silhouettes sharp instead of blurring them over two preview texels.
+vec4 upsamplePreview(vec2 pos)
+{
+    ivec2 size = textureSize(previewGuide, 0);
+    vec2 p = pos * vec2(size) - 0.5;
+    ivec2 base = ivec2(floor(p));
+    vec2 f = p - vec2(base);
+
+    Guide ref = readGuide(previewGuide, clamp(ivec2(floor(p + 0.5)), ivec2(0), size - 1));
+
+    vec3 sum = vec3(0.0);
+    float weight = 0.0;
+    for (int y = 0; y < 2; ++y) {
+        for (int x = 0; x < 2; ++x) {
+            ivec2 q = clamp(base + ivec2(x, y), ivec2(0), size - 1);
+            float bilinear = (x == 1 ? f.x : 1.0 - f.x) * (y == 1 ? f.y : 1.0 - f.y);
+            float w = bilinear * similarity(ref, readGuide(previewGuide, q)) + 1e-5;
+            sum += previewAt(q) * w;
+            weight += w;
+        }
+    }
+    return vec4(sum / weight, 1.0);
+}
+
+vec4 resolve()
+{
+    if (u_mode == MODE_SCALED)
+        return upsamplePreview(uv);
+
+    ivec2 p = ivec2(uv * vec2(textureSize(accumGuide, 0)));
+    vec4 c = resolveFull(p, u_generation, u_mode == MODE_CHECKERBOARD);
+    if (c.a == 0.0 && u_hasFallback)
+        c = resolveFull(p, u_fallbackGeneration, true);
+    if (c.a == 0.0 && u_previewValid)
+        c = upsamplePreview(uv);
+    if (c.a == 0.0)
+        c = vec4(accumAt(p), 1.0);
+    return c;
+}
+
+void main()
+{
+    frag = vec4(tonemap(resolve().rgb), 1.0);
+}